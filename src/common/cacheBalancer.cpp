@@ -0,0 +1,147 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+// std library
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+// system library
+#include <unistd.h>
+
+#include "cacheBalancer.h"
+
+
+cacheBalancer::cacheBalancer( const size_t memoryBytes, const size_t leafEntryBytes, const size_t nodeEntryBytes, const size_t leafSteps ):
+    m_memoryBytes( memoryBytes ), m_leafEntryBytes( leafEntryBytes ), m_nodeEntryBytes( nodeEntryBytes ), m_leafSteps( std::min( leafSteps, ( size_t ) BALANCE_STEPS ) ),
+    m_budget( memoryBytes / 2 ), m_leafLimit( 0 ), m_nodeLimit( 0 ),
+    m_lastLeafHits( 0 ), m_lastLeafMisses( 0 ), m_lastNodeHits( 0 ), m_lastNodeMisses( 0 ), m_moves( 0 ), m_lastDecision( "" )
+{
+    setLimits( m_budget );
+} // end cacheBalancer::cacheBalancer() -------------------------------------------------------------------------------------
+
+bool cacheBalancer::update( const size_t leafHits, const size_t leafMisses, const size_t leafBytes, const size_t nodeHits, const size_t nodeMisses,
+                            const size_t nodeBytes, const size_t leafDemand, const size_t extraBytes )
+{
+    size_t newLeafAccesses( ( leafHits - m_lastLeafHits ) + ( leafMisses - m_lastLeafMisses ) );
+    size_t newNodeAccesses( ( nodeHits - m_lastNodeHits ) + ( nodeMisses - m_lastNodeMisses ) );
+    if( newLeafAccesses + newNodeAccesses < BALANCE_MIN_ACCESSES )
+    {
+        // not enough activity for a decision, only keep the leaf limit within the remaining leaf demand
+        setLimits( leafDemand );
+        return false;
+    }
+
+    // bytes that had to be reloaded from disk by each cache since the last decision
+    const size_t leafMissBytes( ( leafMisses - m_lastLeafMisses ) * m_leafEntryBytes );
+    const size_t nodeMissBytes( ( nodeMisses - m_lastNodeMisses ) * m_nodeEntryBytes );
+
+    // budget: memory limit minus what the rest of the program really holds
+    const size_t oldBudget( m_budget );
+    const size_t resident( anonResidentBytes() );
+    if( resident != 0 )
+    {
+        size_t cacheBytes( leafBytes + nodeBytes + extraBytes );
+        size_t otherBytes( resident > cacheBytes ? resident - cacheBytes : 0 );
+        size_t newBudget( m_memoryBytes > otherBytes ? m_memoryBytes - otherBytes : 0 );
+        newBudget = std::max( newBudget, m_memoryBytes / BALANCE_MIN_SHARE );
+        newBudget = std::min( newBudget, m_memoryBytes );
+        m_budget = newBudget;
+    }
+
+    // move the split one step towards the cache with the most expensive misses, if it is using up its limit
+    const size_t oldSteps( m_leafSteps );
+    const bool leafFull( leafBytes * 10 >= m_leafLimit * 9 && leafDemand > m_leafLimit );
+    const bool nodeFull( nodeBytes * 10 >= m_nodeLimit * 9 );
+    if( leafMissBytes * 4 > nodeMissBytes * 5 && leafFull && m_leafSteps < BALANCE_STEPS )
+    {
+        ++m_leafSteps;
+    }
+    else if( nodeMissBytes * 4 > leafMissBytes * 5 && nodeFull && ( m_leafSteps > 1 || ( m_leafSteps > 0 && leafDemand == 0 ) ) )
+    {
+        --m_leafSteps;
+    }
+    setLimits( leafDemand );
+
+    std::stringstream decision;
+    decision << "Cache budget: " << m_budget / ( 1024 * 1024 ) << " MB (resident " << resident / ( 1024 * 1024 ) << " MB)";
+    decision << ". Leaf cache: " << leafHits - m_lastLeafHits << " hits, " << leafMisses - m_lastLeafMisses << " misses";
+    decision << ". Node cache: " << nodeHits - m_lastNodeHits << " hits, " << nodeMisses - m_lastNodeMisses << " misses";
+    decision << ". Split " << oldSteps << "/" << BALANCE_STEPS << " -> " << m_leafSteps << "/" << BALANCE_STEPS;
+    decision << " (leaves " << m_leafLimit / ( 1024 * 1024 ) << " MB, nodes " << m_nodeLimit / ( 1024 * 1024 ) << " MB)";
+    m_lastDecision = decision.str();
+
+    m_lastLeafHits = leafHits;
+    m_lastLeafMisses = leafMisses;
+    m_lastNodeHits = nodeHits;
+    m_lastNodeMisses = nodeMisses;
+
+    const size_t stepBytes( m_memoryBytes / BALANCE_STEPS );
+    const bool budgetMoved( std::max( m_budget, oldBudget ) - std::min( m_budget, oldBudget ) >= stepBytes );
+    if( m_leafSteps != oldSteps )
+    {
+        ++m_moves;
+    }
+    return ( m_leafSteps != oldSteps || budgetMoved );
+} // end cacheBalancer::update() -------------------------------------------------------------------------------------
+
+void cacheBalancer::setLeafSteps( const size_t leafSteps )
+{
+    m_leafSteps = std::min( leafSteps, ( size_t ) BALANCE_STEPS );
+    return;
+} // end cacheBalancer::setLeafSteps() -------------------------------------------------------------------------------------
+
+size_t cacheBalancer::anonResidentBytes()
+{
+    std::ifstream statm( "/proc/self/statm" );
+    size_t totalPages( 0 ), residentPages( 0 ), sharedPages( 0 );
+    if( !( statm >> totalPages >> residentPages >> sharedPages ) )
+    {
+        return 0;
+    }
+    long pageSize( sysconf( _SC_PAGESIZE ) );
+    if( pageSize <= 0 || sharedPages > residentPages )
+    {
+        return 0;
+    }
+    return ( residentPages - sharedPages ) * pageSize;
+} // end cacheBalancer::anonResidentBytes() -------------------------------------------------------------------------------------
+
+void cacheBalancer::setLimits( const size_t leafDemand )
+{
+    // while there are leaves left the leaf cache keeps at least one step, so that it is never emptied while still in use
+    const size_t leafSteps( leafDemand > 0 ? std::max( m_leafSteps, ( size_t ) 1 ) : m_leafSteps );
+    m_leafLimit = std::min( ( m_budget / BALANCE_STEPS ) * leafSteps, leafDemand );
+    m_nodeLimit = m_budget - m_leafLimit + m_nodeEntryBytes;
+    return;
+} // end cacheBalancer::setLimits() -------------------------------------------------------------------------------------
@@ -0,0 +1,155 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#ifndef CACHEBALANCER_H
+#define CACHEBALANCER_H
+
+// std library
+#include <string>
+#include <cstddef>
+
+#define BALANCE_STEPS 16            // the leaf/node cache split moves in steps of 1/BALANCE_STEPS of the budget
+#define BALANCE_MIN_ACCESSES 4096   // minimum number of cache accesses between two split decisions
+#define BALANCE_MIN_SHARE 8         // the cache budget is never set below 1/BALANCE_MIN_SHARE of the memory limit
+
+/**
+ * This class controls the memory budget of the leaf and node tractogram caches of the centroid tree builder.
+ * The budget is the memory limit minus the real memory footprint of the rest of the program (the anonymous resident size of the process
+ * without the caches and the mean tractogram buffers, that is: neighbourhood tables, tree nodes, heap and others), measured at every decision.
+ * The split between leaf and node caches starts at the given share and is moved online, one step at a time, towards the cache whose misses
+ * cost more bytes to reload, as long as that cache is actually full. The leaf cache never gets more than the bytes of the leaves still unmerged,
+ * and never less than one step while there are leaves still unmerged.
+ */
+class cacheBalancer
+{
+public:
+    /**
+     * Constructor
+     * \param memoryBytes the memory limit for the caches and the rest of the program data, in bytes
+     * \param leafEntryBytes the (mean) size of a leaf cache entry in bytes
+     * \param nodeEntryBytes the size of a node cache entry in bytes
+     * \param leafSteps initial number of budget steps given to the leaf cache (out of BALANCE_STEPS)
+     */
+    cacheBalancer( const size_t memoryBytes, const size_t leafEntryBytes, const size_t nodeEntryBytes, const size_t leafSteps );
+
+    //! Destructor
+    ~cacheBalancer() {}
+
+    // === IN-LINE MEMBER FUNCTIONS ===
+
+    /**
+     * returns the current byte limit for the leaf cache
+     * \return leaf cache limit in bytes
+     */
+    inline size_t leafLimit() const { return m_leafLimit; }
+
+    /**
+     * returns the current byte limit for the node cache
+     * \return node cache limit in bytes
+     */
+    inline size_t nodeLimit() const { return m_nodeLimit; }
+
+    /**
+     * returns the current total budget of the caches
+     * \return cache budget in bytes
+     */
+    inline size_t budget() const { return m_budget; }
+
+    /**
+     * returns the number of times the leaf/node split has been moved
+     * \return number of split changes
+     */
+    inline size_t moves() const { return m_moves; }
+
+    /**
+     * returns a description of the last split decision
+     * \return decision string
+     */
+    inline std::string lastDecision() const { return m_lastDecision; }
+
+    // === PUBLIC MEMBER FUNCTIONS ===
+
+    /**
+     * resets the number of budget steps given to the leaf cache (used as starting point for the following decisions)
+     * \param leafSteps number of budget steps for the leaf cache (out of BALANCE_STEPS)
+     */
+    void setLeafSteps( const size_t leafSteps );
+
+    /**
+     * updates the limits with the cache activity since the previous decision, a new decision is taken only after BALANCE_MIN_ACCESSES accesses
+     * \param leafHits total leaf cache hits
+     * \param leafMisses total leaf cache misses
+     * \param leafBytes bytes currently held by the leaf cache
+     * \param nodeHits total node cache hits
+     * \param nodeMisses total node cache misses
+     * \param nodeBytes bytes currently held by the node cache
+     * \param leafDemand bytes of the leaf tracts that can still be requested (leaves not merged yet)
+     * \param extraBytes resident bytes held by other tract buffers with their own budget, not to be counted as program footprint
+     * \return true if the split was moved or the budget changed by at least one step
+     */
+    bool update( const size_t leafHits, const size_t leafMisses, const size_t leafBytes, const size_t nodeHits, const size_t nodeMisses,
+                 const size_t nodeBytes, const size_t leafDemand, const size_t extraBytes );
+
+    /**
+     * returns the anonymous (not file-backed) resident memory of the process, read from /proc/self/statm
+     * \return resident bytes, 0 if not available
+     */
+    static size_t anonResidentBytes();
+
+private:
+    // === PRIVATE DATA MEMBERS ===
+
+    size_t m_memoryBytes;       //!< memory limit for caches and program data
+    size_t m_leafEntryBytes;    //!< mean size of a leaf cache entry
+    size_t m_nodeEntryBytes;    //!< size of a node cache entry
+    size_t m_leafSteps;         //!< budget steps given to the leaf cache
+    size_t m_budget;            //!< current cache budget
+    size_t m_leafLimit;         //!< current leaf cache limit
+    size_t m_nodeLimit;         //!< current node cache limit
+    size_t m_lastLeafHits;      //!< leaf cache hits at the last decision
+    size_t m_lastLeafMisses;    //!< leaf cache misses at the last decision
+    size_t m_lastNodeHits;      //!< node cache hits at the last decision
+    size_t m_lastNodeMisses;    //!< node cache misses at the last decision
+    size_t m_moves;             //!< number of split changes
+    std::string m_lastDecision; //!< description of the last decision
+
+    // === PRIVATE MEMBER FUNCTIONS ===
+
+    /**
+     * computes the cache limits from the budget, the leaf share and the leaf demand
+     * \param leafDemand bytes of the leaf tracts that can still be requested
+     */
+    void setLimits( const size_t leafDemand );
+};
+
+#endif  // CACHEBALANCER_H
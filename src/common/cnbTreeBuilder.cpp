@@ -36,12 +36,15 @@
 #include <list>
 #include <string>
 #include <map>
+#include <set>
 #include <utility>
 #include <algorithm>
 
 #include "WStringUtils.h"
 
 #include "cnbTreeBuilder.h"
+#include "leafTractStream.h"
+#include "cacheBalancer.h"
 #include "WHtreeProcesser.h"
 
 
@@ -57,6 +60,12 @@ CnbTreeBuilder::CnbTreeBuilder( const std::string& roiFilename, const float thre
     m_ncMiss = 0;
     m_lcHits = 0;
     m_lcMiss = 0;
+    m_batchHits = 0;
+    m_batchMiss = 0;
+    m_normMismatches = 0;
+    m_mergeBatch = 1;
+    m_leafTractMb = 0;
+    m_meanMemory = 0.5;
 
     fileManagerFactory fMFtestFormat;
     m_niftiMode = fMFtestFormat.isNifti();
@@ -149,62 +158,56 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
     fileSingle.readAsLog();
     fileSingle.storeUnzipped();
 
-    fileManagerFactory fileNatMeanMF(m_tempFolder);
-    fileManager& fileNatMean(fileNatMeanMF.getFM());  // to read/write tractograms in float, natural units and unthresholded  (to be merged later)
-    fileNatMean.writeInFloat();
-    fileNatMean.readAsUnThres();
-    fileNatMean.readAsNat();
-    fileNatMean.storeUnzipped();
+    // mean tractograms in float, natural units and unthresholded (to be merged later), kept in memory and spilled to the temp folder
+    meanTractStore meanTracts( m_tempFolder, static_cast< size_t >( m_meanMemory * 1024 * 1024 * 1024 ) );
 
     // vectors for hierarchical and neighborhood information
     std::vector< protoNode > protoLeaves, protoNodes;
     std::vector< WHnode > leaves, nodes;
 
+    // precompute seed voxel norms (and mean sparse leaf tract size)
+    computeNorms();
+
     // compute cache size
     float tractMb( 0 ), leafTractMb( 0 );
-    size_t cacheSize( 0 );
-    float leafCacheRatio( 1 );
+    size_t tractBytes( 0 ), leafTractBytes( 0 ), cacheBytes( 0 );
     {
         compactTract tempTract;
-        compactTractChar tempTractChar;
         fileSingle.readLeafTract( 0, m_trackids, m_roi, &tempTract );
         tractMb = tempTract.mBytes();
-        fileSingle.readLeafTract( 0, m_trackids, m_roi, &tempTractChar );
-        leafTractMb = tempTractChar.mBytes();
+        leafTractMb = m_leafTractMb;
         if( m_verbose )
         {
             std::cout << "Tractogram size is: " << tempTract.size() << " (" << tractMb << " MB)" << std::endl;
-            std::cout << "Leaf tractogram size is: " << leafTractMb << " MB" << std::endl;
+            std::cout << "Mean sparse leaf tractogram size is: " << leafTractMb << " MB" << std::endl;
         }
         if( m_logfile != 0 )
         {
             ( *m_logfile ) << "Tractogram size:\t" << tempTract.size() << " (" << tractMb << " MB)" << std::endl;
-            ( *m_logfile ) << "Leaf tractogram size is: " << leafTractMb << " MB" << std::endl;
+            ( *m_logfile ) << "Mean sparse leaf tractogram size is: " << leafTractMb << " MB" << std::endl;
         }
-        cacheSize = ( memory * 1024 / ( tractMb * 2 ) );
-        leafCacheRatio = ( tractMb / leafTractMb );
+        tractBytes = tempTract.bytes();
+        leafTractBytes = leafTractMb * 1024 * 1024;
+        cacheBytes = memory * 1024 * 1024 * 1024 / 2;
         if( m_verbose )
         {
-            std::cout << "Cache size is: " << cacheSize << " tracts. ("<< static_cast<size_t>(cacheSize*leafCacheRatio) <<" leaf tracts)" << std::endl;
+            std::cout << "Cache size is: " << memory * 512 << " MB. (" << cacheBytes / tractBytes << " tracts, "<< cacheBytes / leafTractBytes <<" leaf tracts)" << std::endl;
         }
         if( m_logfile != 0 )
         {
-            ( *m_logfile ) << "Cache size:\t" << cacheSize << " tracts. ("<< static_cast<size_t>(cacheSize*leafCacheRatio) <<" leaf tracts)" << std::endl;
+            ( *m_logfile ) << "Cache size:\t" << memory * 512 << " MB. (" << cacheBytes / tractBytes << " tracts, "<< cacheBytes / leafTractBytes <<" leaf tracts)" << std::endl;
         }
     }
 
-    // precompute seed voxel norms
-    computeNorms();
-
     // initialize neighborhood info for all seed voxels
-    std::list< WHcoord > discarded = initialize( nbLevel, cacheSize*leafCacheRatio, &protoLeaves );
+    std::list< WHcoord > discarded = initialize( nbLevel, cacheBytes, &protoLeaves );
     std::list< size_t > baseNodes;
 
 
     { // ------- Tree build up ----------
         std::cout << "Starting tree build-up" << std::endl;
         // supernode, keeps track of the current top nodes in the hierarchy
-        std::multimap< dist_t, nodeID_t > priorityNodes;
+        nodeHeap priorityNodes( protoLeaves.size() );
         std::set< size_t > currentNodes;
 
         size_t activeSize( 1 ), prioritySize( 1 );
@@ -221,6 +224,7 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
 
         leaves.reserve( protoLeaves.size() );
         nodes.reserve( protoLeaves.size() );
+        protoNodes.reserve( protoLeaves.size() );
 
         m_nodeNorms.clear();
         m_nodeNorms.reserve( protoLeaves.size() );
@@ -228,27 +232,33 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
         WHnode rootNode( std::make_pair( false, 0 ) ); // node where to keep all isolated clusters
         rootNode.setSize( 0 );
 
-        std::vector< std::multimap< dist_t, nodeID_t >::iterator > priorityLeafIndex( protoLeaves.size(), priorityNodes.end() );
-        std::vector< std::multimap< dist_t, nodeID_t >::iterator > priorityNodeIndex( protoLeaves.size(), priorityNodes.end() );
         for( size_t i = 0; i < protoLeaves.size(); ++i )
         {
-            priorityLeafIndex[i] = priorityNodes.insert( std::make_pair( protoLeaves[i].nearDist(), std::make_pair( false, i ) ) );
+            priorityNodes.push( std::make_pair( false, i ), protoLeaves[i].nearDist() );
             WHnode newLeaf( std::make_pair( false, i ) );
             leaves.push_back( newLeaf );
         }
 
-        listedCache< compactTractChar > leavesCache( protoLeaves.size(), cacheSize*leafCacheRatio );
-        listedCache< compactTract > nodesCache( protoLeaves.size(), cacheSize );
+        // tract caches, limited by memory footprint (sparse leaf tracts vary in size)
+        concurrentCache< sparseTract > leavesCache( protoLeaves.size(), protoLeaves.size() );
+        concurrentCache< compactTract > nodesCache( protoLeaves.size(), protoLeaves.size() );
+        // memory split between the caches, starts with all the budget for leaves while growing and half of it after growing
+        cacheBalancer balancer( static_cast< size_t >( memory * 1024 * 1024 * 1024 ), leafTractBytes, tractBytes, growingStage ? BALANCE_STEPS : BALANCE_STEPS / 2 );
+        leavesCache.setByteLimit( balancer.leafLimit() );
+        nodesCache.setByteLimit( balancer.nodeLimit() );
 
         time_t lastTime( time( NULL ) ), loopStart( time( NULL ) ); // time object
         size_t maxNbs( 0 ); // to keep track of maximum number of neighbours in an iteration during the program
+        nbTable newNbNodes, spareNbNodes; // neighbourhood table of the node being built, and memory recycled from merged nodes to build the next one
         std::stringstream eventStream;
-        volatile size_t threadCount( 0 ); // to keep track of running children threads
 
         m_ncHits = 0;
         m_ncMiss = 0;
         m_lcHits = 0;
         m_lcMiss = 0;
+        m_batchHits = 0;
+        m_batchMiss = 0;
+        m_normMismatches = 0;
 
 
 #if DEBUG
@@ -264,16 +274,88 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
 
         while( !priorityNodes.empty() || currentNodes.size() > 1 )
         {
+            // merges computed ahead in batched merging mode (they are only valid while the active and priority sizes do not change)
+            std::vector< speculativeMerge > mergeBatch;
+            size_t nextMerge( 0 );
 
             while( !priorityNodes.empty() )
             {
+                // in batched merging mode, compute together the next independent merges at the top of the priority heap
+                if( m_mergeBatch > 1 && nextMerge == mergeBatch.size() )
+                {
+                    nextMerge = 0;
+                    if( selectMergeBatch( priorityNodes, &protoLeaves, &protoNodes, &mergeBatch ) > 1 )
+                    {
+#pragma omp parallel for schedule( dynamic, 1 )
+                        for( size_t i = 0; i < mergeBatch.size(); ++i )
+                        {
+                            speculativeMerge& thisMerge( mergeBatch[i] );
+                            const protoNode* thisProtoNode1( fetchProtoNode( thisMerge.node1, &protoLeaves, &protoNodes ) );
+                            const protoNode* thisProtoNode2( fetchProtoNode( thisMerge.node2, &protoLeaves, &protoNodes ) );
+
+                            // mean tracts are copied from the store, they will only be erased when the merge is applied
+                            compactTract thisTract1, thisTract2;
+                            if( thisMerge.node1.first )
+                            {
+                                meanTracts.get( thisMerge.node1.second, &thisTract1 );
+                            }
+                            else
+                            {
+                                fileSingle.readLeafTract( thisMerge.node1.second, m_trackids, m_roi, &thisTract1 );
+                            }
+                            if( thisMerge.node2.first )
+                            {
+                                meanTracts.get( thisMerge.node2.second, &thisTract2 );
+                            }
+                            else
+                            {
+                                fileSingle.readLeafTract( thisMerge.node2.second, m_trackids, m_roi, &thisTract2 );
+                            }
+                            thisMerge.norm = thisMerge.meanTract.joinTracts( thisTract1, thisTract2,
+                                                                             fetchNode( thisMerge.node1, &leaves, &nodes )->getSize(),
+                                                                             fetchNode( thisMerge.node2, &leaves, &nodes )->getSize(),
+                                                                             m_logFactor, m_tractThreshold, &thisMerge.logTract );
+
+                            // get distances to all neighbours
+                            thisMerge.nbNodes.merge( thisProtoNode1->m_nbNodes, thisProtoNode2->m_nbNodes, thisMerge.node1, thisMerge.node2 );
+                            for( nbTable::iterator nbIter( thisMerge.nbNodes.begin() ); nbIter != thisMerge.nbNodes.end(); ++nbIter )
+                            {
+                                void* nbTract( loadTract( nbIter->first, &fileSingle, &meanTracts, &leavesCache, &nodesCache ) );
+                                if( nbIter->first.first )
+                                {
+                                    nbIter->second = thisMerge.logTract.tractDistance( * static_cast< compactTract* >( nbTract ) );
+                                    nodesCache.unpin( nbIter->first.second );
+                                }
+                                else
+                                {
+                                    nbIter->second = static_cast< sparseTract* >( nbTract )->tractDistance( thisMerge.logTract );
+                                    leavesCache.unpin( nbIter->first.second );
+                                }
+#pragma omp atomic
+                                m_numComps++;
+                            }
+                        }
+                    }
+                    else
+                    {
+                        // a single merge is computed as usual, in parallel over its neighbours
+                        mergeBatch.clear();
+                    }
+
+#if DEBUG
+                    if( m_normMismatches != 0 )
+                    {
+                        throw std::runtime_error( "ERROR @ treeBuilder::buildCentroid(): rebuilt node tracts differ from the merged ones" );
+                    }
+#endif
+                }
 
                 // get nodes to join
-                WHnode* node2join1( fetchNode( priorityNodes.begin()->second, &leaves, &nodes ) );
+                WHnode* node2join1( fetchNode( priorityNodes.topID(), &leaves, &nodes ) );
                 protoNode* protoNode2join1( fetchProtoNode( node2join1->getFullID(), &protoLeaves, &protoNodes ) );
                 WHnode* node2join2( fetchNode( protoNode2join1->nearNb(), &leaves, &nodes ) );
                 protoNode* protoNode2join2( fetchProtoNode( node2join2->getFullID(), &protoLeaves, &protoNodes ) );
-                dist_t newDist( priorityNodes.begin()->first );
+                dist_t newDist( priorityNodes.topDist() );
                 size_t newID( nodes.size() );
                 size_t newSize( node2join1->getSize() + node2join2->getSize() );
                 size_t newHLevel( std::max( node2join1->getHLevel(), node2join2->getHLevel() ) + 1 );
@@ -287,6 +369,25 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                     break;
                 }
 
+                // use the merge computed ahead if it is the one due, otherwise the previous merges changed the priority order and the rest of the batch is discarded
+                speculativeMerge* precomputed( 0 );
+                if( nextMerge < mergeBatch.size() )
+                {
+                    if( mergeBatch[nextMerge].node1 == node2join1->getFullID() && mergeBatch[nextMerge].node2 == node2join2->getFullID()
+                        && mergeBatch[nextMerge].dist == newDist )
+                    {
+                        precomputed = &( mergeBatch[nextMerge] );
+                        ++nextMerge;
+                        ++m_batchHits;
+                    }
+                    else
+                    {
+                        m_batchMiss += mergeBatch.size() - nextMerge;
+                        mergeBatch.clear();
+                        nextMerge = 0;
+                    }
+                }
+
 #if DEBUG
                 // test if information is consistent
                 {
@@ -327,75 +428,82 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                 }
 #endif
 
-                //get stored unloged tractograms
+                //get stored unloged tractograms (both reads are done concurrently)
                 compactTract tract1, tract2;
 
-                if( node2join1->isNode() )
+                if( precomputed != 0 )
                 {
-
-                    fileNatMean.readNodeTract( node2join1->getID(), &tract1 );
-                    // delete meantract, boost::bind creates a self contained function object,
-                    // so ts ok if the function takes everything by reference
-
-                    boost::thread delThread( boost::bind( &CnbTreeBuilder::deleteTract, this, node2join1->getID(),
-                                                         &fileNatMean, &threadCount ) );
-                }
-                else
-                {
-                    fileSingle.readLeafTract( node2join1->getID(), m_trackids, m_roi, &tract1 );
-                    tract1.unLog( m_logFactor );
-                }
-
-                if( node2join2->isNode() )
-                {
-                    fileNatMean.readNodeTract( node2join2->getID(), &tract2 );
-                    // delete meantract, boost::bind creates a self contained function object,
-                    // so ts ok if the function takes everything by reference
-
-                    boost::thread delThread( boost::bind( &CnbTreeBuilder::deleteTract, this, node2join2->getID(),
-                                                         &fileNatMean, &threadCount ) );
+                    // tracts were already merged, the mean tracts are no longer needed in the store
+                    if( node2join1->isNode() )
+                    {
+                        meanTracts.erase( node2join1->getID() );
+                    }
+                    if( node2join2->isNode() )
+                    {
+                        meanTracts.erase( node2join2->getID() );
+                    }
                 }
                 else
                 {
-                    fileSingle.readLeafTract( node2join2->getID(), m_trackids, m_roi, &tract2 );
-                    tract2.unLog( m_logFactor );
+#pragma omp parallel sections
+                    {
+#pragma omp section
+                        {
+                            if( node2join1->isNode() )
+                            {
+                                // mean tract is no longer needed in the store once merged
+                                meanTracts.take( node2join1->getID(), &tract1 );
+                            }
+                            else
+                            {
+                                // leaf tracts are kept in log units, the merge kernel converts them on the fly
+                                fileSingle.readLeafTract( node2join1->getID(), m_trackids, m_roi, &tract1 );
+                            }
+                        }
+#pragma omp section
+                        {
+                            if( node2join2->isNode() )
+                            {
+                                meanTracts.take( node2join2->getID(), &tract2 );
+                            }
+                            else
+                            {
+                                fileSingle.readLeafTract( node2join2->getID(), m_trackids, m_roi, &tract2 );
+                            }
+                        }
+                    }
                 }
 
                 if( node2join1->isNode() )
                 {
-#pragma omp critical( nodesCache )
                     nodesCache.erase( node2join1->getID() );
                 }
                 else
                 {
 #pragma omp atomic
                     ++doneLeavesCounter;
-#pragma omp critical( leavesCache )
                     leavesCache.erase( node2join1->getID() );
                 }
 
                 if( node2join2->isNode() )
                 {
-#pragma omp critical( nodesCache )
                     nodesCache.erase( node2join2->getID() );
                 }
                 else
                 {
 #pragma omp atomic
                     ++doneLeavesCounter;
-#pragma omp critical( leavesCache )
                     leavesCache.erase( node2join2->getID() );
                 }
 
 
                 // initialize data members of new node object
                 std::pair< nodeID_t, dist_t > newNearNb( noNbID, noNbDist );
-                std::map< nodeID_t, dist_t > newNbNodes;
                 bool newIsActive( newSize <= activeSize );
 
 
                 // eliminate children entries from current and priority vectors
-                priorityNodes.erase( priorityNodes.begin() );
+                priorityNodes.pop();
                 if( node2join2->isNode() )
                 {
                     if (node2join2->getSize() > prioritySize )
@@ -404,12 +512,12 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                     }
                     else
                     {
-                        priorityNodes.erase( priorityNodeIndex[node2join2->getID()] );
+                        priorityNodes.erase( node2join2->getFullID() );
                     }
                 }
                 else
                 {
-                    priorityNodes.erase( priorityLeafIndex[node2join2->getID()] );
+                    priorityNodes.erase( node2join2->getFullID() );
                 }
 
                 // update parent of joining nodes
@@ -417,50 +525,48 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                 node2join2->setParent( std::make_pair( true, newID ) );
 
                 // start new protonode (merging nbhood tables)
-                newNbNodes.insert( protoNode2join1->m_nbNodes.begin(), protoNode2join1->m_nbNodes.end() );
-                newNbNodes.insert( protoNode2join2->m_nbNodes.begin(), protoNode2join2->m_nbNodes.end() );
-                newNbNodes.erase( node2join1->getFullID() );
-                newNbNodes.erase( node2join2->getFullID() );
-                protoNode2join1->clearNbhood();
+                if( precomputed != 0 )
+                {
+                    newNbNodes.swap( precomputed->nbNodes );
+                }
+                else
+                {
+                    newNbNodes.merge( protoNode2join1->m_nbNodes, protoNode2join2->m_nbNodes, node2join1->getFullID(), node2join2->getFullID() );
+                }
+                protoNode2join1->clearNbhood( &spareNbNodes );
                 protoNode2join1->inactivate();
-                protoNode2join2->clearNbhood();
+                protoNode2join2->clearNbhood( &spareNbNodes );
                 protoNode2join2->inactivate();
                 maxNbs = std::max( maxNbs, newNbNodes.size() );
 
 
-                // get mean tractogram, write it to file in natural units, log it, threshold it, compute norm and put in cache
+                // get mean tractogram in natural units (to store) and logged, thresholded and with computed norm (to put in cache) in a single pass
                 compactTract* newTract;
-                compactTract tempTract( tract1, tract2, node2join1->getSize(), node2join2->getSize() );
-
-                fileNatMean.writeNodeTract( newID, tempTract );
-
-
-                tempTract.doLog( m_logFactor );
-                tempTract.threshold( m_tractThreshold );
-                m_nodeNorms.push_back( tempTract.computeNorm() );
-
-#pragma omp critical( nodesCache )
-                newTract = nodesCache.insert( newID, compactTract() );
-                newTract->steal( &tempTract );
+                compactTract tempTract, logTract;
+                if( precomputed != 0 )
+                {
+                    m_nodeNorms.push_back( precomputed->norm );
+                    tempTract.steal( &( precomputed->meanTract ) );
+                    logTract.steal( &( precomputed->logTract ) );
+                }
+                else
+                {
+                    m_nodeNorms.push_back( tempTract.joinTracts( tract1, tract2, node2join1->getSize(), node2join2->getSize(),
+                                                                 m_logFactor, m_tractThreshold, &logTract ) );
+                }
 
+                meanTracts.put( newID, tempTract );
 
+                newTract = nodesCache.insert( newID, &logTract, true );
 
-                // load tracts from all neighbors
-                std::vector< void* >nbTractVect;
-                nbTractVect.reserve( newNbNodes.size() );
 
-                for( std::map< nodeID_t, dist_t >::iterator nbIter( newNbNodes.begin() ); nbIter != newNbNodes.end(); ++nbIter )
-                {
-                    nbTractVect.push_back( loadTract( nbIter->first, &fileSingle, &fileNatMean, &leavesCache, &nodesCache ) );
-                }
 
-                // get distances to all neighbours
-#pragma omp parallel for schedule( static )
+                // load tracts from all neighbors and get distances to them, each thread loads (from cache or file) the tracts it works on,
+                // so cache misses are read and decoded concurrently and distances are computed as soon as each tract is available
+#pragma omp parallel for schedule( dynamic )
                 for( size_t i = 0; i < newNbNodes.size(); ++i )
                 {
-                    std::map< nodeID_t, dist_t >::iterator nbIter( newNbNodes.begin() );
-                    for( int j = 0; j < i; ++j )
-                        ++nbIter;
+                    nbTable::iterator nbIter( newNbNodes.begin() + i );
 
                     bool nbIsNode( nbIter->first.first );
                     size_t nbId( nbIter->first.second );
@@ -470,27 +576,40 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                     // if we are in the first go of the homogeneus building we set new distances to 1 and recompute all at the end
 
 
-                    if( nbIsNode )
-                    { //nb is a node
-                        if( protoNodes[nbId].isActive() )
-                        {
-                            isNbActive = true;
-                        }
-
-                        // update distance
-                        newNbDist=( newTract->tractDistance( * static_cast< compactTract* >( nbTractVect[i] ) ) );
+                    if( precomputed != 0 )
+                    { // distance was computed with the batch
+                        isNbActive = ( !nbIsNode || protoNodes[nbId].isActive() );
+                        newNbDist = nbIter->second;
                     }
                     else
-                    { //its a leaf
-                        isNbActive = true;
+                    {
+                        // the tract stays pinned in cache until its distance is computed
+                        void* nbTract( loadTract( nbIter->first, &fileSingle, &meanTracts, &leavesCache, &nodesCache ) );
 
-                        // update distance
-                        newNbDist=( newTract->tractDistance( * static_cast< compactTractChar* >( nbTractVect[i] ) ) );
-                    }
+                        if( nbIsNode )
+                        { //nb is a node
+                            if( protoNodes[nbId].isActive() )
+                            {
+                                isNbActive = true;
+                            }
+
+                            // update distance
+                            newNbDist=( newTract->tractDistance( * static_cast< compactTract* >( nbTract ) ) );
+                            nodesCache.unpin( nbId );
+                        }
+                        else
+                        { //its a leaf
+                            isNbActive = true;
+
+                            // update distance
+                            newNbDist=( static_cast< sparseTract* >( nbTract )->tractDistance( *newTract ) );
+                            leavesCache.unpin( nbId );
+                        }
 #pragma omp atomic
-                    m_numComps++;
+                        m_numComps++;
 
-                    nbIter->second = newNbDist;
+                        nbIter->second = newNbDist;
+                    }
 #pragma omp critical
                     if( isNbActive && newNbDist < newNearNb.second )
                     {
@@ -512,44 +631,47 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                         {
                             if ( !nbIsNode )
                             {
-                                priorityNodes.erase( priorityLeafIndex[nbId] );
-                                priorityLeafIndex[nbId] = priorityNodes.insert( std::make_pair( newProtoNb->nearDist(), nbIter->first ) );
+                                priorityNodes.push( nbIter->first, newProtoNb->nearDist() );
                             }
                             else if( nodes[nbId].getSize() <= prioritySize )
                             {
-                                priorityNodes.erase( priorityNodeIndex[nbId] );
-                                priorityNodeIndex[nbId] = priorityNodes.insert( std::make_pair( newProtoNb->nearDist(), nbIter->first ) );
+                                priorityNodes.push( nbIter->first, newProtoNb->nearDist() );
                             }
 
                         }
                     }
                 } // end parallel for
 
-                // set cache sizes, and clean up if overflowed, (50% of the memory for leaves and 50% for nodes unless all leaves are done)
-                if( leavesCache.limit() != 0 )
+#if DEBUG
+                if( m_normMismatches != 0 )
                 {
-                    size_t leavesCacheSize(1);
-                    if( growingStage )
-                    {
-                        leavesCacheSize = std::min( leaves.size() - doneLeavesCounter, static_cast<size_t>(leafCacheRatio * cacheSize) );
+                    throw std::runtime_error( "ERROR @ treeBuilder::buildCentroid(): rebuilt node tracts differ from the merged ones" );
+                }
+#endif
 
-                    }
-                    else
-                    {
-                        leavesCacheSize = std::min( leaves.size() - doneLeavesCounter, static_cast<size_t>(leafCacheRatio * cacheSize / 2) );
+                nodesCache.unpin( newID );
 
-                    }
-                    leavesCache.setLimit( leavesCacheSize );
-                    if( leavesCacheSize == 0 )
+                // set cache sizes from the measured hit rates and memory footprint, and clean up if overflowed
+                if( balancer.update( m_lcHits, m_lcMiss, leavesCache.bytes(), m_ncHits, m_ncMiss, nodesCache.bytes(),
+                                     ( leaves.size() - doneLeavesCounter ) * leafTractBytes, meanTracts.memoryBytes() ) )
+                {
+                    eventStream << "Merge " << newID << ". " << balancer.lastDecision() << std::endl;
+                }
+                // the leaf cache keeps a non-zero limit while there are leaves left, it is shut down only when all of them are merged
+                if( leavesCache.byteLimit() != 0 )
+                {
+                    if( leaves.size() == doneLeavesCounter )
                     {
+                        leavesCache.setByteLimit( 0 );
                         leavesCache.shutdown();
                     }
                     else
                     {
+                        leavesCache.setByteLimit( balancer.leafLimit() );
                         leavesCache.cleanup(); // clean leaves cache
                     }
-                    nodesCache.setLimit( cacheSize - (leavesCacheSize/leafCacheRatio) + 1 );
                 }
+                nodesCache.setByteLimit( balancer.nodeLimit() );
                 nodesCache.cleanup();
 
 
@@ -560,11 +682,12 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                 nodes.push_back( newNode );
 
                 // insert new protoNode object
-                protoNode newProtoNode( newNearNb, newNbNodes, newIsActive );
-                protoNodes.push_back( newProtoNode );
+                protoNodes.push_back( protoNode( newNearNb, nbTable(), newIsActive ) );
+                protoNodes.back().m_nbNodes.swap( newNbNodes );
+                newNbNodes.swap( spareNbNodes );
 
                 // if new node is isolated
-                if( ( newNbNodes.empty() ) )
+                if( ( protoNodes.back().m_nbNodes.empty() ) )
                 {
                     if( m_verbose && ( newSize != m_roi.size() ) )
                     {
@@ -602,7 +725,7 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                         {
                             // store last tract in output folder
                             compactTract rootTract;
-                            fileNatMean.readNodeTract( newID, &rootTract );
+                            meanTracts.get( newID, &rootTract );
                             rootTract.doLog( m_logFactor );
 
                             fileManagerFactory fileLastMF(m_outputFolder);
@@ -612,8 +735,8 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                             fileLast.writeNodeTract( newID, rootTract );
                         }
 
-                        // delete saved tracts
-                        boost::thread delThread( boost::bind( &CnbTreeBuilder::deleteTract, this, newID, &fileNatMean, &threadCount ) );
+                        // delete saved tract
+                        meanTracts.erase( newID );
                     }
                     else
                     {
@@ -624,8 +747,8 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                                       << std::endl;
                         }
 
-                        // delete saved tracts
-                        boost::thread delThread( boost::bind( &CnbTreeBuilder::deleteTract, this, newID, &fileNatMean, &threadCount ) );
+                        // delete saved tract
+                        meanTracts.erase( newID );
 
                         std::list< nodeID_t > worklist;
                         worklist.push_back( std::make_pair( true, newID ) );
@@ -649,7 +772,7 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                     }
                     else
                     {
-                        priorityNodeIndex[newID] = priorityNodes.insert( std::make_pair( newNearNb.second, std::make_pair( true, newID ) ) );
+                        priorityNodes.push( std::make_pair( true, newID ), newNearNb.second );
                     }
                 }
 
@@ -690,11 +813,13 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                 {
                     clust10k = false;
                     std::vector< size_t > bases10k;
-                    for( std::multimap< dist_t, nodeID_t >::iterator priorityIter( priorityNodes.begin() ); priorityIter != priorityNodes.end(); ++priorityIter )
+                    std::vector< nodeID_t > priorityIDs;
+                    priorityNodes.sortedIDs( &priorityIDs );
+                    for( size_t i = 0; i < priorityIDs.size(); ++i )
                     {
-                        if(priorityIter->second.first)
+                        if( priorityIDs[i].first )
                         {
-                            bases10k.push_back(priorityIter->second.second);
+                            bases10k.push_back( priorityIDs[i].second );
                         }
                     }
                     bases10k.insert( bases10k.end(), currentNodes.begin(), currentNodes.end() );
@@ -710,20 +835,24 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                 if( growingStage && ( growType == TC_GROWNUM ) && ( currentNodes.size() + priorityNodes.size() <= baseSize ) )
                 {
                     growingStage = false;
+                    balancer.setLeafSteps( BALANCE_STEPS / 2 );
                     activeSize = protoLeaves.size();
                     prioritySize = protoLeaves.size();
                     baseNodes.clear();
-                    for( std::multimap< dist_t, nodeID_t >::iterator priorityIter( priorityNodes.begin() ); priorityIter != priorityNodes.end(); ++priorityIter )
+                    std::vector< nodeID_t > priorityIDs;
+                    priorityNodes.sortedIDs( &priorityIDs );
+                    for( size_t i = 0; i < priorityIDs.size(); ++i )
                     {
-                        if(priorityIter->second.first)
+                        if( priorityIDs[i].first )
                         {
-                            baseNodes.push_back(priorityIter->second.second);
+                            baseNodes.push_back( priorityIDs[i].second );
                         }
                     }
                     baseNodes.insert( baseNodes.end(), currentNodes.begin(), currentNodes.end() );
                     break;
                 }
             } // end inner big loop (priority size)
+            m_batchMiss += mergeBatch.size() - nextMerge;
 
             if( growingStage )
             {
@@ -737,13 +866,16 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                     if( ( growType == TC_GROWSIZE ) && ( prioritySize >= baseSize ) )
                     {
                         growingStage = false;
+                        balancer.setLeafSteps( BALANCE_STEPS / 2 );
                         prioritySize = protoLeaves.size();
                         activeSize = protoLeaves.size();
-                        for( std::multimap< dist_t, nodeID_t >::iterator priorityIter( priorityNodes.begin() ); priorityIter != priorityNodes.end(); )
+                        std::vector< nodeID_t > priorityIDs;
+                        priorityNodes.sortedIDs( &priorityIDs );
+                        for( size_t i = 0; i < priorityIDs.size(); ++i )
                         {
-                            if(priorityIter->second.first)
+                            if( priorityIDs[i].first )
                             {
-                                baseNodes.push_back(priorityIter->second.second);
+                                baseNodes.push_back( priorityIDs[i].second );
                             }
                         }
                         baseNodes.insert( baseNodes.end(), currentNodes.begin(), currentNodes.end() );
@@ -781,18 +913,20 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                     }
                 }
                 //update nearest neighbors for nodes already in the priority list, save changed entries in a temporal list
-                std::list< std::pair< dist_t, nodeID_t > > tempPnodes;
-                for( std::multimap< dist_t, nodeID_t >::iterator priorityIter( priorityNodes.begin() ); priorityIter != priorityNodes.end(); )
+                std::vector< nodeID_t > priorityIDs;
+                priorityNodes.sortedIDs( &priorityIDs );
+                std::vector< std::pair< dist_t, nodeID_t > > tempPnodes;
+                for( size_t i = 0; i < priorityIDs.size(); ++i )
                 {
                     bool elementChanged( false );
-                    bool isNode( priorityIter->second.first );
-                    size_t thisNodeID(priorityIter->second.second );
+                    bool isNode( priorityIDs[i].first );
+                    size_t thisNodeID( priorityIDs[i].second );
                     if( isNode )
                     {
                         elementChanged = protoNodes[thisNodeID].updateActive( protoNodes );
                         if( elementChanged )
                         {
-                            tempPnodes.push_back( std::make_pair( protoNodes[thisNodeID].nearDist(), priorityIter->second ) );
+                            tempPnodes.push_back( std::make_pair( protoNodes[thisNodeID].nearDist(), priorityIDs[i] ) );
                         }
                     }
                     else
@@ -800,34 +934,15 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                         elementChanged = protoLeaves[thisNodeID].updateActive( protoNodes );
                         if( elementChanged )
                         {
-                            tempPnodes.push_back( std::make_pair( protoLeaves[thisNodeID].nearDist(), priorityIter->second ) );
+                            tempPnodes.push_back( std::make_pair( protoLeaves[thisNodeID].nearDist(), priorityIDs[i] ) );
                         }
                     }
-                    // if the entry changed delete it
-                    if( elementChanged )
-                    {
-                        priorityNodes.erase( priorityIter++ );
-                    }
-                    else
-                    {
-                        ++priorityIter;
-                    }
                 }
-                //insert updated elements on the priority map
-                for( std::list< std::pair< dist_t, nodeID_t > >::const_iterator tempIter( tempPnodes.begin() ); tempIter != tempPnodes.end(); ++tempIter )
+                //update changed elements on the priority heap (as re-insertions, in their previous priority order)
+                for( size_t i = 0; i < tempPnodes.size(); ++i )
                 {
-                    bool isNode( tempIter->second.first );
-                    size_t thisNodeID(tempIter->second.second );
-                    if( isNode )
-                    {
-                        priorityNodeIndex[thisNodeID] = priorityNodes.insert( *tempIter );
-                    }
-                    else
-                    {
-                        priorityLeafIndex[thisNodeID] = priorityNodes.insert( *tempIter );
-                    }
+                    priorityNodes.push( tempPnodes[i].second, tempPnodes[i].first );
                 }
-                tempPnodes.clear();
                 //update nearest neighbors for nodes in the current list and move into the priority list if necessary
                 for( std::set< size_t >::const_iterator currentIter( currentNodes.begin() ); currentIter != currentNodes.end(); )
                 {
@@ -836,7 +951,7 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
                     protoNodes[*currentIter].updateActive( protoNodes );
                     if( thisSize <= prioritySize )
                     {
-                        priorityNodeIndex[*currentIter] = priorityNodes.insert( std::make_pair( protoNodes[*currentIter].nearDist(), std::make_pair( true, *currentIter) ) );
+                        priorityNodes.push( std::make_pair( true, *currentIter ), protoNodes[*currentIter].nearDist() );
                         currentNodes.erase( currentIter++ );
                     }
                     else
@@ -857,15 +972,10 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
 
         } // end upper big loop
 
-        while( threadCount != 0 ) // wait until all threads have finished
-        {
-            boost::this_thread::sleep( boost::posix_time::microseconds( 100 ) );
-        }
-
         if( !priorityNodes.empty() )
         {
             std::cerr << "WARNING @ treeBuilder::buildCentroid(): after finish, supernode is not empty" << std::endl;
-            WHnode* leftNode( fetchNode( priorityNodes.begin()->second, &leaves, &nodes ) );
+            WHnode* leftNode( fetchNode( priorityNodes.topID(), &leaves, &nodes ) );
             std::cerr << "Node info: " << leftNode << std::endl;
             protoNode* leftProtoNode( fetchProtoNode( leftNode->getFullID(), &protoLeaves, &protoNodes ) );
             std::cerr << "Protonode info: " << leftProtoNode << std::endl;
@@ -918,9 +1028,15 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
             std::cout << "maximum number of neighbours in one iteration: " << maxNbs << std::endl;
             std::cout << "Node cache. Hits: " << m_ncHits << ". Misses: " << m_ncMiss << std::endl;
             std::cout << "Leaf cache. Hits: " << m_lcHits << ". Misses: " << m_lcMiss << std::endl;
+            std::cout << "Cache split moves: " << balancer.moves() << ". Final cache budget: " << balancer.budget() / ( 1024 * 1024 ) << " MB" << std::endl;
+            std::cout << meanTracts.getReport() << std::endl;
             std::cout << "Total Hits: " << m_lcHits + m_ncHits << ". Total Misses: " << m_lcMiss
                          + m_ncMiss << std::endl;
             std::cout << "Total correlations: " << m_numComps << std::endl;
+            if( m_mergeBatch > 1 )
+            {
+                std::cout << "Batched merges. Applied: " << m_batchHits << ". Discarded: " << m_batchMiss << std::endl;
+            }
         }
 
 
@@ -933,9 +1049,17 @@ void CnbTreeBuilder::buildCentroid( const unsigned int nbLevel, const float memo
             ( *m_logfile ) << "Node cache misses: " << m_ncMiss << std::endl;
             ( *m_logfile ) << "Leaf cache hits: " << m_lcHits << std::endl;
             ( *m_logfile ) << "Leaf cache misses: " << m_lcMiss << std::endl;
+            ( *m_logfile ) << "Cache split moves: " << balancer.moves() << std::endl;
+            ( *m_logfile ) << "Final cache budget: " << balancer.budget() / ( 1024 * 1024 ) << " MB" << std::endl;
+            ( *m_logfile ) << meanTracts.getReport() << std::endl;
             ( *m_logfile ) << "Total hits: " << m_lcHits + m_ncHits << std::endl;
             ( *m_logfile ) << "Total misses: " << m_lcMiss + m_ncMiss << std::endl;
             ( *m_logfile ) << "Total correlations: " << m_numComps << std::endl;
+            if( m_mergeBatch > 1 )
+            {
+                ( *m_logfile ) << "Batched merges applied: " << m_batchHits << std::endl;
+                ( *m_logfile ) << "Batched merges discarded: " << m_batchMiss << std::endl;
+            }
         }
     } // end tree build up -------------
 
@@ -1241,6 +1365,74 @@ WHnode* CnbTreeBuilder::fetchNode( const nodeID_t& thisNode, std::vector< WHnode
     }
 }
 
+size_t CnbTreeBuilder::selectMergeBatch( const nodeHeap& priorityNodes, std::vector< protoNode >* protoLeavesPointer, std::vector< protoNode >* protoNodesPointer,
+                                         std::vector< speculativeMerge >* batchPointer ) const
+{
+    std::vector< speculativeMerge >& batch( *batchPointer );
+    batch.clear();
+
+    std::vector< std::pair< nodeID_t, dist_t > > topElements;
+    priorityNodes.topElements( m_mergeBatch, &topElements );
+
+    std::set< nodeID_t > mergedIDs;  // elements merged by the batch
+    std::set< nodeID_t > touchedIDs; // elements merged by the batch and their neighbours
+
+    for( size_t i = 0; i < topElements.size(); ++i )
+    {
+        const nodeID_t node1( topElements[i].first );
+        if( mergedIDs.count( node1 ) )
+        {
+            // partner of a batched merge (reciprocal pair), it will leave the heap when that merge is applied
+            continue;
+        }
+        const protoNode* protoNode1( fetchProtoNode( node1, protoLeavesPointer, protoNodesPointer ) );
+        const nodeID_t node2( protoNode1->nearNb() );
+        if( topElements[i].second == noNbDist || protoNode1->nearDist() != topElements[i].second )
+        {
+            break;
+        }
+        const protoNode* protoNode2( fetchProtoNode( node2, protoLeavesPointer, protoNodesPointer ) );
+
+        // the merge can not be computed ahead if its elements were affected by the previous merges, or if it would affect their neighbourhoods
+        if( touchedIDs.count( node1 ) || touchedIDs.count( node2 ) )
+        {
+            break;
+        }
+        bool independent( true );
+        for( nbTable::const_iterator nbIter( protoNode1->m_nbNodes.begin() ); independent && nbIter != protoNode1->m_nbNodes.end(); ++nbIter )
+        {
+            independent = ( mergedIDs.count( nbIter->first ) == 0 );
+        }
+        for( nbTable::const_iterator nbIter( protoNode2->m_nbNodes.begin() ); independent && nbIter != protoNode2->m_nbNodes.end(); ++nbIter )
+        {
+            independent = ( mergedIDs.count( nbIter->first ) == 0 );
+        }
+        if( !independent )
+        {
+            break;
+        }
+
+        mergedIDs.insert( node1 );
+        mergedIDs.insert( node2 );
+        touchedIDs.insert( node1 );
+        touchedIDs.insert( node2 );
+        for( nbTable::const_iterator nbIter( protoNode1->m_nbNodes.begin() ); nbIter != protoNode1->m_nbNodes.end(); ++nbIter )
+        {
+            touchedIDs.insert( nbIter->first );
+        }
+        for( nbTable::const_iterator nbIter( protoNode2->m_nbNodes.begin() ); nbIter != protoNode2->m_nbNodes.end(); ++nbIter )
+        {
+            touchedIDs.insert( nbIter->first );
+        }
+
+        batch.push_back( speculativeMerge() );
+        batch.back().node1 = node1;
+        batch.back().node2 = node2;
+        batch.back().dist = topElements[i].second;
+    }
+    return batch.size();
+} // end cnbTreeBuilder::selectMergeBatch() -------------------------------------------------------------------------------------
+
 void CnbTreeBuilder::computeNorms()
 {
     // loop  through all the seed voxels and compute tractogram norms
@@ -1248,6 +1440,7 @@ void CnbTreeBuilder::computeNorms()
     time_t loopStart( time( NULL ) ), lastTime( time( NULL ) );
     m_leafNorms.assign( m_roi.size(), 0 );
     size_t progCount( 0 );
+    double sparseBytes( 0 );
 
 
     fileManagerFactory fileSingleMF(m_inputFolder);
@@ -1255,14 +1448,16 @@ void CnbTreeBuilder::computeNorms()
     fileSingle.readAsUnThres();
     fileSingle.readAsLog();
 
-#pragma omp parallel for schedule( static )
+#pragma omp parallel for schedule( static ) reduction( +: sparseBytes )
     for( size_t i = 0; i < m_roi.size(); ++i )
     {
         compactTractChar thisTract;
 
         fileSingle.readLeafTract( i, m_trackids, m_roi, &thisTract );
         thisTract.threshold( m_tractThreshold );
-        m_leafNorms[i] = thisTract.computeNorm();
+        sparseTract thisSparseTract( thisTract );
+        m_leafNorms[i] = thisSparseTract.computeNorm();
+        sparseBytes += thisSparseTract.bytes();
 
 #pragma omp atomic
         ++progCount;
@@ -1297,6 +1492,11 @@ void CnbTreeBuilder::computeNorms()
     } // end  for
 
 
+    if( !m_roi.empty() )
+    {
+        m_leafTractMb = sparseBytes / ( m_roi.size() * 1024. * 1024. );
+    }
+
     int timeTaken = difftime( time( NULL ), loopStart );
     if( m_verbose )
     {
@@ -1321,7 +1521,7 @@ void CnbTreeBuilder::computeNorms()
     }
 } // end treeBuilder::computeNorms() -------------------------------------------------------------------------------------
 
-std::list< WHcoord > CnbTreeBuilder::initialize( const unsigned int nbLevel, const size_t cacheSize, std::vector< protoNode >* protoLeavesPointer )
+std::list< WHcoord > CnbTreeBuilder::initialize( const unsigned int nbLevel, const size_t cacheBytes, std::vector< protoNode >* protoLeavesPointer )
 {
     std::cout << "Initializing seed neighbor dissimilarity information" << std::endl;
     std::vector< protoNode >& protoLeaves = *protoLeavesPointer;
@@ -1364,32 +1564,14 @@ std::list< WHcoord > CnbTreeBuilder::initialize( const unsigned int nbLevel, con
         roimap[m_roi[i]] = i;
     }
 
-    protoLeaves.clear();
-    protoLeaves.reserve( m_roi.size() );
-
-    fileManagerFactory fileSingleMF(m_inputFolder);
-    fileManager& fileSingle(fileSingleMF.getFM());
-    fileSingle.readAsUnThres();
-    fileSingle.readAsLog();
-    listedCache< compactTractChar > cache( m_roi.size(), cacheSize );
-    volatile size_t threadCount( 0 );
-
-    //initialize proto-leaves
     time_t loopStart( time( NULL ) ), lastTime( time( NULL ) );
+
+    // get the neighbour IDs of every seed voxel, sorted so that the slot of each pair can be found from both ends
+    std::vector< std::vector< size_t > > nbIDs( m_roi.size() );
+    std::vector< std::vector< dist_t > > nbDists( m_roi.size() );
+#pragma omp parallel for schedule( dynamic, 64 )
     for( size_t roiID = 0; roiID < m_roi.size(); ++roiID )
     {
-        bool discard( true ); // discard voxel flag
-        compactTractChar* thisTract( cache.get( roiID ) );
-
-        if( thisTract == 0 )
-        { // if tract was not in cche, get it from file
-            compactTractChar tempTract;
-            fileSingle.readLeafTract( roiID, m_trackids, m_roi, &tempTract );
-            tempTract.threshold( m_tractThreshold );
-            tempTract.setNorm( m_leafNorms[roiID] );
-            thisTract = cache.insert( roiID, compactTractChar() );
-            thisTract->steal( &tempTract );
-        }
         // get coordinates of neighbouring voxels
         std::vector< WHcoord > nbCoords( m_roi[roiID].getPhysNbs( m_datasetSize, nbLevel1 ) );
         // dicard coordinates that are not part of the roi
@@ -1424,8 +1606,7 @@ std::list< WHcoord > CnbTreeBuilder::initialize( const unsigned int nbLevel, con
             nbAllCoordslist.sort();
             nbAllCoordslist.unique();
 
-            // discard neighbors that are not seeds or are already level 1 ,
-            // or that have already been scanned in a previous iteration
+            // discard neighbors that are not seeds or are the current seed
             std::list< WHcoord >::iterator cleanIter( nbAllCoordslist.begin() );
             while( cleanIter != nbAllCoordslist.end() )
             {
@@ -1447,79 +1628,197 @@ std::list< WHcoord > CnbTreeBuilder::initialize( const unsigned int nbLevel, con
         }
 
         //convert vector of neighbor coordinates to vector of neighbor ids
-        std::vector< size_t > nbIDs;
-        nbIDs.reserve( nbCoords.size() );
+        std::vector< size_t >& theseNbIDs( nbIDs[roiID] );
+        theseNbIDs.reserve( nbCoords.size() );
         for( size_t i = 0; i < nbCoords.size(); ++i )
         {
-            nbIDs.push_back( roimap[nbCoords[i]] );
+            theseNbIDs.push_back( roimap.find( nbCoords[i] )->second );
         }
-        // get neighborhood information
-        std::map< size_t, dist_t > nbLeaves; // variable to keep the current seed voxel neighbours
-        discard = scanNbs( roiID, thisTract, protoLeaves, nbIDs, &nbLeaves, &cache );
+        std::sort( theseNbIDs.begin(), theseNbIDs.end() );
+        nbDists[roiID].assign( theseNbIDs.size(), 2 );
+    }
 
-        if( !discard )
-        { // it is a valid seed voxel
+    // group the seeds by z plane and get the tracts each plane needs: its seeds and the neighbours they own the distance to
+    std::vector< std::vector< size_t > > planeSeeds( m_datasetSize.m_z );
+    for( size_t roiID = 0; roiID < m_roi.size(); ++roiID )
+    {
+        planeSeeds[static_cast< size_t >( m_roi[roiID].m_z )].push_back( roiID );
+    }
+    std::vector< std::vector< size_t > > planeTracts( planeSeeds.size() );
+    std::vector< size_t > planeWork( planeSeeds.size(), 0 );
+    size_t maxPlaneTracts( 0 ), totalWork( 0 );
+    for( size_t z = 0; z < planeSeeds.size(); ++z )
+    {
+        std::vector< size_t >& theseTracts( planeTracts[z] );
+        for( size_t i = 0; i < planeSeeds[z].size(); ++i )
+        {
+            const size_t seedID( planeSeeds[z][i] );
+            theseTracts.push_back( seedID );
+            for( size_t j = 0; j < nbIDs[seedID].size(); ++j )
+            {
+                if( ownsPair( seedID, nbIDs[seedID][j] ) )
+                {
+                    theseTracts.push_back( nbIDs[seedID][j] );
+                    ++planeWork[z];
+                }
+            }
+        }
+        std::sort( theseTracts.begin(), theseTracts.end() );
+        theseTracts.erase( std::unique( theseTracts.begin(), theseTracts.end() ), theseTracts.end() );
+        maxPlaneTracts = std::max( maxPlaneTracts, theseTracts.size() );
+        totalWork += planeWork[z];
+    }
 
+    // each worker keeps the tracts of its current plane and the prefetched ones, run less workers if their windows do not fit in the cache memory
+    size_t numWorkers( std::min( static_cast< size_t >( omp_get_max_threads() ), planeSeeds.size() ) );
+    const double windowBytes( ( LEAF_STREAM_DEPTH + 1 ) * maxPlaneTracts * m_leafTractMb * 1024 * 1024 );
+    if( windowBytes * numWorkers > cacheBytes )
+    {
+        numWorkers = std::max( size_t( 1 ), static_cast< size_t >( cacheBytes / windowBytes ) );
+    }
 
-            //create a valid proto leaf
-            std::pair< nodeID_t, dist_t > nearNb( std::make_pair( std::make_pair( false, 0 ), 999 ) );
-            std::map< nodeID_t, dist_t > nbNodes;
-            for( std::map< size_t, dist_t >::const_iterator fillIter = nbLeaves.begin(); fillIter != nbLeaves.end(); ++fillIter )
+    // split the roi in one z-slab per worker with similar amounts of distances to compute. Workers go through their slabs upwards or downwards
+    // alternately, so that the halo tracts shared by two neighbouring slabs are needed by both workers at the same time (both at the start or both at the end)
+    std::vector< std::vector< size_t > > schedules( numWorkers );
+    {
+        size_t doneWork( 0 ), worker( 0 );
+        for( size_t z = 0; z < planeSeeds.size(); ++z )
+        {
+            if( planeSeeds[z].empty() )
             {
-                nbNodes.insert( std::make_pair( std::make_pair( false, fillIter->first ), fillIter->second ) );
-                if( fillIter->second < nearNb.second )
-                    nearNb = ( std::make_pair( std::make_pair( false, fillIter->first ), fillIter->second ) );
+                continue;
+            }
+            schedules[worker].push_back( z );
+            doneWork += planeWork[z];
+            if( worker + 1 < numWorkers && doneWork * numWorkers >= totalWork * ( worker + 1 ) )
+            {
+                ++worker;
             }
-            protoNode thisProtoLeaf( nearNb, nbNodes );
-            protoLeaves.push_back( thisProtoLeaf );
         }
-        else
+        for( size_t worker = 1; worker < numWorkers; worker += 2 )
         {
-            //create discarded proto leaf
-            std::pair< nodeID_t, dist_t > nearNbEmpty( std::make_pair( std::make_pair( false, 0 ), 1 ) );
-            std::map< nodeID_t, dist_t > nbNodesEmpty;
-            protoNode thisProtoLeaf( nearNbEmpty, nbNodesEmpty );
-            thisProtoLeaf.discard();
-            protoLeaves.push_back( thisProtoLeaf );
+            std::reverse( schedules[worker].begin(), schedules[worker].end() );
         }
+    }
+    if( m_verbose )
+    {
+        std::cout << "Scanning neighbour distances in " << numWorkers << " z-slabs, streaming up to " << maxPlaneTracts << " tracts per plane" << std::endl;
+    }
 
-        if( m_verbose )
+    // compute the distance of every neighbour pair once, each tract is read once and kept only while the planes that need it are being scanned
+    leafTractStream stream( *this, m_roi.size(), planeTracts, schedules, LEAF_STREAM_DEPTH, numWorkers );
+    volatile size_t progCount( 0 );
+    size_t numComps( 0 );
+    std::string scanError; // an exception must not leave the parallel region, the first error is kept and thrown once all the workers have stopped
+    volatile bool scanFailed( false );
+#pragma omp parallel for schedule( static, 1 ) num_threads( numWorkers ) reduction( +: numComps )
+    for( size_t worker = 0; worker < numWorkers; ++worker )
+    {
+        for( size_t i = 0; i < schedules[worker].size() && !scanFailed && !stream.failed(); ++i )
         {
-            time_t currentTime( time( NULL ) );
-            if( currentTime - lastTime > 1 )
+            try
             {
-                lastTime = currentTime;
-                float progress( roiID * 100. / m_roi.size() );
-                size_t elapsedTime( difftime( currentTime, loopStart ) );
-                std::stringstream message;
-                message << "\r" << static_cast<int>( progress ) << " % of leaves initialized (" << roiID << "). ";
-                if( progress > 0 )
+                numComps += scanPlane( worker, &stream, planeSeeds, nbIDs, &nbDists );
+            }
+            catch( const std::exception& except )
+            {
+#pragma omp critical( scanError )
                 {
-                    size_t expectedRemain( elapsedTime * ( ( 100. - progress ) / progress ) );
-                    message << "Expected remaining time: ";
-                    message << expectedRemain / 3600 << "h ";
-                    message << ( expectedRemain % 3600 ) / 60 << "' ";
-                    message << ( expectedRemain % 3600 ) % 60 << "\". ";
+                    if( !scanFailed )
+                    {
+                        scanError = except.what();
+                        scanFailed = true;
+                    }
                 }
-                message << "Elapsed time: ";
-                message << elapsedTime / 3600 << "h " << ( elapsedTime % 3600 ) / 60 << "' ";
-                message << ( elapsedTime % 3600 ) % 60 << "\". ";
-                std::cout << message.str() <<std::flush;
+                break;
             }
-        } // end verbose
 
-        cache.erase( roiID ); //we wont need this tract anymore
-        cache.cleanup(); // if cache is full, delete overflowed tracts
-    } // end big loop
+#pragma omp atomic
+            progCount += planeSeeds[schedules[worker][i]].size();
 
-    while( threadCount != 0 ) // wait until all threads have finished
-        boost::this_thread::sleep( boost::posix_time::microseconds( 100 ) );
+            if( m_verbose && omp_get_thread_num() == 0 )
+            {
+                time_t currentTime( time( NULL ) );
+                if( currentTime - lastTime > 1 )
+                {
+                    lastTime = currentTime;
+                    size_t currentCount( progCount );
+                    float progress( currentCount * 100. / m_roi.size() );
+                    size_t elapsedTime( difftime( currentTime, loopStart ) );
+                    std::stringstream message;
+                    message << "\r" << static_cast<int>( progress ) << " % of leaves initialized (" << currentCount << "). ";
+                    if( progress > 0 )
+                    {
+                        size_t expectedRemain( elapsedTime * ( ( 100. - progress ) / progress ) );
+                        message << "Expected remaining time: ";
+                        message << expectedRemain / 3600 << "h ";
+                        message << ( expectedRemain % 3600 ) / 60 << "' ";
+                        message << ( expectedRemain % 3600 ) % 60 << "\". ";
+                    }
+                    message << "Elapsed time: ";
+                    message << elapsedTime / 3600 << "h " << ( elapsedTime % 3600 ) / 60 << "' ";
+                    message << ( elapsedTime % 3600 ) % 60 << "\". ";
+                    std::cout << message.str() <<std::flush;
+                }
+            } // end verbose
+        }
+    }
+    if( scanFailed )
+    {
+        throw std::runtime_error( scanError );
+    }
+    if( stream.failed() )
+    {
+        throw std::runtime_error( stream.getError() );
+    }
+    const size_t readTracts( stream.readTracts() ), peakTracts( stream.peakTracts() );
+    m_numComps += numComps;
+
+    //initialize proto-leaves
+    // a seed is valid if any of its neighbours is within the maximum distance. A discarded seed has all its distances above it,
+    // so it never decides the validity or nearest neighbour of another seed and it is removed from the neighbourhoods in the cleanup below
+    protoLeaves.clear();
+    protoLeaves.reserve( m_roi.size() );
+    for( size_t roiID = 0; roiID < m_roi.size(); ++roiID )
+    {
+        std::pair< nodeID_t, dist_t > nearNb( std::make_pair( std::make_pair( false, 0 ), 999 ) );
+        nbTable nbNodes;
+        nbNodes.reserve( nbIDs[roiID].size() );
+        for( size_t i = 0; i < nbIDs[roiID].size(); ++i )
+        {
+            if( nbDists[roiID][i] == 2 )
+            {
+                throw std::runtime_error( "ERROR @ treeBuilder::initialize(): dist value is still 2" );
+            }
+            nbNodes.insert( std::make_pair( std::make_pair( false, nbIDs[roiID][i] ), nbDists[roiID][i] ) );
+            if( nbDists[roiID][i] < nearNb.second )
+                nearNb = ( std::make_pair( std::make_pair( false, nbIDs[roiID][i] ), nbDists[roiID][i] ) );
+        }
+        std::vector< size_t >().swap( nbIDs[roiID] );
+        std::vector< dist_t >().swap( nbDists[roiID] );
+
+        if( nearNb.second <= m_maxNbDist )
+        { // it is a valid seed voxel
+            protoNode thisProtoLeaf( nearNb, nbNodes );
+            protoLeaves.push_back( thisProtoLeaf );
+        }
+        else
+        {
+            //create discarded proto leaf
+            std::pair< nodeID_t, dist_t > nearNbEmpty( std::make_pair( std::make_pair( false, 0 ), 1 ) );
+            nbTable nbNodesEmpty;
+            protoNode thisProtoLeaf( nearNbEmpty, nbNodesEmpty );
+            thisProtoLeaf.discard();
+            protoLeaves.push_back( thisProtoLeaf );
+        }
+    }
 
     if( m_verbose )
     {
         int timeTaken = difftime( time( NULL ), loopStart );
         std::cout << "\r" << std::flush << "100 % of leaves initialized. Time taken: " << timeTaken / 3600 << "h " << ( timeTaken
                         % 3600 ) / 60 << "' " << ( ( timeTaken % 3600 ) % 60 ) << "\"    " << std::endl;
+        std::cout << "Leaf tracts read: " << readTracts << ". Peak in memory: " << peakTracts << std::endl;
         std::cout << "Cleaning up discarded voxels..." << std::endl;
     }
 
@@ -1540,13 +1839,14 @@ std::list< WHcoord > CnbTreeBuilder::initialize( const unsigned int nbLevel, con
         if( !protoLeaves[i].isDiscarded() )
         {
             protoLeaves[i].m_nearNb.first.second = lookuptable[protoLeaves[i].m_nearNb.first.second]; // near nb id
-            std::map< nodeID_t, dist_t > newNbs;
-            for( std::map< nodeID_t, dist_t >::iterator nbIter( protoLeaves[i].m_nbNodes.begin() ); nbIter
+            nbTable newNbs;
+            newNbs.reserve( protoLeaves[i].m_nbNodes.size() );
+            for( nbTable::iterator nbIter( protoLeaves[i].m_nbNodes.begin() ); nbIter
                             != protoLeaves[i].m_nbNodes.end(); ++nbIter )
             {
                 size_t nbNewID = ( lookuptable[nbIter->first.second] );
                 if( nbNewID != INVALID_PROTONODE )
-                    newNbs[std::make_pair( 0, nbNewID )] = nbIter->second;
+                    newNbs.set( std::make_pair( false, nbNewID ), nbIter->second );
             }
             protoLeaves[i].m_nbNodes.swap( newNbs );
         }
@@ -1593,6 +1893,7 @@ std::list< WHcoord > CnbTreeBuilder::initialize( const unsigned int nbLevel, con
         ( *m_logfile ) << "Leaves initialized. Time taken: " << timeTaken / 3600 << "h ";
         ( *m_logfile ) << ( timeTaken % 3600 ) / 60 << "' " << ( ( timeTaken % 3600 ) % 60 ) << "\"" << std::endl;
         ( *m_logfile ) << "Mean # of nbs:\t" << meanNbs << std::endl;
+        ( *m_logfile ) << "Leaf tracts read on Init.:\t" << readTracts << " (peak in memory: " << peakTracts << ")" << std::endl;
         ( *m_logfile ) << "Seeds discarded on Init.:\t" << discarded.size() << std::endl;
     }
     discarded.sort();
@@ -1600,151 +1901,94 @@ std::list< WHcoord > CnbTreeBuilder::initialize( const unsigned int nbLevel, con
 } // end treeBuilder::initialize() -------------------------------------------------------------------------------------
 
 
-bool CnbTreeBuilder::scanNbs( const size_t currentSeedID,
-                              const compactTractChar* const currentTract,
-                              const std::vector< protoNode >& protoLeaves,
-                              const std::vector< size_t >& nbIDs,
-                              std::map< size_t, dist_t >* nbLeavesPointer,
-                              listedCache< compactTractChar >* cachePointer )
+size_t CnbTreeBuilder::scanPlane( const size_t worker,
+                                  leafTractStream* streamPointer,
+                                  const std::vector< std::vector< size_t > >& planeSeeds,
+                                  const std::vector< std::vector< size_t > >& nbIDs,
+                                  std::vector< std::vector< dist_t > >* nbDistsPointer )
 {
-    std::map< size_t, dist_t >& nbLeaves = *nbLeavesPointer;
-    listedCache< compactTractChar >& cache = *cachePointer;
-
-    fileManagerFactory fileSingleMF(m_inputFolder);
-    fileManager& fileSingle(fileSingleMF.getFM());
-    fileSingle.readAsUnThres();
-    fileSingle.readAsLog();
-
-    bool discard( true );
-
-    std::vector< compactTractChar* > tractVect;
-    tractVect.reserve( nbIDs.size() );
-    std::vector< std::pair< size_t, dist_t > > distPairVect;
-    distPairVect.reserve( nbIDs.size() );
+    std::vector< std::vector< dist_t > >& nbDists = *nbDistsPointer;
 
+    std::map< size_t, const sparseTract* > window; // tracts needed by the plane
+    size_t plane( 0 ), numComps( 0 );
+    if( !streamPointer->acquirePlane( worker, &window, &plane ) )
+    {
+        // a tract could not be read, the stream keeps the error and it is thrown after the scan
+        return numComps;
+    }
 
-    // first loop obtains tractograms for non computed distances and recovers the ones already computed
-    for( int j = 0; j < nbIDs.size(); ++j )
+    for( size_t i = 0; i < planeSeeds[plane].size(); ++i )
     {
-        size_t thisNbID( nbIDs[j] );
-
-        if( currentSeedID < thisNbID )
-        { // neighbour voxel has not yet been processed
-            compactTractChar* tractPointer;
-            //#pragma omp critical( cache )
-            tractPointer = cache.get( thisNbID );
-
-            if( tractPointer == 0 )
-            { // if tract was not in cache, get it from file
-                compactTractChar nbTract; // get neighbour tract
-                fileSingle.readLeafTract( thisNbID, m_trackids, m_roi, &nbTract );
-                nbTract.threshold( m_tractThreshold );
-                nbTract.setNorm( m_leafNorms[thisNbID] );
-                //#pragma omp critical( cache ) // we insert it this way so that a copy of the tractogram doesnt have to be made
-                tractPointer = cache.insert( thisNbID, compactTractChar() );
-                tractPointer->steal( &nbTract );
-            }
-            tractVect.push_back( tractPointer );
-            distPairVect.push_back( std::make_pair( thisNbID, 2 ) );
-        }
-        else
-        { // neighbour was already processed as seed voxel
-            if( thisNbID >= protoLeaves.size() )
+        const size_t seedID( planeSeeds[plane][i] );
+        const sparseTract* seedTract( window[seedID] );
+        for( size_t j = 0; j < nbIDs[seedID].size(); ++j )
+        {
+            const size_t nbID( nbIDs[seedID][j] );
+            if( !ownsPair( seedID, nbID ) )
             {
-                //#pragma omp critical( error )
-                {
-                    std::cerr<< "Seed: " <<  m_roi[currentSeedID] << ". Nb: " << m_roi[thisNbID] << std::endl;
-                    std::cerr<< "nbID: " <<  thisNbID << ". protoLeaves.size(): " << protoLeaves.size() << std::endl;
-                    throw std::runtime_error( "ERROR @ treeBuilder::buildCentroid(): neighbor is not in protoLeaves vector" );
-                }
-            }
-            else if( protoLeaves[thisNbID].isDiscarded() )
-            { // seed voxel was discarded, skip
                 continue;
             }
-
-            std::map< nodeID_t, dist_t >::const_iterator searchIter( protoLeaves[thisNbID].m_nbNodes.find( std::make_pair( false, currentSeedID ) ) );
-            if( searchIter == protoLeaves[thisNbID].m_nbNodes.end() )
+            std::map< size_t, const sparseTract* >::const_iterator nbTractIter( window.find( nbID ) );
+            std::vector< size_t >::const_iterator backIter( std::lower_bound( nbIDs[nbID].begin(), nbIDs[nbID].end(), seedID ) );
+            if( seedTract == 0 || nbTractIter == window.end() || backIter == nbIDs[nbID].end() || *backIter != seedID )
             {
-                //#pragma omp critical( error )
-                {
-                    std::cerr<< "nb was supposedly already processed but seed is not found in nb data " << std::endl;
-                    std::cerr<< "Seed: " <<  m_roi[currentSeedID] << ". Nb: " << m_roi[thisNbID] << std::endl;
-                    std::cerr<< "SeedID: " <<  currentSeedID << ". nbID: " <<  thisNbID << ". protoLeaves.size(): " << protoLeaves.size() << std::endl;
-                    std::cerr<< "nbInfo: " <<   protoLeaves[thisNbID] << std::endl;
-
-                    throw std::runtime_error( "ERROR @ treeBuilder::scanNbs(): neighborhood data not found" );
-                }
+                std::cerr<< "Seed: " <<  m_roi[seedID] << ". Nb: " << m_roi[nbID] << std::endl;
+                throw std::runtime_error( "ERROR @ treeBuilder::scanPlane(): neighborhood data not found" );
             }
-            //#pragma omp critical( leaves )
-            {
-                nbLeaves.insert( std::make_pair( thisNbID, searchIter->second ) ); // save the pair neighbour-distance
-                if( searchIter->second <= m_maxNbDist )
-                { // neighbour is valid -> seed is valid
-                    discard = false;
-                }
-            }
-        }
-    }
-
-
-    // compute distances from tracts in  parallel
-    #pragma omp parallel for schedule( static ) // loop through neighbours
-    for( int j = 0; j < distPairVect.size(); ++j )
-    {
-        distPairVect[j].second = currentTract->tractDistance( *tractVect[j] );
-    } // end parallel for
-
-    m_numComps += distPairVect.size();
 
-    for( int j = 0; j < distPairVect.size(); ++j )
-    {
-        nbLeaves.insert( distPairVect[j] ); // save the pair neighbour-distance
-        if( distPairVect[j].second <= m_maxNbDist )
-        { // neighbour is valid -> seed is valid
-            discard = false;
-        }
-        else if( distPairVect[j].second == 2 )
-        {
-            throw std::runtime_error( "ERROR @ treeBuilder::scanNbs(): dist value is still 2" );
+            // the tract with the lower ID is the reference one, as in the seed order scan
+            dist_t nbDist( ( seedID < nbID ) ? seedTract->tractDistance( *nbTractIter->second ) : nbTractIter->second->tractDistance( *seedTract ) );
+            nbDists[seedID][j] = nbDist;
+            nbDists[nbID][backIter - nbIDs[nbID].begin()] = nbDist;
+            ++numComps;
         }
     }
-    return discard;
-} // end treeBuilder::scanNbs() -------------------------------------------------------------------------------------
 
+    streamPointer->releasePlane( worker );
+    return numComps;
+} // end treeBuilder::scanPlane() -------------------------------------------------------------------------------------
 
-void CnbTreeBuilder::deleteTract( const size_t &nodeID, const fileManager* const fileMngrPointer, volatile size_t* threadcounterPointer ) const
+
+void CnbTreeBuilder::readSparseLeaf( const size_t leafID, sparseTract* tractPointer ) const
 {
-#pragma omp atomic
-    ++( *threadcounterPointer );
+    fileManagerFactory fileSingleMF(m_inputFolder);
+    fileManager& fileSingle(fileSingleMF.getFM());
+    fileSingle.readAsUnThres();
+    fileSingle.readAsLog();
+
+    compactTractChar tempTract;
+    fileSingle.readLeafTract( leafID, m_trackids, m_roi, &tempTract );
+    tempTract.threshold( m_tractThreshold );
+    sparseTract tempSparseTract( tempTract );
+    tempSparseTract.setNorm( m_leafNorms[leafID] );
+    tractPointer->steal( &tempSparseTract );
+} // end treeBuilder::readSparseLeaf() -------------------------------------------------------------------------------------
 
-    fileMngrPointer->deleteTractFile( nodeID );
 
-#pragma omp atomic
-    --( *threadcounterPointer );
-    return;
-} // end cnbTreeBuilder::deleteTract() -------------------------------------------------------------------------------------
 
 
 compactTract* CnbTreeBuilder::loadNodeTract( const size_t nodeID,
-                                             const fileManager* const nodeMngrPointer,
-                                             listedCache< compactTract >* nodesCachePointer)
+                                             const meanTractStore* const meanTractsPointer,
+                                             concurrentCache< compactTract >* nodesCachePointer)
 {
 
-        compactTract* newNbTract( 0 );
-
-        #pragma omp critical( nodesCache )
-        newNbTract = nodesCachePointer->get( nodeID );
+        compactTract* newNbTract( nodesCachePointer->pin( nodeID ) );
         if( newNbTract == 0 )
-        { //tractogram is not in cache, it must be in file then
+        { //tractogram is not in cache, it must be in the mean tract store then
+            // rebuilt with the merge kernel, so it is identical to the tract that was cached when the node was created
             compactTract nbTractogram;
-            nodeMngrPointer->readNodeTract( nodeID, &nbTractogram );
-            nbTractogram.doLog( m_logFactor );
-            nbTractogram.threshold( m_tractThreshold );
-            nbTractogram.setNorm( m_nodeNorms[nodeID] );
-            #pragma omp critical( nodesCache )
-            newNbTract = nodesCachePointer->insert( nodeID, compactTract() );
-            newNbTract->steal( &nbTractogram );
+            meanTractsPointer->get( nodeID, &nbTractogram );
+#if DEBUG
+            // called from parallel loops, mismatches are counted and reported after the loop
+            if( nbTractogram.logThreshold( m_logFactor, m_tractThreshold ) != m_nodeNorms[nodeID] )
+            {
+                #pragma omp atomic
+                ++m_normMismatches;
+            }
+#else
+            nbTractogram.logThreshold( m_logFactor, m_tractThreshold );
+#endif
+            newNbTract = nodesCachePointer->insert( nodeID, &nbTractogram, true );
             #pragma omp atomic
             ++m_ncMiss;
         }
@@ -1758,22 +2002,19 @@ compactTract* CnbTreeBuilder::loadNodeTract( const size_t nodeID,
 } // end cnbTreeBuilder::loadNodeTract() -------------------------------------------------------------------------------------
 
 
-compactTractChar* CnbTreeBuilder::loadLeafTract( const size_t leafID,
+sparseTract* CnbTreeBuilder::loadLeafTract( const size_t leafID,
                                  const fileManager* const leafMngrPointer,
-                                 listedCache< compactTractChar >* leavesCachePointer)
+                                 concurrentCache< sparseTract >* leavesCachePointer)
 {
-        compactTractChar* newNbTract( 0 );
-        #pragma omp critical( leavesCache )
-        newNbTract = leavesCachePointer->get( leafID );
+        sparseTract* newNbTract( leavesCachePointer->pin( leafID ) );
         if( newNbTract == 0 )
         { //tractogram is not in cache, it must be in file then
             compactTractChar nbTractogram;
             leafMngrPointer->readLeafTract( leafID, m_trackids, m_roi, &nbTractogram );
             nbTractogram.threshold( m_tractThreshold );
-            nbTractogram.setNorm( m_leafNorms[leafID] );
-            #pragma omp critical( leavesCache )
-            newNbTract = leavesCachePointer->insert( leafID, compactTractChar() );
-            newNbTract->steal( &nbTractogram );
+            sparseTract nbSparseTractogram( nbTractogram );
+            nbSparseTractogram.setNorm( m_leafNorms[leafID] );
+            newNbTract = leavesCachePointer->insert( leafID, &nbSparseTractogram, true );
             #pragma omp atomic
             ++m_lcMiss;
         }
@@ -1787,13 +2028,13 @@ compactTractChar* CnbTreeBuilder::loadLeafTract( const size_t leafID,
 
 void* CnbTreeBuilder::loadTract( const nodeID_t nodeID,
                                  const fileManager* const leafMngrPointer,
-                                 const fileManager* const nodeMngrPointer,
-                                 listedCache< compactTractChar >* leavesCachePointer,
-                                 listedCache< compactTract >* nodesCachePointer )
+                                 const meanTractStore* const meanTractsPointer,
+                                 concurrentCache< sparseTract >* leavesCachePointer,
+                                 concurrentCache< compactTract >* nodesCachePointer )
 {
     if( nodeID.first )
     {
-        return loadNodeTract( nodeID.second, nodeMngrPointer, nodesCachePointer );
+        return loadNodeTract( nodeID.second, meanTractsPointer, nodesCachePointer );
     }
     else
     {
@@ -57,14 +57,20 @@
 // hClustering
 #include "compactTract.h"
 #include "compactTractChar.h"
+#include "sparseTract.h"
 #include "WHcoord.h"
 #include "roiLoader.h"
 #include "WHtree.h"
 #include "protoNode.h"
-#include "listedCache.hpp"
+#include "nodeHeap.h"
+#include "concurrentCache.hpp"
+#include "meanTractStore.h"
 #include "fileManagerFactory.h"
 
 #define DEBUG false
+#define LEAF_STREAM_DEPTH 2 // planes prefetched ahead of each worker when scanning the seed neighbourhoods
+
+class leafTractStream;
 
 /**
  * defines the type of homogeneous merging restriction applied to the initial phase of the algorithm
@@ -76,6 +82,20 @@ typedef enum
     TC_GROWSIZE
 } TC_GROWTYPE;
 
+/**
+ * holds a merge of the centroid algorithm computed ahead of its turn in batched merging mode: the mean tractogram of the new node and its distances to its neighbours
+ */
+struct speculativeMerge
+{
+    nodeID_t        node1;      //!< full ID of the element that will be at the top of the priority heap when the merge is due
+    nodeID_t        node2;      //!< full ID of the nearest neighbour of node1, the element it will be merged with
+    dist_t          dist;       //!< merging distance
+    compactTract    meanTract;  //!< mean tractogram of the new node in natural units
+    compactTract    logTract;   //!< mean tractogram of the new node in logarithmic units, thresholded and with computed norm
+    double          norm;       //!< norm of the logarithmic units mean tractogram
+    nbTable         nbNodes;    //!< neighbourhood of the new node, with the distances to each neighbour
+};
+
 
 /**
  * this class implements the main functionalities required for building and saving a centroid-neighborhood hierarchcial tree from tractography data:
@@ -119,10 +139,23 @@ public:
 
     /**
      * sets the temporal folder to store mean tracts during tree building
-     * \param tempFolder folder where to temporally write down mean tracts during tree building
+     * \param tempFolder folder where to temporally write down mean tracts during tree building (those that do not fit in the mean tract memory)
      */
     inline void setTempFolder( const std::string& tempFolder ) { m_tempFolder = tempFolder; }
 
+    /**
+     * sets the amount of RAM memory used to hold the natural-unit mean tracts during tree building, tracts exceeding it are spilled to the temporal folder
+     * \param memory memory in GBs
+     */
+    inline void setMeanTractMemory( const float memory ) { m_meanMemory = memory; }
+
+    /**
+     * sets the batched merging mode: at each step up to batchSize consecutive merges from the top of the priority heap that do not involve each other's neighbourhoods are computed in parallel,
+     * merges are then applied in priority order and those no longer due after applying the previous ones are discarded, so the tree is the same as when merging one pair at a time
+     * \param batchSize maximum number of merges computed together, 0 or 1 merges one pair at a time (default)
+     */
+    inline void setMergeBatch( const size_t batchSize ) { m_mergeBatch = batchSize; }
+
     /**
      * sets (or resets) the debug output flag in order to write additional result files with detailed information meant for debug purposes
      * \param debug the true/false flag to set the m_debug member to
@@ -162,6 +195,8 @@ public:
                         const size_t baseSize = 0, const bool keepDiscarded = true );
 
 
+    friend class leafTractStream;
+
 private:
     // === PRIVATE DATA MEMBERS ===
 
@@ -171,6 +206,8 @@ private:
     std::string     m_inputFolder;       //!< The folder path that contains the seed voxel tractograms
     std::string     m_outputFolder;      //!< The folder path where to write the output files
     std::string     m_tempFolder;        //!< The folder path where to temporarily store the mean tractograms during the tree building process
+    float           m_meanMemory;        //!< The amount of RAM memory in GBs to hold the mean tractograms during the tree building process before spilling them to the temporal folder
+    size_t          m_mergeBatch;        //!< The maximum number of merges computed together in batched merging mode (0 or 1: one merge at a time)
     std::ofstream*  m_logfile;           //!< A pointer to the output log file stream
 
     WHtree          m_tree;              //!< The class that will hold the built tree
@@ -187,12 +224,16 @@ private:
     std::vector<size_t> m_trackids;      //!< Stores the ids of the seed tracts correesponding to each leaf
     std::vector< double >   m_leafNorms; //!< A vector storing the comoputed norms for each seed voxel tractograms
     std::vector< double >   m_nodeNorms; //!< A vector storing the computed norms for the mean tractograms (corresponding to tree nodes)
+    float                   m_leafTractMb; //!< The mean size in MB of a thresholded seed voxel tractogram in sparse form (as stored in the leaf cache)
 
              size_t m_numComps;          //!< A variable to store the total number of tractogram dissimilarity comparisons done while building the tree, for post-analysis and optimizing purposes
     volatile size_t m_ncHits;            //!< A variable to store the total number of successful node tractogram hits in the cache list, for post-analysis and optimizing purposes
     volatile size_t m_ncMiss;            //!< A variable to store the total number of misses when searching for node tractogram in the cache list, for post-analysis and optimizing purposes
     volatile size_t m_lcHits;            //!< A variable to store the total number of successful leaf tractogram hits in the cache list, for post-analysis and optimizing purposes
     volatile size_t m_lcMiss;            //!< A variable to store the total number of misses when searching for leaf tractogram in the cache list, for post-analysis and optimizing purposes
+             size_t m_batchHits;         //!< A variable to store the number of merges applied from a precomputed batch, for post-analysis and optimizing purposes
+             size_t m_batchMiss;         //!< A variable to store the number of precomputed batch merges discarded because they were no longer due, for post-analysis and optimizing purposes
+    volatile size_t m_normMismatches;    //!< A variable to store the number of rebuilt node tractograms whose norm differs from the merged one (only counted in DEBUG builds)
 
 
     // === PRIVATE MEMBER FUNCTIONS ===
@@ -217,75 +258,98 @@ private:
     WHnode* fetchNode( const nodeID_t& thisNode, std::vector< WHnode >* leavesPointer, std::vector< WHnode >* nodesPointer ) const;
 
     /**
-     * Computes the norms of all the seed voxel tractograms and stores them in the m_leafNorms vector
+     * Selects the merges to be computed together in batched merging mode: the consecutive elements at the top of the priority heap (each to be merged with its nearest neighbour)
+     * up to the first one whose merge involves an element merged before it in the batch or one of their neighbours, as its result would depend on those merges
+     * \param priorityNodes the priority heap of the elements to be merged
+     * \param protoLeavesPointer a pointer to the vector containing the proto-leaves
+     * \param protoNodesPointer a pointer to the vector containing the proto-nodes
+     * \param batchPointer a pointer to the vector where the selected merges will be stored (only their IDs and distance are set)
+     * \return the number of merges selected
+     */
+    size_t selectMergeBatch( const nodeHeap& priorityNodes, std::vector< protoNode >* protoLeavesPointer, std::vector< protoNode >* protoNodesPointer,
+                             std::vector< speculativeMerge >* batchPointer ) const;
+
+    /**
+     * Computes the norms of all the seed voxel tractograms and stores them in the m_leafNorms vector, also computes the mean leaf tract size m_leafTractMb
      */
     void computeNorms();
 
     /**
      * Finds out the neighbroghood relationships between seed voxels and calculates the tractogram dissimilarity between all neighbors, data is saved into the protoLeaves vector
      * Seed voxel tracts with dissimilarity to its most similar neighbor greater than m_maxNbDist are discarded
+     * Distances are computed in parallel over z-slabs of the roi, each neighbor pair only once and each tract read only once (see scanPlane())
      * \param nbLevel the neighborhood level to be considered
-     * \param cacheSize the maximum number of leaf tracts that can be saved into RAM cache
+     * \param cacheBytes the maximum number of bytes of leaf tracts that can be held into RAM at once by the slab windows of all the workers
      * \param protoLeavesPointer a pointer to the vector of proto-leaves where the neghborhood information and distance to neighbors will be stored
      * \return a list containing the coordinates of the voxels that were discarded during the initialization process
      */
-    std::list< WHcoord > initialize( const unsigned int nbLevel, const size_t cacheSize, std::vector< protoNode >* protoLeavesPointer );
+    std::list< WHcoord > initialize( const unsigned int nbLevel, const size_t cacheBytes, std::vector< protoNode >* protoLeavesPointer );
+
+    /**
+     * Calculates the distance values between the seed voxels in the next plane of a worker and the neighbors they own the distance to
+     * (neighbors in upper planes, or in the same plane with a higher ID), the tracts are taken from the leaf tract stream
+     * \param worker the worker index
+     * \param streamPointer a pointer to the leaf tract stream providing the tracts of each plane
+     * \param planeSeeds the IDs of the seed voxels in each plane
+     * \param nbIDs the sorted IDs of the neighbors of each seed voxel
+     * \param nbDistsPointer a pointer to the distances to the neighbors of each seed voxel, in the order of nbIDs, where the computed values will be written (from both ends of each pair)
+     * \return the number of distances computed
+     */
+    size_t scanPlane( const size_t worker, leafTractStream* streamPointer, const std::vector< std::vector< size_t > >& planeSeeds,
+                      const std::vector< std::vector< size_t > >& nbIDs, std::vector< std::vector< dist_t > >* nbDistsPointer );
+
+    /**
+     * returns true if the distance between a seed voxel and its neighbor is computed when scanning the plane of the seed voxel:
+     * if the neighbor is in an upper plane or in the same plane with a higher ID
+     * \param seedID the ID of the seed voxel
+     * \param nbID the ID of the neighbor
+     * \return the ownership flag
+     */
+    inline bool ownsPair( const size_t seedID, const size_t nbID ) const
+    {
+        return ( m_roi[nbID].m_z > m_roi[seedID].m_z ) || ( m_roi[nbID].m_z == m_roi[seedID].m_z && nbID > seedID );
+    }
 
     /**
-     * Calculates the distance values between a given seed voxel tract and its seed voxel neighbors
-     * \param currentSeedID the ID of the leaf we want to compute the neighbor distances of
-     * \param currentTract the tractogram information corresponding to that seed voxel
-     * \param protoLeaves the vector of proto-leaves where the neghborhood information and distance to neighbors is stored
-     * \param nbIDs a vector with the IDs of the neighbors to the current seed voxel
-     * \param nbLeavesPointer a pointer to a map structure where the distance to the neghbors will be stored with the neighbor ID as key
-     * \param cachePointer a pointer to the cache holding the data of previously loaded tractograms
-     * \return a bit indicating if the seed voxel is to be discarded due to the high dissimilarity to its neighbors (true) or accepted as valid (false)
+     * Loads a leaf tractogram from file, thresholds its values, converts it to sparse form and adds the pre-computed norm value
+     * \param leafID the ID of the the corresponding leaf
+     * \param tractPointer a pointer to the tract object where the data will be stored
      */
-    bool scanNbs( const size_t currentSeedID, const compactTractChar* const currentTractPointer, const std::vector< protoNode >& protoLeaves,
-                  const std::vector< size_t >& nbIDs, std::map< size_t, dist_t >* nbLeavesPointer, listedCache< compactTractChar >* cachePointer );
+    void readSparseLeaf( const size_t leafID, sparseTract* tractPointer ) const;
 
     /**
      * Fetches a node tractogram from cache if present. Otherwise, loads the tractogram from file into a tractogram class,
      * applies log transform, thresholds its values, adds the pre-computed norm value to the class and stores it in cache
      * \param nodeID the ID of the the corresponding node
-     * \param nodeMngrPointer a pointer to the file manager that handles reading node tracts from file
+     * \param meanTractsPointer a pointer to the store holding the natural-unit node mean tracts
      * \param nodesCachePointer a pointer to the node tractogram cache
-     * \return a pointer to the compactTract object stored in chache with the loaded tractogram data
+     * \return a pointer to the compactTract object stored in chache with the loaded tractogram data, the entry is pinned and must be unpinned when no longer used
      */
-    compactTract* loadNodeTract( const size_t nodeID, const fileManager* const nodeMngrPointer,
-                                 listedCache< compactTract >* nodesCachePointer );
+    compactTract* loadNodeTract( const size_t nodeID, const meanTractStore* const meanTractsPointer,
+                                 concurrentCache< compactTract >* nodesCachePointer );
 
     /**
      * Fetches a leaf tractogram from cache if present. Otherwise, loads the tractogram from file into a tractogram class,
-     * thresholds its values, adds the pre-computed norm value to the class and stores it in cache
+     * thresholds its values, converts it to sparse form, adds the pre-computed norm value to the class and stores it in cache
      * \param leafID the ID of the the corresponding leaf
      * \param leafMngrPointer a pointer to the file manager that handles reading leaf leaf tracts from file
      * \param leavesCachePointer a pointer to the leaf tractogram cache
-     * \return a pointer to the compactTractChar object stored in chache with the loaded tractogram data
+     * \return a pointer to the sparseTract object stored in chache with the loaded tractogram data, the entry is pinned and must be unpinned when no longer used
      */
-    compactTractChar* loadLeafTract( const size_t leafID, const fileManager* const leafMngrPointer,
-                                     listedCache< compactTractChar >* leavesCachePointer );
+    sparseTract* loadLeafTract( const size_t leafID, const fileManager* const leafMngrPointer,
+                                concurrentCache< sparseTract >* leavesCachePointer );
 
     /**
      * Fetches a leaf or node tractogram from cache or file calling to either loadNodeTract or loadLeafTract members
      * \param nodeID the full-ID of the the corresponding leaf or node
      * \param leafMngrPointer a pointer to the file manager that handles reading leaf leaf tracts from file
-     * \param nodeMngrPointer a pointer to the file manager that handles reading node tracts from file
+     * \param meanTractsPointer a pointer to the store holding the natural-unit node mean tracts
      * \param leavesCachePointer a pointer to the leaf tractogram cache
      * \param nodesCachePointer a pointer to the node tractogram cache
-     * \return a pointer to void with the address of the compactTractChar or compactTractChar object stored in chache with the loaded tractogram data
-     */
-    void* loadTract( const nodeID_t nodeID, const fileManager* const leafMngrPointer, const fileManager* const nodeMngrPointer,
-                     listedCache< compactTractChar >* leavesCachePointer, listedCache< compactTract >* nodesCachePointer );
-
-
-    /**
-     * Deletes a tract file that was temporarily stored in the hard disk
-     * \param nodeID ID of the node corresponding to the tract that is to be deleted
-     * \param fileMngrPointer a pointer to the output node tractogram file manager
-     * \param threadcounterPointer a pointer to the volatile variable keeping track of the number of active boost threads writing to disk
+     * \return a pointer to void with the address of the sparseTract or compactTract object stored in chache with the loaded tractogram data (pinned)
      */
-    void deleteTract( const size_t& nodeID, const fileManager* const fileMngrPointer, volatile size_t* threadcounterPointer ) const;
+    void* loadTract( const nodeID_t nodeID, const fileManager* const leafMngrPointer, const meanTractStore* const meanTractsPointer,
+                     concurrentCache< sparseTract >* leavesCachePointer, concurrentCache< compactTract >* nodesCachePointer );
 
 
     /**
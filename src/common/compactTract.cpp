@@ -34,6 +34,7 @@
 #include <vector>
 
 #include "compactTract.h"
+#include "tractKernels.h"
 
 compactTract::compactTract() :
     m_norm( 0 ), m_thresholded( false ), m_normReady( false ), m_inLogUnits( true ) {}
@@ -82,6 +83,61 @@ compactTract::compactTract( const compactTract &tract1, const compactTract &trac
 }
 
 
+double compactTract::joinTracts( const compactTract &tract1, const compactTract &tract2, const size_t size1, const size_t size2,
+                               const float logFactor, const float threshold, compactTract* logTract )
+{
+    if( tract1.m_tract.size() != tract2.m_tract.size() )
+    {
+        throw std::runtime_error( "ERROR @ compactTract::joinTracts(): Tractograms are not of the same size" );
+    }
+    else if( ( tract1.m_thresholded ) || ( tract2.m_thresholded ) )
+    {
+        throw std::runtime_error( "ERROR @ compactTract::joinTracts(): one (or both) of the tracts has been thresholded" );
+    }
+
+    const size_t tractSize( tract1.m_tract.size() );
+    m_tract.resize( tractSize );
+    logTract->m_tract.resize( tractSize );
+    double squareSum( 0 );
+    if( tractSize != 0 )
+    {
+        const float totalSize( size1 + size2 );
+        squareSum = tract_kernels::mergeMeans( &tract1.m_tract.front(), tract1.m_inLogUnits, &tract2.m_tract.front(), tract2.m_inLogUnits,
+                                               size1 / totalSize, size2 / totalSize, logFactor, threshold,
+                                               &m_tract.front(), &logTract->m_tract.front(), tractSize );
+    }
+    m_norm = 0;
+    m_thresholded = false;
+    m_normReady = false;
+    m_inLogUnits = false;
+    logTract->m_thresholded = true;
+    logTract->m_inLogUnits = true;
+    logTract->setNorm( sqrt( squareSum ) );
+    return logTract->m_norm;
+} // end "joinTracts()" -----------------------------------------------------------------
+
+
+double compactTract::logThreshold( const float logFactor, const float threshold )
+{
+    if( m_thresholded || m_inLogUnits )
+    {
+        throw std::runtime_error( "ERROR @ compactTract::logThreshold(): tract is already thresholded or in logarithmic units" );
+    }
+
+    std::vector< float > logValues( m_tract.size() );
+    double squareSum( 0 );
+    if( !m_tract.empty() )
+    {
+        squareSum = tract_kernels::logThreshold( &m_tract.front(), logFactor, threshold, &logValues.front(), m_tract.size() );
+    }
+    m_tract.swap( logValues );
+    m_thresholded = true;
+    m_inLogUnits = true;
+    setNorm( sqrt( squareSum ) );
+    return m_norm;
+} // end "logThreshold()" -----------------------------------------------------------------
+
+
 /*
  This program allows you to calculate the similarity between tractograms.
  Other possible similarity indices would be:
@@ -144,27 +200,7 @@ double compactTract::normDotProduct( const compactTract &tractogram ) const
         // Initialize variables
     double inProd( 0 ), dotprod_sum( 0 );
 
-#if 0
-
-    for( std::vector<float>::const_iterator iter1( this->m_tract.begin() ), iter2( tractogram.m_tract.begin() );
-                    iter1 != this->m_tract.end(); ++iter1, ++iter2 )
-    {
-        dotprod_sum += ( *iter1 )*( *iter2 );
-    }
-
-#else
-
-    const float* piter1, *piter2;
-    piter1 = &m_tract.front();
-    piter2 = &tractogram.m_tract.front();
-    size_t tractSize( m_tract.size() );
-
-    for( size_t i = 0; i < tractSize; ++i )
-    {
-        dotprod_sum += ( *piter1++ ) * ( *piter2++ );
-    }
-
-#endif
+    dotprod_sum = tract_kernels::dotProduct( &m_tract.front(), &tractogram.m_tract.front(), m_tract.size() );
 
     inProd = dotprod_sum / ( this->m_norm * tractogram.m_norm );
 
@@ -223,19 +259,8 @@ double compactTract::normDotProduct( const compactTractChar &charTract ) const
     double inProd( 0 ), dotprod_sum( 0 );
 
 
-
-    const float* piterFloat;
-    const unsigned char* piterChar;
-
-    piterFloat = &m_tract.front();
-    piterChar = &charTract.m_tract.front();
-    size_t tractSize( m_tract.size() );
-
-    for( size_t i = 0; i < tractSize; ++i )
-    {
-        dotprod_sum += ( *piterFloat++ ) * ( *piterChar++ / 255. );
-    }
-
+    // char data is rescaled to [0,1] after the sum, as it is a constant factor
+    dotprod_sum = tract_kernels::dotProduct( &m_tract.front(), &charTract.m_tract.front(), m_tract.size() ) / 255.;
 
     inProd = dotprod_sum / ( this->m_norm * charTract.m_norm / 255. );
 
@@ -274,9 +299,10 @@ double compactTract::computeNorm()
     else
     {
         m_norm = 0;
-        for( std::vector< float >::const_iterator iter = m_tract.begin(); iter != m_tract.end(); ++iter )
-            m_norm += ( *iter ) * ( *iter );
-
+        if( !m_tract.empty() )
+        {
+            m_norm = tract_kernels::dotProduct( &m_tract.front(), &m_tract.front(), m_tract.size() );
+        }
         m_norm = sqrt( m_norm );
         m_normReady = true;
         return m_norm;
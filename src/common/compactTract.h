@@ -187,6 +187,32 @@ public:
      */
     void doLog( float logFactor );
 
+    /**
+     * computes the mean tractogram resulting from a merging of two clusters/nodes (as the merging constructor does) and, in the same pass,
+     * its log-transformed and thresholded form and its norm (as doLog(), threshold() and computeNorm() would do). Uses the fused merge kernel
+     * with fast log10/10^x approximations (relative error below 4e-7)
+     * \param tract1 tractogram object from the first node being merged, unthresholded, in natural or logarithmic units
+     * \param tract2 tractogram object from the second node being merged, unthresholded, in natural or logarithmic units
+     * \param size1 cluster size the first node being merged
+     * \param size2 cluster size the second node being merged
+     * \param logFactor normalization-related parameter to properly switch between logarithmic and natural units
+     * \param threshold threshold value for the logarithmic units tractogram
+     * \param logTract pointer to the tractogram object that will receive the logarithmic units, thresholded mean (with its norm), this object receives the natural units mean
+     * \return the norm of the logarithmic units, thresholded mean
+     */
+    double joinTracts( const compactTract &tract1, const compactTract &tract2, const size_t size1, const size_t size2,
+                     const float logFactor, const float threshold, compactTract* logTract );
+
+    /**
+     * transforms the natural units, unthresholded tractogram to its log-transformed and thresholded form and computes its norm
+     * (as doLog(), threshold() and computeNorm() would do). Uses the fused merge kernel, so a natural units mean obtained with joinTracts()
+     * gives exactly the same values and norm as the logarithmic units tract joinTracts() returned with it
+     * \param logFactor normalization-related parameter to properly switch between logarithmic and natural units
+     * \param threshold threshold value for the logarithmic units tractogram
+     * \return the norm of the logarithmic units, thresholded tractogram
+     */
+    double logThreshold( const float logFactor, const float threshold );
+
     /**
      * thresholds the tractogram data, if the value of a point is less than the given threshold, it is set to 0
      * \param threshold threshold value
@@ -216,6 +242,8 @@ public:
     friend class vistaManager;
     friend class niftiManager;
     friend class randCnbTreeBuilder;
+    friend class meanTractStore;
+    friend class sparseTract;
 
 
 protected:
@@ -34,6 +34,7 @@
 #include <vector>
 
 #include "compactTractChar.h"
+#include "tractKernels.h"
 
 
 
@@ -96,15 +97,7 @@ double compactTractChar::normDotProduct( const compactTractChar &tractogram ) co
     double inProd( 0 ), dotprod_sum( 0 );
 
 
-    const unsigned char* piter1, *piter2;
-    piter1 = &m_tract.front();
-    piter2 = &tractogram.m_tract.front();
-    size_t tractSize( m_tract.size() );
-
-    for( size_t i = 0; i < tractSize; ++i )
-    {
-        dotprod_sum += ( *piter1++ ) * ( *piter2++ );
-    }
+    dotprod_sum = tract_kernels::dotProduct( &m_tract.front(), &tractogram.m_tract.front(), m_tract.size() );
 
     inProd = dotprod_sum / ( this->m_norm * tractogram.m_norm );
 
@@ -138,11 +131,10 @@ double compactTractChar::computeNorm()
     else
     {
         m_norm = 0;
-        for( std::vector< unsigned char >::const_iterator iter = m_tract.begin(); iter != m_tract.end(); ++iter )
+        if( !m_tract.empty() )
         {
-            m_norm += ( *iter ) * ( *iter );
+            m_norm = tract_kernels::dotProduct( &m_tract.front(), &m_tract.front(), m_tract.size() );
         }
-
         m_norm = sqrt( m_norm );
         m_normReady = true;
         return m_norm;
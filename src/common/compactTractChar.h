@@ -181,6 +181,7 @@ public:
     friend class vistaManager;
     friend class niftiManager;
     friend class compactTract;
+    friend class sparseTract;
 
 
 protected:
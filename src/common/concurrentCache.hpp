@@ -0,0 +1,467 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#ifndef CONCURRENTCACHE_H
+#define CONCURRENTCACHE_H
+
+// std library
+#include <iostream>
+#include <vector>
+#include <limits>
+#include <stdexcept>
+
+// boost library
+#include <boost/thread/mutex.hpp>
+
+#define CACHE_SHARDS 16 // number of independently locked shards the cache entries are distributed into
+
+/**
+ * This class implements a thread-safe cache template for objects identified by an index (usually an ID number), with a memory budget given
+ * as a maximum number of entries and, optionally, a maximum number of bytes [as reported by T::bytes()].
+ * Entries are distributed by index into independently locked shards, so concurrent threads only contend when working on the same shard,
+ * and only for the few instructions a lookup takes. Each shard keeps its entries in a CLOCK ring: an access sets the entry reference bit, and
+ * when the cache is cleaned up the clock hand evicts the first entry found without it (clearing the bits it passes), an approximation
+ * of least-recently-used replacement that needs no reordering on access.
+ * Entries may be pinned while a thread works on them, pinned entries are never evicted by cleanup(), so the pointers handed out stay valid
+ * until the entry is unpinned. Pointers to unpinned entries stay valid until the entry is erased or a cleanup() is called.
+ */
+template< typename T > class concurrentCache
+{
+    struct entry
+    {
+        T           value;      //!< the cached object
+        size_t      bytes;      //!< memory footprint of the object when inserted
+        size_t      slot;       //!< position of the entry in the clock ring of its shard
+        size_t      pins;       //!< number of pins currently held on the entry
+        bool        referenced; //!< clock reference bit, set on access and cleared by the clock hand
+    };
+
+    struct shard
+    {
+        boost::mutex            mutex; //!< lock protecting the shard ring and the tracker entries of its indices
+        std::vector< size_t >   ring;  //!< indices of the entries stored in the shard, in clock order
+        size_t                  hand;  //!< current position of the clock hand in the ring
+    };
+
+public:
+    /**
+     * Constructor
+     * \param listSize total number of different entries that may at some point be introduced in the cache (as in number of different possible IDs)
+     * \param sizeLimitInit maximum size (as in maximum number of entries) that the cache is allowed to have
+     */
+    concurrentCache( const size_t listSize, const size_t sizeLimitInit = 0 ) :
+        m_sizeLimit( sizeLimitInit ), m_byteLimit( std::numeric_limits< size_t >::max() ), m_size( 0 ), m_bytes( 0 ), m_sweepShard( 0 ), m_tracker( listSize, NULL )
+    {
+        for( size_t i = 0; i < CACHE_SHARDS; ++i )
+        {
+            m_shards[i].hand = 0;
+        }
+    }
+
+    //! Destructor
+    ~concurrentCache() { clear(); }
+
+    // === IN-LINE MEMBER FUNCTIONS ===
+
+    /**
+     * sets the maximum number of objects to be stored in cache [after a call to cleanup()]
+     * \param sizeLimit new max cache size, if 0 the cache will be emptied on cleanup
+     */
+    inline void setLimit( size_t sizeLimit ) { m_sizeLimit = sizeLimit; }
+
+    /**
+     * returns the maximum number of objects to be stored in cache [after a call to cleanup()]
+     * \return max cache size
+     */
+    inline size_t limit() const { return m_sizeLimit; }
+
+    /**
+     * sets the maximum number of bytes to be held in cache [after a call to cleanup()]
+     * \param byteLimit new memory budget in bytes, if 0 the cache will be emptied on cleanup (by default there is no byte limit)
+     */
+    inline void setByteLimit( size_t byteLimit ) { m_byteLimit = byteLimit; }
+
+    /**
+     * returns the maximum number of bytes to be held in cache [after a call to cleanup()]
+     * \return memory budget in bytes
+     */
+    inline size_t byteLimit() const { return m_byteLimit; }
+
+    /**
+     * returns number of elements currently stored in cache (can be temporarily greater than the size limit)
+     * \return current cache size
+     */
+    inline size_t size() const { return m_size; }
+
+    /**
+     * returns the number of bytes currently held in cache (can be temporarily greater than the byte limit)
+     * \return current cache memory in bytes
+     */
+    inline size_t bytes() const { return m_bytes; }
+
+
+    // === PUBLIC MEMBER FUNCTIONS ===
+
+    /**
+     * checks whether a specific element is contained in the cache
+     * \param index an index identifying the desired entry (usually an ID number)
+     * \return true if the element is stored in the cache, false otherwise
+     */
+    bool has( const size_t index )
+    {
+        shard& thisShard( getShard( index ) );
+        boost::mutex::scoped_lock lock( thisShard.mutex );
+        return ( m_tracker[index] != NULL );
+    }
+
+    /**
+     * fetches the object identified by the index parameter and marks it as recently used
+     * \param index an index identifying the desired entry (usually an ID number)
+     * \return a pointer to the element associated with index, NULL if it is not in the cache
+     */
+    T* get( const size_t index )
+    {
+        shard& thisShard( getShard( index ) );
+        boost::mutex::scoped_lock lock( thisShard.mutex );
+        entry* thisEntry( m_tracker[index] );
+        if( thisEntry == NULL )
+        {
+            return NULL;
+        }
+        thisEntry->referenced = true;
+        return &( thisEntry->value );
+    }
+
+    /**
+     * fetches the object identified by the index parameter but does not update its usage status
+     * \param index an index identifying the desired entry (usually an ID number)
+     * \return a pointer to the element associated with index, NULL if it is not in the cache
+     */
+    T* getNoUpdate( const size_t index )
+    {
+        shard& thisShard( getShard( index ) );
+        boost::mutex::scoped_lock lock( thisShard.mutex );
+        entry* thisEntry( m_tracker[index] );
+        return ( thisEntry == NULL ? NULL : &( thisEntry->value ) );
+    }
+
+    /**
+     * fetches the object identified by the index parameter, marks it as recently used and pins it so that it will not be evicted until unpin() is called
+     * \param index an index identifying the desired entry (usually an ID number)
+     * \return a pointer to the element associated with index, NULL if it is not in the cache (in which case no pin is taken)
+     */
+    T* pin( const size_t index )
+    {
+        shard& thisShard( getShard( index ) );
+        boost::mutex::scoped_lock lock( thisShard.mutex );
+        entry* thisEntry( m_tracker[index] );
+        if( thisEntry == NULL )
+        {
+            return NULL;
+        }
+        ++( thisEntry->pins );
+        thisEntry->referenced = true;
+        return &( thisEntry->value );
+    }
+
+    /**
+     * releases a pin previously taken with pin() or insert()
+     * \param index an index identifying the pinned entry (usually an ID number)
+     */
+    void unpin( const size_t index )
+    {
+        shard& thisShard( getShard( index ) );
+        boost::mutex::scoped_lock lock( thisShard.mutex );
+        entry* thisEntry( m_tracker[index] );
+        if( thisEntry != NULL && thisEntry->pins > 0 )
+        {
+            --( thisEntry->pins );
+        }
+    }
+
+    /**
+     * inserts a copy of an object and returns a pointer to the stored value
+     * \param index an index identifying the new entry (usually an ID number)
+     * \param value the data of the new entry
+     * \return a pointer to the element inside the cache, if an element with that index was already present (i.e. inserted concurrently by another thread) the existing element is kept and returned
+     */
+    T* insert( const size_t index, const T& value )
+    {
+        entry* newEntry( new entry );
+        newEntry->value = value;
+        return addEntry( index, newEntry, false );
+    }
+
+    /**
+     * inserts a new object taking over the data of the given one [as T::steal() does] and returns a pointer to the stored value, avoiding a copy of the data
+     * \param index an index identifying the new entry (usually an ID number)
+     * \param stolen pointer to the object with the data to be inserted, if the insertion takes place it is left empty
+     * \param pinEntry if true the returned element is pinned and will not be evicted until unpin() is called
+     * \return a pointer to the element inside the cache, if an element with that index was already present (i.e. inserted concurrently by another thread) the existing element is kept and returned
+     */
+    T* insert( const size_t index, T* const stolen, const bool pinEntry = false )
+    {
+        entry* newEntry( new entry );
+        newEntry->value.steal( stolen );
+        return addEntry( index, newEntry, pinEntry );
+    }
+
+    /**
+     * removes the element entry associated with index, moving its data into the given object [as T::steal() does]
+     * \param index an index identifying the desired entry (usually an ID number)
+     * \param output pointer to the object that will receive the element data
+     * \return true if the element was in the cache and has been taken, false otherwise
+     */
+    bool take( const size_t index, T* const output )
+    {
+        shard& thisShard( getShard( index ) );
+        boost::mutex::scoped_lock lock( thisShard.mutex );
+        entry* thisEntry( m_tracker[index] );
+        if( thisEntry == NULL )
+        {
+            return false;
+        }
+        output->steal( &( thisEntry->value ) );
+        removeEntry( &thisShard, index );
+        return true;
+    }
+
+    /**
+     * erases the element entry associated with index (regardless of any pins held on it)
+     * \param index an index identifying the entry to be deleted (usually an ID number)
+     */
+    void erase( const size_t index )
+    {
+        if( index >= m_tracker.size() )
+            throw std::runtime_error( "ERROR @ concurrentCache::erase(): index is out of bounds" );
+        shard& thisShard( getShard( index ) );
+        boost::mutex::scoped_lock lock( thisShard.mutex );
+        if( m_tracker[index] != NULL )
+        {
+            removeEntry( &thisShard, index );
+        }
+        return;
+    }
+
+    /**
+     * if the cache is over the specified entry or byte limits, iteratively evicts unpinned elements that have not been accessed recently
+     * (sweeping the shards in turn) until the limits are met or only pinned elements are left. With a zero limit all unpinned elements are evicted
+     */
+    void cleanup()
+    {
+        if( ( m_sizeLimit == 0 || m_byteLimit == 0 ) && m_size > 0 )
+        {
+            for( size_t i = 0; i < CACHE_SHARDS; ++i )
+            {
+                boost::mutex::scoped_lock lock( m_shards[i].mutex );
+                std::vector< size_t >& ring( m_shards[i].ring );
+                // walk the ring backwards, so that the entries moved into freed slots have already been checked
+                for( size_t slot = ring.size(); slot-- > 0; )
+                {
+                    if( m_tracker[ring[slot]]->pins == 0 )
+                    {
+                        removeEntry( &( m_shards[i] ), ring[slot] );
+                    }
+                }
+                m_shards[i].hand = 0;
+            }
+            return;
+        }
+        boost::mutex::scoped_lock sweepLock( m_sweepMutex );
+        size_t failedShards( 0 );
+        while( ( m_size > m_sizeLimit || m_bytes > m_byteLimit ) && failedShards < CACHE_SHARDS )
+        {
+            shard& thisShard( m_shards[m_sweepShard] );
+            m_sweepShard = ( m_sweepShard + 1 ) % CACHE_SHARDS;
+            boost::mutex::scoped_lock lock( thisShard.mutex );
+            if( evictOne( &thisShard ) )
+            {
+                failedShards = 0;
+            }
+            else
+            {
+                ++failedShards;
+            }
+        }
+        return;
+    }
+
+    /**
+     * erases all the elements in the cache (regardless of any pins held on them)
+     */
+    void clear()
+    {
+        for( size_t i = 0; i < CACHE_SHARDS; ++i )
+        {
+            boost::mutex::scoped_lock lock( m_shards[i].mutex );
+            while( !m_shards[i].ring.empty() )
+            {
+                removeEntry( &( m_shards[i] ), m_shards[i].ring.back() );
+            }
+            std::vector< size_t > emptyRing;
+            m_shards[i].ring.swap( emptyRing );
+            m_shards[i].hand = 0;
+        }
+        return;
+    }
+
+    /**
+     * erases all the elements and frees the memory of the tracker vector, this cache object may not be used any more
+     */
+    void shutdown()
+    {
+        clear();
+        {
+            std::vector< entry* > emptytracker;
+            m_tracker.swap( emptytracker );
+        }
+        return;
+    }
+
+
+private:
+    // === PRIVATE MEMBER FUNCTIONS ===
+
+    /**
+     * returns the shard an index belongs to, checking the index bounds
+     * \param index an index identifying an entry (usually an ID number)
+     * \return a reference to the shard holding that entry
+     */
+    shard& getShard( const size_t index )
+    {
+        if( index >= m_tracker.size() )
+            throw std::runtime_error( "ERROR @ concurrentCache::getShard(): index is out of bounds" );
+        return m_shards[index % CACHE_SHARDS];
+    }
+
+    /**
+     * adds a new entry to the cache, or deletes it if an entry with the same index is already stored
+     * \param index an index identifying the new entry (usually an ID number)
+     * \param newEntry the entry to add, with its value already set
+     * \param pinEntry if true the returned element is pinned
+     * \return a pointer to the element stored in the cache
+     */
+    T* addEntry( const size_t index, entry* newEntry, const bool pinEntry )
+    {
+        newEntry->bytes = newEntry->value.bytes();
+        newEntry->pins = ( pinEntry ? 1 : 0 );
+        newEntry->referenced = true;
+
+        shard& thisShard( getShard( index ) );
+        boost::mutex::scoped_lock lock( thisShard.mutex );
+        entry* oldEntry( m_tracker[index] );
+        if( oldEntry != NULL )
+        {
+            delete newEntry;
+            if( pinEntry )
+            {
+                ++( oldEntry->pins );
+            }
+            oldEntry->referenced = true;
+            return &( oldEntry->value );
+        }
+        newEntry->slot = thisShard.ring.size();
+        thisShard.ring.push_back( index );
+        m_tracker[index] = newEntry;
+#pragma omp atomic
+        ++m_size;
+#pragma omp atomic
+        m_bytes += newEntry->bytes;
+        return &( newEntry->value );
+    }
+
+    /**
+     * removes an entry from its shard and deletes it, the shard lock must be held by the caller
+     * \param thisShard pointer to the shard holding the entry
+     * \param index an index identifying the entry (usually an ID number)
+     */
+    void removeEntry( shard* thisShard, const size_t index )
+    {
+        entry* thisEntry( m_tracker[index] );
+        // move the last entry in the ring into the freed slot
+        const size_t lastIndex( thisShard->ring.back() );
+        thisShard->ring[thisEntry->slot] = lastIndex;
+        m_tracker[lastIndex]->slot = thisEntry->slot;
+        thisShard->ring.pop_back();
+        m_tracker[index] = NULL;
+#pragma omp atomic
+        --m_size;
+#pragma omp atomic
+        m_bytes -= thisEntry->bytes;
+        delete thisEntry;
+        return;
+    }
+
+    /**
+     * advances the clock hand of a shard until an unpinned element with no reference bit is found and evicts it, the shard lock must be held by the caller
+     * \param thisShard pointer to the shard to evict from
+     * \return true if an element was evicted, false if the shard is empty or all its elements are pinned
+     */
+    bool evictOne( shard* thisShard )
+    {
+        std::vector< size_t >& ring( thisShard->ring );
+        // two full turns are enough to clear every reference bit and then find an unpinned entry
+        for( size_t steps = 0; steps < 2 * ring.size(); ++steps )
+        {
+            if( thisShard->hand >= ring.size() )
+            {
+                thisShard->hand = 0;
+            }
+            entry* thisEntry( m_tracker[ring[thisShard->hand]] );
+            if( thisEntry->pins == 0 )
+            {
+                if( !thisEntry->referenced )
+                {
+                    removeEntry( thisShard, ring[thisShard->hand] );
+                    return true;
+                }
+                thisEntry->referenced = false;
+            }
+            ++( thisShard->hand );
+        }
+        return false;
+    }
+
+    // === PRIVATE DATA MEMBERS ===
+
+    size_t                  m_sizeLimit;    //!< max cache size (in number of entries)
+    size_t                  m_byteLimit;    //!< max cache memory in bytes
+    volatile size_t         m_size;         //!< current number of entries
+    volatile size_t         m_bytes;        //!< current memory held by the entries in bytes
+    size_t                  m_sweepShard;   //!< shard where the next cleanup() eviction attempt will start
+    boost::mutex            m_sweepMutex;   //!< lock serializing concurrent cleanup() calls
+    shard                   m_shards[CACHE_SHARDS]; //!< the cache shards, each guarded by its own lock
+    std::vector< entry* >   m_tracker;      //!< lookup vector storing for each ID a pointer to its entry (NULL if not in the cache)
+};
+
+#endif // CONCURRENTCACHE_H
@@ -35,8 +35,18 @@
 // std library
 #include <vector>
 #include <utility>
-#include <map>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
 #include <string>
+#include <sstream>
+
+// posix
+#include <unistd.h>
+
+// boost library
+#include <boost/bind.hpp>
 
 #include "distBlock.h"
 
@@ -46,57 +56,127 @@ distBlock::distBlock( const std::string& distBlockFolderInit ): m_indexReady( fa
                                                                 m_blockReady( false ),
                                                                 m_maxBlockID( 0 ),
                                                                 m_distBlockFolder( distBlockFolderInit ),
-                                                                m_blockID( std::make_pair( 0, 0 ) )
+                                                                m_gridDimX( 0 ),
+                                                                m_gridDimY( 0 ),
+                                                                m_gridDimZ( 0 ),
+                                                                m_fullBlockSize( 0 ),
+                                                                m_blockID( std::make_pair( 0, 0 ) ),
+                                                                m_lastRequest( std::make_pair( 0, 0 ) ),
+                                                                m_cacheBytes( 0 ),
+                                                                m_cacheUsedBytes( 0 ),
+                                                                m_cacheHits( 0 ),
+                                                                m_cacheMisses( 0 ),
+                                                                m_prefetchedBlocks( 0 ),
+                                                                m_pendingReads( 0 ),
+                                                                m_prefetch( false ),
+                                                                m_prefetchBusy( false ),
+                                                                m_stop( false )
 {
     m_indexReady = readIndex();
 }
 
-bool distBlock::readIndex()
+distBlock::~distBlock()
 {
+    {
+        boost::unique_lock< boost::mutex > lock( m_cacheMutex );
+        m_stop = true;
+    }
+    m_cacheChanged.notify_all();
+    m_prefetchThread.join_all();
+}
 
-    m_fullIndex.clear();
-    m_blockIndex1.clear();
-    m_blockIndex1.clear();
-    m_indexReady = false;
-    m_blockReady = false;
+bool distBlock::readIndex()
+{
+    m_seedCoords.clear();
+    m_seedBlockPos.clear();
+    {
+        // blocks being read keep an empty entry in the cache that their reader will fill: wait for the prefetch thread and any other readers
+        // to finish before the cache is cleared
+        boost::unique_lock< boost::mutex > lock( m_cacheMutex );
+        m_prefetchQueue.clear();
+        while( m_prefetchBusy || m_pendingReads != 0 )
+        {
+            m_cacheChanged.wait( lock );
+        }
+        m_cache.clear();
+        m_lruList.clear();
+        m_cacheUsedBytes = 0;
+        m_block.reset();
+        m_indexReady = false;
+        m_blockReady = false;
+    }
     m_maxBlockID = 0;
 
     std::string indexFilename( getIndexFilename() );
 
-    WFileParser parser( indexFilename );
-    if( !parser.readFile() )
+    // the sidecar is only trusted if it was written from the current text index
+    uint64_t textBytes( 0 );
+    int64_t textTime( 0 );
+    try
     {
-        std::cerr << "ERROR @ distBlock::readIndex(): Parser error" << std::endl;
-        return false;
+        textBytes = boost::filesystem::file_size( indexFilename );
+        textTime = boost::filesystem::last_write_time( indexFilename );
     }
-
-    std::vector< std::string > lines = parser.getRawLines();
-    if( lines.size() == 0 )
+    catch( const boost::filesystem::filesystem_error& e )
     {
-        std::cerr << "ERROR @ distBlock::readIndex(): Index file is empty" << std::endl;
+        std::cerr << "ERROR @ distBlock::readIndex(): index file \"" << indexFilename << "\" is not accessible" << std::endl;
         return false;
     }
 
-    std::vector< std::vector< std::string > > indexStrings = parser.getLinesForTagSeparated( "distindex" );
-    for( size_t i = 0; i < indexStrings.size(); ++i )
+    if( !readBinaryIndex( textBytes, textTime ) )
     {
-        if( indexStrings[i].size() != 7 || indexStrings[i][3] != "b" || indexStrings[i][5] != "i" )
+        if( !readTextIndex() )
         {
-            std::cerr << "ERROR @ distBlock::readIndex(): format of index file is not correct" << std::endl;
             return false;
         }
-        WHcoord tempCoord( boost::lexical_cast< coord_t >( indexStrings[i][0] ), boost::lexical_cast< coord_t >(
-                        indexStrings[i][1] ), boost::lexical_cast< coord_t >( indexStrings[i][2] ) );
-        std::pair< unsigned int, unsigned int > tempPair( boost::lexical_cast< unsigned int >( indexStrings[i][4] ),
-                        boost::lexical_cast< unsigned int >( indexStrings[i][6] ) );
-        m_fullIndex[tempCoord] = tempPair;
-        if( tempPair.first > m_maxBlockID )
-            m_maxBlockID = tempPair.first;
+        writeBinaryIndex( textBytes, textTime );
     }
-
+    buildLookup();
     return true;
 } // end "readIndex()" -----------------------------------------------------------------
 
+size_t distBlock::getMatrixID( const WHcoord& coord ) const
+{
+    size_t matrixID( 0 );
+    if( !findSeed( coord, &matrixID ) )
+    {
+        throw std::runtime_error( "ERROR @ distBlock::getMatrixID(): coordinate " + coord.getNameString() + " is not in the matrix index" );
+    }
+    return matrixID;
+} // end "getMatrixID()" -----------------------------------------------------------------
+
+void distBlock::setCacheSize( size_t cacheBytes )
+{
+    boost::unique_lock< boost::mutex > lock( m_cacheMutex );
+    m_cacheBytes = cacheBytes;
+    evictBlocks( m_blockID );
+    return;
+} // end "setCacheSize()" -----------------------------------------------------------------
+
+void distBlock::setPrefetch( bool prefetch )
+{
+    boost::unique_lock< boost::mutex > lock( m_cacheMutex );
+    m_prefetch = prefetch;
+    if( !m_prefetch )
+    {
+        m_prefetchQueue.clear();
+    }
+    else if( m_prefetchThread.size() == 0 )
+    {
+        m_prefetchThread.create_thread( boost::bind( &distBlock::prefetchLoop, this ) );
+    }
+    return;
+} // end "setPrefetch()" -----------------------------------------------------------------
+
+std::string distBlock::getCacheReport() const
+{
+    boost::unique_lock< boost::mutex > lock( m_cacheMutex );
+    std::stringstream reportStream;
+    reportStream << "Block cache: " << m_cacheHits << " hits, " << m_cacheMisses << " misses, " << m_prefetchedBlocks << " blocks prefetched. ";
+    reportStream << m_cache.size() << " blocks in memory (" << m_cacheUsedBytes / ( 1024 * 1024 ) << " MB, budget " << m_cacheBytes / ( 1024 * 1024 ) << " MB)";
+    return reportStream.str();
+} // end "getCacheReport()" -----------------------------------------------------------------
+
 void distBlock::loadBlock( std::pair< unsigned int, unsigned int > blockID )
 {
     loadBlock( blockID.first, blockID.second );
@@ -123,25 +203,24 @@ void distBlock::loadBlock( unsigned int blockID1, unsigned int blockID2 )
         }
 
         // load distanceblock
-        fileManagerFactory fileMF( m_distBlockFolder );
-        fileManager& fileMngr( fileMF.getFM() );
-        fileMngr.readDistBlock( blockID1, blockID2, &m_block );
-        m_blockID = std::make_pair( blockID1, blockID2 );
-        m_blockIndex1.clear();
-        m_blockIndex2.clear();
-
-        // fill block indices
-        for( std::map< WHcoord, std::pair< unsigned int, unsigned int > >::const_iterator iter( m_fullIndex.begin() ); iter
-                        != m_fullIndex.end(); ++iter )
+        const blockKey_t blockID( blockID1, blockID2 );
         {
-            if( iter->second.first == blockID1 )
-                m_blockIndex1[iter->first] = iter->second.second;
-            if( iter->second.first == blockID2 )
-                m_blockIndex2[iter->first] = iter->second.second;
+            boost::unique_lock< boost::mutex > lock( m_cacheMutex );
+            m_blockReady = false;
         }
+        boost::shared_ptr< const std::vector< std::vector< float > > > block( fetchBlock( blockID, false, false ) );
+        {
+            boost::unique_lock< boost::mutex > lock( m_cacheMutex );
+            m_block = block;
+            m_blockID = blockID;
+
+            //set flags
+            m_blockReady = true;
 
-        //set flags
-        m_blockReady = true;
+            // the previously loaded block may now be evicted
+            evictBlocks( blockID );
+        }
+        queuePrefetch( blockID );
     }
     return;
 } // end "loadblock()" -----------------------------------------------------------------
@@ -153,10 +232,8 @@ void distBlock::loadBlock( const WHcoord& coord1, const WHcoord& coord2 )
     return;
 } // end "loadblock()" -----------------------------------------------------------------
 
-float distBlock::getDistance( const WHcoord& coord1, const WHcoord& coord2 )
+float distBlock::getDistance( const WHcoord& coord1, const WHcoord& coord2 ) const
 {
-    unsigned int index1( 0 ), index2( 0 );
-
     if( !m_indexReady )
     {
         throw std::runtime_error( "ERROR @ distBlock::getDistance(): Index was not previously loaded" );
@@ -167,31 +244,52 @@ float distBlock::getDistance( const WHcoord& coord1, const WHcoord& coord2 )
     }
     else
     {
-        std::map< WHcoord, unsigned int >::iterator findIter( m_blockIndex1.find( coord1 ) );
-        if( findIter == m_blockIndex1.end() )
+        size_t matrixID1( 0 ), matrixID2( 0 ), position1( 0 ), position2( 0 );
+        if( !findSeed( coord1, &matrixID1 ) )
         {
             throw std::runtime_error( "ERROR @ distBlock::getDistance(): first coordinate is out of bounds" );
         }
-        else
-        {
-            index1 = findIter->second;
-        }
-
-        findIter = ( m_blockIndex2.find( coord2 ) );
-        if( findIter == m_blockIndex2.end() )
+        if( !findSeed( coord2, &matrixID2 ) )
         {
             throw std::runtime_error( "ERROR @ distBlock::getDistance(): second coordinate is out of bounds" );
         }
-        else
+        if( !blockPosition( m_blockID, matrixID1, matrixID2, &position1, &position2 ) )
         {
-            index2 = findIter->second;
+            throw std::runtime_error( "ERROR @ distBlock::getDistance(): coordinates are not contained in the loaded block" );
         }
+        return ( *m_block )[position1][position2];
+    }
+} // end "getDistance()" -----------------------------------------------------------------
 
-        return m_block[index1][index2];
+float distBlock::getDistance( size_t matrixID1, size_t matrixID2 )
+{
+    if( !m_indexReady )
+    {
+        throw std::runtime_error( "ERROR @ distBlock::getDistance(): Index was not previously loaded" );
+    }
+    else if( matrixID1 >= m_seedBlockPos.size() || matrixID2 >= m_seedBlockPos.size() )
+    {
+        throw std::runtime_error( "ERROR @ distBlock::getDistance(): matrix ID is out of bounds" );
     }
+    size_t position1( 0 ), position2( 0 );
+    if( m_blockReady && blockPosition( m_blockID, matrixID1, matrixID2, &position1, &position2 ) )
+    {
+        return ( *m_block )[position1][position2];
+    }
+
+    // pair outside the loaded block: use the block cache
+    blockKey_t blockID( m_seedBlockPos[matrixID1].first, m_seedBlockPos[matrixID2].first );
+    if( blockID.first > blockID.second )
+    {
+        std::swap( blockID.first, blockID.second );
+    }
+    boost::shared_ptr< const std::vector< std::vector< float > > > block( fetchBlock( blockID, false, false ) );
+    queuePrefetch( blockID );
+    blockPosition( blockID, matrixID1, matrixID2, &position1, &position2 );
+    return ( *block )[position1][position2];
 } // end "getDistance()" -----------------------------------------------------------------
 
-std::pair< std::pair< WHcoord, WHcoord >, std::pair< WHcoord, WHcoord > > distBlock::getBlockRange()
+std::pair< std::pair< WHcoord, WHcoord >, std::pair< WHcoord, WHcoord > > distBlock::getBlockRange() const
 {
     if( !m_indexReady )
     {
@@ -203,12 +301,7 @@ std::pair< std::pair< WHcoord, WHcoord >, std::pair< WHcoord, WHcoord > > distBl
     }
     else
     {
-        std::pair< std::pair< WHcoord, WHcoord >, std::pair< WHcoord, WHcoord > > outRange;
-        outRange.first.first = ( m_blockIndex1.begin() )->first;
-        outRange.first.second = ( --m_blockIndex1.end() )->first;
-        outRange.second.first = ( m_blockIndex2.begin() )->first;
-        outRange.second.second = ( --m_blockIndex2.end() )->first;
-        return outRange;
+        return std::make_pair( m_blockRanges[m_blockID.first], m_blockRanges[m_blockID.second] );
     }
 } // end "getBlockRange()" -----------------------------------------------------------------
 
@@ -227,7 +320,7 @@ void distBlock::writeBlock()
     {
         fileManagerFactory fileMF( m_distBlockFolder );
         fileManager& fMngr( fileMF.getFM() );
-        fMngr.writeDistBlock( m_blockID, m_block );
+        fMngr.writeDistBlock( m_blockID, *m_block );
     }
     return;
 } // end "writeBlock()" -----------------------------------------------------------------
@@ -235,33 +328,282 @@ void distBlock::writeBlock()
 
 // PRIVATE FUNCTIONS
 
-std::string distBlock::getIndexFilename()
+std::string distBlock::getIndexFilename() const
 {
     std::string indexFilename = m_distBlockFolder + "/" + MATRIX_INDEX_FILENAME;
     return indexFilename;
 } // end "getIndexFilename()" -----------------------------------------------------------------
 
-std::pair< unsigned int, unsigned int > distBlock::whichBlock( const WHcoord& coord1, const WHcoord& coord2 )
+std::string distBlock::getBinaryIndexFilename() const
+{
+    std::string indexFilename = m_distBlockFolder + "/" + DISTBLOCK_BINARY_INDEX_FILENAME;
+    return indexFilename;
+} // end "getBinaryIndexFilename()" -----------------------------------------------------------------
+
+bool distBlock::readTextIndex()
 {
-    unsigned int rowBlockID, colBlockID;
-    std::map< WHcoord, std::pair< unsigned int, unsigned int > >::iterator findIter( m_fullIndex.find( coord1 ) );
-    if( findIter == m_fullIndex.end() )
+    WFileParser parser( getIndexFilename() );
+    if( !parser.readFile() )
     {
-        throw std::runtime_error( "ERROR @ distBlock::whichBlock(): first coordinate is out of bounds" );
+        std::cerr << "ERROR @ distBlock::readIndex(): Parser error" << std::endl;
+        return false;
+    }
+
+    std::vector< std::string > lines = parser.getRawLines();
+    if( lines.size() == 0 )
+    {
+        std::cerr << "ERROR @ distBlock::readIndex(): Index file is empty" << std::endl;
+        return false;
+    }
+
+    std::vector< std::vector< std::string > > indexStrings = parser.getLinesForTagSeparated( "distindex" );
+    m_seedCoords.reserve( indexStrings.size() );
+    m_seedBlockPos.reserve( indexStrings.size() );
+    for( size_t i = 0; i < indexStrings.size(); ++i )
+    {
+        if( indexStrings[i].size() != 7 || indexStrings[i][3] != "b" || indexStrings[i][5] != "i" )
+        {
+            std::cerr << "ERROR @ distBlock::readIndex(): format of index file is not correct" << std::endl;
+            m_seedCoords.clear();
+            m_seedBlockPos.clear();
+            return false;
+        }
+        m_seedCoords.push_back( WHcoord( boost::lexical_cast< coord_t >( indexStrings[i][0] ), boost::lexical_cast< coord_t >(
+                        indexStrings[i][1] ), boost::lexical_cast< coord_t >( indexStrings[i][2] ) ) );
+        m_seedBlockPos.push_back( std::make_pair( boost::lexical_cast< unsigned int >( indexStrings[i][4] ),
+                        boost::lexical_cast< unsigned int >( indexStrings[i][6] ) ) );
+    }
+    return true;
+} // end "readTextIndex()" -----------------------------------------------------------------
+
+bool distBlock::readBinaryIndex( uint64_t textBytes, int64_t textTime )
+{
+    std::ifstream inFile( getBinaryIndexFilename().c_str(), std::ios::in | std::ios::binary );
+    if( !inFile )
+    {
+        return false;
+    }
+
+    char magic[8];
+    uint32_t version( 0 ), maxBlockID( 0 );
+    uint64_t seeds( 0 ), fileTextBytes( 0 );
+    int64_t fileTextTime( 0 );
+    inFile.read( magic, sizeof( magic ) );
+    inFile.read( reinterpret_cast< char* >( &version ), sizeof( version ) );
+    inFile.read( reinterpret_cast< char* >( &maxBlockID ), sizeof( maxBlockID ) );
+    inFile.read( reinterpret_cast< char* >( &seeds ), sizeof( seeds ) );
+    inFile.read( reinterpret_cast< char* >( &fileTextBytes ), sizeof( fileTextBytes ) );
+    inFile.read( reinterpret_cast< char* >( &fileTextTime ), sizeof( fileTextTime ) );
+    if( !inFile || std::memcmp( magic, DISTBLOCK_BINARY_INDEX_MAGIC, sizeof( magic ) ) != 0 || version != DISTBLOCK_BINARY_INDEX_VERSION
+                    || fileTextBytes != textBytes || fileTextTime != textTime || seeds == 0 )
+    {
+        return false;
+    }
+
+    std::vector< float > coordData( seeds * 3 );
+    std::vector< uint32_t > blockPosData( seeds * 2 );
+    inFile.read( reinterpret_cast< char* >( &coordData[0] ), coordData.size() * sizeof( float ) );
+    inFile.read( reinterpret_cast< char* >( &blockPosData[0] ), blockPosData.size() * sizeof( uint32_t ) );
+    if( !inFile )
+    {
+        return false;
+    }
+
+    m_seedCoords.resize( seeds );
+    m_seedBlockPos.resize( seeds );
+    for( size_t i = 0; i < seeds; ++i )
+    {
+        m_seedCoords[i] = WHcoord( coordData[3 * i], coordData[3 * i + 1], coordData[3 * i + 2] );
+        m_seedBlockPos[i] = std::make_pair( blockPosData[2 * i], blockPosData[2 * i + 1] );
+    }
+    return true;
+} // end "readBinaryIndex()" -----------------------------------------------------------------
+
+void distBlock::writeBinaryIndex( uint64_t textBytes, int64_t textTime ) const
+{
+    std::vector< float > coordData( m_seedCoords.size() * 3 );
+    std::vector< uint32_t > blockPosData( m_seedBlockPos.size() * 2 );
+    uint32_t maxBlockID( 0 );
+    for( size_t i = 0; i < m_seedCoords.size(); ++i )
+    {
+        coordData[3 * i] = m_seedCoords[i].m_x;
+        coordData[3 * i + 1] = m_seedCoords[i].m_y;
+        coordData[3 * i + 2] = m_seedCoords[i].m_z;
+        blockPosData[2 * i] = m_seedBlockPos[i].first;
+        blockPosData[2 * i + 1] = m_seedBlockPos[i].second;
+        maxBlockID = std::max( maxBlockID, static_cast< uint32_t >( m_seedBlockPos[i].first ) );
+    }
+
+    // written under a temporary name and then renamed, so that concurrent readers never see a partial sidecar
+    std::string binaryFilename( getBinaryIndexFilename() );
+    std::string tempFilename( binaryFilename + ".tmp" + boost::lexical_cast< std::string >( getpid() ) );
+    {
+        std::ofstream outFile( tempFilename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+        if( !outFile )
+        {
+            return;
+        }
+        uint32_t version( DISTBLOCK_BINARY_INDEX_VERSION );
+        uint64_t seeds( m_seedCoords.size() );
+        outFile.write( DISTBLOCK_BINARY_INDEX_MAGIC, 8 );
+        outFile.write( reinterpret_cast< const char* >( &version ), sizeof( version ) );
+        outFile.write( reinterpret_cast< const char* >( &maxBlockID ), sizeof( maxBlockID ) );
+        outFile.write( reinterpret_cast< const char* >( &seeds ), sizeof( seeds ) );
+        outFile.write( reinterpret_cast< const char* >( &textBytes ), sizeof( textBytes ) );
+        outFile.write( reinterpret_cast< const char* >( &textTime ), sizeof( textTime ) );
+        outFile.write( reinterpret_cast< const char* >( &coordData[0] ), coordData.size() * sizeof( float ) );
+        outFile.write( reinterpret_cast< const char* >( &blockPosData[0] ), blockPosData.size() * sizeof( uint32_t ) );
+        if( !outFile )
+        {
+            outFile.close();
+            std::remove( tempFilename.c_str() );
+            return;
+        }
+    }
+    std::rename( tempFilename.c_str(), binaryFilename.c_str() );
+    return;
+} // end "writeBinaryIndex()" -----------------------------------------------------------------
+
+void distBlock::buildLookup()
+{
+    m_grid.clear();
+    m_sortedIndex.clear();
+    m_blockRanges.clear();
+    m_gridDimX = m_gridDimY = m_gridDimZ = 0;
+    m_maxBlockID = 0;
+    m_fullBlockSize = 0;
+    if( m_seedCoords.empty() )
+    {
+        return;
+    }
+
+    // block ranges and seed bounding box
+    WHcoord lowCorner( m_seedCoords.front() ), highCorner( m_seedCoords.front() );
+    bool integerCoords( true );
+    for( size_t i = 0; i < m_seedCoords.size(); ++i )
+    {
+        const WHcoord& coord( m_seedCoords[i] );
+        const unsigned int block( m_seedBlockPos[i].first );
+        if( block >= m_blockRanges.size() )
+        {
+            m_blockRanges.resize( block + 1, std::make_pair( coord, coord ) );
+        }
+        if( coord < m_blockRanges[block].first )
+        {
+            m_blockRanges[block].first = coord;
+        }
+        if( m_blockRanges[block].second < coord )
+        {
+            m_blockRanges[block].second = coord;
+        }
+        m_maxBlockID = std::max( m_maxBlockID, block );
+        m_fullBlockSize = std::max( m_fullBlockSize, static_cast< size_t >( m_seedBlockPos[i].second ) + 1 );
+
+        lowCorner.m_x = std::min( lowCorner.m_x, coord.m_x );
+        lowCorner.m_y = std::min( lowCorner.m_y, coord.m_y );
+        lowCorner.m_z = std::min( lowCorner.m_z, coord.m_z );
+        highCorner.m_x = std::max( highCorner.m_x, coord.m_x );
+        highCorner.m_y = std::max( highCorner.m_y, coord.m_y );
+        highCorner.m_z = std::max( highCorner.m_z, coord.m_z );
+        if( coord.m_x != std::floor( coord.m_x ) || coord.m_y != std::floor( coord.m_y ) || coord.m_z != std::floor( coord.m_z ) )
+        {
+            integerCoords = false;
+        }
+    }
+
+    const double gridCells( ( highCorner.m_x - lowCorner.m_x + 1. ) * ( highCorner.m_y - lowCorner.m_y + 1. ) * ( highCorner.m_z - lowCorner.m_z + 1. ) );
+    if( integerCoords && gridCells <= DISTBLOCK_GRID_MAX_CELLS )
+    {
+        // voxel seeds: dense grid with direct addressing
+        m_gridOrigin = lowCorner;
+        m_gridDimX = static_cast< size_t >( highCorner.m_x - lowCorner.m_x ) + 1;
+        m_gridDimY = static_cast< size_t >( highCorner.m_y - lowCorner.m_y ) + 1;
+        m_gridDimZ = static_cast< size_t >( highCorner.m_z - lowCorner.m_z ) + 1;
+        m_grid.assign( m_gridDimX * m_gridDimY * m_gridDimZ, 0 );
+        for( size_t i = 0; i < m_seedCoords.size(); ++i )
+        {
+            const WHcoord& coord( m_seedCoords[i] );
+            const size_t cell( ( static_cast< size_t >( coord.m_z - m_gridOrigin.m_z ) * m_gridDimY + static_cast< size_t >( coord.m_y
+                            - m_gridOrigin.m_y ) ) * m_gridDimX + static_cast< size_t >( coord.m_x - m_gridOrigin.m_x ) );
+            m_grid[cell] = i + 1;
+        }
     }
     else
-        rowBlockID = findIter->second.first;
+    {
+        // sparse or non-voxel seeds: binary search on the sorted coordinates
+        m_sortedIndex.reserve( m_seedCoords.size() );
+        for( size_t i = 0; i < m_seedCoords.size(); ++i )
+        {
+            m_sortedIndex.push_back( std::make_pair( m_seedCoords[i], i ) );
+        }
+        std::sort( m_sortedIndex.begin(), m_sortedIndex.end() );
+    }
+    return;
+} // end "buildLookup()" -----------------------------------------------------------------
 
-    findIter = ( m_fullIndex.find( coord2 ) );
-    if( findIter == m_fullIndex.end() )
+bool distBlock::findSeed( const WHcoord& coord, size_t* matrixID ) const
+{
+    if( !m_grid.empty() )
     {
-        throw std::runtime_error( "ERROR @ distBlock::whichBlock(): second coordinate is out of bounds" );
+        const coord_t x( coord.m_x - m_gridOrigin.m_x ), y( coord.m_y - m_gridOrigin.m_y ), z( coord.m_z - m_gridOrigin.m_z );
+        if( x < 0 || y < 0 || z < 0 || x >= m_gridDimX || y >= m_gridDimY || z >= m_gridDimZ )
+        {
+            return false;
+        }
+        const size_t cell( ( static_cast< size_t >( z ) * m_gridDimY + static_cast< size_t >( y ) ) * m_gridDimX + static_cast< size_t >( x ) );
+        if( m_grid[cell] == 0 || m_seedCoords[m_grid[cell] - 1] != coord )
+        {
+            return false;
+        }
+        *matrixID = m_grid[cell] - 1;
+        return true;
     }
     else
     {
-        colBlockID = findIter->second.first;
+        std::vector< std::pair< WHcoord, size_t > >::const_iterator findIter( std::lower_bound( m_sortedIndex.begin(), m_sortedIndex.end(),
+                        std::make_pair( coord, size_t( 0 ) ) ) );
+        if( findIter == m_sortedIndex.end() || findIter->first != coord )
+        {
+            return false;
+        }
+        *matrixID = findIter->second;
+        return true;
     }
+} // end "findSeed()" -----------------------------------------------------------------
 
+bool distBlock::blockPosition( const blockKey_t& blockID, size_t matrixID1, size_t matrixID2, size_t* position1, size_t* position2 ) const
+{
+    const std::pair< unsigned int, unsigned int >& blockPos1( m_seedBlockPos[matrixID1] );
+    const std::pair< unsigned int, unsigned int >& blockPos2( m_seedBlockPos[matrixID2] );
+    if( blockPos1.first == blockID.first && blockPos2.first == blockID.second )
+    {
+        *position1 = blockPos1.second;
+        *position2 = blockPos2.second;
+        return true;
+    }
+    else if( blockPos2.first == blockID.first && blockPos1.first == blockID.second )
+    {
+        // pair given in column-row order, the block holds the upper triangle only
+        *position1 = blockPos2.second;
+        *position2 = blockPos1.second;
+        return true;
+    }
+    return false;
+} // end "blockPosition()" -----------------------------------------------------------------
+
+std::pair< unsigned int, unsigned int > distBlock::whichBlock( const WHcoord& coord1, const WHcoord& coord2 ) const
+{
+    size_t matrixID1( 0 ), matrixID2( 0 );
+    if( !findSeed( coord1, &matrixID1 ) )
+    {
+        throw std::runtime_error( "ERROR @ distBlock::whichBlock(): first coordinate is out of bounds" );
+    }
+    if( !findSeed( coord2, &matrixID2 ) )
+    {
+        throw std::runtime_error( "ERROR @ distBlock::whichBlock(): second coordinate is out of bounds" );
+    }
+
+    unsigned int rowBlockID( m_seedBlockPos[matrixID1].first ), colBlockID( m_seedBlockPos[matrixID2].first );
     if( colBlockID < rowBlockID )
     {
         unsigned int tempID( rowBlockID );
@@ -272,4 +614,194 @@ std::pair< unsigned int, unsigned int > distBlock::whichBlock( const WHcoord& co
     return std::make_pair( rowBlockID, colBlockID );
 } // end "whichBlock()" -----------------------------------------------------------------
 
+boost::shared_ptr< const std::vector< std::vector< float > > > distBlock::fetchBlock( const blockKey_t& blockID, bool prefetch, bool mayEvict )
+{
+    boost::unique_lock< boost::mutex > lock( m_cacheMutex );
+    while( true )
+    {
+        std::map< blockKey_t, cacheEntry >::iterator cacheIter( m_cache.find( blockID ) );
+        if( cacheIter == m_cache.end() )
+        {
+            break;
+        }
+        else if( prefetch )
+        {
+            return boost::shared_ptr< const std::vector< std::vector< float > > >();
+        }
+        else if( cacheIter->second.block )
+        {
+            ++m_cacheHits;
+            m_lruList.splice( m_lruList.begin(), m_lruList, cacheIter->second.lruPosition );
+            return cacheIter->second.block;
+        }
+        // block is being read by another thread
+        m_cacheChanged.wait( lock );
+    }
+
+    if( prefetch )
+    {
+        if( !mayEvict && m_cacheUsedBytes + blockBytes() > m_cacheBytes )
+        {
+            return boost::shared_ptr< const std::vector< std::vector< float > > >();
+        }
+        ++m_prefetchedBlocks;
+    }
+    else
+    {
+        ++m_cacheMisses;
+    }
+
+    // not cached: insert an empty entry (so that other requests wait for this one instead of reading the block again) and read it
+    m_lruList.push_front( blockID );
+    cacheEntry& newEntry( m_cache[blockID] );
+    newEntry.bytes = 0;
+    newEntry.lruPosition = m_lruList.begin();
+    ++m_pendingReads;
+    lock.unlock();
+
+    boost::shared_ptr< std::vector< std::vector< float > > > loaded( new std::vector< std::vector< float > > );
+    try
+    {
+        fileManagerFactory fileMF( m_distBlockFolder );
+        fileManager& fileMngr( fileMF.getFM() );
+        fileMngr.readDistBlock( blockID.first, blockID.second, loaded.get() );
+    }
+    catch( ... )
+    {
+        lock.lock();
+        --m_pendingReads;
+        std::map< blockKey_t, cacheEntry >::iterator cacheIter( m_cache.find( blockID ) );
+        if( cacheIter != m_cache.end() && !cacheIter->second.block )
+        {
+            m_lruList.erase( cacheIter->second.lruPosition );
+            m_cache.erase( cacheIter );
+        }
+        lock.unlock();
+        m_cacheChanged.notify_all();
+        throw;
+    }
+
+    size_t bytes( sizeof( std::vector< std::vector< float > > ) );
+    for( size_t i = 0; i < loaded->size(); ++i )
+    {
+        bytes += sizeof( std::vector< float > ) + ( *loaded )[i].capacity() * sizeof( float );
+    }
 
+    lock.lock();
+    --m_pendingReads;
+    std::map< blockKey_t, cacheEntry >::iterator cacheIter( m_cache.find( blockID ) );
+    if( cacheIter != m_cache.end() && !cacheIter->second.block )
+    {
+        cacheIter->second.block = loaded;
+        cacheIter->second.bytes = bytes;
+        m_cacheUsedBytes += bytes;
+        evictBlocks( blockID );
+    }
+    lock.unlock();
+    m_cacheChanged.notify_all();
+    return loaded;
+} // end "fetchBlock()" -----------------------------------------------------------------
+
+void distBlock::evictBlocks( const blockKey_t& keptBlock )
+{
+    std::list< blockKey_t >::iterator lruIter( m_lruList.end() );
+    while( m_cacheUsedBytes > m_cacheBytes && lruIter != m_lruList.begin() )
+    {
+        --lruIter;
+        if( *lruIter == keptBlock || ( m_blockReady && *lruIter == m_blockID ) )
+        {
+            continue;
+        }
+        std::map< blockKey_t, cacheEntry >::iterator cacheIter( m_cache.find( *lruIter ) );
+        if( !cacheIter->second.block )
+        {
+            // still being read
+            continue;
+        }
+        m_cacheUsedBytes -= cacheIter->second.bytes;
+        m_cache.erase( cacheIter );
+        lruIter = m_lruList.erase( lruIter );
+    }
+    return;
+} // end "evictBlocks()" -----------------------------------------------------------------
+
+void distBlock::queuePrefetch( const blockKey_t& blockID )
+{
+    {
+        boost::unique_lock< boost::mutex > lock( m_cacheMutex );
+        if( !m_prefetch || blockID == m_lastRequest )
+        {
+            return;
+        }
+        const long int rowStep( static_cast< long int >( blockID.first ) - static_cast< long int >( m_lastRequest.first ) );
+        const long int columnStep( static_cast< long int >( blockID.second ) - static_cast< long int >( m_lastRequest.second ) );
+        m_lastRequest = blockID;
+        m_prefetchQueue.clear();
+
+        std::vector< std::pair< long int, long int > > candidates;
+        bool sequential( std::abs( rowStep ) + std::abs( columnStep ) == 1 );
+        if( sequential )
+        {
+            // sequential access: read ahead the next block in the same direction
+            candidates.push_back( std::make_pair( blockID.first + rowStep, blockID.second + columnStep ) );
+        }
+        else
+        {
+            // random access: neighbouring blocks, only if they fit in the budget
+            candidates.push_back( std::make_pair( blockID.first, blockID.second + 1 ) );
+            candidates.push_back( std::make_pair( blockID.first + 1, blockID.second ) );
+            candidates.push_back( std::make_pair( blockID.first, blockID.second - 1 ) );
+            candidates.push_back( std::make_pair( blockID.first - 1, blockID.second ) );
+        }
+        for( size_t i = 0; i < candidates.size(); ++i )
+        {
+            const long int row( candidates[i].first ), column( candidates[i].second );
+            if( row < 0 || row > column || column > static_cast< long int >( m_maxBlockID ) )
+            {
+                continue;
+            }
+            const blockKey_t candidateID( row, column );
+            if( m_cache.find( candidateID ) == m_cache.end() )
+            {
+                m_prefetchQueue.push_back( std::make_pair( candidateID, sequential ) );
+            }
+        }
+    }
+    m_cacheChanged.notify_all();
+    return;
+} // end "queuePrefetch()" -----------------------------------------------------------------
+
+void distBlock::prefetchLoop()
+{
+    while( true )
+    {
+        std::pair< blockKey_t, bool > request;
+        {
+            boost::unique_lock< boost::mutex > lock( m_cacheMutex );
+            while( !m_stop && m_prefetchQueue.empty() )
+            {
+                m_cacheChanged.wait( lock );
+            }
+            if( m_stop )
+            {
+                return;
+            }
+            request = m_prefetchQueue.front();
+            m_prefetchQueue.pop_front();
+            m_prefetchBusy = true;
+        }
+        try
+        {
+            fetchBlock( request.first, true, request.second );
+        }
+        catch( ... )
+        {
+            // a block that cannot be read is reported when it is actually requested
+        }
+        {
+            boost::unique_lock< boost::mutex > lock( m_cacheMutex );
+            m_prefetchBusy = false;
+        }
+        m_cacheChanged.notify_all();
+    }
+} // end "prefetchLoop()" -----------------------------------------------------------------
@@ -39,21 +39,36 @@
 #include <vector>
 #include <utility>
 #include <string>
+#include <map>
+#include <list>
+#include <deque>
 #include <cmath>
 #include <stdexcept>
 #include <iostream>
+#include <stdint.h>
 
 // boost library
 #include <boost/lexical_cast.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
 
 // hClustering
 #include "WHcoord.h"
 #include "WFileParser.h"
 #include "fileManagerFactory.h"
 
+#define DISTBLOCK_BINARY_INDEX_FILENAME "roi_index.bin"  // binary sidecar of the matrix index file
+#define DISTBLOCK_BINARY_INDEX_MAGIC    "HCDISTIX"
+#define DISTBLOCK_BINARY_INDEX_VERSION  1
+#define DISTBLOCK_GRID_MAX_CELLS        16777216        // largest seed bounding box (in voxels) indexed with a dense grid
+
 
 /**
  * this class manages the reading and writing of blocks belonging to a dissimilarity matrix
+ * blocks are read through a memory-bounded least-recently-used block cache. The loaded (current) block is the one set by loadBlock(),
+ * while getDistance() on matrix IDs may use any cached block. When prefetching is enabled a background thread reads ahead the block
+ * following the current access direction (or, for non-sequential access, the neighbouring blocks if they fit in the cache budget)
  */
 class distBlock
 {
@@ -64,8 +79,8 @@ public:
      */
     explicit distBlock( const std::string& distBlockFolderInit );
 
-    //! Destructor
-    ~distBlock() {}
+    //! Destructor, stops the prefetch thread
+    ~distBlock();
 
     // === IN-LINE MEMBER FUNCTIONS ===
 
@@ -73,13 +88,13 @@ public:
      * returns size of of the loaded distance block in number of rows/columns
      * \return block size (number of rows/columns)
      */
-    inline size_t size() const { return m_block.size(); }
+    inline size_t size() const { return ( m_block ? m_block->size() : 0 ); }
 
     /**
      * returns the size of the complete distance matrix the loaded block is part of in number of rows/columns
      * \return full matrix size (number of rows/columns)
      */
-    inline size_t matrixSize() const { return m_fullIndex.size(); }
+    inline size_t matrixSize() const { return m_seedCoords.size(); }
 
     /**
      * returns the index ready flag, if true the matrix index file has been successfully loaded
@@ -111,15 +126,65 @@ public:
      */
     inline unsigned int numBlocks() const { return ( ( ( m_maxBlockID + 1 ) * ( m_maxBlockID + 2 ) ) / 2 ); }
 
+    /**
+     * returns the memory needed to hold a full (non-edge) block of the current distance matrix, to size the block cache
+     * \return full block size in bytes
+     */
+    inline size_t blockBytes() const { return m_fullBlockSize * ( m_fullBlockSize * sizeof( float ) + sizeof( std::vector< float > ) ); }
+
+    /**
+     * returns the number of block requests served from the block cache
+     * \return number of cache hits
+     */
+    inline size_t cacheHits() const { return m_cacheHits; }
+
+    /**
+     * returns the number of block requests that had to be read from disk
+     * \return number of cache misses
+     */
+    inline size_t cacheMisses() const { return m_cacheMisses; }
+
+    /**
+     * returns the number of blocks read from disk by the prefetch thread
+     * \return number of prefetched blocks
+     */
+    inline size_t prefetchedBlocks() const { return m_prefetchedBlocks; }
+
     // MEMBER FUNCTIONS
 
 
     /**
      * loads the block index that links a position in the block to a specific seed voxel coordinate
+     * the binary index sidecar is used if it is up to date with the index text file, otherwise the text file is parsed and the sidecar is (re)written
      * \return success bit, if true index was loaded successfully
      */
     bool readIndex();
 
+    /**
+     * returns the matrix ID (row/column of the full matrix, same order as the seed roi) of a seed voxel coordinate
+     * \param coord seed voxel coordinate
+     * \return matrix ID of the coordinate
+     */
+    size_t getMatrixID( const WHcoord& coord ) const;
+
+    /**
+     * sets the memory budget of the block cache, the most recently used block is always kept (default: 0, keep one block only)
+     * \param cacheBytes cache budget in bytes
+     */
+    void setCacheSize( size_t cacheBytes );
+
+    /**
+     * enables or disables background prefetching of neighbouring blocks (default: disabled)
+     * \param prefetch prefetch flag
+     */
+    void setPrefetch( bool prefetch );
+
+    /**
+     * returns a string with the block cache statistics
+     * \return cache report string
+     */
+    std::string getCacheReport() const;
+
     /**
      * loads the the distance block dissimilarity values and stores them in the corresponding data member
      * \param blockID integer pair with the block ID that is to be loaded
@@ -146,7 +211,17 @@ public:
      * \param coord2 seed coordinate of second tract
      * \return distance value
      */
-    float getDistance( const WHcoord& coord1, const WHcoord& coord2 );
+    float getDistance( const WHcoord& coord1, const WHcoord& coord2 ) const;
+    /**
+     * \overload
+     * fetches the distance value between two seeds defined by their matrix IDs (row/column of the full matrix, same as leaf IDs when the tree was built on the matrix roi)
+     * if the pair is not contained in the loaded block the block containing it is taken from the block cache (read from disk on a miss),
+     * the loaded block does not change. May be called concurrently from several threads as long as loadBlock() is not
+     * \param matrixID1 matrix ID of first tract
+     * \param matrixID2 matrix ID of second tract
+     * \return distance value
+     */
+    float getDistance( size_t matrixID1, size_t matrixID2 );
 
     /**
      * returns the ranges of seed coordinates with contained within the currently loaded block
@@ -154,7 +229,7 @@ public:
 
      * \return a pair of coordinate ranges (for rows and columns) each consisting of a pair of first and last coordinate of range
      */
-    std::pair< std::pair< WHcoord, WHcoord >, std::pair< WHcoord, WHcoord > > getBlockRange();
+    std::pair< std::pair< WHcoord, WHcoord >, std::pair< WHcoord, WHcoord > > getBlockRange() const;
 
     /**
      * writes the loaded block into the folder specified at object creation
@@ -174,11 +249,46 @@ private:
     bool m_blockReady; //!< block successfully loaded flag
     unsigned int m_maxBlockID;      //!< maximum block ID of the distance matrix
     std::string m_distBlockFolder;  //!< folder containing the distance matrix blocks (or where these blocks will be written to)
-    std::map< WHcoord, std::pair< unsigned int, unsigned int > > m_fullIndex; //!< index map linking each seed voxel coordinate to a block and position within the block
+    std::vector< WHcoord > m_seedCoords;    //!< seed voxel coordinate of each matrix ID
+    std::vector< std::pair< unsigned int, unsigned int > > m_seedBlockPos;  //!< block and position within the block of each matrix ID
+    std::vector< std::pair< WHcoord, WHcoord > > m_blockRanges;            //!< first and last seed coordinate contained in each block row/column
+    std::vector< unsigned int > m_grid;     //!< dense voxel grid over the seed bounding box holding matrix ID + 1 of each seed (0 if voxel is not a seed)
+    WHcoord m_gridOrigin;                   //!< lowest corner of the seed bounding box
+    size_t m_gridDimX;                      //!< grid size in x
+    size_t m_gridDimY;                      //!< grid size in y
+    size_t m_gridDimZ;                      //!< grid size in z
+    std::vector< std::pair< WHcoord, size_t > > m_sortedIndex; //!< coordinate sorted matrix IDs, used instead of the grid when seeds do not lie on a compact integer grid
+    size_t m_fullBlockSize;                 //!< number of seeds in a full (non-edge) block
     std::pair< unsigned int, unsigned int > m_blockID;  //!< block ID within the full matrix
-    std::map< WHcoord, unsigned int > m_blockIndex1;    //!< index map linking each seed voxel coordinate a specific row position in the current block
-    std::map< WHcoord, unsigned int > m_blockIndex2;    //!< index map linking each seed voxel coordinate a specific column position in the current block
-    std::vector< std::vector< float > > m_block;        //!< block pairwise distance information matrix
+    boost::shared_ptr< const std::vector< std::vector< float > > > m_block;  //!< block pairwise distance information matrix
+
+    /**
+     * An entry of the block cache
+     */
+    struct cacheEntry
+    {
+        boost::shared_ptr< const std::vector< std::vector< float > > > block; //!< the block distances, null while being read
+        size_t bytes;                                                       //!< memory used by the block
+        std::list< std::pair< unsigned int, unsigned int > >::iterator lruPosition; //!< position of the block in the recency list
+    };
+    typedef std::pair< unsigned int, unsigned int > blockKey_t;
+
+    std::map< blockKey_t, cacheEntry > m_cache;   //!< the block cache
+    std::list< blockKey_t > m_lruList;            //!< cached block IDs, most recently used first
+    std::deque< std::pair< blockKey_t, bool > > m_prefetchQueue;   //!< blocks to be prefetched, with a flag indicating if they may evict cached blocks
+    blockKey_t m_lastRequest;                     //!< block ID of the last block requested, to detect sequential access
+    size_t m_cacheBytes;                          //!< memory budget of the block cache
+    size_t m_cacheUsedBytes;                      //!< memory currently used by the block cache
+    size_t m_cacheHits;                           //!< number of block requests served from the cache
+    size_t m_cacheMisses;                         //!< number of block requests read from disk
+    size_t m_prefetchedBlocks;                    //!< number of blocks read by the prefetch thread
+    size_t m_pendingReads;                        //!< number of blocks being read (they have an empty entry in the cache until they are loaded)
+    bool m_prefetch;                              //!< prefetch enabled flag
+    bool m_prefetchBusy;                          //!< flag indicating that the prefetch thread has taken a request and not finished it yet
+    bool m_stop;                                  //!< stop flag for the prefetch thread
+    mutable boost::mutex m_cacheMutex;            //!< protects the cache and prefetch state
+    boost::condition_variable m_cacheChanged;     //!< signals block insertions, prefetch requests and stops
+    boost::thread_group m_prefetchThread;         //!< the prefetch thread (started when prefetching is enabled)
 
     // === PRIVATE MEMBER FUNCTIONS ===
 
@@ -186,7 +296,85 @@ private:
      * retrieve the path for the index file corresponding to the current distance matrix
      * \return the index file path
      */
-    std::string getIndexFilename();
+    std::string getIndexFilename() const;
+
+    /**
+     * retrieve the path for the binary index sidecar corresponding to the current distance matrix
+     * \return the binary index file path
+     */
+    std::string getBinaryIndexFilename() const;
+
+    /**
+     * parses the matrix index text file and fills the seed coordinate and block position tables
+     * \return success bit, if true index was parsed successfully
+     */
+    bool readTextIndex();
+
+    /**
+     * loads the seed coordinate and block position tables from the binary index sidecar
+     * \param textBytes size in bytes of the current index text file
+     * \param textTime last modification time of the current index text file
+     * \return success bit, false if the sidecar is missing, corrupt or does not match the text file
+     */
+    bool readBinaryIndex( uint64_t textBytes, int64_t textTime );
+
+    /**
+     * writes the seed coordinate and block position tables to the binary index sidecar (failure to write is not an error)
+     * \param textBytes size in bytes of the current index text file
+     * \param textTime last modification time of the current index text file
+     */
+    void writeBinaryIndex( uint64_t textBytes, int64_t textTime ) const;
+
+    /**
+     * builds the coordinate lookup structures (dense grid or sorted index) and the block ranges from the seed tables
+     */
+    void buildLookup();
+
+    /**
+     * finds the matrix ID of a seed voxel coordinate
+     * \param coord seed voxel coordinate
+     * \param matrixID pointer where the found matrix ID will be stored
+     * \return true if the coordinate is a seed of the matrix
+     */
+    bool findSeed( const WHcoord& coord, size_t* matrixID ) const;
+
+    /**
+     * returns the position of a seed pair within a block
+     * \param blockID block ID (row block not greater than column block)
+     * \param matrixID1 matrix ID of first tract
+     * \param matrixID2 matrix ID of second tract
+     * \param position1 pointer where the row position of the pair will be stored
+     * \param position2 pointer where the column position of the pair will be stored
+     * \return true if the pair is contained in the block
+     */
+    bool blockPosition( const blockKey_t& blockID, size_t matrixID1, size_t matrixID2, size_t* position1, size_t* position2 ) const;
+
+    /**
+     * returns a block from the cache, reading it from disk if not cached (waits if another thread is already reading it)
+     * \param blockID block ID (row block not greater than column block)
+     * \param prefetch if true the request comes from the prefetch thread: it is not counted as hit/miss, and returns null without waiting if the block is cached or being read
+     * \param mayEvict (only for prefetch requests) if false the block is only read if it fits in the cache budget without evicting other blocks
+     * \return a shared pointer to the block distances
+     */
+    boost::shared_ptr< const std::vector< std::vector< float > > > fetchBlock( const blockKey_t& blockID, bool prefetch, bool mayEvict );
+
+    /**
+     * evicts least recently used blocks until the cache fits its budget, the loaded block and the given block are never evicted (mutex must be held)
+     * \param keptBlock block ID of the block that must be kept
+     */
+    void evictBlocks( const blockKey_t& keptBlock );
+
+    /**
+     * queues prefetch requests following a demand access: the next block in the access direction if the access is sequential,
+     * otherwise the four neighbouring blocks if they fit in the cache budget
+     * \param blockID block ID that was just requested
+     */
+    void queuePrefetch( const blockKey_t& blockID );
+
+    /**
+     * prefetch thread main loop
+     */
+    void prefetchLoop();
 
     /**
      * calculates based on the index information the block ID where the distance information of two pairs of seed coordinates is located
@@ -194,7 +382,7 @@ private:
      * \param coord2 seed coordinate of second tract
      * \return the block ID pair pointing to the block with the required information
      */
-    std::pair< unsigned int, unsigned int > whichBlock( const WHcoord& coord1, const WHcoord& coord2 );
+    std::pair< unsigned int, unsigned int > whichBlock( const WHcoord& coord1, const WHcoord& coord2 ) const;
 };
 
 #endif  // DISTBLOCK_H
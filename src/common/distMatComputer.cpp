@@ -1,4 +1,5 @@
 #include "distMatComputer.h"
+#include "tractKernels.h"
 
 
 distMatComputer::distMatComputer( const std::string& roiFilename, const float thresholdRatio, const bool verbose, const bool noLog )
@@ -10,6 +11,10 @@ distMatComputer::distMatComputer( const std::string& roiFilename, const float th
     m_blocksPerRow = 0;
     m_subBlockSize = 0;
     m_subBlocksPerBlock = 0;
+    m_prefetchDepth = DEFAULT_PREFETCH_DEPTH;
+    m_cacheBytes = 0;
+    m_shardIndex = 0;
+    m_shardCount = 1;
     m_zipFlag = true;
 
 
@@ -144,11 +149,29 @@ void distMatComputer::setBlockSize( float memory, size_t blockSize )
     m_trackSize = testTract.size();
     tractBytes = m_trackSize*sizeof( testTract.tract()[0] );
 
+    // estimate the size of a thresholded tractogram in sparse form from a sample of seeds (with a safety margin)
+    testFM.readAsLog();
+    testFM.readAsUnThres();
+    const size_t sampleSize( std::min( m_coordinates.size(), ( size_t )SPARSE_SIZE_SAMPLE ) );
+    double sampleBytes( 0 );
+    for( size_t i = 0; i < sampleSize; ++i )
+    {
+        compactTractChar sampleTract;
+        testFM.readLeafTract( ( i * m_coordinates.size() ) / sampleSize, m_trackids, m_coordinates, &sampleTract );
+        sampleTract.threshold( m_tractThreshold );
+        sampleBytes += sparseTract( sampleTract ).bytes();
+    }
+    size_t sparseTractBytes( 1.25 * sampleBytes / sampleSize );
+
     if( m_verbose )
     {
-        std::cout <<"Tractogram size: "<< m_trackSize <<" elements ("<< tractBytes / (1024.*1024.) << " MBytes)"<< std::endl;
+        std::cout <<"Tractogram size: "<< m_trackSize <<" elements ("<< tractBytes / (1024.*1024.) << " MBytes, "<< sparseTractBytes / (1024.*1024.) << " MBytes in sparse form)"<< std::endl;
     }
-    size_t maxSubBlockSize( remainingMemoryBytes / ( 2 * tractBytes ) );
+    // column sets are dense, m_prefetchDepth of them are held in memory at the same time (the one in use and the prefetched ones),
+    // row sets are sparse. The sets of the sub-block being computed get TRACT_BUFFER_SHARE of the remaining memory,
+    // the rest is used by the sparse set cache, which avoids reading again the sets that are requested several times
+    const size_t seedBytes( m_prefetchDepth * tractBytes + sparseTractBytes );
+    size_t maxSubBlockSize( ( remainingMemoryBytes * TRACT_BUFFER_SHARE ) / seedBytes );
 
     if ( maxSubBlockSize < MIN_SUB_BLOCK_SIZE )
     {
@@ -177,13 +200,14 @@ void distMatComputer::setBlockSize( float memory, size_t blockSize )
         m_subBlocksPerBlock = 1;
     }
 
-    size_t tractBlockBytes( tractBytes * m_subBlockSize );
-    size_t memoryUsageBytes( distBlockBytes + ( 2 * tractBlockBytes ) + sizeof(*this) + ( sizeof( double ) * m_coordinates.size() ) );
+    size_t tractBlockBytes( seedBytes * m_subBlockSize );
+    m_cacheBytes = ( remainingMemoryBytes > tractBlockBytes ) ? remainingMemoryBytes - tractBlockBytes : 0;
+    size_t memoryUsageBytes( distBlockBytes + tractBlockBytes + m_cacheBytes + sizeof(*this) + ( sizeof( double ) * m_coordinates.size() ) );
 
     if( m_verbose )
     {
         std::cout <<"Using "<< m_subBlocksPerBlock <<"x"<< m_subBlocksPerBlock <<" tractogram sub-blocks of "<< m_subBlockSize <<" tracts for each distance block."<< std::endl;
-        std::cout << "Expected memory usage: " << ( memoryUsageBytes / (1024 * 1024 ) / 1024.) << " GBytes (" << memoryUsageBytes / (1024 * 1024) << " MBytes). [ distBlock: " << distBlockBytes/(1024 * 1024) << " MB. tract subBlocks: 2 x " << tractBlockBytes/(1024 * 1024) << " MB. ]" << std::endl;
+        std::cout << "Expected memory usage: " << ( memoryUsageBytes / (1024 * 1024 ) / 1024.) << " GBytes (" << memoryUsageBytes / (1024 * 1024) << " MBytes). [ distBlock: " << distBlockBytes/(1024 * 1024) << " MB. tract subBlocks: " << tractBlockBytes/(1024 * 1024) << " MB (prefetch depth: " << m_prefetchDepth << "). tract set cache: " << m_cacheBytes/(1024 * 1024) << " MB. ]" << std::endl;
     }
 
     if( m_finishBlock.first == 0 && m_finishBlock.second == 0 )
@@ -277,106 +301,395 @@ void distMatComputer::setFinishBlock( size_t finish_row, size_t finish_column )
     }
 }
 
-
-
-void distMatComputer::doDistBlocks()
+void distMatComputer::setShard( size_t shardIndex, size_t shardCount )
 {
-    //variables to keep tract of min and max values
-    dist_t maxValue(-1), minValue(2);
+    if( shardCount == 0 || shardIndex >= shardCount )
+    {
+        throw std::runtime_error( "ERROR @ distMatComputer::setShard(): shard index must be lower than the number of shards" );
+    }
+    m_shardIndex = shardIndex;
+    m_shardCount = shardCount;
+}
 
-    // variables for progress printout
-    time_t distmatStartTime(time(NULL)), currentTime(time(NULL));
-    size_t blockProgress(0), progressInt(0), elapsedTime(0), expectedRemain(0), totalBlocks(0), totalSubBlocks( 0 );
-    float progress(0);
+bool distMatComputer::verifyMatrix() const
+{
+    if ( !m_roiLoaded )
+    {
+        std::cerr << "ERROR: Roi was not loaded." << std::endl;
+        return false;
+    }
+    if ( m_outputFolder.empty() )
+    {
+        std::cerr << "ERROR: Output folder was not set." << std::endl;
+        return false;
+    }
 
-    // write index file
-    writeIndex();
+    // read the index file and check it against the seed voxel list, get the size of each block from it
+    std::string indexFilename = m_outputFolder + "/" + MATRIX_INDEX_FILENAME;
+    WFileParser indexParser( indexFilename );
+    if( !indexParser.readFile() )
+    {
+        std::cerr << "ERROR: unable to read index file: \"" << indexFilename << "\"" << std::endl;
+        return false;
+    }
+    std::vector< std::vector< std::string > > indexStrings = indexParser.getLinesForTagSeparated( "distindex" );
+    if( indexStrings.size() != m_coordinates.size() )
+    {
+        std::cerr << "ERROR: index file has " << indexStrings.size() << " seeds, roi file has " << m_coordinates.size() << std::endl;
+        return false;
+    }
 
-    // compute tractogram norms
-    computeNorms();
+    std::vector< size_t > blockSeeds; // number of seeds in each block row/column
+    for( size_t i = 0; i < indexStrings.size(); ++i )
+    {
+        if( indexStrings[i].size() != 7 || indexStrings[i][3] != "b" || indexStrings[i][5] != "i" )
+        {
+            std::cerr << "ERROR: format of index file is not correct" << std::endl;
+            return false;
+        }
+        WHcoord indexCoord( boost::lexical_cast< coord_t >( indexStrings[i][0] ), boost::lexical_cast< coord_t >( indexStrings[i][1] ),
+                            boost::lexical_cast< coord_t >( indexStrings[i][2] ) );
+        if( indexCoord != m_coordinates[i] )
+        {
+            std::cerr << "ERROR: seed " << i << " of the index file (" << indexCoord << ") does not match the roi file (" << m_coordinates[i] << ")" << std::endl;
+            return false;
+        }
+        const size_t block( boost::lexical_cast< size_t >( indexStrings[i][4] ) ), position( boost::lexical_cast< size_t >( indexStrings[i][6] ) );
+        if( block == blockSeeds.size() )
+        {
+            blockSeeds.push_back( 0 );
+        }
+        if( block + 1 != blockSeeds.size() || position != blockSeeds.back() )
+        {
+            std::cerr << "ERROR: block positions of the index file are not consecutive at seed " << i << std::endl;
+            return false;
+        }
+        ++blockSeeds.back();
+    }
+    if( blockSeeds.empty() )
+    {
+        std::cerr << "ERROR: index file is empty" << std::endl;
+        return false;
+    }
+    const size_t blockSize( blockSeeds.front() ), blocksPerRow( blockSeeds.size() );
+    for( size_t i = 0; i < blocksPerRow; ++i )
+    {
+        if( blockSeeds[i] > blockSize || ( i + 1 < blocksPerRow && blockSeeds[i] != blockSize ) )
+        {
+            std::cerr << "ERROR: block " << i << " of the index file has " << blockSeeds[i] << " seeds, block size is " << blockSize << std::endl;
+            return false;
+        }
+    }
+    if( m_verbose )
+    {
+        std::cout << "Index file matches roi file: " << blocksPerRow << "x" << blocksPerRow << " blocks of size " << blockSize << "x" << blockSize << std::endl;
+    }
 
-    // just to test the number of blocks that will be computed
-    for (size_t row = m_startingBlock.first ; row <= m_finishBlock.first ; ++row)
+    // read the shard manifests (if the matrix was computed in shards) and check they assign every block exactly once
+    bool consistent( true );
+    std::map< std::pair< size_t, size_t >, size_t > blockShard;
+    size_t shardCount( 0 );
+    for( size_t shard = 0; shard == 0 || shard < shardCount; ++shard )
     {
-        for (size_t column = row ; column < m_blocksPerRow ; ++column)
+        std::string manifestFilename( m_outputFolder + "/" + str( boost::format( SHARD_MANIFEST_FNAME ) % shard ) );
+        if( !boost::filesystem::exists( manifestFilename ) )
         {
-            if( row == m_startingBlock.first && column < m_startingBlock.second )
+            // a matrix computed in a single process has no manifests at all, shard 0 is only missing if other shards wrote theirs
+            if( shard > 0 || hasShardManifests() )
             {
-                continue;
+                std::cerr << "ERROR: manifest file of shard " << shard << " is missing: \"" << manifestFilename << "\"" << std::endl;
+                consistent = false;
             }
-            if( row == m_finishBlock.first && column > m_finishBlock.second )
+            continue;
+        }
+        WFileParser manifestParser( manifestFilename );
+        manifestParser.readFile();
+        std::vector< std::vector< std::string > > headerStrings = manifestParser.getLinesForTagSeparated( "distshard" );
+        size_t manifestShard( 0 ), manifestShards( 0 ), manifestSeeds( 0 ), manifestBlockSize( 0 );
+        for( size_t i = 0; i < headerStrings.size(); ++i )
+        {
+            if( headerStrings[i].size() == 3 && headerStrings[i][0] == "shard" )
             {
-                continue;
+                manifestShard = boost::lexical_cast< size_t >( headerStrings[i][1] );
+                manifestShards = boost::lexical_cast< size_t >( headerStrings[i][2] );
             }
-            ++totalBlocks;
-            if( row == column )
+            else if( headerStrings[i].size() == 2 && headerStrings[i][0] == "seeds" )
             {
-                totalSubBlocks += ( m_subBlocksPerBlock * ( m_subBlocksPerBlock + 1) / 2 );
+                manifestSeeds = boost::lexical_cast< size_t >( headerStrings[i][1] );
             }
-            else
+            else if( headerStrings[i].size() == 2 && headerStrings[i][0] == "blocksize" )
             {
-                totalSubBlocks += m_subBlocksPerBlock * m_subBlocksPerBlock;
+                manifestBlockSize = boost::lexical_cast< size_t >( headerStrings[i][1] );
             }
         }
+        if( shard == 0 )
+        {
+            shardCount = manifestShards;
+        }
+        if( manifestShard != shard || manifestShards != shardCount || manifestSeeds != m_coordinates.size() || manifestBlockSize != blockSize )
+        {
+            std::cerr << "ERROR: manifest file of shard " << shard << " does not match the index file or the other shards (shard " << manifestShard << " of " << manifestShards;
+            std::cerr << ", " << manifestSeeds << " seeds, block size " << manifestBlockSize << ")" << std::endl;
+            consistent = false;
+            continue;
+        }
+        std::vector< std::vector< std::string > > blockStrings = manifestParser.getLinesForTagSeparated( "blocks" );
+        for( size_t i = 0; i < blockStrings.size(); ++i )
+        {
+            if( blockStrings[i].size() < 2 )
+            {
+                continue;
+            }
+            std::pair< size_t, size_t > block( boost::lexical_cast< size_t >( blockStrings[i][0] ), boost::lexical_cast< size_t >( blockStrings[i][1] ) );
+            if( block.first > block.second || block.second >= blocksPerRow || blockShard.count( block ) )
+            {
+                std::cerr << "ERROR: block " << block.first << "-" << block.second << " of shard " << shard << " manifest is out of the matrix or assigned twice" << std::endl;
+                consistent = false;
+                continue;
+            }
+            blockShard[block] = shard;
+        }
+    }
+    if( shardCount > 0 && m_verbose )
+    {
+        std::cout << "Matrix was computed in " << shardCount << " shards" << std::endl;
     }
 
-    // loop through rows of the distance matrix (each element will be a separate distance block)
-    for (size_t row = m_startingBlock.first ; row <= m_finishBlock.first ; ++row)
+    // check every block of the upper triangle
+    fileManagerFactory blockFMF( m_outputFolder );
+    fileManager& blockFM( blockFMF.getFM() );
+    size_t missingBlocks( 0 ), wrongBlocks( 0 );
+    for( size_t row = 0; row < blocksPerRow; ++row )
     {
-        // loop through columns of the distance matrix (each element will be a separate distance block)
-        for (size_t column = row ; column < m_blocksPerRow ; ++column)
+        for( size_t column = row; column < blocksPerRow; ++column )
         {
-            if( row == m_startingBlock.first && column < m_startingBlock.second )
+            std::stringstream blockName;
+            blockName << "block " << row << "-" << column;
+            if( shardCount > 0 )
             {
-                continue;
+                std::map< std::pair< size_t, size_t >, size_t >::const_iterator shardIter( blockShard.find( std::make_pair( row, column ) ) );
+                if( shardIter == blockShard.end() )
+                {
+                    std::cerr << "ERROR: " << blockName.str() << " is not assigned to any shard" << std::endl;
+                    consistent = false;
+                }
+                else
+                {
+                    blockName << " (shard " << shardIter->second << ")";
+                }
+            }
+            if( m_verbose )
+            {
+                std::cout << "\rChecking " << blockName.str() << "...           " << std::flush;
             }
 
-            if( row == m_finishBlock.first && column > m_finishBlock.second )
+            std::string blockFilename( blockFM.getBlockFilename( row, column ) );
+            if( !boost::filesystem::exists( blockFilename ) && !boost::filesystem::exists( blockFilename + ".gz" ) )
+            {
+                std::cerr << "\rMISSING: " << blockName.str() << std::endl;
+                ++missingBlocks;
+                continue;
+            }
+            std::vector< std::vector< float > > blockValues;
+            try
+            {
+                blockFM.readDistBlock( row, column, &blockValues );
+            }
+            catch( std::runtime_error& except )
+            {
+                std::cerr << "\rUNREADABLE: " << blockName.str() << std::endl;
+                ++wrongBlocks;
+                continue;
+            }
+            bool rightSize( blockValues.size() == blockSeeds[row] );
+            for( size_t i = 0; rightSize && i < blockValues.size(); ++i )
             {
-                 continue;
+                rightSize = ( blockValues[i].size() == blockSeeds[column] );
             }
+            if( !rightSize )
+            {
+                std::cerr << "\rWRONG SIZE: " << blockName.str() << ", expected " << blockSeeds[row] << "x" << blockSeeds[column] << std::endl;
+                ++wrongBlocks;
+            }
+        }
+    }
+
+    const size_t totalBlocks( blocksPerRow * ( blocksPerRow + 1 ) / 2 );
+    std::cout << "\rChecked " << totalBlocks << " blocks: " << missingBlocks << " missing, " << wrongBlocks << " wrong.             " << std::endl;
+    if( missingBlocks == 0 && wrongBlocks == 0 && consistent )
+    {
+        std::cout << "Distance matrix is complete and consistent with the index file." << std::endl;
+        return true;
+    }
+    return false;
+}// end "verifyMatrix()" -----------------------------------------------------------------
 
 
-            std::pair< dist_t, dist_t > blockMinMax = computeDistBlock( row, column );
+void distMatComputer::doDistBlocks()
+{
+    //variables to keep tract of min and max values
+    dist_t maxValue(-1), minValue(2);
 
-            if( blockMinMax.first < minValue )
+    // variables for progress printout
+    time_t distmatStartTime(time(NULL)), currentTime(time(NULL));
+    size_t blockProgress(0), progressInt(0), elapsedTime(0), expectedRemain(0), totalBlocks(0), totalSubBlocks( 0 );
+    float progress(0);
+
+    // write index file (in a sharded run it is written only by the first shard)
+    if( m_shardIndex == 0 )
+    {
+        writeIndex();
+    }
+
+    // compute tractogram norms
+    computeNorms();
+
+    // list the blocks that will be computed
+    std::vector< std::pair< size_t, size_t > > blockList;
+    if( m_shardCount > 1 )
+    {
+        shardBlocks( &blockList );
+        writeShardManifest( blockList );
+    }
+    else
+    {
+        for (size_t row = m_startingBlock.first ; row <= m_finishBlock.first ; ++row)
+        {
+            for (size_t column = row ; column < m_blocksPerRow ; ++column)
             {
-                minValue = blockMinMax.first;
+                if( row == m_startingBlock.first && column < m_startingBlock.second )
+                {
+                    continue;
+                }
+                if( row == m_finishBlock.first && column > m_finishBlock.second )
+                {
+                    continue;
+                }
+                blockList.push_back( std::make_pair( row, column ) );
             }
-            if( blockMinMax.second > maxValue )
+        }
+    }
+    // columns are traversed in snake order (alternating direction on each row) so that consecutive blocks share their column sets
+    for( size_t firstRowBlock = 0, rowCount = 0; firstRowBlock < blockList.size(); ++rowCount )
+    {
+        size_t postLastRowBlock( firstRowBlock );
+        while( postLastRowBlock < blockList.size() && blockList[postLastRowBlock].first == blockList[firstRowBlock].first )
+        {
+            ++postLastRowBlock;
+        }
+        if( rowCount % 2 == 1 )
+        {
+            std::reverse( blockList.begin() + firstRowBlock, blockList.begin() + postLastRowBlock );
+        }
+        firstRowBlock = postLastRowBlock;
+    }
+
+    // resume an interrupted run: blocks recorded in the journal are skipped if their files are valid, incomplete or corrupt ones are computed again
+    std::map< std::pair< size_t, size_t >, blockRecord > journal;
+    readJournal( &journal );
+    size_t resumedBlocks( 0 );
+    {
+        std::vector< std::pair< size_t, size_t > > pendingBlocks;
+        pendingBlocks.reserve( blockList.size() );
+        for( size_t i = 0; i < blockList.size(); ++i )
+        {
+            std::map< std::pair< size_t, size_t >, blockRecord >::const_iterator recordIter( journal.find( blockList[i] ) );
+            if( recordIter == journal.end() )
             {
-                maxValue = blockMinMax.second;
+                pendingBlocks.push_back( blockList[i] );
             }
-            //update progress (number of subblocks computed)
-            if( row == column )
+            else if( checkJournalBlock( blockList[i].first, blockList[i].second, recordIter->second ) )
             {
-                blockProgress += ( m_subBlocksPerBlock * ( m_subBlocksPerBlock + 1) / 2 );
+                minValue = std::min( minValue, recordIter->second.minValue );
+                maxValue = std::max( maxValue, recordIter->second.maxValue );
+                ++resumedBlocks;
             }
             else
             {
-                blockProgress += m_subBlocksPerBlock * m_subBlocksPerBlock;
+                std::cerr << "WARNING: block " << blockList[i].first << "-" << blockList[i].second << " recorded in the journal is incomplete or corrupt, it will be computed again" << std::endl;
+                pendingBlocks.push_back( blockList[i] );
             }
+        }
+        blockList.swap( pendingBlocks );
+    }
+    if( resumedBlocks > 0 )
+    {
+        std::cout << resumedBlocks << " blocks were already computed in a previous run (validated with the journal), they will be skipped" << std::endl;
+    }
+    if( blockList.empty() )
+    {
+        std::cout << "No blocks left to compute." << std::endl;
+        if( resumedBlocks > 0 )
+        {
+            std::cout<<"Total MAX value: "<< maxValue <<". Total min value: "<< minValue <<std::endl;
+        }
+        return;
+    }
 
+    for( size_t i = 0; i < blockList.size(); ++i )
+    {
+        ++totalBlocks;
+        if( blockList[i].first == blockList[i].second )
+        {
+            totalSubBlocks += ( m_subBlocksPerBlock * ( m_subBlocksPerBlock + 1) / 2 );
+        }
+        else
+        {
+            totalSubBlocks += m_subBlocksPerBlock * m_subBlocksPerBlock;
+        }
+    }
 
-            if( m_verbose )
-            {
-                currentTime = (time(NULL));
+    // schedule all tractogram set loads of the run and start the prefetch pipeline
+    std::vector< tractSetJob > loadJobs;
+    for( size_t i = 0; i < blockList.size(); ++i )
+    {
+        scheduleBlockLoads( blockList[i].first, blockList[i].second, &loadJobs );
+    }
+    tractSetPipeline pipeline( *this, loadJobs, m_prefetchDepth, m_cacheBytes );
 
-                // printout progress
-                progress = ( blockProgress * 100.) / totalSubBlocks;
-                progressInt = progress;
+    // loop through the distance matrix blocks
+    for( size_t blockIndex = 0; blockIndex < blockList.size(); ++blockIndex )
+    {
+        const size_t row( blockList[blockIndex].first ), column( blockList[blockIndex].second );
+        std::pair< dist_t, dist_t > blockMinMax = computeDistBlock( row, column, &pipeline );
 
-                currentTime = ( time( NULL ) );
-                elapsedTime = ( difftime( currentTime, distmatStartTime ) );
-                expectedRemain = ( elapsedTime * ( ( 100.-progress ) / progress ));
+        if( blockMinMax.first < minValue )
+        {
+            minValue = blockMinMax.first;
+        }
+        if( blockMinMax.second > maxValue )
+        {
+            maxValue = blockMinMax.second;
+        }
+        //update progress (number of subblocks computed)
+        if( row == column )
+        {
+            blockProgress += ( m_subBlocksPerBlock * ( m_subBlocksPerBlock + 1) / 2 );
+        }
+        else
+        {
+            blockProgress += m_subBlocksPerBlock * m_subBlocksPerBlock;
+        }
 
-                std::stringstream message;
-                message << "\rCompleted block " << row << "-" << column << ". " << progressInt <<  "% completed (" << blockProgress << " of " << totalSubBlocks << " sub-blocks). ";
-                message << "Elapsed: " << elapsedTime/3600 <<"h "<<  (elapsedTime%3600)/60 <<"' "<< ((elapsedTime%3600)%60) <<"\". ";
-                message << "Remaining: "<< expectedRemain/3600 <<"h "<<  (expectedRemain%3600)/60 <<"' "<< ((expectedRemain%3600)%60) <<"\"           ";
-                std::cout << message.str() <<std::endl;
 
-            }
+        if( m_verbose )
+        {
+            currentTime = (time(NULL));
+
+            // printout progress
+            progress = ( blockProgress * 100.) / totalSubBlocks;
+            progressInt = progress;
+
+            currentTime = ( time( NULL ) );
+            elapsedTime = ( difftime( currentTime, distmatStartTime ) );
+            expectedRemain = ( elapsedTime * ( ( 100.-progress ) / progress ));
+
+            std::stringstream message;
+            message << "\rCompleted block " << row << "-" << column << ". " << progressInt <<  "% completed (" << blockProgress << " of " << totalSubBlocks << " sub-blocks). ";
+            message << "Elapsed: " << elapsedTime/3600 <<"h "<<  (elapsedTime%3600)/60 <<"' "<< ((elapsedTime%3600)%60) <<"\". ";
+            message << "Remaining: "<< expectedRemain/3600 <<"h "<<  (expectedRemain%3600)/60 <<"' "<< ((expectedRemain%3600)%60) <<"\"           ";
+            std::cout << message.str() <<std::endl;
+
         }
     }
 
@@ -385,10 +698,231 @@ void distMatComputer::doDistBlocks()
     std::cout << "100% of blocks completed (" << totalBlocks << " of matrix total " << (m_blocksPerRow*(m_blocksPerRow+1))/2. << "). ";
     std::cout << "Elapsed time: " << elapsedTime/3600 <<"h "<<  (elapsedTime%3600)/60 <<"' "<< ((elapsedTime%3600)%60) <<"\". " << std::endl;
     std::cout<<"Total MAX value: "<< maxValue <<". Total min value: "<< minValue <<std::endl;
+    {
+        // report tractogram I/O volume: without set reuse every request would be read from disk, at best every seed is read once
+        size_t runSeeds( m_coordinates.size() - std::min( blockList.front().first, blockList.back().first ) * m_blockSize );
+        std::cout << "Tractograms read: " << pipeline.readTracts() << " (" << pipeline.readTracts() / ( double )runSeeds << " per seed). ";
+        std::cout << "Without set reuse: " << pipeline.requestedTracts() << " (" << pipeline.requestedTracts() / ( double )runSeeds << " per seed)." << std::endl;
+    }
+    if( m_verbose )
+    {
+        std::cout << "Time spent waiting for tractogram sets: " << ( size_t )pipeline.waitSeconds() << " s. (" << pipeline.taken() << " sets taken)" << std::endl;
+    }
 
 }// end "doDistBlocks()" -----------------------------------------------------------------
 
 
+size_t distMatComputer::blockCost( const size_t row, const size_t column ) const
+{
+    const size_t rowSize( std::min( ( row + 1 ) * m_blockSize, m_coordinates.size() ) - row * m_blockSize );
+    const size_t columnSize( std::min( ( column + 1 ) * m_blockSize, m_coordinates.size() ) - column * m_blockSize );
+    if( row == column )
+    {
+        return rowSize * ( rowSize + 1 ) / 2;
+    }
+    return rowSize * columnSize;
+}// end "blockCost()" -----------------------------------------------------------------
+
+void distMatComputer::shardBlocks( std::vector< std::pair< size_t, size_t > >* blockListPointer ) const
+{
+    std::vector< std::pair< size_t, size_t > >& blockList( *blockListPointer );
+    blockList.clear();
+
+    double totalCost( 0 );
+    for( size_t row = 0; row < m_blocksPerRow; ++row )
+    {
+        for( size_t column = row; column < m_blocksPerRow; ++column )
+        {
+            totalCost += blockCost( row, column );
+        }
+    }
+
+    double shardCost( 0 ), previousCost( 0 );
+    for( size_t row = 0; row < m_blocksPerRow; ++row )
+    {
+        for( size_t column = row; column < m_blocksPerRow; ++column )
+        {
+            const double cost( blockCost( row, column ) );
+            const size_t shard( std::min( ( size_t )( ( previousCost + cost / 2 ) * m_shardCount / totalCost ), m_shardCount - 1 ) );
+            if( shard == m_shardIndex )
+            {
+                blockList.push_back( std::make_pair( row, column ) );
+                shardCost += cost;
+            }
+            previousCost += cost;
+        }
+    }
+
+    if( m_verbose )
+    {
+        std::cout << "Shard " << m_shardIndex << " of " << m_shardCount << ": " << blockList.size() << " blocks, ";
+        std::cout << ( 100. * shardCost ) / totalCost << " % of the matrix computation" << std::endl;
+    }
+}// end "shardBlocks()" -----------------------------------------------------------------
+
+void distMatComputer::writeShardManifest( const std::vector< std::pair< size_t, size_t > >& blockList ) const
+{
+    std::string manifestFilename( m_outputFolder + "/" + str( boost::format( SHARD_MANIFEST_FNAME ) % m_shardIndex ) );
+    std::ofstream outFileStream( manifestFilename.c_str() );
+    if( !outFileStream )
+    {
+        std::cerr << "ERROR: unable to open output shard manifest file: \"" << manifestFilename << "\"" << std::endl;
+        throw std::runtime_error("ERROR: unable to open output shard manifest file");
+    }
+
+    if( m_verbose )
+    {
+        std::cout<< "Writing shard manifest file in \""<< manifestFilename <<"\""<< std::endl;
+    }
+
+    outFileStream << "#distshard" << std::endl;
+    outFileStream << "shard " << m_shardIndex << " " << m_shardCount << std::endl;
+    outFileStream << "seeds " << m_coordinates.size() << std::endl;
+    outFileStream << "blocksize " << m_blockSize << std::endl;
+    outFileStream << "#enddistshard" << std::endl;
+
+    outFileStream << "#blocks" << std::endl;
+    for( size_t i = 0; i < blockList.size(); ++i )
+    {
+        outFileStream << boost::format( "%03d %03d" ) % blockList[i].first % blockList[i].second;
+        outFileStream << " " << blockCost( blockList[i].first, blockList[i].second ) << std::endl;
+    }
+    outFileStream << "#endblocks" << std::endl;
+}// end "writeShardManifest()" -----------------------------------------------------------------
+
+bool distMatComputer::hasShardManifests() const
+{
+    const std::string manifestPattern( SHARD_MANIFEST_FNAME );
+    const std::string manifestPrefix( manifestPattern.substr( 0, manifestPattern.find( '%' ) ) );
+    for( boost::filesystem::directory_iterator fileIter( m_outputFolder ); fileIter != boost::filesystem::directory_iterator(); ++fileIter )
+    {
+        if( fileIter->path().filename().string().compare( 0, manifestPrefix.size(), manifestPrefix ) == 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}// end "hasShardManifests()" -----------------------------------------------------------------
+
+std::string distMatComputer::journalFilename() const
+{
+    return m_outputFolder + "/" + str( boost::format( JOURNAL_FNAME ) % m_shardIndex );
+}// end "journalFilename()" -----------------------------------------------------------------
+
+std::vector< std::string > distMatComputer::journalHeader() const
+{
+    std::vector< std::string > header;
+    header.push_back( "#distjournal" );
+    header.push_back( "seeds " + boost::lexical_cast< std::string >( m_coordinates.size() ) );
+    header.push_back( "blocksize " + boost::lexical_cast< std::string >( m_blockSize ) );
+    header.push_back( "threshold " + boost::lexical_cast< std::string >( m_tractThreshold ) );
+    header.push_back( "logfactor " + boost::lexical_cast< std::string >( m_logFactor ) );
+    header.push_back( "#enddistjournal" );
+    return header;
+}// end "journalHeader()" -----------------------------------------------------------------
+
+void distMatComputer::readJournal( std::map< std::pair< size_t, size_t >, blockRecord >* recordsPointer ) const
+{
+    std::map< std::pair< size_t, size_t >, blockRecord >& records( *recordsPointer );
+    records.clear();
+    const std::string filename( journalFilename() );
+    const std::vector< std::string > header( journalHeader() );
+
+    bool validJournal( false );
+    WFileParser journalParser( filename );
+    if( journalParser.readFile() )
+    {
+        std::vector< std::string > journalLines( journalParser.getRawLines() );
+        validJournal = ( journalLines.size() >= header.size() && std::equal( header.begin(), header.end(), journalLines.begin() ) );
+        if( !validJournal )
+        {
+            std::cerr << "WARNING: journal file \"" << filename << "\" was written with different parameters, starting a new journal" << std::endl;
+        }
+        for( size_t i = header.size(); validJournal && i < journalLines.size(); ++i )
+        {
+            // a record cut short by an interrupted run is either unreadable or has a wrong checksum, in both cases the block is computed again
+            std::stringstream lineStream( journalLines[i] );
+            std::string tag;
+            size_t row( 0 ), column( 0 );
+            blockRecord record;
+            if( ( lineStream >> tag >> row >> column >> record.minValue >> record.maxValue >> record.checksum ) && tag == "block" )
+            {
+                records[ std::make_pair( row, column ) ] = record;
+            }
+        }
+    }
+
+    if( !validJournal )
+    {
+        std::ofstream outFileStream( filename.c_str() );
+        if( !outFileStream )
+        {
+            std::cerr << "ERROR: unable to open journal file: \"" << filename << "\"" << std::endl;
+            throw std::runtime_error("ERROR: unable to open journal file");
+        }
+        for( size_t i = 0; i < header.size(); ++i )
+        {
+            outFileStream << header[i] << std::endl;
+        }
+    }
+    else if( m_verbose )
+    {
+        std::cout << "Read " << records.size() << " block records from journal file \"" << filename << "\"" << std::endl;
+    }
+}// end "readJournal()" -----------------------------------------------------------------
+
+bool distMatComputer::checkJournalBlock( const size_t row, const size_t column, const blockRecord& record ) const
+{
+    fileManagerFactory blockFMF( m_outputFolder );
+    fileManager& blockFM( blockFMF.getFM() );
+    std::string blockFilename( blockFM.getBlockFilename( row, column ) );
+    if( !boost::filesystem::exists( blockFilename ) && !boost::filesystem::exists( blockFilename + ".gz" ) )
+    {
+        return false;
+    }
+    std::vector< std::vector< dist_t > > blockValues;
+    try
+    {
+        blockFM.readDistBlock( row, column, &blockValues );
+    }
+    catch( std::runtime_error& except )
+    {
+        return false;
+    }
+    return ( blockChecksum( blockValues ) == record.checksum );
+}// end "checkJournalBlock()" -----------------------------------------------------------------
+
+void distMatComputer::writeJournalRecord( const size_t row, const size_t column, const blockRecord& record ) const
+{
+    std::ofstream outFileStream( journalFilename().c_str(), std::ios_base::app );
+    if( !outFileStream )
+    {
+        std::cerr << "ERROR: unable to open journal file: \"" << journalFilename() << "\"" << std::endl;
+        throw std::runtime_error("ERROR: unable to open journal file");
+    }
+    outFileStream << "block " << row << " " << column << " " << std::setprecision( 9 ) << record.minValue << " " << record.maxValue << " " << record.checksum << std::endl;
+}// end "writeJournalRecord()" -----------------------------------------------------------------
+
+uint64_t distMatComputer::blockChecksum( const std::vector< std::vector< dist_t > >& blockValues ) const
+{
+    uint64_t checksum( 14695981039346656037ULL );
+    for( size_t i = 0; i < blockValues.size(); ++i )
+    {
+        if( blockValues[i].empty() )
+        {
+            continue;
+        }
+        const unsigned char* bytes( reinterpret_cast< const unsigned char* >( &blockValues[i][0] ) );
+        const size_t rowBytes( blockValues[i].size() * sizeof( dist_t ) );
+        for( size_t j = 0; j < rowBytes; ++j )
+        {
+            checksum ^= bytes[j];
+            checksum *= 1099511628211ULL;
+        }
+    }
+    return checksum;
+}// end "blockChecksum()" -----------------------------------------------------------------
+
 void distMatComputer::computeNorms()
 {
     // loop  through all the seed voxels and compute tractogram norms
@@ -465,7 +999,7 @@ void distMatComputer::computeNorms()
 } // end distMatComputer::computeNorms() -------------------------------------------------------------------------------------
 
 
-std::pair< dist_t, dist_t > distMatComputer::computeDistBlock( const size_t row, const size_t column ) const
+std::pair< dist_t, dist_t > distMatComputer::computeDistBlock( const size_t row, const size_t column, tractSetPipeline* pipelinePointer ) const
 {
     // variables for progress printout
     size_t blockProgress(0), progressInt(0), totalSubBlocks( 0 );
@@ -524,54 +1058,22 @@ std::pair< dist_t, dist_t > distMatComputer::computeDistBlock( const size_t row,
         distBlockValues.swap( blockTemp );
     }
 
-    // loop over sub block rows
-    for( size_t subRow = 0; subRow < m_subBlocksPerBlock; ++subRow )
-    {
-        size_t firstSubRowSeedPos( subRow * m_subBlockSize ), postlastSubRowSeedPos( ( subRow + 1 ) * m_subBlockSize );
-        if ( postlastSubRowSeedPos > thisBlockRowSize )
-        {
-            postlastSubRowSeedPos = thisBlockRowSize;
-        }
-        std::vector< double > subRowNorms( m_leafNorms.begin()+firstRowSeedID+firstSubRowSeedPos,  m_leafNorms.begin()+firstRowSeedID+postlastSubRowSeedPos );
-
+    // loop over sub blocks (sub-rows in order, sub-columns in snake order)
+    std::vector< std::pair< size_t, size_t > > subBlocks;
+    subBlockOrder( row, column, &subBlocks );
+    boost::shared_ptr< const tractSet > rowTracts;
+    std::vector< double > subRowNorms;
+    size_t firstSubRowSeedPos( 0 );
 
-        if( m_verbose )
-        {
-            if ( m_subBlocksPerBlock > 1 )
-            {
-                progress = blockProgress * 100. / totalSubBlocks;
-                progressInt = progress;
-                std::cout << blockMessage << progressInt << "% complete. ";
-                std::cout << "Loading sub-row " << subRow << " tracts..." << std::flush;
-            }
-            else
-            {
-                std::cout << " Loading row tracts..." << std::flush;
-            }
-        }
-
-
-        //load row tracts
-        unsigned char* rowTracts;
-        loadTractSet( blockRowIDs[firstSubRowSeedPos], blockRowIDs[postlastSubRowSeedPos-1]+1, &rowTracts, false );
-        if( m_verbose )
-        {
-            std::cout << "Done. " << std::flush;
-
-        }
+    for( size_t subBlock = 0; subBlock < subBlocks.size(); ++subBlock )
+    {
+        const size_t subRow( subBlocks[subBlock].first ), subColumn( subBlocks[subBlock].second );
 
-        // loop over sub block columns
-        for( size_t subColumn = 0; subColumn < m_subBlocksPerBlock; ++subColumn )
+        if( subBlock == 0 || subRow != subBlocks[subBlock-1].first )
         {
-
-            size_t firstSubColumnSeedPos( subColumn * m_subBlockSize ), postlastSubColumnSeedPos( ( subColumn + 1 ) * m_subBlockSize );
-            if ( postlastSubColumnSeedPos > thisBlockColumnSize )
-            {
-                postlastSubColumnSeedPos = thisBlockColumnSize;
-            }
-            size_t subBlockColumnSize( postlastSubColumnSeedPos - firstSubColumnSeedPos );
-            std::vector< double > subColumnNorms( m_leafNorms.begin()+firstColumnSeedID+firstSubColumnSeedPos,  m_leafNorms.begin()+firstColumnSeedID+postlastSubColumnSeedPos );
-
+            firstSubRowSeedPos = subRow * m_subBlockSize;
+            size_t postlastSubRowSeedPos( std::min( ( subRow + 1 ) * m_subBlockSize, thisBlockRowSize ) );
+            subRowNorms.assign( m_leafNorms.begin()+firstRowSeedID+firstSubRowSeedPos,  m_leafNorms.begin()+firstRowSeedID+postlastSubRowSeedPos );
 
             if( m_verbose )
             {
@@ -579,62 +1081,69 @@ std::pair< dist_t, dist_t > distMatComputer::computeDistBlock( const size_t row,
                 {
                     progress = blockProgress * 100. / totalSubBlocks;
                     progressInt = progress;
-                    std::cout << blockMessage << progressInt << "% complete. Sub-block " << subRow << "-" << subColumn <<". ";
-                }
-                std::cout << " Loading column tracts..." << std::flush;
-            }
-
-            unsigned char* colTracts;
-            if( row == column )
-            {
-                // if its a block in the diagonal do not compute sub-blocks under the diagonal
-                if( subRow > subColumn )
-                {
-                    continue;
-                }
-                else if( subRow == subColumn )
-                {
-                    // if its a sub-block in the diagonal sets are equal
-                    transposeSet( subBlockColumnSize, rowTracts, &colTracts );
+                    std::cout << blockMessage << progressInt << "% complete. ";
+                    std::cout << "Loading sub-row " << subRow << " tracts..." << std::flush;
                 }
                 else
                 {
-                    // load tractograms in transposed position
-                    loadTractSet( blockColumnIDs[firstSubColumnSeedPos], blockColumnIDs[postlastSubColumnSeedPos-1]+1, &colTracts, true );
+                    std::cout << " Loading row tracts..." << std::flush;
                 }
             }
-            else
+
+            //get row tracts (prepared in advance by the prefetch pipeline)
+            tractSetJob rowJob = { blockRowIDs[firstSubRowSeedPos], blockRowIDs[postlastSubRowSeedPos-1]+1, false };
+            rowTracts = pipelinePointer->next( rowJob );
+            if( m_verbose )
             {
-                // load tractograms in transposed position
-                loadTractSet( blockColumnIDs[firstSubColumnSeedPos], blockColumnIDs[postlastSubColumnSeedPos-1]+1, &colTracts, true );
+                std::cout << "Done. " << std::flush;
+
             }
+        }
+
+        size_t firstSubColumnSeedPos( subColumn * m_subBlockSize ), postlastSubColumnSeedPos( ( subColumn + 1 ) * m_subBlockSize );
+        if ( postlastSubColumnSeedPos > thisBlockColumnSize )
+        {
+            postlastSubColumnSeedPos = thisBlockColumnSize;
+        }
+        std::vector< double > subColumnNorms( m_leafNorms.begin()+firstColumnSeedID+firstSubColumnSeedPos,  m_leafNorms.begin()+firstColumnSeedID+postlastSubColumnSeedPos );
 
 
-            if( m_verbose )
+        if( m_verbose )
+        {
+            if ( m_subBlocksPerBlock > 1 )
             {
-                if ( m_subBlocksPerBlock > 1 )
-                {
-                    progress = blockProgress * 100. / totalSubBlocks;
-                    progressInt = progress;
-                    std::cout << blockMessage << progressInt << "% complete. Sub-block " << subRow << "-" << subColumn <<". ";
-                }
-                std::cout << " Computing distances..." << std::flush;
+                progress = blockProgress * 100. / totalSubBlocks;
+                progressInt = progress;
+                std::cout << blockMessage << progressInt << "% complete. Sub-block " << subRow << "-" << subColumn <<". ";
             }
+            std::cout << " Loading column tracts..." << std::flush;
+        }
 
+        // get tractograms in transposed position
+        tractSetJob columnJob = { blockColumnIDs[firstSubColumnSeedPos], blockColumnIDs[postlastSubColumnSeedPos-1]+1, true };
+        boost::shared_ptr< const tractSet > colTracts( pipelinePointer->next( columnJob ) );
 
-            computeDistances( subRowNorms, rowTracts, subColumnNorms, colTracts, &distBlockValues, firstSubRowSeedPos, firstSubColumnSeedPos );
-            if( m_verbose )
+
+        if( m_verbose )
+        {
+            if ( m_subBlocksPerBlock > 1 )
             {
-                std::cout << "Done. " << std::flush;
+                progress = blockProgress * 100. / totalSubBlocks;
+                progressInt = progress;
+                std::cout << blockMessage << progressInt << "% complete. Sub-block " << subRow << "-" << subColumn <<". ";
             }
-            ++blockProgress;
+            std::cout << " Computing distances..." << std::flush;
+        }
+
 
-            // cleanup
-            delete [] colTracts;
+        computeDistances( subRowNorms, rowTracts->sparseSet, subColumnNorms, &colTracts->denseSet[0], &distBlockValues, firstSubRowSeedPos, firstSubColumnSeedPos );
+        if( m_verbose )
+        {
+            std::cout << "Done. " << std::flush;
         }
-        // cleanup
-        delete [] rowTracts;
+        ++blockProgress;
     }
+    rowTracts.reset();
 
 
     // get min and max values
@@ -678,6 +1187,10 @@ std::pair< dist_t, dist_t > distMatComputer::computeDistBlock( const size_t row,
         blockFM.storeUnzipped();
     }
     blockFM.writeDistBlock( row, column, distBlockValues );
+
+    // record the completed block in the journal
+    blockRecord record = { minValue, maxValue, blockChecksum( distBlockValues ) };
+    writeJournalRecord( row, column, record );
     if( m_verbose )
     {
         std::cout << "Done." << std::flush;
@@ -691,6 +1204,54 @@ std::pair< dist_t, dist_t > distMatComputer::computeDistBlock( const size_t row,
     return std::make_pair< dist_t, dist_t >( minValue, maxValue );
 }// end "computeDistBlock()" -----------------------------------------------------------------
 
+void distMatComputer::scheduleBlockLoads( const size_t row, const size_t column, std::vector< tractSetJob >* jobsPointer ) const
+{
+    std::vector< tractSetJob >& jobs( *jobsPointer );
+    const size_t firstRowSeedID( row * m_blockSize ), postlastRowSeedID( std::min( ( row + 1 ) * m_blockSize, m_coordinates.size() ) );
+    const size_t firstColumnSeedID( column * m_blockSize ), postlastColumnSeedID( std::min( ( column + 1 ) * m_blockSize, m_coordinates.size() ) );
+
+    std::vector< std::pair< size_t, size_t > > subBlocks;
+    subBlockOrder( row, column, &subBlocks );
+    for( size_t subBlock = 0; subBlock < subBlocks.size(); ++subBlock )
+    {
+        const size_t subRow( subBlocks[subBlock].first ), subColumn( subBlocks[subBlock].second );
+        if( subBlock == 0 || subRow != subBlocks[subBlock-1].first )
+        {
+            const size_t firstSubRowSeedID( firstRowSeedID + subRow * m_subBlockSize );
+            tractSetJob rowJob = { firstSubRowSeedID, std::min( firstSubRowSeedID + m_subBlockSize, postlastRowSeedID ), false };
+            jobs.push_back( rowJob );
+        }
+        const size_t firstSubColumnSeedID( firstColumnSeedID + subColumn * m_subBlockSize );
+        tractSetJob columnJob = { firstSubColumnSeedID, std::min( firstSubColumnSeedID + m_subBlockSize, postlastColumnSeedID ), true };
+        jobs.push_back( columnJob );
+    }
+    return;
+}// end "scheduleBlockLoads()" -----------------------------------------------------------------
+
+void distMatComputer::subBlockOrder( const size_t row, const size_t column, std::vector< std::pair< size_t, size_t > >* subBlocksPointer ) const
+{
+    std::vector< std::pair< size_t, size_t > >& subBlocks( *subBlocksPointer );
+    subBlocks.clear();
+    const size_t thisBlockRowSize( std::min( ( row + 1 ) * m_blockSize, m_coordinates.size() ) - row * m_blockSize );
+    const size_t thisBlockColumnSize( std::min( ( column + 1 ) * m_blockSize, m_coordinates.size() ) - column * m_blockSize );
+
+    // the last block of the matrix may be smaller than the others and have less sub-blocks
+    const size_t subRows( ( thisBlockRowSize + m_subBlockSize - 1 ) / m_subBlockSize );
+    const size_t subColumns( ( thisBlockColumnSize + m_subBlockSize - 1 ) / m_subBlockSize );
+
+    for( size_t subRow = 0; subRow < subRows; ++subRow )
+    {
+        // if its a block in the diagonal do not compute sub-blocks under the diagonal
+        const size_t firstSubColumn( ( row == column ) ? subRow : 0 );
+        for( size_t i = firstSubColumn; i < subColumns; ++i )
+        {
+            const size_t subColumn( ( subRow % 2 == 0 ) ? i : subColumns - 1 - ( i - firstSubColumn ) );
+            subBlocks.push_back( std::make_pair( subRow, subColumn ) );
+        }
+    }
+    return;
+}// end "subBlockOrder()" -----------------------------------------------------------------
+
 void distMatComputer::writeIndex() const
 {
     std::vector< std::pair< size_t, size_t > > roiBlockIndex;
@@ -737,142 +1298,144 @@ void distMatComputer::writeIndex() const
 
 }// end "writeIndex()" -----------------------------------------------------------------
 
-void distMatComputer::computeDistances( const std::vector< double >& rowNorms, const unsigned char* rowTractSet,
+void distMatComputer::computeDistances( const std::vector< double >& rowNorms, const std::vector< sparseTract >& rowTractSet,
                                         const std::vector< double >& columnNorms, const unsigned char* columnTractSet,
                                         std::vector< std::vector< dist_t > >* distBlockPointer,
                                         const size_t blockRowOffset, const size_t blockColumnOffset ) const
 {
 
     std::vector< std::vector< dist_t > >& distBlockValues( *distBlockPointer );
-    size_t rowBlockSize( rowNorms.size() ), columnBlockSize( columnNorms.size() );
+    const size_t rowBlockSize( rowNorms.size() ), columnBlockSize( columnNorms.size() );
+    const size_t rowTileSize( DIST_ROW_TILE ), columnTileSize( DIST_COLUMN_TILE );
+    const size_t rowTiles( ( rowBlockSize + rowTileSize - 1 ) / rowTileSize );
+    const size_t columnTiles( ( columnBlockSize + columnTileSize - 1 ) / columnTileSize );
 
-    #pragma omp parallel for // loop through tractograms (use parallel threads)
-    for(size_t i=0 ; i<rowBlockSize ; ++i)
+    #pragma omp parallel
     {
-        // if a norm is 0 then distance is 1
-        if (rowNorms[i]!=0.)
+        // accumulators are allocated once per thread and reused for every tile
+        std::vector< uint32_t > accumulator( columnTileSize, 0 );
+        std::vector< uint64_t > dotProducts( columnTileSize, 0 );
+        const unsigned char* columns[4];
+        uint32_t weights[4];
+
+        #pragma omp for schedule( dynamic ) // loop through tiles (use parallel threads)
+        for( size_t tile = 0; tile < rowTiles * columnTiles; ++tile )
         {
-            double* dotprodArray = new double[ columnBlockSize ];
+            const size_t firstRow( ( tile / columnTiles ) * rowTileSize );
+            const size_t postLastRow( std::min( firstRow + rowTileSize, rowBlockSize ) );
+            const size_t firstColumn( ( tile % columnTiles ) * columnTileSize );
+            const size_t tileWidth( std::min( columnTileSize, columnBlockSize - firstColumn ) );
+            const unsigned char* columnTile( columnTractSet + firstColumn );
 
-            //initialize
-            for(size_t init=0; init < columnBlockSize; ++init)
+            for( size_t i = firstRow; i < postLastRow; ++i )
             {
-                    dotprodArray[init]=0;
-            }
-
-            size_t rowTractArrayOffset( i * m_trackSize );
-            double value1( 0 );
-            size_t k(0), j(0);
-            const unsigned char* p_value2;
-            double* p_result;
+                dist_t* distRow( &distBlockValues[blockRowOffset+i][blockColumnOffset+firstColumn] );
 
-            for(k=0 ; k<m_trackSize ; ++k)
-            {
+                // if a norm is 0 then distance is 1
+                if( rowNorms[i] == 0. )
+                {
+                    std::fill( distRow, distRow + tileWidth, 1 );
+                    continue;
+                }
 
-                p_result = dotprodArray;
+                std::fill( accumulator.begin(), accumulator.begin() + tileWidth, 0 );
+                std::fill( dotProducts.begin(), dotProducts.begin() + tileWidth, 0 );
 
-                value1 = rowTractSet[rowTractArrayOffset+k];
-                if (value1)
+                // only the stored (non-zero) row entries contribute, they are fed to the kernel four at a time
+                const std::vector< uint16_t >& rowGaps( rowTractSet[i].indexGaps() );
+                const std::vector< unsigned char >& rowValues( rowTractSet[i].values() );
+                size_t k( 0 ), slot( 0 ), calls( 0 );
+                for( size_t entry = 0; entry < rowValues.size(); ++entry )
                 {
-                    p_value2 = columnTractSet + ( k * columnBlockSize );
-
-                    for (j=0 ; j<columnBlockSize ;++j)
+                    k += rowGaps[entry];
+                    if( rowValues[entry] == 0 )
                     {
-
-                        *(p_result++) += *(p_value2++) * value1;
+                        continue;
+                    }
+                    columns[slot] = columnTile + ( k * columnBlockSize );
+                    weights[slot] = rowValues[entry];
+                    if( ++slot == 4 )
+                    {
+                        tract_kernels::multiplyAccumulate( columns, weights, &accumulator[0], tileWidth );
+                        slot = 0;
+                        if( ++calls == tract_kernels::MAC_FLUSH_CALLS )
+                        {
+                            for( size_t j = 0; j < tileWidth; ++j )
+                            {
+                                dotProducts[j] += accumulator[j];
+                                accumulator[j] = 0;
+                            }
+                            calls = 0;
+                        }
                     }
                 }
-            }
-
-            for (j=0 ; j<columnBlockSize ;++j)
-            {
-
-                double vprod(0);
-
-                if (columnNorms[j]!=0.)
+                if( slot > 0 )
                 {
-                    vprod = dotprodArray[j]/(rowNorms[i] * columnNorms[j]);
+                    for( ; slot < 4; ++slot )
+                    {
+                        columns[slot] = columns[0];
+                        weights[slot] = 0;
+                    }
+                    tract_kernels::multiplyAccumulate( columns, weights, &accumulator[0], tileWidth );
                 }
 
-                //insert value in distance matrix
-                distBlockValues[blockRowOffset+i][blockColumnOffset+j] = 1 - (vprod);
-            }
+                for( size_t j = 0; j < tileWidth; ++j )
+                {
+                    double vprod( 0 );
+                    const double columnNorm( columnNorms[firstColumn+j] );
 
+                    if( columnNorm != 0. )
+                    {
+                        vprod = ( dotProducts[j] + accumulator[j] ) / ( rowNorms[i] * columnNorm );
+                    }
 
-            delete [] dotprodArray;
-        }
-        else
-        {
-            for (int j=0 ; j<columnBlockSize ;++j)
-            {
-                distBlockValues[blockRowOffset+i][blockColumnOffset+j] = 1;
+                    //insert value in distance matrix
+                    distRow[j] = 1 - ( vprod );
+                }
             }
         }
     }
 
 }// end "computeDistances()" -----------------------------------------------------------------
 
-void distMatComputer::loadTractSet( const size_t firstID, const size_t postLastID, unsigned char** tractSetPtr, const bool transposed ) const
+void distMatComputer::loadTractSet( const size_t firstID, const size_t postLastID, std::vector< sparseTract >* tractSetPtr ) const
 {
-    const size_t setSize( postLastID - firstID  );
-    *tractSetPtr = new unsigned char [ m_trackSize * setSize ];
-    unsigned char* tractSet = *tractSetPtr;
-
-    for( size_t i = 0; i <  m_trackSize * setSize; ++i )
-    {
-        tractSet[i]=0;
-    }
+    std::vector< sparseTract >& tractSet( *tractSetPtr );
+    tractSet.clear();
+    tractSet.resize( postLastID - firstID );
 
     fileManagerFactory tractFMF( m_inputFolder );
     fileManager& tractFM( tractFMF.getFM() );
     tractFM.readAsLog();
     tractFM.readAsUnThres();
 
-    size_t setOffset(0);
     for(size_t i = firstID; i < postLastID; ++i )
     {
-
         compactTractChar tract;
         tractFM.readLeafTract( i, m_trackids, m_coordinates, &tract );
         tract.threshold( m_tractThreshold );
-        std::vector< unsigned char > tractValues( tract.tract() );
-        if( transposed )
-        {
-            for( size_t tractPos = 0; tractPos < m_trackSize; ++tractPos )
-            {
-                tractSet[ ( tractPos * setSize ) + setOffset ] = tractValues[ tractPos ];
-            }
-        }
-        else
-        {
-            for( size_t tractPos = 0; tractPos < m_trackSize; ++tractPos )
-            {
-                tractSet[ tractPos + ( setOffset * m_trackSize) ] = tractValues[ tractPos ];
-            }
-        }
-        ++setOffset;
+        sparseTract sparse( tract );
+        tractSet[ i - firstID ].steal( &sparse );
     }
     return;
 }
 
-void distMatComputer::transposeSet( const size_t setSize, const unsigned char* originalSet, unsigned char** transposedSetPtr ) const
+void distMatComputer::transposeSet( const std::vector< sparseTract >& originalSet, std::vector< unsigned char >* transposedSetPtr ) const
 {
-    *transposedSetPtr = new unsigned char [ m_trackSize * setSize ];
-    unsigned char* transposedSet = *transposedSetPtr;
-
-    for( size_t i = 0; i <  m_trackSize * setSize; ++i )
-    {
-        transposedSet[i] = 0;
-    }
+    const size_t setSize( originalSet.size() );
+    std::vector< unsigned char >& transposedSet( *transposedSetPtr );
+    transposedSet.assign( m_trackSize * setSize, 0 );
 
     for(size_t setOffset = 0; setOffset < setSize; ++setOffset )
     {
-        for( size_t tractPos = 0; tractPos < m_trackSize; ++tractPos )
+        const std::vector< uint16_t >& gaps( originalSet[setOffset].indexGaps() );
+        const std::vector< unsigned char >& values( originalSet[setOffset].values() );
+        size_t tractPos( 0 );
+        for( size_t entry = 0; entry < values.size(); ++entry )
         {
-            transposedSet[ ( tractPos * setSize ) + setOffset ] = originalSet[ tractPos + (setOffset * m_trackSize) ];
+            tractPos += gaps[entry];
+            transposedSet[ ( tractPos * setSize ) + setOffset ] = values[entry];
         }
     }
     return;
 }
-
-
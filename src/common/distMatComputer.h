@@ -8,11 +8,18 @@
 #include <cstdio>
 #include <algorithm>
 #include <utility>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdint.h>
 #include <boost/random/uniform_01.hpp>
 #include <boost/random/normal_distribution.hpp>
 #include <boost/random/bernoulli_distribution.hpp>
 #include <boost/random/mersenne_twister.hpp>
 #include <boost/random/variate_generator.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/filesystem.hpp>
 
 
 
@@ -24,12 +31,32 @@
 #include "WHcoord.h"
 #include "fileManagerFactory.h"
 #include "compactTract.h"
+#include "sparseTract.h"
 #include "roiLoader.h"
 #include "WStringUtils.h"
+#include "WFileParser.h"
+#include "tractSetPipeline.h"
 
 
 #define MIN_BLOCK_SIZE 500
 #define MIN_SUB_BLOCK_SIZE 10
+#define DEFAULT_PREFETCH_DEPTH 2
+#define TRACT_BUFFER_SHARE 0.5   // share of the tractogram memory used for the sets of the sub-block being computed (the rest is used for the set cache)
+#define SPARSE_SIZE_SAMPLE 100   // number of tractograms sampled to estimate the sparse tractogram size
+#define DIST_ROW_TILE 16        // rows of a sub-block computed together (they share the column tile data in cache)
+#define DIST_COLUMN_TILE 2048   // columns of a sub-block computed together (the integer accumulators of a row tile stay in L1 cache)
+#define SHARD_MANIFEST_FNAME "dist_shard_%03d.txt" // manifest with the blocks assigned to a shard of a multi-process run
+#define JOURNAL_FNAME "dist_journal_%03d.txt"      // journal of the blocks completed by a shard (or by a non-sharded run), used to resume interrupted runs
+
+/**
+ * Journal record of a completed distance block
+ */
+struct blockRecord
+{
+    dist_t minValue;    //!< minimum distance value of the block
+    dist_t maxValue;    //!< maximum distance value of the block
+    uint64_t checksum;  //!< checksum of the block distance values (as returned by distMatComputer::blockChecksum())
+};
 
 /**
  * This class computes a distance matrix from compact probabilistic tracts
@@ -82,6 +109,12 @@ public:
      */
     inline bool ready() const { return m_ready2go; }
 
+    /**
+     * sets the buffer depth of the tractogram set prefetch pipeline. Must be called before setBlockSize(), as every buffer counts against the memory budget
+     * \param depth the buffer depth (1: no prefetching, sets are loaded on demand; 2: double buffering; 3: triple buffering...)
+     */
+    inline void setPrefetchDepth( size_t depth ) { m_prefetchDepth = ( depth < 1 ) ? 1 : depth; }
+
     /**
      * sets the the zip flag in order to zip the files upon writing
      */
@@ -115,12 +148,30 @@ public:
      */
     void setFinishBlock( size_t finish_row, size_t finish_column );
 
+    /**
+     * Restricts the computation to one shard of the matrix, so that several processes (i.e. on different cluster nodes sharing a filesystem) can compute it together.
+     * The upper-triangle blocks are split in shardCount contiguous ranges of similar estimated cost (diagonal blocks count half),
+     * starting and finishing blocks are ignored. Only shard 0 writes the matrix index file, every shard writes a manifest with its blocks
+     * \param shardIndex index of the shard to be computed by this process [0,shardCount)
+     * \param shardCount total number of shards the matrix is divided in
+     */
+    void setShard( size_t shardIndex, size_t shardCount );
+
+    /**
+     * Checks that the distance matrix in the output folder is complete and consistent: the index file must match the seed voxel list,
+     * every upper-triangle block must exist with the dimensions given by the index, and the shard manifests (if any) must agree
+     * with the index and together assign every block exactly once. Missing or wrong blocks are reported together with the shard that computes them.
+     * \return true if the matrix is complete and consistent
+     */
+    bool verifyMatrix() const;
+
     /**
      * Computes and writes the distance matrix
      */
     void doDistBlocks();
 
 
+    friend class tractSetPipeline;
 
 
 private:
@@ -150,8 +201,12 @@ private:
     size_t m_subBlockSize;          //!< The number of tractograms that will be loaded at the same time
     size_t m_subBlocksPerBlock;     //!< The number of tract-subblocks in each distance block
     size_t m_trackSize;             //!< The number of points in a compact tractogram
+    size_t m_prefetchDepth;         //!< The buffer depth of the tractogram set prefetch pipeline
+    size_t m_cacheBytes;            //!< The memory budget in bytes of the sparse tractogram set cache
     std::pair< size_t, size_t > m_startingBlock;  //!< the matrix block index to start computing from (in case some block computantions wished to be excluded i.e: if program closed before finishing)
     std::pair< size_t, size_t > m_finishBlock;  //!< the matrix block index to finish computing at (in case only a subset of the blocks wished to be computed )
+    size_t m_shardIndex;            //!< The index of the shard computed by this process
+    size_t m_shardCount;            //!< The number of shards the matrix computation is divided in (1: no sharding)
 
     // === PRIVATE MEMBER FUNCTIONS ===
 
@@ -160,47 +215,138 @@ private:
      */
     void writeIndex() const;
 
+    /**
+     * Returns the estimated computation cost of a block: the number of distance values computed (only the upper triangle of diagonal blocks is computed)
+     * \param row the row identifier of the block
+     * \param column the column identifier of the block
+     * \return the block cost
+     */
+    size_t blockCost( const size_t row, const size_t column ) const;
+
+    /**
+     * Returns the blocks assigned to the shard of this process. The upper-triangle blocks are taken in row order and split
+     * in m_shardCount contiguous ranges of similar cost (a block belongs to the shard whose cost range contains the block cost midpoint)
+     * \param blockListPointer a pointer to the vector where the (row, column) block pairs will be returned
+     */
+    void shardBlocks( std::vector< std::pair< size_t, size_t > >* blockListPointer ) const;
+
+    /**
+     * Writes the manifest file of the shard of this process, with the matrix dimensions and the list of blocks assigned to the shard
+     * \param blockList the blocks assigned to the shard
+     */
+    void writeShardManifest( const std::vector< std::pair< size_t, size_t > >& blockList ) const;
+
+    /**
+     * Checks whether the output folder holds any shard manifest file, which means the matrix was computed in shards
+     * \return true if a file named as a shard manifest was found
+     */
+    bool hasShardManifests() const;
+
+    /**
+     * Returns the path of the journal file of this run (one journal per shard)
+     * \return the journal file path
+     */
+    std::string journalFilename() const;
+
+    /**
+     * Returns the header lines of the journal file, with the run parameters that determine the block contents.
+     * A journal written with different parameters is not valid for the current run
+     * \return the header lines
+     */
+    std::vector< std::string > journalHeader() const;
+
+    /**
+     * Reads the block records of the journal file of this run. If the journal does not exist or was written with different parameters,
+     * a new journal is started (with no records)
+     * \param recordsPointer a pointer to the map where the records will be returned, indexed by block (later records of a block override earlier ones)
+     */
+    void readJournal( std::map< std::pair< size_t, size_t >, blockRecord >* recordsPointer ) const;
+
+    /**
+     * Checks that a block recorded in the journal was completely written: the block file is read back and its checksum compared with the record
+     * \param row the row identifier of the block
+     * \param column the column identifier of the block
+     * \param record the journal record of the block
+     * \return true if the block file is valid
+     */
+    bool checkJournalBlock( const size_t row, const size_t column, const blockRecord& record ) const;
+
+    /**
+     * Appends the record of a completed block to the journal file (the record is flushed before returning, once the block file has been written)
+     * \param row the row identifier of the block
+     * \param column the column identifier of the block
+     * \param record the record of the block
+     */
+    void writeJournalRecord( const size_t row, const size_t column, const blockRecord& record ) const;
+
+    /**
+     * Computes a checksum of the distance values of a block (64 bit FNV-1a hash of the values in row order)
+     * \param blockValues the distance block values
+     * \return the checksum
+     */
+    uint64_t blockChecksum( const std::vector< std::vector< dist_t > >& blockValues ) const;
+
     /**
      * Computes the norms of all the seed voxel tractograms and stores them in the m_leafNorms vector
      */
     void computeNorms();
 
     /**
-     * Computes the distance values of a fragment (block) of the total matrix, loading the corresponding tractograms and calculating the normalized dot product
+     * Computes the distance values of a fragment (block) of the total matrix, loading the corresponding tractograms and calculating the normalized dot product.
+     * Once the block has been written it is recorded in the journal
      * \param row the row identifier of the block to be computed
      * \param column the column identifier of the block to be computed
+     * \param pipelinePointer a pointer to the pipeline providing the tractogram sets
      * \return a pair with the minimum and maximum distance values in the computed block
      */
-    std::pair< dist_t, dist_t > computeDistBlock( const size_t row, const size_t column ) const;
+    std::pair< dist_t, dist_t > computeDistBlock( const size_t row, const size_t column, tractSetPipeline* pipelinePointer ) const;
+
+    /**
+     * Appends to a load schedule the tractogram sets needed to compute a block, in the order computeDistBlock() will request them
+     * \param row the row identifier of the block
+     * \param column the column identifier of the block
+     * \param jobsPointer a pointer to the load schedule vector
+     */
+    void scheduleBlockLoads( const size_t row, const size_t column, std::vector< tractSetJob >* jobsPointer ) const;
+
+    /**
+     * Returns the order in which the sub-blocks of a block are computed: sub-rows in increasing order, sub-columns in snake order
+     * (alternating direction with each sub-row, so that consecutive sub-rows start with the column set used last). Sub-blocks under the diagonal
+     * of diagonal blocks and empty sub-blocks of the last (smaller) block of the matrix are left out
+     * \param row the row identifier of the block
+     * \param column the column identifier of the block
+     * \param subBlocksPointer a pointer to the vector where the (sub-row, sub-column) pairs will be returned
+     */
+    void subBlockOrder( const size_t row, const size_t column, std::vector< std::pair< size_t, size_t > >* subBlocksPointer ) const;
 
     /**
-     * Loads to memory a set of tractograms in a char array to compute a sub-block of the matrix. Allocation is done within.
+     * Loads to memory a set of tractograms in sparse form (only the non-zero values of each thresholded tractogram are kept) to compute a sub-block of the matrix.
      * \param firstID the ID of the first seed of the set
-     * \param lastID the ID following the last seed of the set
-     * \param rowTracts a pointer to the array pointer (unallocated) where the tractogram data will be loaded to
-     * \param transposed if set the tractogram data will be loaded in a transposed position (used when loading column sets)
+     * \param postLastID the ID following the last seed of the set
+     * \param rowTractsPtr a pointer to the vector where the sparse tractograms will be loaded to
      */
-    void loadTractSet( const size_t firstID, const size_t postLastID, unsigned char** rowTractsPtr, const bool transposed = false ) const;
+    void loadTractSet( const size_t firstID, const size_t postLastID, std::vector< sparseTract >* rowTractsPtr ) const;
 
     /**
-     * Transposes a previously loaded tractogram set and stores it in a newly allocated array.
-     * \param setSize nomber of tracts in the original set
-     * \param originalSet the original tractogram set (must be in horizontal/not-transposed orientation)
-     * \param transposedSet a pointer to the the array pointer (unallocated) where the tractogram data will be loaded to.
+     * Transposes a previously loaded sparse tractogram set into a dense char array.
+     * \param originalSet the original tractogram set in sparse form
+     * \param transposedSetPtr a pointer to the vector where the transposed tractogram data will be stored
      */
-    void transposeSet( const size_t setSize, const unsigned char* originalSet, unsigned char** transposedSetPtr ) const;
+    void transposeSet( const std::vector< sparseTract >& originalSet, std::vector< unsigned char >* transposedSetPtr ) const;
 
     /**
-     * Computes the normalized dot product distance between previously loaded tractogram sets
+     * Computes the normalized dot product distance between previously loaded tractogram sets.
+     * The sub-block is split in tiles of DIST_ROW_TILE x DIST_COLUMN_TILE elements that are distributed among threads,
+     * dot products are accumulated exactly in integer arithmetic with the SIMD multiply-accumulate kernel and only converted for the final normalization.
      * \param rowNorms a reference to a vector containing the norms of the row tractograms
-     * \param rowTractSet an array with the row tractogram data (normal orientation)
+     * \param rowTractSet a vector with the row tractograms in sparse form
      * \param columnNorms a reference to a vector containing the norms of the column tractograms
      * \param columnTractSet an array with the column tractogram data (transposed orientation)
      * \param distBlockPointer a pointer the matrix where the distance block are stored
      * \param blockRowOffset offset of the row sub-block position in the block
      * \param blockColumnOffset offset of the column sub-block position in the block
      */
-    void computeDistances( const std::vector< double >& rowNorms, const unsigned char* rowTractSet,
+    void computeDistances( const std::vector< double >& rowNorms, const std::vector< sparseTract >& rowTractSet,
                            const std::vector< double >& columnNorms, const unsigned char* columnTractSet,
                            std::vector< std::vector< dist_t > >* distBlockPointer,
                            const size_t blockRowOffset, const size_t blockColumnOffset) const;
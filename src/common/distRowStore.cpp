@@ -0,0 +1,196 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+
+// std library
+#include <vector>
+#include <list>
+#include <map>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <cerrno>
+
+// posix
+#include <fcntl.h>
+#include <unistd.h>
+
+// boost library
+#include <boost/lexical_cast.hpp>
+
+#include "distRowStore.h"
+
+
+distRowStore::distRowStore( const std::string& rowFolder, const size_t numRows, const size_t cacheBytes ):
+    m_numRows( numRows ), m_maxCachedRows( std::max( static_cast< size_t >( ROWSTORE_MIN_ROWS ), cacheBytes / ( numRows * sizeof( float ) + 1 ) ) ),
+    m_rowDescriptor( -1 ), m_diskStamps( numRows, 0 ), m_cacheHits( 0 ), m_rowsRead( 0 ), m_rowsWritten( 0 )
+{
+    // create the row file and unlink it right away, the space is released when the descriptor is closed
+    std::string rowFilename( rowFolder + "/distRows_" + boost::lexical_cast< std::string >( getpid() ) + "_"
+                             + boost::lexical_cast< std::string >( reinterpret_cast< size_t >( this ) ) + ".rows" );
+    m_rowDescriptor = open( rowFilename.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600 );
+    if( m_rowDescriptor < 0 )
+    {
+        throw std::runtime_error( "ERROR @ distRowStore::distRowStore(): unable to create row file \"" + rowFilename + "\"" );
+    }
+    unlink( rowFilename.c_str() );
+    if( ftruncate( m_rowDescriptor, m_numRows * m_numRows * sizeof( float ) ) != 0 )
+    {
+        close( m_rowDescriptor );
+        throw std::runtime_error( "ERROR @ distRowStore::distRowStore(): unable to size the row file (disk full?)" );
+    }
+}
+
+distRowStore::~distRowStore()
+{
+    if( m_rowDescriptor >= 0 )
+    {
+        close( m_rowDescriptor );
+    }
+}
+
+void distRowStore::writeSegment( const size_t row, const size_t column, const float* const values, const size_t count )
+{
+    transfer( reinterpret_cast< char* >( const_cast< float* >( values ) ), count * sizeof( float ), ( row * m_numRows + column ) * sizeof( float ), true );
+    return;
+}// end "writeSegment()" -----------------------------------------------------------------
+
+size_t distRowStore::getRow( const size_t row, std::vector< float >* const values )
+{
+    std::map< size_t, cacheEntry >::iterator cacheIter( m_cache.find( row ) );
+    if( cacheIter != m_cache.end() )
+    {
+        ++m_cacheHits;
+        m_lruList.splice( m_lruList.begin(), m_lruList, cacheIter->second.lruPosition );
+        *values = cacheIter->second.values;
+        return cacheIter->second.stamp;
+    }
+
+    // read from disk and keep a clean copy in the cache
+    values->resize( m_numRows );
+    transfer( reinterpret_cast< char* >( &( *values )[0] ), m_numRows * sizeof( float ), row * m_numRows * sizeof( float ), false );
+    ++m_rowsRead;
+    if( m_cache.size() >= m_maxCachedRows )
+    {
+        evictRow();
+    }
+    m_lruList.push_front( row );
+    cacheEntry& newEntry( m_cache[row] );
+    newEntry.values = *values;
+    newEntry.stamp = m_diskStamps[row];
+    newEntry.dirty = false;
+    newEntry.lruPosition = m_lruList.begin();
+    return m_diskStamps[row];
+}// end "getRow()" -----------------------------------------------------------------
+
+void distRowStore::putRow( const size_t row, const std::vector< float >& values, const size_t stamp, const bool modified )
+{
+    if( values.size() != m_numRows )
+    {
+        throw std::runtime_error( "ERROR @ distRowStore::putRow(): row size does not match the matrix size" );
+    }
+    std::map< size_t, cacheEntry >::iterator cacheIter( m_cache.find( row ) );
+    if( cacheIter == m_cache.end() )
+    {
+        if( m_cache.size() >= m_maxCachedRows )
+        {
+            evictRow();
+        }
+        m_lruList.push_front( row );
+        cacheIter = m_cache.insert( std::make_pair( row, cacheEntry() ) ).first;
+        cacheIter->second.lruPosition = m_lruList.begin();
+        cacheIter->second.dirty = false;
+    }
+    else
+    {
+        m_lruList.splice( m_lruList.begin(), m_lruList, cacheIter->second.lruPosition );
+    }
+    cacheIter->second.values = values;
+    cacheIter->second.stamp = stamp;
+    cacheIter->second.dirty = cacheIter->second.dirty || modified;
+    return;
+}// end "putRow()" -----------------------------------------------------------------
+
+void distRowStore::dropRow( const size_t row )
+{
+    std::map< size_t, cacheEntry >::iterator cacheIter( m_cache.find( row ) );
+    if( cacheIter != m_cache.end() )
+    {
+        m_lruList.erase( cacheIter->second.lruPosition );
+        m_cache.erase( cacheIter );
+    }
+    return;
+}// end "dropRow()" -----------------------------------------------------------------
+
+std::string distRowStore::getReport() const
+{
+    std::stringstream reportStream;
+    reportStream << "Row cache: " << m_cacheHits << " hits, " << m_rowsRead << " rows read, " << m_rowsWritten << " rows written back. ";
+    reportStream << m_maxCachedRows << " rows fit in memory (" << ( m_maxCachedRows * m_numRows * sizeof( float ) ) / ( 1024 * 1024 ) << " MB)";
+    return reportStream.str();
+}// end "getReport()" -----------------------------------------------------------------
+
+void distRowStore::evictRow()
+{
+    const size_t row( m_lruList.back() );
+    std::map< size_t, cacheEntry >::iterator cacheIter( m_cache.find( row ) );
+    if( cacheIter->second.dirty )
+    {
+        transfer( reinterpret_cast< char* >( &cacheIter->second.values[0] ), m_numRows * sizeof( float ), row * m_numRows * sizeof( float ), true );
+        m_diskStamps[row] = cacheIter->second.stamp;
+        ++m_rowsWritten;
+    }
+    m_lruList.pop_back();
+    m_cache.erase( cacheIter );
+    return;
+}// end "evictRow()" -----------------------------------------------------------------
+
+void distRowStore::transfer( char* buffer, size_t bytes, size_t offset, const bool write ) const
+{
+    while( bytes > 0 )
+    {
+        ssize_t done( write ? pwrite( m_rowDescriptor, buffer, bytes, offset ) : pread( m_rowDescriptor, buffer, bytes, offset ) );
+        if( done < 0 && errno == EINTR )
+        {
+            continue;
+        }
+        if( done <= 0 )
+        {
+            throw std::runtime_error( std::string( "ERROR @ distRowStore::transfer(): unable to " ) + ( write ? "write to" : "read from" ) + " the row file" );
+        }
+        buffer += done;
+        bytes -= done;
+        offset += done;
+    }
+    return;
+}// end "transfer()" -----------------------------------------------------------------
@@ -0,0 +1,188 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+
+#ifndef DISTROWSTORE_H
+#define DISTROWSTORE_H
+
+// std library
+#include <vector>
+#include <list>
+#include <map>
+#include <string>
+#include <stdexcept>
+
+#define ROWSTORE_MIN_ROWS 4 // minimum number of rows kept in the row cache regardless of the memory budget
+
+/**
+ * This class keeps a full square distance matrix on disk in row order (each row holds the distances of one position to all the others,
+ * both halves of the symmetric matrix are stored), so that any row can be read or written with a single contiguous file access.
+ * It is meant to hold the working matrix of the out-of-core graph linkage: rows are read on demand through a least-recently-used cache
+ * bounded by a memory budget, and modified rows are written back to disk when they are evicted.
+ * Each row carries a stamp set by the caller when the row is stored (e.g. the number of merges its values reflect), so that updates of
+ * the matrix can be applied lazily when the row is needed again.
+ * The row file holds N^2 float values, so it needs N^2 * 4 bytes of free disk space in the row folder (e.g. 57.6 GB for 120000 rows).
+ * It is created sparse and filled as rows are written, a full disk is only reported when a write fails.
+ * The row file is unlinked as soon as it is created, so its disk space is returned to the system when the store is destroyed (or the program ends).
+ * Only writeSegment() is thread-safe.
+ */
+class distRowStore
+{
+public:
+    /**
+     * Constructor, creates the (zero-filled) row file
+     * \param rowFolder folder where the row file will be created
+     * \param numRows number of rows (and columns) of the matrix
+     * \param cacheBytes the maximum number of bytes of row data to keep in RAM
+     */
+    distRowStore( const std::string& rowFolder, const size_t numRows, const size_t cacheBytes );
+
+    //! Destructor, closes the row file
+    ~distRowStore();
+
+    // === IN-LINE MEMBER FUNCTIONS ===
+
+    /**
+     * returns the number of rows (and columns) of the matrix
+     * \return matrix size
+     */
+    inline size_t size() const { return m_numRows; }
+
+    /**
+     * returns the number of rows that fit in the row cache
+     * \return maximum number of cached rows
+     */
+    inline size_t cachedRows() const { return m_maxCachedRows; }
+
+    /**
+     * returns the number of row requests served from the cache
+     * \return cache hits
+     */
+    inline size_t cacheHits() const { return m_cacheHits; }
+
+    /**
+     * returns the number of rows read from disk
+     * \return rows read
+     */
+    inline size_t rowsRead() const { return m_rowsRead; }
+
+    /**
+     * returns the number of rows written to disk (not counting the segments written with writeSegment())
+     * \return rows written
+     */
+    inline size_t rowsWritten() const { return m_rowsWritten; }
+
+    // === PUBLIC MEMBER FUNCTIONS ===
+
+    /**
+     * writes a contiguous segment of a row straight to disk, bypassing the cache. Meant for filling the matrix,
+     * may be called concurrently for non-overlapping segments as long as no other member function is called
+     * \param row row of the segment
+     * \param column first column of the segment
+     * \param values pointer to the segment values
+     * \param count number of values in the segment
+     */
+    void writeSegment( const size_t row, const size_t column, const float* const values, const size_t count );
+
+    /**
+     * fetches a row, from the cache or from disk
+     * \param row the row to fetch
+     * \param values pointer to the vector where the row values will be written (resized to the matrix size)
+     * \return the stamp the row was stored with (0 if it was never stored with putRow())
+     */
+    size_t getRow( const size_t row, std::vector< float >* const values );
+
+    /**
+     * stores a row in the cache, it will be written to disk when evicted
+     * \param row the row to store
+     * \param values the row values (must have the matrix size)
+     * \param stamp a stamp to be returned by getRow() together with the values
+     * \param modified if false, the values can be reconstructed by the caller from the copy on disk and its stamp, and the row is
+     *        only written back if it had already been modified
+     */
+    void putRow( const size_t row, const std::vector< float >& values, const size_t stamp, const bool modified = true );
+
+    /**
+     * discards a row that will not be fetched again, freeing its cache space without writing it to disk
+     * \param row the row to discard
+     */
+    void dropRow( const size_t row );
+
+    /**
+     * returns a report of the row cache usage
+     * \return report string
+     */
+    std::string getReport() const;
+
+private:
+    // === PRIVATE DATA MEMBERS ===
+
+    /**
+     * An entry of the row cache
+     */
+    struct cacheEntry
+    {
+        std::vector< float > values;                //!< the row values
+        size_t stamp;                               //!< stamp given when the row was stored
+        bool dirty;                                 //!< flag indicating the row differs from its copy on disk
+        std::list< size_t >::iterator lruPosition;  //!< position of the row in the recency list
+    };
+
+    size_t m_numRows;                    //!< number of rows (and columns) of the matrix
+    size_t m_maxCachedRows;              //!< number of rows that fit in the cache budget
+    int m_rowDescriptor;                 //!< file descriptor of the row file
+    std::vector< size_t > m_diskStamps;  //!< stamp of the copy of each row on disk
+    std::map< size_t, cacheEntry > m_cache;  //!< the row cache
+    std::list< size_t > m_lruList;       //!< cached rows, most recently used first
+    size_t m_cacheHits;                  //!< number of row requests served from the cache
+    size_t m_rowsRead;                   //!< number of rows read from disk
+    size_t m_rowsWritten;                //!< number of rows written back to disk
+
+    // === PRIVATE MEMBER FUNCTIONS ===
+
+    /**
+     * makes room in the cache for one more row, writing back the least recently used row if it was modified
+     */
+    void evictRow();
+
+    /**
+     * reads or writes a byte range of the row file, looping over partial transfers
+     * \param buffer pointer to the data to write or the buffer to read into
+     * \param bytes number of bytes to transfer
+     * \param offset position in the file
+     * \param write true for writing, false for reading
+     */
+    void transfer( char* buffer, size_t bytes, size_t offset, const bool write ) const;
+};
+
+#endif  // DISTROWSTORE_H
@@ -37,14 +37,270 @@
 #include <string>
 #include <utility>
 #include <algorithm>
+#include <map>
+#include <queue>
+#include <functional>
+#include <limits>
+#include <cmath>
+
+// boost library
+#include <boost/scoped_ptr.hpp>
 
 #include "WStringUtils.h"
 
 #include "graphTreeBuilder.h"
 
 
+namespace
+{
+    // Lance-Williams distance updates of the graph linkages, as functors so that they are inlined into the matrix merging passes
+
+    // Single linkage: D(k,i+j) = min[D(i,k),D(j,k)]
+    struct singleUpdate
+    {
+        inline float operator()( const float distance1, const float distance2 ) const
+        {
+            return std::min( distance1, distance2 );
+        }
+    };
+
+    // Complete linkage: D(k,i+j) = MAX[D(i,k),D(j,k)]
+    struct completeUpdate
+    {
+        inline float operator()( const float distance1, const float distance2 ) const
+        {
+            return std::max( distance1, distance2 );
+        }
+    };
+
+    // Average linkage: D(k,i+j) = [D(i,k)*Size(i),D(j,k)*size(j)]/[size(i)+size(j)]
+    struct averageUpdate
+    {
+        averageUpdate( const size_t size1, const size_t size2 ): m_size1( size1 ), m_size2( size2 ), m_sizeSum( size1 + size2 ) {}
+        inline float operator()( const float distance1, const float distance2 ) const
+        {
+            return ( ( m_size1 * distance1 ) + ( m_size2 * distance2 ) ) / m_sizeSum;
+        }
+        float m_size1, m_size2, m_sizeSum;
+    };
+
+    // Weighted linkage: D(k,i+j) = [D(i,k)+D(i,k)]/2
+    struct weightedUpdate
+    {
+        inline float operator()( const float distance1, const float distance2 ) const
+        {
+            return ( distance1 + distance2 ) / 2;
+        }
+    };
+
+    // Ward linkage: D(k,i+j) = [(Si*Sj)/(Si+Sj)]*[Da(i,k)-D(i,k)/2-D(j,k)/2]
+    struct wardUpdate
+    {
+        wardUpdate( const size_t size1, const size_t size2 ): m_size1( size1 ), m_size2( size2 ) {}
+        inline float operator()( const float distance1, const float distance2 ) const
+        {
+            dist_t avrg( ( ( m_size1 * distance1 ) + ( m_size2 * distance2 ) ) / ( m_size1 + m_size2 ) );
+            dist_t ward( ( m_size1 * m_size2 ) * ( avrg - ( distance1 / 2. ) - ( distance2 / 2. ) ) / ( m_size1 + m_size2 ) );
+            return ward;
+        }
+        size_t m_size1, m_size2;
+    };
+
+    // merges two positions of the matrix, updating the distances to all positions or only to the listed ones
+    template< class Update > void applyUpdate( const size_t first, const size_t second, const Update& update,
+                                               const std::vector< size_t >* const positions, triangleDistMatrix* const distMatrix )
+    {
+        if( positions == 0 )
+        {
+            distMatrix->mergePositions( first, second, update );
+        }
+        else
+        {
+            distMatrix->mergePositions( first, second, update, *positions );
+        }
+    }
+
+    // updates the distances to the first merged cluster held in a row of the out-of-core matrix
+    template< class Update > void updateValues( const Update& update, const float* const secondValues, float* const firstValues, const size_t count )
+    {
+        for( size_t k = 0; k < count; ++k )
+        {
+            firstValues[k] = update( firstValues[k], secondValues[k] );
+        }
+    }
+
+    // edges of the minimum spanning tree engine, totally ordered by distance and then by their end positions so that the tree is unique
+    typedef std::pair< dist_t, std::pair< size_t, size_t > > mstEdge_t;
+
+    inline mstEdge_t mstEdge( const dist_t distance, const size_t pos1, const size_t pos2 )
+    {
+        return std::make_pair( distance, std::make_pair( std::min( pos1, pos2 ), std::max( pos1, pos2 ) ) );
+    }
+
+    // inserts an edge into the sorted candidate list of a position if it is among its MST_CANDIDATES best ones
+    // (for a fixed position, ordering by distance and other position agrees with the total edge order)
+    inline void offerCandidate( std::pair< dist_t, size_t >* const list, size_t* const count, const dist_t distance, const size_t other )
+    {
+        const std::pair< dist_t, size_t > edge( distance, other );
+        if( *count == MST_CANDIDATES )
+        {
+            if( !( edge < list[MST_CANDIDATES - 1] ) )
+            {
+                return;
+            }
+        }
+        else
+        {
+            ++( *count );
+        }
+        size_t k( *count - 1 );
+        while( k > 0 && edge < list[k - 1] )
+        {
+            list[k] = list[k - 1];
+            --k;
+        }
+        list[k] = edge;
+    }
+
+    // union-find root of a position, with path halving
+    inline size_t findRoot( std::vector< size_t >* const parents, size_t position )
+    {
+        std::vector< size_t >& parentsRef( *parents );
+        while( parentsRef[position] != position )
+        {
+            parentsRef[position] = parentsRef[parentsRef[position]];
+            position = parentsRef[position];
+        }
+        return position;
+    }
+
+    // neighbour list of a cluster in the sparse graph mode: position of each neighbouring cluster and distance to it, sorted by position
+    typedef std::vector< std::pair< size_t, dist_t > > nbList_t;
+
+    // edges of the sparse graph mode, ordered by distance and then by their higher and lower positions as in the global minimum scan
+    typedef std::pair< dist_t, std::pair< size_t, size_t > > sparseEdge_t;
+
+    inline sparseEdge_t sparseEdge( const dist_t distance, const size_t pos1, const size_t pos2 )
+    {
+        return std::make_pair( distance, std::make_pair( std::max( pos1, pos2 ), std::min( pos1, pos2 ) ) );
+    }
+
+    inline bool nbLess( const std::pair< size_t, dist_t >& neighbour, const size_t position )
+    {
+        return neighbour.first < position;
+    }
+
+    // finds a position in a neighbour list, returns the end of the list if not present
+    inline nbList_t::const_iterator findNeighbour( const nbList_t& neighbours, const size_t position )
+    {
+        nbList_t::const_iterator nbIter( std::lower_bound( neighbours.begin(), neighbours.end(), position, nbLess ) );
+        return ( nbIter != neighbours.end() && nbIter->first == position ) ? nbIter : neighbours.end();
+    }
+
+    // removes a position from a neighbour list, if present
+    inline void eraseNeighbour( nbList_t* const neighbours, const size_t position )
+    {
+        nbList_t::iterator nbIter( std::lower_bound( neighbours->begin(), neighbours->end(), position, nbLess ) );
+        if( nbIter != neighbours->end() && nbIter->first == position )
+        {
+            neighbours->erase( nbIter );
+        }
+    }
+
+    // sets the distance to a position in a neighbour list, inserting it if not present. Returns true if the list changed
+    inline bool setNeighbour( nbList_t* const neighbours, const size_t position, const dist_t distance )
+    {
+        nbList_t::iterator nbIter( std::lower_bound( neighbours->begin(), neighbours->end(), position, nbLess ) );
+        if( nbIter != neighbours->end() && nbIter->first == position )
+        {
+            if( nbIter->second == distance )
+            {
+                return false;
+            }
+            nbIter->second = distance;
+        }
+        else
+        {
+            neighbours->insert( nbIter, std::make_pair( position, distance ) );
+        }
+        return true;
+    }
+
+    // merges the neighbour lists of two clusters, updating the distances to the common neighbours
+    template< class Update > void updateNeighbours( const Update& update, const nbList_t& secondNbs, nbList_t* const firstNbs )
+    {
+        const nbList_t& oldNbs( *firstNbs );
+        nbList_t newNbs;
+        newNbs.reserve( oldNbs.size() + secondNbs.size() );
+        size_t i( 0 ), j( 0 );
+        while( i < oldNbs.size() || j < secondNbs.size() )
+        {
+            if( j == secondNbs.size() || ( i < oldNbs.size() && oldNbs[i].first < secondNbs[j].first ) )
+            {
+                newNbs.push_back( oldNbs[i++] );
+            }
+            else if( i == oldNbs.size() || secondNbs[j].first < oldNbs[i].first )
+            {
+                newNbs.push_back( secondNbs[j++] );
+            }
+            else
+            {
+                newNbs.push_back( std::make_pair( oldNbs[i].first, update( oldNbs[i].second, secondNbs[j].second ) ) );
+                ++i;
+                ++j;
+            }
+        }
+        firstNbs->swap( newNbs );
+    }
+
+    // writes a row segment to the row store from a parallel loop: an exception must not leave the loop, so the first error message is kept
+    // to be thrown by the calling thread once the loop has finished
+    void writeRowSegment( distRowStore* const distRows, const size_t row, const size_t start, const float* const values, const size_t count,
+                          std::string* const error )
+    {
+        try
+        {
+            distRows->writeSegment( row, start, values, count );
+        }
+        catch( const std::exception& except )
+        {
+#pragma omp critical( rowStoreError )
+            if( error->empty() )
+            {
+                *error = except.what();
+            }
+        }
+    }
+
+    // whether the pair (top, candidate) precedes the pair (top, current) in the tie order of the global minimum scan: higher, then lower position
+    bool precedesInScan( const size_t top, const size_t candidate, const size_t current )
+    {
+        const size_t candidateHigh( std::max( top, candidate ) ), currentHigh( std::max( top, current ) );
+        if( candidateHigh != currentHigh )
+        {
+            return candidateHigh < currentHigh;
+        }
+        return std::min( top, candidate ) < std::min( top, current );
+    }
+
+    // minimum of the distances of a full row to the positions below it, as triangleDistMatrix::rowMinimum()
+    void lowerRowMinimum( const std::vector< float >& rowValues, const size_t row, float* const minDist, size_t* const minPosition )
+    {
+        for( size_t k = 0; k < row; ++k )
+        {
+            if( rowValues[k] < *minDist )
+            {
+                *minDist = rowValues[k];
+                *minPosition = k;
+            }
+        }
+    }
+}
+
+
 graphTreeBuilder::graphTreeBuilder( std::string roiFilename, bool verbose ):
-    m_roiLoaded( false ), m_treeReady( false ), m_logfile( 0 ), m_verbose( verbose )
+    m_roiLoaded( false ), m_treeReady( false ), m_logfile( 0 ), m_rowMemory( 0 ), m_nbLevel( 0 ), m_tractThreshold( 0 ), m_logFactor( 0 ),
+    m_verbose( verbose ), m_nnChain( false ), m_halfMatrix( false ), m_mstSingle( false )
 {
     fileManagerFactory fMFtestFormat;
     m_niftiMode = fMFtestFormat.isNifti();
@@ -53,6 +309,52 @@ graphTreeBuilder::graphTreeBuilder( std::string roiFilename, bool verbose ):
 }
 
 
+void graphTreeBuilder::setNeighbourhood( const unsigned int nbLevel, const float thresholdRatio, const bool noLog )
+{
+    if( nbLevel != 0 && nbLevel != 6 && nbLevel != 18 && nbLevel != 26 && nbLevel != 32 && nbLevel != 92 && nbLevel != 124 )
+    {
+        throw std::runtime_error( "ERROR @ treeBuilder::setNeighbourhood(): invalid neighbourhood level value" );
+    }
+    m_nbLevel = nbLevel;
+
+    // trees built from a distance matrix keep tractogram units out of the tree file
+    if( noLog || nbLevel == 0 )
+    {
+        m_logFactor = 0;
+    }
+    else
+    {
+        if( m_numStreamlines == 0 )
+        {
+            std::cerr << "WARNING @ treeBuilder::setNeighbourhood(): provided a number of stramlines per voxel of 0, interpreting it as requesting no logarithmic normalization of tracts (input tracts must also be in natural units)" << std::endl;
+            m_logFactor = 0;
+        }
+        else
+        {
+            m_logFactor = log10( m_numStreamlines );
+        }
+    }
+
+    if( nbLevel == 0 || thresholdRatio <= 0 || thresholdRatio >= 1 )
+    {
+        if( nbLevel != 0 && thresholdRatio != 0 )
+        {
+            std::cerr << "WARNING @ treeBuilder::setNeighbourhood(): threshold ratio provided (" << thresholdRatio << ") is out of bounds [0,1), using a value of 0.0 (no thresholding)" << std::endl;
+        }
+        m_tractThreshold = 0;
+    }
+    else if ( m_logFactor == 0 )
+    {
+        m_tractThreshold = thresholdRatio; // if using natural units the normalized tract threshold is the same as the threshold ratio
+    }
+    else
+    {
+        m_tractThreshold = log10( m_numStreamlines * thresholdRatio ) / m_logFactor; // if using log units the threshold must be calculated
+    }
+    return;
+} // end treeBuilder::setNeighbourhood() -------------------------------------------------------------------------------------
+
+
 void graphTreeBuilder::buildGraph( const TG_GRAPHTYPE graphMethod )
 {
     if( !m_roiLoaded )
@@ -67,40 +369,1083 @@ void graphTreeBuilder::buildGraph( const TG_GRAPHTYPE graphMethod )
         return;
     }
 
-    // load matrix
-    std::vector< std::vector< float > > distMatrix;
-    loadDistMatrix( &distMatrix );
+    // in sparse graph mode only the neighbour distances are computed, from the tractograms
+    const bool sparseMode( m_nbLevel != 0 );
+
+    // single linkage is built from the minimum spanning tree, which streams the matrix and does not need to load it
+    const bool mstMode( graphMethod == TG_SINGLE && m_mstSingle && !sparseMode );
+
+    // load matrix, in out-of-core mode it is written to the row file instead
+    triangleDistMatrix distMatrix;
+    boost::scoped_ptr< distRowStore > distRows;
+    std::vector< size_t > nbOffsets, nbIDs;
+    std::vector< dist_t > nbDists;
+    if( !m_rowFolder.empty() && !mstMode && !sparseMode )
+    {
+        distRows.reset( new distRowStore( m_rowFolder, m_roi.size(), m_rowMemory ) );
+        float diskGB( ( m_roi.size() * static_cast< float >( m_roi.size() ) * sizeof( float ) ) / ( 1024 * 1024 * 1024 ) );
+        if( m_verbose )
+            std::cout << "Out-of-core mode: working matrix kept on disk at " << m_rowFolder << " (" << diskGB << " GBytes), "
+                      << distRows->cachedRows() << " rows cached in memory" << std::endl;
+        if( m_logfile != 0 )
+            ( *m_logfile ) << "Out-of-core matrix:\t" << diskGB << " GB on disk, " << distRows->cachedRows() << " rows cached" << std::endl;
+    }
+    if( mstMode )
+    {
+        // nothing to load
+    }
+    else if( sparseMode )
+    {
+        sparseNeighbours( &nbOffsets, &nbIDs );
+        sparseDistances( nbOffsets, nbIDs, &nbDists );
+    }
+    else if( boost::filesystem::is_regular_file( boost::filesystem::path( m_inputFolder ) ) )
+    {
+        loadPackedMatrix( &distMatrix, distRows.get() );
+    }
+    else
+    {
+        loadDistMatrix( &distMatrix, distRows.get() );
+    }
 
     //initialize leaves vector
-    //create lookup table (translate position in the list to leaf/node ID
     std::vector< WHnode > leaves, nodes;
-    std::vector< nodeID_t > lookup;
     leaves.reserve( m_roi.size() );
-    lookup.reserve( m_roi.size() );
     nodes.reserve( m_roi.size() - 1 );
     for( size_t i = 0; i < m_roi.size(); ++i )
     {
         WHnode leaf( std::make_pair( false, i ) );
         leaves.push_back( leaf );
-        lookup.push_back( leaf.getFullID() );
     }
 
-    time_t loopStart( time( NULL ) ), lastTime( time( NULL ) );
+    time_t loopStart( time( NULL ) );
+
+    if( sparseMode )
+    {
+        if( m_verbose )
+            std::cout << "Building tree restricted to the neighbourhood graph" << std::endl;
+        sparseLinkage( graphMethod, nbOffsets, nbIDs, nbDists, &leaves, &nodes );
+        std::vector< size_t >().swap( nbOffsets );
+        std::vector< size_t >().swap( nbIDs );
+        std::vector< dist_t >().swap( nbDists );
+    }
+    else if( mstMode )
+    {
+        if( m_verbose )
+            std::cout << "Building single linkage tree from the minimum spanning tree" << std::endl;
+        mstLinkage( &leaves, &nodes );
+    }
+    // ward linkage as implemented is not reducible (merged distances may fall below the merge level), so it needs the global minimum scan
+    else if( m_nnChain && graphMethod != TG_WARD )
+    {
+        if( m_verbose )
+            std::cout << "Building tree with nearest-neighbour chains" << std::endl;
+        if( distRows )
+        {
+            diskChainLinkage( graphMethod, distRows.get(), &leaves, &nodes );
+        }
+        else
+        {
+            chainLinkage( graphMethod, &distMatrix, &leaves, &nodes );
+        }
+    }
+    else
+    {
+        if( m_verbose )
+            std::cout << "Building tree with global minimum scan" << std::endl;
+        if( distRows )
+        {
+            diskScanLinkage( graphMethod, distRows.get(), &leaves, &nodes );
+        }
+        else
+        {
+            scanLinkage( graphMethod, &distMatrix, &leaves, &nodes );
+        }
+    }
+
+    if( m_verbose )
+    {
+        int timeTaken = difftime( time( NULL ), loopStart );
+        std::cout << "\r" << std::flush << "100% of of tree built. Time taken: " << timeTaken / 3600 << "h " << ( timeTaken
+                        % 3600 ) / 60 << "' " << ( ( timeTaken % 3600 ) % 60 ) << "\"    " << std::endl;
+    }
+    if( distRows )
+    {
+        if( m_verbose )
+            std::cout << distRows->getReport() << std::endl;
+        if( m_logfile != 0 )
+            ( *m_logfile ) << distRows->getReport() << std::endl;
+        distRows.reset();
+    }
+
+    std::string graphName;
+    if( graphMethod == TG_SINGLE )
+    {
+        graphName = "single";
+    }
+    else if( graphMethod == TG_COMPLETE )
+    {
+        graphName = "complete";
+    }
+    else if( graphMethod == TG_AVERAGE )
+    {
+        graphName = "average";
+    }
+    else if( graphMethod == TG_WEIGHTED )
+    {
+        graphName = "weighted";
+    }
+    else if( graphMethod == TG_WARD )
+    {
+        graphName = "ward";
+    }
+    else
+    {
+        throw std::runtime_error( "ERROR @ treeBuilder::buildGraph(): graph method not recognized" );
+    }
+
+    {
+        std::list< WHcoord > discarded;
+        WHtree thisTree( graphName, m_datasetGrid, m_datasetSize, m_numStreamlines, m_logFactor, leaves, nodes, m_trackids, m_roi, discarded );
+        m_tree = thisTree;
+        std::vector< WHnode > emptyL, emptyN;
+        leaves.swap( emptyL );
+        nodes.swap( emptyN );
+    }
+
+    if( !m_tree.check() )
+    {
+        m_tree.writeTreeDebug( m_outputFolder + "/treedebug.txt" );
+        throw std::runtime_error( "ERROR @ treeBuilder::buildGraph(): resulting tree is not valid" );
+    }
+
+    m_treeReady = true;
+
+    if( m_verbose )
+        std::cout << m_tree.getReport() << std::endl;
+    if( m_logfile != 0 )
+        ( *m_logfile ) << m_tree.getReport() << std::endl;
+
+    m_tree.m_treeName = ( graphName );
+    writeTree();
+
+    return;
+} // end treeBuilder::buildGraph() -------------------------------------------------------------------------------------
+
+
+void graphTreeBuilder::scanLinkage( const TG_GRAPHTYPE graphMethod, triangleDistMatrix* const distMatrixPointer,
+                                    std::vector< WHnode >* const leavesPointer, std::vector< WHnode >* const nodesPointer ) const
+{
+    triangleDistMatrix& distMatrix( *distMatrixPointer );
+    std::vector< WHnode >& leaves( *leavesPointer );
+    std::vector< WHnode >& nodes( *nodesPointer );
+
+    //create lookup table (translate position in the list to leaf/node ID
+    std::vector< nodeID_t > lookup;
+    lookup.reserve( leaves.size() );
+    for( size_t i = 0; i < leaves.size(); ++i )
+    {
+        lookup.push_back( leaves[i].getFullID() );
+    }
+
+    time_t loopStart( time( NULL ) ), lastTime( time( NULL ) );
+
+    std::vector< dist_t > lowestDistVector( distMatrix.size(), 2 );
+    std::vector< std::pair< size_t, size_t > > lowestLocationVector( distMatrix.size(), std::make_pair( 0, 0 ) );
+
+    // keep track of lowest distance per row (accelerates process)
+#pragma omp parallel for schedule(guided)
+    for( size_t i = 0; i < distMatrix.size(); ++i )
+    {
+        size_t lowestCol( i );
+        distMatrix.rowMinimum( i, &lowestDistVector[i], &lowestCol );
+        if( lowestCol != i )
+        {
+            lowestLocationVector[i] = std::make_pair( lowestCol, i ); //greater number is always in the second position
+        }
+    }
+
+    // repeat until all nodes are added
+    while( nodes.size() < ( leaves.size() - 1 ) )
+    {
+        // find closest pair
+        dist_t lowestDist( 999 ); // reset lower dist to greater than 1
+        std::pair< size_t, size_t > lowestLocation( 0, 0 );
+        for( size_t i = 1; i < lowestDistVector.size(); ++i )
+        {
+            if( lowestDistVector[i] < lowestDist )
+            {
+                lowestDist = lowestDistVector[i];
+                lowestLocation = lowestLocationVector[i];
+            }
+        }
+
+        // get children and new node IDs
+        nodeID_t node2join1ID( lookup[lowestLocation.first] );
+        nodeID_t node2join2ID( lookup[lowestLocation.second] );
+        nodeID_t newID( std::make_pair( true, nodes.size() ) );
+        WHnode* node2join1( fetchNode( node2join1ID, &leaves, &nodes ) );
+        WHnode* node2join2( fetchNode( node2join2ID, &leaves, &nodes ) );
+        node2join1->setParent( newID );
+        node2join2->setParent( newID );
+
+        // inroduce new node in node vector
+        std::vector< nodeID_t > newKids( 1, node2join1ID );
+        newKids.push_back( node2join2ID );
+        size_t newSize( node2join1->getSize() + node2join2->getSize() );
+        size_t newHLevel( std::max( node2join1->getHLevel(), node2join2->getHLevel() ) + 1 );
+        WHnode newNode( newID, newKids, newSize, lowestDist, newHLevel );
+        nodes.push_back( newNode );
+
+        //update matrix, values corresponding to the 1st joining node are changed to the ones corresponding to the new node
+        // values corresponding to the 2nd joining node are changed to discarded value (3)
+        mergeDistances( lowestLocation.first, lowestLocation.second, node2join1->getSize(), node2join2->getSize(), graphMethod, &distMatrix );
+        distMatrix.fillPosition( lowestLocation.second, 3 );
+
+        //update lookup table
+        lookup[lowestLocation.first] = newID;
+        lookup[lowestLocation.second] = std::make_pair( false, 0 );
+
+        //update lowest distances
+#pragma omp parallel for schedule( guided )
+        for( size_t row = 1; row < lowestDistVector.size(); ++row )
+        {
+            if( lowestDistVector[row] != 3 )
+            {
+                // if row is not discarded
+                if( row < lowestLocation.first )
+                {
+                    // if row is above first joining node theres nothing to be changed
+                }
+                else if( row == lowestLocation.second )
+                {
+                    // this row has been eliminated
+                    lowestDistVector[row] = 3;
+                    lowestLocationVector[row] = std::make_pair( 0, 0 );
+                }
+                else if( ( row == lowestLocation.first ) || ( lowestLocationVector[row].first == lowestLocation.first )
+                                || ( lowestLocationVector[row].first == lowestLocation.second ) )
+                {
+                    // if the old smallest distance is no longer valid
+                    lowestDistVector[row] = 2;
+                    lowestLocationVector[row] = std::make_pair( 0, 0 );
+
+                    size_t lowestCol( row );
+                    distMatrix.rowMinimum( row, &lowestDistVector[row], &lowestCol );
+                    if( lowestCol != row )
+                    {
+                        lowestLocationVector[row] = std::make_pair( lowestCol, row ); //greater number is always in the second position
+                    }
+                }
+                else
+                { // if old distance is still valid
+                    if( lowestDistVector[row] > distMatrix.getDistance( row, lowestLocation.first ) )
+                    { // if new element is the smallest, change
+                        lowestDistVector[row] = distMatrix.getDistance( row, lowestLocation.first );
+                        lowestLocationVector[row] = std::make_pair( lowestLocation.first, row );
+                    }
+                }
+            } // end if
+        } // end parallel for
+
+        if( m_verbose )
+        {
+            showProgress( nodes.size(), leaves.size() - 1, loopStart, &lastTime );
+        }
+
+
+
+    } // end big loop
+
+    return;
+} // end treeBuilder::scanLinkage() -------------------------------------------------------------------------------------
+
+
+void graphTreeBuilder::chainLinkage( const TG_GRAPHTYPE graphMethod, triangleDistMatrix* const distMatrixPointer,
+                                     std::vector< WHnode >* const leavesPointer, std::vector< WHnode >* const nodesPointer ) const
+{
+    triangleDistMatrix& distMatrix( *distMatrixPointer );
+    std::vector< WHnode >& leaves( *leavesPointer );
+    std::vector< WHnode >& nodes( *nodesPointer );
+
+    time_t loopStart( time( NULL ) ), lastTime( time( NULL ) );
+
+    // clusters are identified by the lowest matrix position of their leaves (the position that keeps the merged distances)
+    std::vector< size_t > activePositions( leaves.size() ); // sorted
+    std::vector< size_t > clusterSizes( leaves.size(), 1 );
+    for( size_t i = 0; i < leaves.size(); ++i )
+    {
+        activePositions[i] = i;
+    }
+
+    std::vector< chainMerge > merges;
+    merges.reserve( leaves.size() - 1 );
+    std::vector< size_t > chain;
+    chain.reserve( leaves.size() );
+
+    while( activePositions.size() > 1 )
+    {
+        if( chain.empty() )
+        {
+            chain.push_back( activePositions.front() );
+        }
+        const size_t chainTop( chain.back() );
+
+        // find nearest active cluster to the top of the chain, ties are broken by the positions of the pair in the order of the global minimum scan.
+        // Every pair has its own place in that order, so the chain always ends at a reciprocal pair
+        size_t nearest( chainTop );
+        dist_t nearestDist( 999 );
+        if( chain.size() > 1 )
+        {
+            nearest = chain[chain.size() - 2];
+            nearestDist = distMatrix.getDistance( chainTop, nearest );
+        }
+        for( size_t i = 0; i < activePositions.size(); ++i )
+        {
+            const size_t position( activePositions[i] );
+            if( position == chainTop )
+            {
+                continue;
+            }
+            const dist_t distance( distMatrix.getDistance( chainTop, position ) );
+            if( distance < nearestDist || ( distance == nearestDist && precedesInScan( chainTop, position, nearest ) ) )
+            {
+                nearestDist = distance;
+                nearest = position;
+            }
+        }
+
+        if( chain.size() == 1 || nearest != chain[chain.size() - 2] )
+        {
+            chain.push_back( nearest );
+            continue;
+        }
+
+        // reciprocal nearest neighbours: merge them, the rest of the chain stays valid for reducible linkages
+        chain.pop_back();
+        chain.pop_back();
+        chainMerge thisMerge;
+        thisMerge.first = std::min( chainTop, nearest );
+        thisMerge.second = std::max( chainTop, nearest );
+        thisMerge.dist = nearestDist;
+        merges.push_back( thisMerge );
+
+        // update distances, values corresponding to the first position are changed to the ones corresponding to the merged cluster
+        // (distances to inactive positions below the first one are updated too, they are never read again)
+        mergeDistances( thisMerge.first, thisMerge.second, clusterSizes[thisMerge.first], clusterSizes[thisMerge.second], graphMethod, &distMatrix,
+                        &activePositions );
+        clusterSizes[thisMerge.first] += clusterSizes[thisMerge.second];
+        activePositions.erase( std::lower_bound( activePositions.begin(), activePositions.end(), thisMerge.second ) );
+
+        if( m_verbose )
+        {
+            showProgress( merges.size(), leaves.size() - 1, loopStart, &lastTime );
+        }
+    } // end big loop
+
+    buildChainNodes( merges, &leaves, &nodes );
+    return;
+} // end treeBuilder::chainLinkage() -------------------------------------------------------------------------------------
+
+
+void graphTreeBuilder::buildChainNodes( const std::vector< chainMerge >& merges, std::vector< WHnode >* const leavesPointer,
+                                        std::vector< WHnode >* const nodesPointer ) const
+{
+    std::vector< WHnode >& leaves( *leavesPointer );
+    std::vector< WHnode >& nodes( *nodesPointer );
+
+    // merges were found out of distance order: sort them by distance, never placing a merge before the ones that formed its clusters
+    // (sort keys are raised to the key of the child merges in case of rounding inversions). Merges at the same distance are taken in the
+    // order the global minimum scan would take them (by higher and then lower matrix position)
+    std::vector< dist_t > sortKeys( merges.size() );
+    std::vector< size_t > pendingChildren( merges.size(), 0 ), parentMerge( merges.size(), merges.size() );
+    std::vector< size_t > lastMerge( leaves.size(), merges.size() ); // last merge that formed the cluster at each position
+    for( size_t i = 0; i < merges.size(); ++i )
+    {
+        sortKeys[i] = merges[i].dist;
+        size_t children[2] = { lastMerge[merges[i].first], lastMerge[merges[i].second] };
+        for( size_t k = 0; k < 2; ++k )
+        {
+            if( children[k] != merges.size() )
+            {
+                sortKeys[i] = std::max( sortKeys[i], sortKeys[children[k]] );
+                parentMerge[children[k]] = i;
+                ++pendingChildren[i];
+            }
+        }
+        lastMerge[merges[i].first] = i;
+    }
+    typedef std::pair< std::pair< dist_t, std::pair< size_t, size_t > >, size_t > mergeKey_t;
+    std::priority_queue< mergeKey_t, std::vector< mergeKey_t >, std::greater< mergeKey_t > > readyMerges;
+    for( size_t i = 0; i < merges.size(); ++i )
+    {
+        if( pendingChildren[i] == 0 )
+        {
+            readyMerges.push( std::make_pair( std::make_pair( sortKeys[i], std::make_pair( merges[i].second, merges[i].first ) ), i ) );
+        }
+    }
+    std::vector< size_t > mergeOrder;
+    mergeOrder.reserve( merges.size() );
+    while( !readyMerges.empty() )
+    {
+        size_t thisMergeID( readyMerges.top().second );
+        readyMerges.pop();
+        mergeOrder.push_back( thisMergeID );
+        size_t parentID( parentMerge[thisMergeID] );
+        if( parentID != merges.size() && --pendingChildren[parentID] == 0 )
+        {
+            readyMerges.push( std::make_pair( std::make_pair( sortKeys[parentID], std::make_pair( merges[parentID].second, merges[parentID].first ) ), parentID ) );
+        }
+    }
+
+    //create lookup table (translate position in the list to leaf/node ID) and build the nodes in order
+    std::vector< nodeID_t > lookup;
+    lookup.reserve( leaves.size() );
+    for( size_t i = 0; i < leaves.size(); ++i )
+    {
+        lookup.push_back( leaves[i].getFullID() );
+    }
+    for( size_t i = 0; i < mergeOrder.size(); ++i )
+    {
+        const chainMerge& thisMerge( merges[mergeOrder[i]] );
+        nodeID_t node2join1ID( lookup[thisMerge.first] );
+        nodeID_t node2join2ID( lookup[thisMerge.second] );
+        nodeID_t newID( std::make_pair( true, nodes.size() ) );
+        WHnode* node2join1( fetchNode( node2join1ID, &leaves, &nodes ) );
+        WHnode* node2join2( fetchNode( node2join2ID, &leaves, &nodes ) );
+        node2join1->setParent( newID );
+        node2join2->setParent( newID );
+
+        std::vector< nodeID_t > newKids( 1, node2join1ID );
+        newKids.push_back( node2join2ID );
+        size_t newSize( node2join1->getSize() + node2join2->getSize() );
+        size_t newHLevel( std::max( node2join1->getHLevel(), node2join2->getHLevel() ) + 1 );
+        WHnode newNode( newID, newKids, newSize, thisMerge.dist, newHLevel );
+        nodes.push_back( newNode );
+
+        lookup[thisMerge.first] = newID;
+    }
+    return;
+} // end treeBuilder::buildChainNodes() -------------------------------------------------------------------------------------
+
+
+void graphTreeBuilder::mstLinkage( std::vector< WHnode >* const leavesPointer, std::vector< WHnode >* const nodesPointer ) const
+{
+    const size_t roiSize( m_roi.size() );
+
+    // open the distance source, the matrix is streamed on every pass and never kept in memory
+    boost::scoped_ptr< distBlock > dBlock;
+    boost::scoped_ptr< packedDistMatrix > packedMatrix;
+    std::vector< size_t > roiMatrixIDs( roiSize );
+    if( boost::filesystem::is_regular_file( boost::filesystem::path( m_inputFolder ) ) )
+    {
+        packedMatrix.reset( new packedDistMatrix( m_inputFolder ) );
+        findRoiMatrixIDs( *packedMatrix, &roiMatrixIDs );
+    }
+    else
+    {
+        dBlock.reset( new distBlock( m_inputFolder ) );
+        if( !dBlock->indexReady() )
+        {
+            throw std::runtime_error( "ERROR @ treeBuilder::mstLinkage(): distance matrix index did not load" );
+        }
+        for( size_t i = 0; i < roiSize; ++i )
+        {
+            roiMatrixIDs[i] = dBlock->getMatrixID( m_roi[i] );
+        }
+        dBlock->setCacheSize( 2 * dBlock->blockBytes() );
+        dBlock->setPrefetch( true );
+    }
+
+    std::vector< size_t > parents( roiSize ), components( roiSize ); // union-find forest, and component of each position at the last pass
+    for( size_t i = 0; i < roiSize; ++i )
+    {
+        parents[i] = i;
+    }
+    std::vector< std::pair< dist_t, size_t > > candidates( roiSize * MST_CANDIDATES );
+    std::vector< size_t > candidateCounts( roiSize, 0 ), candidatePointers( roiSize, 0 );
+    const mstEdge_t noEdge( std::numeric_limits< dist_t >::max(), std::make_pair( roiSize, roiSize ) );
+    std::vector< mstEdge_t > bestEdges( roiSize, noEdge ), lowerBounds( roiSize, noEdge );
+    std::vector< mstEdge_t > treeEdges;
+    treeEdges.reserve( roiSize - 1 );
+    size_t numPasses( 0 );
+
+    while( treeEdges.size() < roiSize - 1 )
+    {
+        // collect the best edges leaving the current component of each position
+        for( size_t i = 0; i < roiSize; ++i )
+        {
+            components[i] = findRoot( &parents, i );
+        }
+        ++numPasses;
+        if( m_verbose )
+            std::cout << "\rMinimum spanning tree pass " << numPasses << ": " << roiSize - treeEdges.size() << " components...   " << std::flush;
+        mstPass( dBlock.get(), packedMatrix.get(), roiMatrixIDs, components, &candidates, &candidateCounts );
+        std::fill( candidatePointers.begin(), candidatePointers.end(), 0 );
+
+        // contract the components in memory (Boruvka steps) for as long as the minimum edge leaving each of them is known from the candidates
+        bool contracted( true );
+        while( contracted && treeEdges.size() < roiSize - 1 )
+        {
+            contracted = false;
+            std::fill( bestEdges.begin(), bestEdges.end(), noEdge );
+            std::fill( lowerBounds.begin(), lowerBounds.end(), noEdge );
+            for( size_t i = 0; i < roiSize; ++i )
+            {
+                const size_t root( findRoot( &parents, i ) );
+                const std::pair< dist_t, size_t >* const list( &candidates[i * MST_CANDIDATES] );
+                size_t& pointer( candidatePointers[i] );
+                while( pointer < candidateCounts[i] && findRoot( &parents, list[pointer].second ) == root )
+                {
+                    ++pointer;
+                }
+                if( pointer < candidateCounts[i] )
+                {
+                    bestEdges[root] = std::min( bestEdges[root], mstEdge( list[pointer].first, i, list[pointer].second ) );
+                }
+                else if( candidateCounts[i] == MST_CANDIDATES )
+                {
+                    // the edges of this position that were not kept all come after its last candidate
+                    lowerBounds[root] = std::min( lowerBounds[root], mstEdge( list[MST_CANDIDATES - 1].first, i, list[MST_CANDIDATES - 1].second ) );
+                }
+            }
+            for( size_t root = 0; root < roiSize; ++root )
+            {
+                if( bestEdges[root] < lowerBounds[root] )
+                {
+                    // the minimum edge leaving a component belongs to the minimum spanning tree
+                    const size_t root1( findRoot( &parents, bestEdges[root].second.first ) );
+                    const size_t root2( findRoot( &parents, bestEdges[root].second.second ) );
+                    if( root1 != root2 )
+                    {
+                        parents[root2] = root1;
+                        treeEdges.push_back( bestEdges[root] );
+                        contracted = true;
+                    }
+                }
+            }
+        }
+    }
+    if( m_verbose )
+        std::cout << "\rMinimum spanning tree built in " << numPasses << " passes over the matrix" << std::endl;
+    if( m_logfile != 0 )
+        ( *m_logfile ) << "Minimum spanning tree passes:\t" << numPasses << std::endl;
+
+    // the single linkage merges are the tree edges in increasing order, clusters are identified by the lowest position of their leaves
+    std::sort( treeEdges.begin(), treeEdges.end() );
+    std::vector< size_t > lowestPositions( roiSize );
+    for( size_t i = 0; i < roiSize; ++i )
+    {
+        parents[i] = i;
+        lowestPositions[i] = i;
+    }
+    std::vector< chainMerge > merges;
+    merges.reserve( treeEdges.size() );
+    for( size_t i = 0; i < treeEdges.size(); ++i )
+    {
+        const size_t root1( findRoot( &parents, treeEdges[i].second.first ) );
+        const size_t root2( findRoot( &parents, treeEdges[i].second.second ) );
+        chainMerge thisMerge;
+        thisMerge.first = std::min( lowestPositions[root1], lowestPositions[root2] );
+        thisMerge.second = std::max( lowestPositions[root1], lowestPositions[root2] );
+        thisMerge.dist = treeEdges[i].first;
+        merges.push_back( thisMerge );
+        parents[root2] = root1;
+        lowestPositions[root1] = thisMerge.first;
+    }
+
+    buildChainNodes( merges, leavesPointer, nodesPointer );
+    return;
+} // end treeBuilder::mstLinkage() -------------------------------------------------------------------------------------
+
+
+void graphTreeBuilder::mstPass( distBlock* const dBlock, const packedDistMatrix* const packedMatrix, const std::vector< size_t >& roiMatrixIDs,
+                                const std::vector< size_t >& components, std::vector< std::pair< dist_t, size_t > >* const candidatesPointer,
+                                std::vector< size_t >* const candidateCounts ) const
+{
+    std::vector< std::pair< dist_t, size_t > >& candidates( *candidatesPointer );
+    std::vector< size_t >& counts( *candidateCounts );
+    std::fill( counts.begin(), counts.end(), 0 );
+    const size_t roiSize( m_roi.size() );
+
+    // distances are read for the same seed pairs as when loading the matrix
+    if( dBlock == 0 )
+    {
+        // each row is scanned by a single thread, so every pair is read twice
+#pragma omp parallel for schedule( guided )
+        for( size_t i = 0; i < roiSize; ++i )
+        {
+            for( size_t j = 0; j < roiSize; ++j )
+            {
+                if( components[j] != components[i] )
+                {
+                    offerCandidate( &candidates[i * MST_CANDIDATES], &counts[i], ( j < i ) ? packedMatrix->getDistance( roiMatrixIDs[i], roiMatrixIDs[j] )
+                                                                                           : packedMatrix->getDistance( roiMatrixIDs[j], roiMatrixIDs[i] ), j );
+                }
+            }
+        }
+        return;
+    }
+
+    size_t rowStart( 0 ), rowEnd( 0 ), colStart( 0 ), colEnd( 0 );
+    while( rowStart < roiSize )
+    {
+        dBlock->loadBlock( m_roi[rowStart], m_roi[colStart] );
+        blockEnds( *dBlock, rowStart, colStart, &rowEnd, &colEnd );
+
+        // each block is scanned by rows and then by columns, so that every candidate list is only updated by one thread
+#pragma omp parallel for schedule( guided )
+        for( size_t i = rowStart; i < rowEnd; ++i )
+        {
+            for( size_t j = std::max( colStart, i + 1 ); j < colEnd; ++j )
+            {
+                if( components[j] != components[i] )
+                {
+                    offerCandidate( &candidates[i * MST_CANDIDATES], &counts[i], dBlock->getDistance( roiMatrixIDs[i], roiMatrixIDs[j] ), j );
+                }
+            }
+        }
+#pragma omp parallel for schedule( guided )
+        for( size_t j = colStart; j < colEnd; ++j )
+        {
+            for( size_t i = rowStart; i < std::min( rowEnd, j ); ++i )
+            {
+                if( components[j] != components[i] )
+                {
+                    offerCandidate( &candidates[j * MST_CANDIDATES], &counts[j], dBlock->getDistance( roiMatrixIDs[i], roiMatrixIDs[j] ), i );
+                }
+            }
+        }
+
+        if( colEnd == roiSize )
+        {
+            // if we just finished the last column of the roi, move to the diagonal element of the next row
+            rowStart = rowEnd;
+            colStart = rowStart;
+        }
+        else
+        {
+            // move to the next column
+            colStart = colEnd;
+        }
+    }
+    return;
+} // end treeBuilder::mstPass() -------------------------------------------------------------------------------------
+
+
+void graphTreeBuilder::blockEnds( const distBlock& dBlock, const size_t rowStart, const size_t colStart, size_t* const rowEnd, size_t* const colEnd ) const
+{
+    // get range of block and find the position of the first voxel in the roi not contained in the block (for both rows and columns)
+    std::pair< std::pair< WHcoord, WHcoord >, std::pair< WHcoord, WHcoord > > currentRange( dBlock.getBlockRange() );
+    std::pair< WHcoord, WHcoord > rangeBlockRow( currentRange.first );
+    std::pair< WHcoord, WHcoord > rangeBlockColumn( currentRange.second );
+
+    *rowEnd = std::lower_bound( m_roi.begin() + rowStart, m_roi.end(), rangeBlockRow.second ) - m_roi.begin();
+    if( m_roi[*rowEnd] == rangeBlockRow.second )
+        ++( *rowEnd );
+
+    if( colStart == rowStart )
+    {
+        *colEnd = *rowEnd;
+    }
+    else
+    {
+        *colEnd = std::lower_bound( m_roi.begin() + colStart, m_roi.end(), rangeBlockColumn.second ) - m_roi.begin();
+        if( m_roi[*colEnd] == rangeBlockColumn.second )
+            ++( *colEnd );
+    }
+    return;
+} // end treeBuilder::blockEnds() -------------------------------------------------------------------------------------
+
+
+void graphTreeBuilder::findRoiMatrixIDs( const packedDistMatrix& packedMatrix, std::vector< size_t >* const roiMatrixIDs ) const
+{
+    std::map< WHcoord, size_t > matrixIDs;
+    for( size_t i = 0; i < packedMatrix.coordinates().size(); ++i )
+    {
+        matrixIDs[packedMatrix.coordinates()[i]] = i;
+    }
+    roiMatrixIDs->resize( m_roi.size() );
+    for( size_t i = 0; i < m_roi.size(); ++i )
+    {
+        std::map< WHcoord, size_t >::const_iterator findIter( matrixIDs.find( m_roi[i] ) );
+        if( findIter == matrixIDs.end() )
+        {
+            throw std::runtime_error( "ERROR @ treeBuilder::findRoiMatrixIDs(): roi seed " + m_roi[i].getNameString() + " is not in the matrix" );
+        }
+        ( *roiMatrixIDs )[i] = findIter->second;
+    }
+    return;
+} // end treeBuilder::findRoiMatrixIDs() -------------------------------------------------------------------------------------
+
+
+void graphTreeBuilder::sparseNeighbours( std::vector< size_t >* const nbOffsetsPointer, std::vector< size_t >* const nbIDsPointer ) const
+{
+    std::vector< size_t >& nbOffsets( *nbOffsetsPointer );
+    std::vector< size_t >& nbIDs( *nbIDsPointer );
+
+    // translate neighborhood level, the wider neighbourhoods are the neighbours of the neighbours, as in the centroid tree initialization
+    unsigned int nbLevel1( m_nbLevel ), nbLevel2( 0 );
+    if( m_nbLevel == 92 )
+    {
+        nbLevel1 = 18;
+        nbLevel2 = 18;
+    }
+    else if( m_nbLevel == 124 )
+    {
+        nbLevel1 = 26;
+        nbLevel2 = 26;
+    }
+
+    std::map< WHcoord, size_t > roimap;
+    for( size_t i = 0; i < m_roi.size(); ++i )
+    {
+        roimap[m_roi[i]] = i;
+    }
+
+    // get the neighbour IDs of every seed voxel, sorted so that the slot of each pair can be found from both ends
+    std::vector< std::vector< size_t > > seedNbs( m_roi.size() );
+#pragma omp parallel for schedule( dynamic, 64 )
+    for( size_t roiID = 0; roiID < m_roi.size(); ++roiID )
+    {
+        std::vector< size_t >& theseNbs( seedNbs[roiID] );
+        std::vector< WHcoord > nbCoords( m_roi[roiID].getPhysNbs( m_datasetSize, nbLevel1 ) );
+        for( size_t i = 0; i < nbCoords.size(); ++i )
+        {
+            std::map< WHcoord, size_t >::const_iterator roiIter( roimap.find( nbCoords[i] ) );
+            if( roiIter != roimap.end() )
+            {
+                theseNbs.push_back( roiIter->second );
+            }
+        }
+        if( nbLevel2 != 0 )
+        { // theres a second nbhood search phase, from the level 1 neighbours that are seeds
+            const size_t level1Count( theseNbs.size() );
+            for( size_t i = 0; i < level1Count; ++i )
+            {
+                std::vector< WHcoord > nbCoords2( m_roi[theseNbs[i]].getPhysNbs( m_datasetSize, nbLevel2 ) );
+                for( size_t j = 0; j < nbCoords2.size(); ++j )
+                {
+                    std::map< WHcoord, size_t >::const_iterator roiIter( roimap.find( nbCoords2[j] ) );
+                    if( roiIter != roimap.end() && roiIter->second != roiID )
+                    {
+                        theseNbs.push_back( roiIter->second );
+                    }
+                }
+            }
+        }
+        std::sort( theseNbs.begin(), theseNbs.end() );
+        theseNbs.erase( std::unique( theseNbs.begin(), theseNbs.end() ), theseNbs.end() );
+    }
+
+    // pack the neighbour lists into compressed rows
+    nbOffsets.assign( m_roi.size() + 1, 0 );
+    for( size_t i = 0; i < m_roi.size(); ++i )
+    {
+        nbOffsets[i + 1] = nbOffsets[i] + seedNbs[i].size();
+    }
+    nbIDs.clear();
+    nbIDs.reserve( nbOffsets.back() );
+    for( size_t i = 0; i < m_roi.size(); ++i )
+    {
+        nbIDs.insert( nbIDs.end(), seedNbs[i].begin(), seedNbs[i].end() );
+        std::vector< size_t >().swap( seedNbs[i] );
+    }
+
+    float meanNbs( m_roi.empty() ? 0 : nbIDs.size() / static_cast< float >( m_roi.size() ) );
+    if( m_verbose )
+    {
+        std::cout << "Neighbourhood graph (level " << m_nbLevel << "): " << nbIDs.size() / 2 << " edges, mean number of neighbours: " << meanNbs << std::endl;
+    }
+    if( m_logfile != 0 )
+    {
+        ( *m_logfile ) << "Neighbourhood graph edges:\t" << nbIDs.size() / 2 << std::endl;
+        ( *m_logfile ) << "Mean # of nbs:\t" << meanNbs << std::endl;
+    }
+    return;
+} // end treeBuilder::sparseNeighbours() -------------------------------------------------------------------------------------
+
+
+void graphTreeBuilder::sparseDistances( const std::vector< size_t >& nbOffsets, const std::vector< size_t >& nbIDs,
+                                        std::vector< dist_t >* const nbDistsPointer ) const
+{
+    std::vector< dist_t >& nbDists( *nbDistsPointer );
+    nbDists.assign( nbIDs.size(), 2 );
+
+    if( m_verbose )
+    {
+        std::cout << "Computing neighbour tractogram dissimilarities" << std::endl;
+        std::cout << "Tractogram threshold (in log units): " << m_tractThreshold << std::endl;
+        std::cout << "Tractogram log factor: " << m_logFactor << std::endl;
+    }
+    if( m_logfile != 0 )
+    {
+        ( *m_logfile ) << "Tractogram threshold (in log units): " << m_tractThreshold << std::endl;
+        ( *m_logfile ) << "Tractogram log factor: " << m_logFactor << std::endl;
+    }
+
+    fileManagerFactory fileSingleMF( m_inputFolder );
+    fileManager& fileSingle( fileSingleMF.getFM() );
+    fileSingle.readAsUnThres();
+    fileSingle.readAsLog();
+
+    // group the seeds by z plane. The distance of a pair is computed when the plane of its lower seed (in z, and then in ID) is scanned,
+    // so the tracts of a plane are freed once it is scanned and only the planes up to the reach of the neighbourhood above are kept in memory
+    std::vector< std::vector< size_t > > planeSeeds( m_datasetSize.m_z );
+    for( size_t i = 0; i < m_roi.size(); ++i )
+    {
+        planeSeeds[static_cast< size_t >( m_roi[i].m_z )].push_back( i );
+    }
+    size_t reach( 0 );
+    for( size_t i = 0; i < m_roi.size(); ++i )
+    {
+        for( size_t k = nbOffsets[i]; k < nbOffsets[i + 1]; ++k )
+        {
+            if( m_roi[nbIDs[k]].m_z > m_roi[i].m_z )
+            {
+                reach = std::max( reach, static_cast< size_t >( m_roi[nbIDs[k]].m_z - m_roi[i].m_z ) );
+            }
+        }
+    }
+
+    time_t loopStart( time( NULL ) ), lastTime( time( NULL ) );
+    std::vector< sparseTract > tracts( m_roi.size() );
+    size_t readPlanes( 0 ), windowTracts( 0 ), peakTracts( 0 ), scannedSeeds( 0 ), numComps( 0 );
+    for( size_t z = 0; z < planeSeeds.size(); ++z )
+    {
+        // read the tracts of the planes entering the window
+        for( ; readPlanes < planeSeeds.size() && readPlanes <= z + reach; ++readPlanes )
+        {
+            const std::vector< size_t >& newSeeds( planeSeeds[readPlanes] );
+#pragma omp parallel for schedule( dynamic )
+            for( size_t i = 0; i < newSeeds.size(); ++i )
+            {
+                compactTractChar tempTract;
+                fileSingle.readLeafTract( newSeeds[i], m_trackids, m_roi, &tempTract );
+                tempTract.threshold( m_tractThreshold );
+                sparseTract tempSparseTract( tempTract );
+                tempSparseTract.computeNorm();
+                tracts[newSeeds[i]].steal( &tempSparseTract );
+            }
+            windowTracts += newSeeds.size();
+        }
+        peakTracts = std::max( peakTracts, windowTracts );
+
+        // compute the distances of the pairs owned by the seeds of the plane
+        const std::vector< size_t >& theseSeeds( planeSeeds[z] );
+#pragma omp parallel for schedule( dynamic ) reduction( +: numComps )
+        for( size_t i = 0; i < theseSeeds.size(); ++i )
+        {
+            const size_t seedID( theseSeeds[i] );
+            for( size_t k = nbOffsets[seedID]; k < nbOffsets[seedID + 1]; ++k )
+            {
+                const size_t nbID( nbIDs[k] );
+                if( m_roi[nbID].m_z < m_roi[seedID].m_z || ( m_roi[nbID].m_z == m_roi[seedID].m_z && nbID < seedID ) )
+                {
+                    continue;
+                }
+                std::vector< size_t >::const_iterator nbEnd( nbIDs.begin() + nbOffsets[nbID + 1] );
+                std::vector< size_t >::const_iterator backIter( std::lower_bound( nbIDs.begin() + nbOffsets[nbID], nbEnd, seedID ) );
+                if( backIter == nbEnd || *backIter != seedID )
+                {
+                    std::cerr<< "Seed: " <<  m_roi[seedID] << ". Nb: " << m_roi[nbID] << std::endl;
+                    throw std::runtime_error( "ERROR @ treeBuilder::sparseDistances(): neighborhood data not found" );
+                }
+
+                // the tract with the lower ID is the reference one
+                dist_t nbDist( ( seedID < nbID ) ? tracts[seedID].tractDistance( tracts[nbID] ) : tracts[nbID].tractDistance( tracts[seedID] ) );
+                nbDists[k] = nbDist;
+                nbDists[backIter - nbIDs.begin()] = nbDist;
+                ++numComps;
+            }
+        }
+
+        // free the tracts of the plane
+        for( size_t i = 0; i < theseSeeds.size(); ++i )
+        {
+            sparseTract emptyTract;
+            tracts[theseSeeds[i]].steal( &emptyTract );
+        }
+        windowTracts -= theseSeeds.size();
+        scannedSeeds += theseSeeds.size();
+
+        if( m_verbose )
+        {
+            time_t currentTime( time( NULL ) );
+            if( currentTime - lastTime > 1 )
+            {
+                lastTime = currentTime;
+                std::cout << "\r" << static_cast< int >( scannedSeeds * 100. / m_roi.size() ) << " % of seeds scanned (" << scannedSeeds << "). " << std::flush;
+            }
+        }
+    }
+
+    if( m_verbose )
+    {
+        int timeTaken = difftime( time( NULL ), loopStart );
+        std::cout << "\r" << std::flush << "100 % of seeds scanned. Time taken: " << timeTaken / 3600 << "h " << ( timeTaken
+                        % 3600 ) / 60 << "' " << ( ( timeTaken % 3600 ) % 60 ) << "\"    " << std::endl;
+        std::cout << "Neighbour distances computed: " << numComps << ". Peak tracts in memory: " << peakTracts << " (" << reach + 1 << " planes)" << std::endl;
+    }
+    if( m_logfile != 0 )
+    {
+        ( *m_logfile ) << "Neighbour distances computed:\t" << numComps << std::endl;
+        ( *m_logfile ) << "Peak tracts in memory:\t" << peakTracts << std::endl;
+    }
+    return;
+} // end treeBuilder::sparseDistances() -------------------------------------------------------------------------------------
+
+
+void graphTreeBuilder::sparseLinkage( const TG_GRAPHTYPE graphMethod, const std::vector< size_t >& nbOffsets, const std::vector< size_t >& nbIDs,
+                                      const std::vector< dist_t >& nbDists, std::vector< WHnode >* const leavesPointer,
+                                      std::vector< WHnode >* const nodesPointer ) const
+{
+    std::vector< WHnode >& leaves( *leavesPointer );
+    std::vector< WHnode >& nodes( *nodesPointer );
+
+    time_t loopStart( time( NULL ) ), lastTime( time( NULL ) );
+
+    // clusters are identified by the lowest matrix position of their leaves (the position that keeps the merged distances)
+    std::vector< nbList_t > neighbours( leaves.size() );
+    std::vector< size_t > clusterSizes( leaves.size(), 1 );
+    std::vector< bool > active( leaves.size(), true );
+    std::priority_queue< sparseEdge_t, std::vector< sparseEdge_t >, std::greater< sparseEdge_t > > edges;
+    for( size_t i = 0; i < leaves.size(); ++i )
+    {
+        neighbours[i].reserve( nbOffsets[i + 1] - nbOffsets[i] );
+        for( size_t k = nbOffsets[i]; k < nbOffsets[i + 1]; ++k )
+        {
+            neighbours[i].push_back( std::make_pair( nbIDs[k], nbDists[k] ) );
+            if( nbIDs[k] < i )
+            {
+                edges.push( sparseEdge( nbDists[k], i, nbIDs[k] ) );
+            }
+        }
+    }
+
+    std::vector< chainMerge > merges;
+    merges.reserve( leaves.size() - 1 );
+    dist_t topDist( 1 );
+    while( !edges.empty() )
+    {
+        const sparseEdge_t thisEdge( edges.top() );
+        edges.pop();
+        const size_t first( thisEdge.second.second ), second( thisEdge.second.first );
+
+        // edges are not removed from the heap when their distance changes, an edge is outdated if it no longer matches the neighbour lists
+        if( !active[first] || !active[second] )
+        {
+            continue;
+        }
+        nbList_t::const_iterator edgeIter( findNeighbour( neighbours[first], second ) );
+        if( edgeIter == neighbours[first].end() || edgeIter->second != thisEdge.first )
+        {
+            continue;
+        }
+
+        chainMerge thisMerge;
+        thisMerge.first = first;
+        thisMerge.second = second;
+        thisMerge.dist = thisEdge.first;
+        merges.push_back( thisMerge );
+        topDist = std::max( topDist, thisMerge.dist );
+
+        // update distances, the merged cluster takes the first position and the neighbours of both pre-merge clusters
+        eraseNeighbour( &neighbours[first], second );
+        eraseNeighbour( &neighbours[second], first );
+        mergeDistances( clusterSizes[first], clusterSizes[second], graphMethod, neighbours[second], &neighbours[first] );
+        clusterSizes[first] += clusterSizes[second];
+        active[second] = false;
+
+        // only the distances to the neighbours of the second cluster may have changed, the edges to the other neighbours of the first one stay valid
+        for( nbList_t::const_iterator nbIter( neighbours[second].begin() ); nbIter != neighbours[second].end(); ++nbIter )
+        {
+            const dist_t newDist( findNeighbour( neighbours[first], nbIter->first )->second );
+            eraseNeighbour( &neighbours[nbIter->first], second );
+            if( setNeighbour( &neighbours[nbIter->first], first, newDist ) )
+            {
+                edges.push( sparseEdge( newDist, first, nbIter->first ) );
+            }
+        }
+        nbList_t().swap( neighbours[second] );
+
+        if( m_verbose )
+        {
+            showProgress( merges.size(), leaves.size() - 1, loopStart, &lastTime );
+        }
+    } // end big loop
+
+    // clusters in different connected components of the graph are joined to the one at the lowest position
+    if( merges.size() < leaves.size() - 1 )
+    {
+        const size_t components( leaves.size() - merges.size() );
+        size_t first( leaves.size() );
+        for( size_t i = 0; i < leaves.size(); ++i )
+        {
+            if( !active[i] )
+            {
+                continue;
+            }
+            if( first == leaves.size() )
+            {
+                first = i;
+                continue;
+            }
+            chainMerge thisMerge;
+            thisMerge.first = first;
+            thisMerge.second = i;
+            thisMerge.dist = topDist;
+            merges.push_back( thisMerge );
+        }
+        if( m_verbose )
+        {
+            std::cout << std::endl << "WARNING: the neighbourhood graph has " << components << " connected components, they were joined at level " << topDist << std::endl;
+        }
+        if( m_logfile != 0 )
+        {
+            ( *m_logfile ) << "Neighbourhood graph components:\t" << components << " (joined at level " << topDist << ")" << std::endl;
+        }
+    }
+
+    buildChainNodes( merges, &leaves, &nodes );
+    return;
+} // end treeBuilder::sparseLinkage() -------------------------------------------------------------------------------------
+
+
+void graphTreeBuilder::diskScanLinkage( const TG_GRAPHTYPE graphMethod, distRowStore* const distRowsPointer,
+                                        std::vector< WHnode >* const leavesPointer, std::vector< WHnode >* const nodesPointer ) const
+{
+    distRowStore& distRows( *distRowsPointer );
+    std::vector< WHnode >& leaves( *leavesPointer );
+    std::vector< WHnode >& nodes( *nodesPointer );
+
+    //create lookup table (translate position in the list to leaf/node ID
+    std::vector< nodeID_t > lookup;
+    lookup.reserve( leaves.size() );
+    for( size_t i = 0; i < leaves.size(); ++i )
+    {
+        lookup.push_back( leaves[i].getFullID() );
+    }
+
+    time_t loopStart( time( NULL ) ), lastTime( time( NULL ) );
+
+    // rows keep the values of the in-memory matrix, merges not yet applied to a stored row are replayed from the log when it is read
+    std::vector< rowUpdate > updates;
+    updates.reserve( leaves.size() - 1 );
+    std::vector< float > firstRow, secondRow;
 
-    std::vector< dist_t > lowestDistVector( distMatrix.size(), 2 );
-    std::vector< std::pair< size_t, size_t > > lowestLocationVector( distMatrix.size(), std::make_pair( 0, 0 ) );
+    std::vector< dist_t > lowestDistVector( distRows.size(), 2 );
+    std::vector< std::pair< size_t, size_t > > lowestLocationVector( distRows.size(), std::make_pair( 0, 0 ) );
 
-    // keep track of lowest distance per row (accelerates process)
-#pragma omp parallel for schedule(guided)
-    for( size_t i = 0; i < distMatrix.size(); ++i )
+    // keep track of lowest distance per row, reading the row file once in order
+    for( size_t i = 0; i < distRows.size(); ++i )
     {
-        for( int j = 0; j < i; ++j )
+        fetchRow( i, graphMethod, updates, &distRows, &firstRow );
+        size_t lowestCol( i );
+        lowerRowMinimum( firstRow, i, &lowestDistVector[i], &lowestCol );
+        if( lowestCol != i )
         {
-            if( distMatrix[i][j] < lowestDistVector[i] )
-            {
-                lowestDistVector[i] = distMatrix[i][j];
-                lowestLocationVector[i] = std::make_pair( j, i ); //greater number is always in the second position
-            }
+            lowestLocationVector[i] = std::make_pair( lowestCol, i ); //greater number is always in the second position
         }
     }
 
@@ -136,45 +1481,27 @@ void graphTreeBuilder::buildGraph( const TG_GRAPHTYPE graphMethod )
         WHnode newNode( newID, newKids, newSize, lowestDist, newHLevel );
         nodes.push_back( newNode );
 
-        //update matrix, values corresponding to the 1st joining node are changed to the ones corresponding to the new node
-        // values corresponding to the 2nd joining node are changed to discarded value (3)
-#pragma omp parallel for
-        for( size_t i = 0; i < distMatrix.size(); ++i )
-        {
-            if( i < lowestLocation.first )
-            {
-                distMatrix[lowestLocation.first][i] = newGraphDist( distMatrix[lowestLocation.first][i],
-                                distMatrix[lowestLocation.second][i], node2join1->getSize(), node2join2->getSize(), graphMethod );
-                distMatrix[lowestLocation.second][i] = 3;
-            }
-            else if( i == lowestLocation.first )
-            {
-                distMatrix[lowestLocation.second][i] = 3;
-            }
-            else if( i < lowestLocation.second )
-            {
-                distMatrix[i][lowestLocation.first] = newGraphDist( distMatrix[i][lowestLocation.first],
-                                distMatrix[lowestLocation.second][i], node2join1->getSize(), node2join2->getSize(), graphMethod );
-                distMatrix[lowestLocation.second][i] = 3;
-            }
-            else if( i == lowestLocation.second )
-            {
-            }
-            else
-            {
-                distMatrix[i][lowestLocation.first] = newGraphDist( distMatrix[i][lowestLocation.first],
-                                distMatrix[i][lowestLocation.second], node2join1->getSize(), node2join2->getSize(), graphMethod );
-                distMatrix[i][lowestLocation.second] = 3;
-            }
-        }
+        // the merged row is written to the first position, the other rows get the update (and the discarded value 3 for the second position)
+        // when they are read again
+        rowUpdate thisUpdate;
+        thisUpdate.first = lowestLocation.first;
+        thisUpdate.second = lowestLocation.second;
+        thisUpdate.size1 = node2join1->getSize();
+        thisUpdate.size2 = node2join2->getSize();
+        fetchRow( thisUpdate.first, graphMethod, updates, &distRows, &firstRow );
+        fetchRow( thisUpdate.second, graphMethod, updates, &distRows, &secondRow );
+        mergeDistances( thisUpdate.size1, thisUpdate.size2, graphMethod, &secondRow[0], &firstRow[0], firstRow.size() );
+        firstRow[thisUpdate.second] = 3;
+        updates.push_back( thisUpdate );
+        distRows.putRow( thisUpdate.first, firstRow, updates.size() );
+        distRows.dropRow( thisUpdate.second );
 
         //update lookup table
         lookup[lowestLocation.first] = newID;
         lookup[lowestLocation.second] = std::make_pair( false, 0 );
 
-        //update lowest distances
-#pragma omp parallel for schedule( guided )
-        for( int row = 1; row < lowestDistVector.size(); ++row )
+        //update lowest distances, the rows that need a rescan are read from the row store
+        for( size_t row = 1; row < lowestDistVector.size(); ++row )
         {
             if( lowestDistVector[row] != 3 )
             {
@@ -196,116 +1523,190 @@ void graphTreeBuilder::buildGraph( const TG_GRAPHTYPE graphMethod )
                     lowestDistVector[row] = 2;
                     lowestLocationVector[row] = std::make_pair( 0, 0 );
 
-                    for( int col = 0; col < row; ++col )
+                    if( row != lowestLocation.first )
                     {
-                        if( distMatrix[row][col] < lowestDistVector[row] )
-                        {
-                            lowestDistVector[row] = distMatrix[row][col];
-                            lowestLocationVector[row] = std::make_pair( col, row ); //greater number is always in the second position
-                        }
+                        fetchRow( row, graphMethod, updates, &distRows, &secondRow );
+                    }
+                    size_t lowestCol( row );
+                    lowerRowMinimum( ( row == lowestLocation.first ) ? firstRow : secondRow, row, &lowestDistVector[row], &lowestCol );
+                    if( lowestCol != row )
+                    {
+                        lowestLocationVector[row] = std::make_pair( lowestCol, row ); //greater number is always in the second position
                     }
                 }
                 else
                 { // if old distance is still valid
-                    if( lowestDistVector[row] > distMatrix[row][lowestLocation.first] )
+                    if( lowestDistVector[row] > firstRow[row] )
                     { // if new element is the smallest, change
-                        lowestDistVector[row] = distMatrix[row][lowestLocation.first];
+                        lowestDistVector[row] = firstRow[row];
                         lowestLocationVector[row] = std::make_pair( lowestLocation.first, row );
                     }
                 }
             } // end if
-        } // end parallel for
+        } // end for
 
         if( m_verbose )
         {
-            time_t currentTime( time( NULL ) );
-            if( currentTime - lastTime > 1 )
-            {
-                lastTime = currentTime;
-                float progress = nodes.size() * 100. / ( leaves.size() - 1. );
-                size_t elapsedTime( difftime( currentTime, loopStart ) );
-                std::stringstream message;
-                message << "\r" << static_cast<int>( progress ) << " % of tree built (";
-                message << nodes.size() << " nodes). ";
-                if( progress > 0 )
-                {
-                    size_t expectedRemain( elapsedTime * ( ( 100. - progress ) / progress ) );
-                    message << "Expected remaining time: ";
-                    message << expectedRemain / 3600 << "h ";
-                    message << ( expectedRemain % 3600 ) / 60 << "' ";
-                    message << ( expectedRemain % 3600 ) % 60 << "\". ";
-                }
-                message << "Elapsed time: ";
-                message << elapsedTime / 3600 << "h " << ( elapsedTime % 3600 ) / 60 << "' ";
-                message << ( elapsedTime % 3600 ) % 60 << "\". ";
-                std::cout << message.str() <<std::flush;
-            }
-        } // end verbose
+            showProgress( nodes.size(), leaves.size() - 1, loopStart, &lastTime );
+        }
+    } // end big loop
 
+    return;
+} // end treeBuilder::diskScanLinkage() -------------------------------------------------------------------------------------
 
 
-    } // end big loop
+void graphTreeBuilder::diskChainLinkage( const TG_GRAPHTYPE graphMethod, distRowStore* const distRowsPointer,
+                                         std::vector< WHnode >* const leavesPointer, std::vector< WHnode >* const nodesPointer ) const
+{
+    distRowStore& distRows( *distRowsPointer );
+    std::vector< WHnode >& leaves( *leavesPointer );
 
-    if( m_verbose )
-    {
-        int timeTaken = difftime( time( NULL ), loopStart );
-        std::cout << "\r" << std::flush << "100% of of tree built. Time taken: " << timeTaken / 3600 << "h " << ( timeTaken
-                        % 3600 ) / 60 << "' " << ( ( timeTaken % 3600 ) % 60 ) << "\"    " << std::endl;
-    }
+    time_t loopStart( time( NULL ) ), lastTime( time( NULL ) );
 
-    std::string graphName;
-    if( graphMethod == TG_SINGLE )
-    {
-        graphName = "single";
-    }
-    else if( graphMethod == TG_COMPLETE )
-    {
-        graphName = "complete";
-    }
-    else if( graphMethod == TG_AVERAGE )
-    {
-        graphName = "average";
-    }
-    else if( graphMethod == TG_WEIGHTED )
-    {
-        graphName = "weighted";
-    }
-    else if( graphMethod == TG_WARD )
+    // clusters are identified by the lowest matrix position of their leaves (the position that keeps the merged distances)
+    std::vector< size_t > activePositions( leaves.size() ); // sorted
+    std::vector< size_t > clusterSizes( leaves.size(), 1 );
+    for( size_t i = 0; i < leaves.size(); ++i )
     {
-        graphName = "ward";
+        activePositions[i] = i;
     }
-    else
+
+    std::vector< chainMerge > merges;
+    merges.reserve( leaves.size() - 1 );
+    std::vector< size_t > chain;
+    chain.reserve( leaves.size() );
+
+    // rows keep the values of the in-memory matrix, merges not yet applied to a stored row are replayed from the log when it is read
+    std::vector< rowUpdate > updates;
+    updates.reserve( leaves.size() - 1 );
+    std::vector< float > topRow, nearestRow;
+
+    while( activePositions.size() > 1 )
     {
-        throw std::runtime_error( "ERROR @ treeBuilder::buildGraph(): graph method not recognized" );
-    }
+        if( chain.empty() )
+        {
+            chain.push_back( activePositions.front() );
+        }
+        const size_t chainTop( chain.back() );
+        fetchRow( chainTop, graphMethod, updates, &distRows, &topRow );
+
+        // find nearest active cluster to the top of the chain, ties are broken by the positions of the pair in the order of the global minimum scan.
+        // Every pair has its own place in that order, so the chain always ends at a reciprocal pair
+        size_t nearest( chainTop );
+        dist_t nearestDist( 999 );
+        if( chain.size() > 1 )
+        {
+            nearest = chain[chain.size() - 2];
+            nearestDist = topRow[nearest];
+        }
+        for( size_t i = 0; i < activePositions.size(); ++i )
+        {
+            const size_t position( activePositions[i] );
+            if( position == chainTop )
+            {
+                continue;
+            }
+            if( topRow[position] < nearestDist || ( topRow[position] == nearestDist && precedesInScan( chainTop, position, nearest ) ) )
+            {
+                nearestDist = topRow[position];
+                nearest = position;
+            }
+        }
+
+        if( chain.size() == 1 || nearest != chain[chain.size() - 2] )
+        {
+            chain.push_back( nearest );
+            continue;
+        }
+
+        // reciprocal nearest neighbours: merge them, the rest of the chain stays valid for reducible linkages
+        chain.pop_back();
+        chain.pop_back();
+        chainMerge thisMerge;
+        thisMerge.first = std::min( chainTop, nearest );
+        thisMerge.second = std::max( chainTop, nearest );
+        thisMerge.dist = nearestDist;
+        merges.push_back( thisMerge );
+
+        // the merged row is written to the first position, the other rows get the update when they are read again
+        rowUpdate thisUpdate;
+        thisUpdate.first = thisMerge.first;
+        thisUpdate.second = thisMerge.second;
+        thisUpdate.size1 = clusterSizes[thisMerge.first];
+        thisUpdate.size2 = clusterSizes[thisMerge.second];
+        fetchRow( nearest, graphMethod, updates, &distRows, &nearestRow );
+        std::vector< float >& firstRow( ( chainTop == thisMerge.first ) ? topRow : nearestRow );
+        const std::vector< float >& secondRow( ( chainTop == thisMerge.first ) ? nearestRow : topRow );
+        mergeDistances( thisUpdate.size1, thisUpdate.size2, graphMethod, &secondRow[0], &firstRow[0], firstRow.size() );
+        firstRow[thisUpdate.second] = 3;
+        updates.push_back( thisUpdate );
+        distRows.putRow( thisUpdate.first, firstRow, updates.size() );
+        distRows.dropRow( thisUpdate.second );
+
+        clusterSizes[thisMerge.first] += clusterSizes[thisMerge.second];
+        activePositions.erase( std::lower_bound( activePositions.begin(), activePositions.end(), thisMerge.second ) );
+
+        if( m_verbose )
+        {
+            showProgress( merges.size(), leaves.size() - 1, loopStart, &lastTime );
+        }
+    } // end big loop
+
+    buildChainNodes( merges, leavesPointer, nodesPointer );
+    return;
+} // end treeBuilder::diskChainLinkage() -------------------------------------------------------------------------------------
 
+
+void graphTreeBuilder::fetchRow( const size_t row, const TG_GRAPHTYPE graphMethod, const std::vector< rowUpdate >& updates,
+                                 distRowStore* const distRows, std::vector< float >* const values ) const
+{
+    std::vector< float >& rowValues( *values );
+    const size_t stamp( distRows->getRow( row, values ) );
+    if( stamp == updates.size() )
     {
-        std::list< WHcoord > discarded;
-        WHtree thisTree( graphName, m_datasetGrid, m_datasetSize, m_numStreamlines, 0, leaves, nodes, m_trackids, m_roi, discarded );
-        m_tree = thisTree;
-        std::vector< WHnode > emptyL, emptyN;
-        leaves.swap( emptyL );
-        nodes.swap( emptyN );
+        return;
     }
 
-    if( !m_tree.check() )
+    // apply the merges done since the row was stored, in the same order and with the same arithmetic as the in-memory matrix gets them
+    for( size_t i = stamp; i < updates.size(); ++i )
     {
-        m_tree.writeTreeDebug( m_outputFolder + "/treedebug.txt" );
-        throw std::runtime_error( "ERROR @ treeBuilder::buildGraph(): resulting tree is not valid" );
+        const rowUpdate& thisUpdate( updates[i] );
+        mergeDistances( thisUpdate.size1, thisUpdate.size2, graphMethod, &rowValues[thisUpdate.second], &rowValues[thisUpdate.first], 1 );
+        rowValues[thisUpdate.second] = 3;
     }
 
-    m_treeReady = true;
-
-    if( m_verbose )
-        std::cout << m_tree.getReport() << std::endl;
-    if( m_logfile != 0 )
-        ( *m_logfile ) << m_tree.getReport() << std::endl;
+    // keep the updated row in the cache, its copy on disk is still valid together with the log so it is not marked for writing
+    distRows->putRow( row, rowValues, updates.size(), false );
+    return;
+} // end treeBuilder::fetchRow() -------------------------------------------------------------------------------------
 
-    m_tree.m_treeName = ( graphName );
-    writeTree();
 
+void graphTreeBuilder::showProgress( const size_t builtNodes, const size_t totalNodes, const time_t loopStart, time_t* const lastTime ) const
+{
+    time_t currentTime( time( NULL ) );
+    if( currentTime - *lastTime > 1 )
+    {
+        *lastTime = currentTime;
+        float progress = builtNodes * 100. / totalNodes;
+        size_t elapsedTime( difftime( currentTime, loopStart ) );
+        std::stringstream message;
+        message << "\r" << static_cast<int>( progress ) << " % of tree built (";
+        message << builtNodes << " nodes). ";
+        if( progress > 0 )
+        {
+            size_t expectedRemain( elapsedTime * ( ( 100. - progress ) / progress ) );
+            message << "Expected remaining time: ";
+            message << expectedRemain / 3600 << "h ";
+            message << ( expectedRemain % 3600 ) / 60 << "' ";
+            message << ( expectedRemain % 3600 ) % 60 << "\". ";
+        }
+        message << "Elapsed time: ";
+        message << elapsedTime / 3600 << "h " << ( elapsedTime % 3600 ) / 60 << "' ";
+        message << ( elapsedTime % 3600 ) % 60 << "\". ";
+        std::cout << message.str() <<std::flush;
+    }
     return;
-} // end treeBuilder::buildGraph() -------------------------------------------------------------------------------------
+} // end treeBuilder::showProgress() -------------------------------------------------------------------------------------
 
 
 void graphTreeBuilder::writeTree() const
@@ -360,9 +1761,9 @@ WHnode* graphTreeBuilder::fetchNode( const nodeID_t thisNode, std::vector< WHnod
 } // end treeBuilder::fetchNode() -------------------------------------------------------------------------------------
 
 
-void graphTreeBuilder::loadDistMatrix( std::vector< std::vector< float > >* const distMatrix ) const
+void graphTreeBuilder::loadDistMatrix( triangleDistMatrix* const distMatrix, distRowStore* const distRows ) const
 {
-    std::vector< std::vector< float > >& distMatrixRef( *distMatrix );
+    triangleDistMatrix& distMatrixRef( *distMatrix );
     // load distance block index
     if( m_verbose )
         std::cout << "Reading distance matrix index..." << std::flush;
@@ -378,18 +1779,22 @@ void graphTreeBuilder::loadDistMatrix( std::vector< std::vector< float > >* cons
         std::cout << "OK. Whole matrix is " << topBlock + 1 << "x" << topBlock + 1 << " blocks (real: " << numBlocks << "). "
                         << std::flush;
 
-    // initialize matrix
-    float floatVar( 0 );
-    float usedMem( ( ( m_roi.size() * m_roi.size() / 2. ) * ( sizeof( floatVar ) * CHAR_BIT / 8. ) ) / ( 1024 * 1024 * 1024 ) );
-    if( m_verbose )
-        std::cout << "WARNING: Initializing roi distance matrix. Expected memory comsumption at least " << usedMem
-                        << " GBytes... " << std::flush;
-    distMatrixRef.clear();
-    distMatrixRef.resize( m_roi.size() );
+    // matrix position of each roi seed, so that distances are fetched without coordinate lookups
+    std::vector< size_t > roiMatrixIDs( m_roi.size() );
     for( size_t i = 0; i < m_roi.size(); ++i )
-        distMatrixRef[i].resize( i, 0 );
-    if( m_verbose )
-        std::cout << "Done" << std::endl;
+    {
+        roiMatrixIDs[i] = dBlock.getMatrixID( m_roi[i] );
+    }
+
+    // blocks are traversed along the rows: keep the current block and read the next one in the background
+    dBlock.setCacheSize( 2 * dBlock.blockBytes() );
+    dBlock.setPrefetch( true );
+
+    // initialize matrix
+    if( distRows == 0 )
+    {
+        initMatrix( distMatrix );
+    }
 
     // initialize tracking positions
     size_t rowStart( 0 ), rowEnd( 0 ), colStart( 0 ), colEnd( 0 );
@@ -430,27 +1835,60 @@ void graphTreeBuilder::loadDistMatrix( std::vector< std::vector< float > >* cons
             }
         }
 
-        // get range of block and find the position of the first voxel in the roi not contained in the block (for both rows and columns)
-        std::pair< std::pair< WHcoord, WHcoord >, std::pair< WHcoord, WHcoord > > currentRange( dBlock.getBlockRange() );
-        std::pair< WHcoord, WHcoord > rangeBlockRow( currentRange.first );
-        std::pair< WHcoord, WHcoord > rangeBlockColumn( currentRange.second );
-
-        rowEnd = std::lower_bound( m_roi.begin() + rowStart, m_roi.end(), rangeBlockRow.second ) - m_roi.begin();
-        if( m_roi[rowEnd] == rangeBlockRow.second )
-            ++rowEnd;
+        // find the roi positions contained in the block
+        blockEnds( dBlock, rowStart, colStart, &rowEnd, &colEnd );
 
-        if( colStart == rowStart )
-        {
-            colEnd = rowEnd;
-        }
-        else
+        if( distRows != 0 )
         {
-            colEnd = std::lower_bound( m_roi.begin() + colStart, m_roi.end(), rangeBlockColumn.second ) - m_roi.begin();
-            if( m_roi[colEnd] == rangeBlockColumn.second )
-                ++colEnd;
+            // out-of-core: the block is written to the row file both as row segments and (transposed) as column segments,
+            // distances are read for the same seed pairs as for the in-memory matrix and mirrored
+            const size_t blockRows( rowEnd - rowStart ), blockCols( colEnd - colStart );
+            std::vector< float > blockValues( blockRows * blockCols, 0 );
+            std::string writeError;
+#pragma omp parallel for schedule( guided )
+            for( size_t i = rowStart; i < rowEnd; ++i )
+            {
+                for( size_t j = std::max( colStart, i + 1 ); j < colEnd; ++j )
+                {
+                    blockValues[( i - rowStart ) * blockCols + j - colStart] = dBlock.getDistance( roiMatrixIDs[i], roiMatrixIDs[j] );
+                }
+            }
+            if( rowStart == colStart )
+            {
+                for( size_t i = 0; i < blockRows; ++i )
+                {
+                    for( size_t j = 0; j < i; ++j )
+                    {
+                        blockValues[i * blockCols + j] = blockValues[j * blockCols + i];
+                    }
+                }
+                doneCount += ( blockRows * ( blockRows - 1 ) ) / 2;
+            }
+            else
+            {
+#pragma omp parallel for schedule( guided )
+                for( size_t j = colStart; j < colEnd; ++j )
+                {
+                    std::vector< float > columnValues( blockRows );
+                    for( size_t i = 0; i < blockRows; ++i )
+                    {
+                        columnValues[i] = blockValues[i * blockCols + j - colStart];
+                    }
+                    writeRowSegment( distRows, j, rowStart, &columnValues[0], blockRows, &writeError );
+                }
+                doneCount += blockRows * blockCols;
+            }
+#pragma omp parallel for schedule( guided )
+            for( size_t i = rowStart; i < rowEnd; ++i )
+            {
+                writeRowSegment( distRows, i, colStart, &blockValues[( i - rowStart ) * blockCols], blockCols, &writeError );
+            }
+            if( !writeError.empty() )
+            {
+                throw std::runtime_error( writeError );
+            }
         }
-
-        if( rowStart == colStart )
+        else if( rowStart == colStart )
         {
             // its a diagonal element
 
@@ -459,7 +1897,7 @@ void graphTreeBuilder::loadDistMatrix( std::vector< std::vector< float > >* cons
             {
                 for( size_t j = i + 1; j < colEnd; ++j )
                 {
-                    distMatrixRef[j][i] = ( dBlock.getDistance( m_roi[i], m_roi[j] ) );
+                    distMatrixRef.setDistance( j, i, dBlock.getDistance( roiMatrixIDs[i], roiMatrixIDs[j] ) );
                 }
             }
             doneCount += ( ( rowEnd - rowStart ) * ( rowEnd - rowStart - 1 ) ) / 2;
@@ -473,7 +1911,7 @@ void graphTreeBuilder::loadDistMatrix( std::vector< std::vector< float > >* cons
             {
                 for( size_t j = colStart; j < colEnd; ++j )
                 {
-                    distMatrixRef[j][i] = ( dBlock.getDistance( m_roi[i], m_roi[j] ) );
+                    distMatrixRef.setDistance( j, i, dBlock.getDistance( roiMatrixIDs[i], roiMatrixIDs[j] ) );
                 }
             }
             doneCount += ( rowEnd - rowStart ) * ( colEnd - colStart );
@@ -497,6 +1935,7 @@ void graphTreeBuilder::loadDistMatrix( std::vector< std::vector< float > >* cons
         int timeTaken = difftime( time( NULL ), loopStartTime );
         std::cout << "\r" << std::flush << "100 % of Matrix loaded. Time taken: " << timeTaken / 3600 << "h " << ( timeTaken
                         % 3600 ) / 60 << "' " << ( ( timeTaken % 3600 ) % 60 ) << "\"    " << std::endl;
+        std::cout << dBlock.getCacheReport() << std::endl;
     }
     if( m_logfile != 0 )
         ( *m_logfile ) << "Distance matrix loaded" << std::endl;
@@ -504,33 +1943,175 @@ void graphTreeBuilder::loadDistMatrix( std::vector< std::vector< float > >* cons
     return;
 } // end treeBuilder::loadDistMatrix() -------------------------------------------------------------------------------------
 
-dist_t graphTreeBuilder::newGraphDist( const dist_t distance1, const dist_t distance2, const size_t size1, const size_t size2,
-                const TG_GRAPHTYPE graphMethod ) const
+void graphTreeBuilder::loadPackedMatrix( triangleDistMatrix* const distMatrix, distRowStore* const distRows ) const
+{
+    triangleDistMatrix& distMatrixRef( *distMatrix );
+    if( m_verbose )
+        std::cout << "Opening packed distance matrix..." << std::flush;
+    packedDistMatrix packedMatrix( m_inputFolder );
+    if( m_verbose )
+        std::cout << "OK. Matrix has " << packedMatrix.size() << " seeds" << std::endl;
+
+    // matrix position of each roi seed
+    std::vector< size_t > roiMatrixIDs;
+    findRoiMatrixIDs( packedMatrix, &roiMatrixIDs );
+
+    // values are read straight from the mapped pages, rows are spread over the threads
+    time_t loopStartTime( time( NULL ) );
+    if( distRows != 0 )
+    {
+        // out-of-core: full rows are written to the row file, distances are read for the same seed pairs as for the in-memory matrix
+        std::string writeError;
+#pragma omp parallel for schedule( guided )
+        for( size_t i = 0; i < m_roi.size(); ++i )
+        {
+            std::vector< float > rowValues( m_roi.size(), 0 );
+            for( size_t j = 0; j < m_roi.size(); ++j )
+            {
+                if( j < i )
+                {
+                    rowValues[j] = packedMatrix.getDistance( roiMatrixIDs[i], roiMatrixIDs[j] );
+                }
+                else if( j > i )
+                {
+                    rowValues[j] = packedMatrix.getDistance( roiMatrixIDs[j], roiMatrixIDs[i] );
+                }
+            }
+            writeRowSegment( distRows, i, 0, &rowValues[0], rowValues.size(), &writeError );
+        }
+        if( !writeError.empty() )
+        {
+            throw std::runtime_error( writeError );
+        }
+    }
+    else
+    {
+        initMatrix( distMatrix );
+#pragma omp parallel for schedule( guided )
+        for( size_t i = 1; i < m_roi.size(); ++i )
+        {
+            for( size_t j = 0; j < i; ++j )
+            {
+                distMatrixRef.setDistance( i, j, packedMatrix.getDistance( roiMatrixIDs[i], roiMatrixIDs[j] ) );
+            }
+        }
+    }
+
+    if( m_verbose )
+    {
+        int timeTaken = difftime( time( NULL ), loopStartTime );
+        std::cout << "100 % of Matrix loaded. Time taken: " << timeTaken / 3600 << "h " << ( timeTaken
+                        % 3600 ) / 60 << "' " << ( ( timeTaken % 3600 ) % 60 ) << "\"    " << std::endl;
+    }
+    if( m_logfile != 0 )
+        ( *m_logfile ) << "Distance matrix loaded from packed file" << std::endl;
+
+    return;
+} // end treeBuilder::loadPackedMatrix() -------------------------------------------------------------------------------------
+
+void graphTreeBuilder::initMatrix( triangleDistMatrix* const distMatrix ) const
+{
+    PackedStorage storage( m_halfMatrix ? PSFloat16 : PSFloat32 );
+    float usedMem( ( ( m_roi.size() * ( m_roi.size() - 1 ) / 2. ) * ( m_halfMatrix ? 2 : 4 ) ) / ( 1024 * 1024 * 1024 ) );
+    if( m_verbose )
+        std::cout << "WARNING: Initializing roi distance matrix (" << ( m_halfMatrix ? "float16" : "float32" ) << "). Expected memory comsumption "
+                  << usedMem << " GBytes... " << std::flush;
+    distMatrix->resize( m_roi.size(), storage );
+    if( m_verbose )
+        std::cout << "Done" << std::endl;
+    if( m_logfile != 0 )
+        ( *m_logfile ) << "Distance matrix storage:\t" << ( m_halfMatrix ? "float16" : "float32" ) << " (" << usedMem << " GB)" << std::endl;
+    return;
+} // end treeBuilder::initMatrix() -------------------------------------------------------------------------------------
+
+void graphTreeBuilder::mergeDistances( const size_t first, const size_t second, const size_t size1, const size_t size2,
+                                       const TG_GRAPHTYPE graphMethod, triangleDistMatrix* const distMatrix,
+                                       const std::vector< size_t >* const positions ) const
+{
+    if( graphMethod == TG_SINGLE )
+    {
+        applyUpdate( first, second, singleUpdate(), positions, distMatrix );
+    }
+    else if( graphMethod == TG_COMPLETE )
+    {
+        applyUpdate( first, second, completeUpdate(), positions, distMatrix );
+    }
+    else if( graphMethod == TG_AVERAGE )
+    {
+        applyUpdate( first, second, averageUpdate( size1, size2 ), positions, distMatrix );
+    }
+    else if( graphMethod == TG_WEIGHTED )
+    {
+        applyUpdate( first, second, weightedUpdate(), positions, distMatrix );
+    }
+    else if ( graphMethod == TG_WARD )
+    {
+        applyUpdate( first, second, wardUpdate( size1, size2 ), positions, distMatrix );
+    }
+    else
+    {
+        throw std::runtime_error( "ERROR @ treeBuilder::mergeDistances(): graphMethodage option has an invalid value" );
+    }
+    return;
+} // end treeBuilder::mergeDistances() -------------------------------------------------------------------------------------
+
+void graphTreeBuilder::mergeDistances( const size_t size1, const size_t size2, const TG_GRAPHTYPE graphMethod,
+                                       const float* const secondValues, float* const firstValues, const size_t count ) const
+{
+    if( graphMethod == TG_SINGLE )
+    {
+        updateValues( singleUpdate(), secondValues, firstValues, count );
+    }
+    else if( graphMethod == TG_COMPLETE )
+    {
+        updateValues( completeUpdate(), secondValues, firstValues, count );
+    }
+    else if( graphMethod == TG_AVERAGE )
+    {
+        updateValues( averageUpdate( size1, size2 ), secondValues, firstValues, count );
+    }
+    else if( graphMethod == TG_WEIGHTED )
+    {
+        updateValues( weightedUpdate(), secondValues, firstValues, count );
+    }
+    else if ( graphMethod == TG_WARD )
+    {
+        updateValues( wardUpdate( size1, size2 ), secondValues, firstValues, count );
+    }
+    else
+    {
+        throw std::runtime_error( "ERROR @ treeBuilder::mergeDistances(): graphMethodage option has an invalid value" );
+    }
+    return;
+} // end treeBuilder::mergeDistances() -------------------------------------------------------------------------------------
+
+void graphTreeBuilder::mergeDistances( const size_t size1, const size_t size2, const TG_GRAPHTYPE graphMethod,
+                                       const std::vector< std::pair< size_t, dist_t > >& secondNbs,
+                                       std::vector< std::pair< size_t, dist_t > >* const firstNbs ) const
 {
-    if( graphMethod == TG_SINGLE ) // Single graphMethodage: D(k,i+j) = min[D(i,k),D(j,k)]
+    if( graphMethod == TG_SINGLE )
     {
-        return std::min( distance1, distance2 );
+        updateNeighbours( singleUpdate(), secondNbs, firstNbs );
     }
-    else if( graphMethod == TG_COMPLETE ) // Complete graphMethodage: D(k,i+j) = MAX[D(i,k),D(j,k)]
+    else if( graphMethod == TG_COMPLETE )
     {
-        return std::max( distance1, distance2 );
+        updateNeighbours( completeUpdate(), secondNbs, firstNbs );
     }
-    else if( graphMethod == TG_AVERAGE ) // Average graphMethodage: D(k,i+j) = [D(i,k)*Size(i),D(j,k)*size(j)]/[size(i)+size(j)]
+    else if( graphMethod == TG_AVERAGE )
     {
-        return ( ( size1 * distance1 ) + ( size2 * distance2 ) ) / ( size1 + size2 );
+        updateNeighbours( averageUpdate( size1, size2 ), secondNbs, firstNbs );
     }
-    else if( graphMethod == TG_WEIGHTED ) // Weighted graphMethodage: D(k,i+j) = [D(i,k)+D(i,k)]/2
+    else if( graphMethod == TG_WEIGHTED )
     {
-        return ( distance1 + distance2 ) / 2;
+        updateNeighbours( weightedUpdate(), secondNbs, firstNbs );
     }
     else if ( graphMethod == TG_WARD )
     {
-        dist_t avrg( ( ( size1 * distance1 ) + ( size2 * distance2 ) ) / ( size1 + size2 ) );
-        dist_t ward( (size1 * size2) * ( avrg - ( distance1 / 2.) - ( distance2 / 2.) ) / ( size1 + size2 )  );
-        return ward;
+        updateNeighbours( wardUpdate( size1, size2 ), secondNbs, firstNbs );
     }
     else
     {
-        throw std::runtime_error( "ERROR @ treeBuilder::loadDistMatrix(): graphMethodage option has an invalid value" );
+        throw std::runtime_error( "ERROR @ treeBuilder::mergeDistances(): graphMethodage option has an invalid value" );
     }
-} // end treeBuilder::newGraphDist() -------------------------------------------------------------------------------------
+    return;
+} // end treeBuilder::mergeDistances() -------------------------------------------------------------------------------------
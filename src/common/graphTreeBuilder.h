@@ -52,12 +52,19 @@
 #include <boost/filesystem.hpp>
 
 // hClustering
+#include "compactTractChar.h"
+#include "sparseTract.h"
 #include "WHcoord.h"
 #include "distBlock.h"
+#include "packedDistMatrix.h"
+#include "triangleDistMatrix.h"
+#include "distRowStore.h"
 #include "roiLoader.h"
 #include "WHtree.h"
 #include "fileManagerFactory.h"
 
+#define MST_CANDIDATES 32 // number of best edges kept per seed on every pass of the minimum spanning tree engine
+
 /**
  * defines the type of graph linkage algorithm that  will be applied
  */
@@ -72,7 +79,8 @@ typedef enum
 
 /**
  * this class implements the main functionalities required for building and saving a graph-method-based hierarchcial tree from a precomputed distance matrix (using distBlocks program):
- * reads a seed voxel coordinates list, builds a graph hierarchical tree from distance datablocks and writes output files
+ * reads a seed voxel coordinates list, builds a graph hierarchical tree from distance datablocks and writes output files.
+ * Alternatively, the tree can be built from the sparse graph of spatially neighbouring seeds, computing their distances from the seed tractograms
  */
 class graphTreeBuilder
 {
@@ -97,7 +105,7 @@ public:
 
     /**
      * sets the input folder
-     * \param inputFolder path to the folder where distance block files are located
+     * \param inputFolder path to the folder where distance block files are located, or to a packed distance matrix file
      */
     inline void setInputFolder( const std::string& inputFolder ) { m_inputFolder = inputFolder; }
 
@@ -119,6 +127,41 @@ public:
      */
     inline void setVerbose( bool verbose = true ) { m_verbose = verbose; }
 
+    /**
+     * sets (or resets) the use of the nearest-neighbour chain engine for the reducible linkages (single, complete, average, weighted).
+     * if reset (default), all linkages are built by scanning the per-row minima for the global minimum on every merge
+     * \param nnChain the true/false flag to set the m_nnChain member to
+     */
+    inline void setNnChain( bool nnChain = true ) { m_nnChain = nnChain; }
+
+    /**
+     * sets (or resets) the storage of the in-memory distance matrix in half precision (float16), which halves its memory footprint
+     * \param halfMatrix the true/false flag to set the m_halfMatrix member to
+     */
+    inline void setHalfMatrix( bool halfMatrix = true ) { m_halfMatrix = halfMatrix; }
+
+    /**
+     * sets the out-of-core mode, where the working distance matrix is kept on disk as full rows and only a bounded row cache is held in memory.
+     * Distance updates are applied lazily to the rows when they are read, the resulting tree is the same as with the in-memory matrix
+     * \param rowFolder folder where the row file will be created (if empty, the matrix is kept in memory)
+     * \param rowMemory maximum memory (in bytes) for the row cache
+     */
+    inline void setOutOfCore( const std::string& rowFolder, const size_t rowMemory ) { m_rowFolder = rowFolder; m_rowMemory = rowMemory; }
+
+    /**
+     * sets (or resets) the use of the minimum spanning tree engine for single linkage, which streams the distance matrix from disk without keeping it in memory.
+     * if reset (default), single linkage is built with the same engines as the other linkages. Tied distances may be merged in a different order than by
+     * the global minimum scan
+     * \param mstSingle the true/false flag to set the m_mstSingle member to
+     */
+    inline void setMstSingle( bool mstSingle = true ) { m_mstSingle = mstSingle; }
+
+    /**
+     * queries the neighbourhood level of the sparse graph mode
+     * \return the neighbourhood level, 0 if the tree is built from a full distance matrix
+     */
+    inline unsigned int nbLevel() const { return m_nbLevel; }
+
     /**
      * queries whether the roi file was loaded and therefore the class is ready for tree building
      * \return the ready flag, if true roi file has been successfully loaded
@@ -140,12 +183,26 @@ public:
      */
     void buildGraph( const TG_GRAPHTYPE graphMethod );
 
+    /**
+     * sets the sparse graph mode, where the tree is built from the distances between spatially neighbouring seeds only, computed from the seed tractograms
+     * in the input folder instead of read from a distance matrix. Merges are restricted to clusters joined by an edge of the neighbourhood graph
+     * \param nbLevel neighbourhood level defining the graph edges (6, 18, 26, 32, 92 or 124), 0 to build from a full distance matrix
+     * \param thresholdRatio number of streamlines relative to the total generated that must pass through a tract voxel to be considered for tract similarity [0,1)
+     * \param noLog if true, the input tracts are only linearly normalized instead of logarithmically normalized
+     */
+    void setNeighbourhood( const unsigned int nbLevel, const float thresholdRatio = 0, const bool noLog = false );
+
 private:
     // === PRIVATE DATA MEMBERS ===
 
     std::string     m_inputFolder;       //!< The folder path that contains the seed voxel tractograms
     std::string     m_outputFolder;      //!< The folder path where to write the output files
     std::ofstream*  m_logfile;           //!< A pointer to the output log file stream
+    std::string     m_rowFolder;         //!< The folder where the out-of-core working matrix is kept (if empty, the matrix is kept in memory)
+    size_t          m_rowMemory;         //!< Memory budget (in bytes) of the out-of-core row cache
+    unsigned int    m_nbLevel;           //!< Neighbourhood level of the sparse graph mode (if 0, the tree is built from a full distance matrix)
+    float           m_tractThreshold;    //!< The threshold to apply to the logarithmic tractograms in the sparse graph mode
+    float           m_logFactor;         //!< The logarithmic factor of the tractograms in the sparse graph mode (0 if tractograms are in natural units)
 
     WHtree          m_tree;              //!< The class that will hold the built tree
     WHcoord         m_datasetSize;       //!< Contains the size in voxels of the dataset where the seed voxel coordinates correspond. Necessary for proper coordinate fam conversion. Taken from file
@@ -157,9 +214,33 @@ private:
     bool            m_treeReady;         //!< The tree building success flag. If true, the hierarchical centroid algorithm was successful and the class is ready to write the output data
     bool            m_debug;             //!< The debug output flag. If true, additional detailed outputs meant for debug will be written.
     bool            m_verbose;           //!< The verbose output flag. If true, additional and progress information will be shown through the standard output on execution.
+    bool            m_nnChain;           //!< The nearest-neighbour chain flag. If true, reducible linkages are built with the nearest-neighbour chain engine
+    bool            m_halfMatrix;        //!< The half precision flag. If true, the in-memory distance matrix is stored in float16
+    bool            m_mstSingle;         //!< The minimum spanning tree flag. If true, single linkage is built from the minimum spanning tree of the streamed matrix
     std::vector< WHcoord >  m_roi;       //!< A vector where the seed voxel coordinates are stored
     std::vector<size_t> m_trackids;      //!< Stores the ids of the seed tracts correesponding to each leaf
 
+    /**
+     * merge found by the nearest-neighbour chain engine, clusters are identified by the lowest matrix position of their leaves
+     */
+    struct chainMerge
+    {
+        size_t first;   //!< matrix position of the first cluster (lower)
+        size_t second;  //!< matrix position of the second cluster (higher)
+        dist_t dist;    //!< distance between the clusters
+    };
+
+    /**
+     * merge logged by the out-of-core engines, replayed on the stored rows that were written before it
+     */
+    struct rowUpdate
+    {
+        size_t first;   //!< matrix position of the first cluster (lower), keeps the merged distances
+        size_t second;  //!< matrix position of the second cluster (higher), discarded
+        size_t size1;   //!< size of the first cluster
+        size_t size2;   //!< size of the second cluster
+    };
+
 
     /**
      * Fetches a node or leaf from the appropiate vector in pointer form provided its ID. This node/-leaf can be modified.
@@ -174,20 +255,210 @@ private:
      * reconstructs the whole dist matrix into RAM memory from all the available distance Block.
      * WARNING: can be extremely memory intensive if distance matrix is big.
      * \param distMatrix a pointer to the matrix that will be filled with the loaded distance data
+     * \param distRows a pointer to the out-of-core row store, if given the distances are written into it instead and distMatrix is not used
+     */
+    void loadDistMatrix( triangleDistMatrix* const distMatrix, distRowStore* const distRows = 0 ) const;
+
+    /**
+     * builds the tree nodes by finding the global minimum of the per-row minima on every merge and rescanning the affected rows, valid for all linkages.
+     * O(N^2) per merge in the worst case
+     * \param graphMethod the linkage method to be used for tree building
+     * \param distMatrix a pointer to the lower triangular distance matrix (will be overwritten)
+     * \param leavesPointer a pointer to the vector containing the leaves
+     * \param nodesPointer a pointer to the the vector where the nodes will be written
      */
-    void loadDistMatrix( std::vector< std::vector< float > >* const distMatrix ) const;
+    void scanLinkage( const TG_GRAPHTYPE graphMethod, triangleDistMatrix* const distMatrix,
+                      std::vector< WHnode >* const leavesPointer, std::vector< WHnode >* const nodesPointer ) const;
 
     /**
-     * Calculates a the distance between a newly merged cluster to another cluster from the distances of the pre-merge clusters to that cluster
+     * builds the tree nodes following chains of nearest neighbours until a reciprocal pair is found, then merges it. Every chain step is a linear
+     * search and there are less than 3N of them, so O(N^2) in total.
+     * Only valid for reducible linkages (single, complete, average, weighted), where merges can be done out of order and sorted by distance afterwards.
+     * Equal distances are ordered by the positions of the pairs as in scanLinkage(), but the positions change as clusters merge, so with ties
+     * the tree may differ from the scanLinkage() one (and be equally valid)
+     * \param graphMethod the linkage method to be used for tree building
+     * \param distMatrix a pointer to the lower triangular distance matrix (will be overwritten)
+     * \param leavesPointer a pointer to the vector containing the leaves
+     * \param nodesPointer a pointer to the the vector where the nodes will be written
+     */
+    void chainLinkage( const TG_GRAPHTYPE graphMethod, triangleDistMatrix* const distMatrix,
+                       std::vector< WHnode >* const leavesPointer, std::vector< WHnode >* const nodesPointer ) const;
+
+    /**
+     * out-of-core version of scanLinkage(): the per-row minima are kept in memory and the rows are read from the row store when they need a rescan.
+     * Merges only write the merged row, the other rows are updated when they are read again. Builds the same tree as scanLinkage()
+     * \param graphMethod the linkage method to be used for tree building
+     * \param distRows a pointer to the row store holding the full distance matrix (will be overwritten)
+     * \param leavesPointer a pointer to the vector containing the leaves
+     * \param nodesPointer a pointer to the the vector where the nodes will be written
+     */
+    void diskScanLinkage( const TG_GRAPHTYPE graphMethod, distRowStore* const distRows,
+                          std::vector< WHnode >* const leavesPointer, std::vector< WHnode >* const nodesPointer ) const;
+
+    /**
+     * out-of-core version of chainLinkage(): one row is read from the row store for every chain step.
+     * Merges only write the merged row, the other rows are updated when they are read again. Builds the same tree as chainLinkage()
+     * \param graphMethod the linkage method to be used for tree building
+     * \param distRows a pointer to the row store holding the full distance matrix (will be overwritten)
+     * \param leavesPointer a pointer to the vector containing the leaves
+     * \param nodesPointer a pointer to the the vector where the nodes will be written
+     */
+    void diskChainLinkage( const TG_GRAPHTYPE graphMethod, distRowStore* const distRows,
+                           std::vector< WHnode >* const leavesPointer, std::vector< WHnode >* const nodesPointer ) const;
+
+    /**
+     * builds the single linkage tree from the minimum spanning tree of the distance graph, computed with Boruvka steps. Every pass streams the
+     * distance matrix (blocks or packed file) once and keeps the MST_CANDIDATES best edges leaving the component of each seed, the components are then
+     * contracted in memory for as long as the minimum edge leaving each of them is known from the candidates. Memory use is O(N*MST_CANDIDATES)
+     * \param leavesPointer a pointer to the vector containing the leaves
+     * \param nodesPointer a pointer to the the vector where the nodes will be written
+     */
+    void mstLinkage( std::vector< WHnode >* const leavesPointer, std::vector< WHnode >* const nodesPointer ) const;
+
+    /**
+     * streams the distance matrix once and finds, for every seed, the MST_CANDIDATES best edges to seeds of other components
+     * \param dBlock a pointer to the distance block reader (if 0, the packed matrix is read)
+     * \param packedMatrix a pointer to the packed matrix file
+     * \param roiMatrixIDs matrix ID of each roi seed
+     * \param components component of each roi seed
+     * \param candidates pointer to the vector where the candidate edges (distance and roi position of the other seed) will be written,
+     *        MST_CANDIDATES slots per seed, sorted
+     * \param candidateCounts pointer to the vector where the number of candidates of each seed will be written
+     */
+    void mstPass( distBlock* const dBlock, const packedDistMatrix* const packedMatrix, const std::vector< size_t >& roiMatrixIDs,
+                  const std::vector< size_t >& components, std::vector< std::pair< dist_t, size_t > >* const candidates,
+                  std::vector< size_t >* const candidateCounts ) const;
+
+    /**
+     * finds the roi positions covered by the loaded distance block, for a traversal of the blocks along the rows of the roi matrix
+     * \param dBlock the distance block reader with the block containing the starting positions loaded
+     * \param rowStart first roi position of the block rows
+     * \param colStart first roi position of the block columns
+     * \param rowEnd pointer to where the position after the last block row will be written
+     * \param colEnd pointer to where the position after the last block column will be written
+     */
+    void blockEnds( const distBlock& dBlock, const size_t rowStart, const size_t colStart, size_t* const rowEnd, size_t* const colEnd ) const;
+
+    /**
+     * finds the position of each roi seed in a packed matrix file
+     * \param packedMatrix the packed matrix
+     * \param roiMatrixIDs pointer to the vector where the matrix ID of each roi seed will be written
+     */
+    void findRoiMatrixIDs( const packedDistMatrix& packedMatrix, std::vector< size_t >* const roiMatrixIDs ) const;
+
+    /**
+     * finds the neighbours of every seed within the roi for the sparse graph mode, as the centroid tree initialization does
+     * \param nbOffsets pointer to the vector where the position of the first neighbour of each seed in the neighbour vector will be written
+     *        (compressed sparse rows, with a final entry holding the total number of neighbours)
+     * \param nbIDs pointer to the vector where the roi IDs of the neighbours will be written, sorted for each seed
+     */
+    void sparseNeighbours( std::vector< size_t >* const nbOffsets, std::vector< size_t >* const nbIDs ) const;
+
+    /**
+     * computes the tractogram dissimilarity of every pair of neighbouring seeds. Seeds are scanned by z plane and every tract is read once,
+     * only the tracts of the planes within the neighbourhood reach of the current plane are kept in memory
+     * \param nbOffsets position of the first neighbour of each seed in the neighbour vector
+     * \param nbIDs roi IDs of the neighbours of each seed
+     * \param nbDists pointer to the vector where the distance to each neighbour will be written (same layout as nbIDs)
+     */
+    void sparseDistances( const std::vector< size_t >& nbOffsets, const std::vector< size_t >& nbIDs, std::vector< dist_t >* const nbDists ) const;
+
+    /**
+     * builds the tree nodes merging on every step the closest pair of clusters joined by an edge of the neighbourhood graph, taken from a heap of edges.
+     * Distances are updated with the Lance-Williams formula where both merged clusters have an edge to a neighbour, otherwise the existing edge is kept.
+     * If the graph is not connected, the remaining clusters are joined at the end at the level of the highest merge (at least 1)
+     * \param graphMethod the linkage method to be used for tree building
+     * \param nbOffsets position of the first neighbour of each seed in the neighbour vector
+     * \param nbIDs roi IDs of the neighbours of each seed
+     * \param nbDists distance to each neighbour
+     * \param leavesPointer a pointer to the vector containing the leaves
+     * \param nodesPointer a pointer to the the vector where the nodes will be written
+     */
+    void sparseLinkage( const TG_GRAPHTYPE graphMethod, const std::vector< size_t >& nbOffsets, const std::vector< size_t >& nbIDs,
+                        const std::vector< dist_t >& nbDists, std::vector< WHnode >* const leavesPointer, std::vector< WHnode >* const nodesPointer ) const;
+
+    /**
+     * sorts the merges found by following nearest-neighbour chains into merge order and builds the corresponding tree nodes
+     * \param merges the merges in the order they were found
+     * \param leavesPointer a pointer to the vector containing the leaves
+     * \param nodesPointer a pointer to the the vector where the nodes will be written
+     */
+    void buildChainNodes( const std::vector< chainMerge >& merges, std::vector< WHnode >* const leavesPointer, std::vector< WHnode >* const nodesPointer ) const;
+
+    /**
+     * fetches a row from the out-of-core row store and brings it up to date by applying the merges logged since the row was stored
+     * \param row the row to fetch
+     * \param graphMethod the linkage method used for the merges
+     * \param updates the log of all the merges done so far
+     * \param distRows a pointer to the row store
+     * \param values pointer to the vector where the row values will be written
+     */
+    void fetchRow( const size_t row, const TG_GRAPHTYPE graphMethod, const std::vector< rowUpdate >& updates,
+                   distRowStore* const distRows, std::vector< float >* const values ) const;
+
+    /**
+     * shows the tree building progress through the standard output, at most once per second
+     * \param builtNodes number of nodes already built
+     * \param totalNodes number of nodes of the finished tree
+     * \param loopStart time when the tree building started
+     * \param lastTime pointer to the time of the last progress output (will be updated)
+     */
+    void showProgress( const size_t builtNodes, const size_t totalNodes, const time_t loopStart, time_t* const lastTime ) const;
+
+    /**
+     * reconstructs the whole dist matrix into RAM memory from a packed matrix file (as written by packmatrix), read through a memory mapping.
      * WARNING: can be extremely memory intensive if distance matrix is big.
-     * \param distance1 distance value from the first pre-merge cluster to a third cluster
-     * \param distance2 distance value from the second pre-merge cluster to a third cluster
+     * \param distMatrix a pointer to the matrix that will be filled with the loaded distance data
+     * \param distRows a pointer to the out-of-core row store, if given the distances are written into it instead and distMatrix is not used
+     */
+    void loadPackedMatrix( triangleDistMatrix* const distMatrix, distRowStore* const distRows = 0 ) const;
+
+    /**
+     * allocates the in-memory distance matrix for the roi, with the storage type selected by the half precision flag
+     * \param distMatrix a pointer to the matrix to be allocated
+     */
+    void initMatrix( triangleDistMatrix* const distMatrix ) const;
+
+    /**
+     * updates the distances of a newly merged cluster to all other clusters from the distances of the pre-merge clusters (Lance-Williams update),
+     * the merged cluster takes the first matrix position
+     * \param first matrix position of the first pre-merge cluster (the lower one)
+     * \param second matrix position of the second pre-merge cluster (the higher one)
+     * \param size1 size of first pre-merge cluster
+     * \param size2 size of second pre-merge cluster
+     * \param graphMethod the linkage method algorithm to be used to calculate the distance of the merged cluster to the other clusters
+     * \param distMatrix a pointer to the distance matrix to be updated
+     * \param positions a pointer to the sorted list of positions whose distances above the first position have to be updated (if 0, all of them)
+     */
+    void mergeDistances( const size_t first, const size_t second, const size_t size1, const size_t size2,
+                         const TG_GRAPHTYPE graphMethod, triangleDistMatrix* const distMatrix, const std::vector< size_t >* const positions = 0 ) const;
+
+    /**
+     * \overload
+     * applies the Lance-Williams update to row values of the out-of-core matrix: each distance to the first pre-merge cluster is replaced by
+     * the distance to the merged cluster
+     * \param size1 size of first pre-merge cluster
+     * \param size2 size of second pre-merge cluster
+     * \param graphMethod the linkage method algorithm to be used
+     * \param secondValues pointer to the distances to the second pre-merge cluster
+     * \param firstValues pointer to the distances to the first pre-merge cluster (will be updated)
+     * \param count number of distances to update
+     */
+    void mergeDistances( const size_t size1, const size_t size2, const TG_GRAPHTYPE graphMethod,
+                         const float* const secondValues, float* const firstValues, const size_t count ) const;
+
+    /**
+     * \overload
+     * applies the Lance-Williams update to the neighbour lists of the sparse graph mode: the neighbour list of the first pre-merge cluster
+     * is replaced by the one of the merged cluster, neighbours of only one of the pre-merge clusters keep their distance
      * \param size1 size of first pre-merge cluster
      * \param size2 size of second pre-merge cluster
-     * \param graphMethod the linkage method algorithm to be used to calculate the distance of the merged cluster to the third cluster
-     * \return the distance value between the newly merged cluster to the third cluster
+     * \param graphMethod the linkage method algorithm to be used
+     * \param secondNbs neighbours of the second pre-merge cluster (without the first one), sorted by position
+     * \param firstNbs pointer to the neighbours of the first pre-merge cluster (without the second one), sorted by position (will be updated)
      */
-    dist_t newGraphDist( const dist_t distance1, const dist_t distance2, const size_t size1, const size_t size2, const TG_GRAPHTYPE graphMethod ) const;
+    void mergeDistances( const size_t size1, const size_t size2, const TG_GRAPHTYPE graphMethod,
+                         const std::vector< std::pair< size_t, dist_t > >& secondNbs, std::vector< std::pair< size_t, dist_t > >* const firstNbs ) const;
 
     /**
      * Writes the data files from the computed trees to the output folder
@@ -0,0 +1,287 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#include <algorithm>
+
+#include "leafTractStream.h"
+#include "cnbTreeBuilder.h"
+
+
+leafTractStream::leafTractStream( const CnbTreeBuilder& builder, const size_t numTracts, const std::vector< std::vector< size_t > >& planeTracts,
+                                  const std::vector< std::vector< size_t > >& schedules, const size_t depth, const size_t ioThreads ):
+    m_builder( builder ), m_planeTracts( planeTracts ), m_schedules( schedules ), m_depth( depth ), m_readTracts( 0 ), m_windowTracts( 0 ),
+    m_peakTracts( 0 ), m_stop( false )
+{
+    m_acquired.assign( m_schedules.size(), 0 );
+    m_prefetched.assign( m_schedules.size(), 0 );
+    m_released.assign( m_schedules.size(), 0 );
+    m_tracts.assign( numTracts, 0 );
+    m_states.assign( numTracts, TS_UNREAD );
+
+    // count how many scheduled planes use each tract, it will be freed after the last one
+    m_uses.assign( numTracts, 0 );
+    for( size_t i = 0; i < m_schedules.size(); ++i )
+    {
+        for( size_t j = 0; j < m_schedules[i].size(); ++j )
+        {
+            const std::vector< size_t >& theseTracts( m_planeTracts.at( m_schedules[i][j] ) );
+            for( size_t k = 0; k < theseTracts.size(); ++k )
+            {
+                if( theseTracts[k] >= numTracts )
+                {
+                    throw std::runtime_error( "ERROR @ leafTractStream::leafTractStream(): tract ID out of range" );
+                }
+                ++m_uses[theseTracts[k]];
+            }
+        }
+    }
+
+    if( m_depth > 0 )
+    {
+        for( size_t i = 0; i < ioThreads; ++i )
+        {
+            m_ioThreads.create_thread( boost::bind( &leafTractStream::ioLoop, this ) );
+        }
+    }
+} // end "leafTractStream()" -----------------------------------------------------------------
+
+
+leafTractStream::~leafTractStream()
+{
+    {
+        boost::unique_lock< boost::mutex > lock( m_mutex );
+        m_stop = true;
+    }
+    m_changed.notify_all();
+    m_ioThreads.join_all();
+    for( size_t i = 0; i < m_tracts.size(); ++i )
+    {
+        delete m_tracts[i];
+    }
+} // end "~leafTractStream()" -----------------------------------------------------------------
+
+
+bool leafTractStream::acquirePlane( const size_t worker, std::map< size_t, const sparseTract* >* windowPointer, size_t* planePointer )
+{
+    std::map< size_t, const sparseTract* >& window( *windowPointer );
+    size_t plane( 0 );
+    {
+        boost::unique_lock< boost::mutex > lock( m_mutex );
+        if( !m_error.empty() )
+        {
+            return false;
+        }
+        if( m_acquired.at( worker ) >= m_schedules[worker].size() )
+        {
+            lock.unlock();
+            setError( "ERROR @ leafTractStream::acquirePlane(): all scheduled planes of the worker have already been acquired" );
+            return false;
+        }
+        plane = m_schedules[worker][m_acquired[worker]++];
+    }
+    m_changed.notify_all();
+    *planePointer = plane;
+
+    // read on demand the tracts the I/O threads have not taken yet
+    try
+    {
+        readPlane( plane );
+    }
+    catch( const std::exception& except )
+    {
+        setError( except.what() );
+        return false;
+    }
+
+    window.clear();
+    boost::unique_lock< boost::mutex > lock( m_mutex );
+    const std::vector< size_t >& theseTracts( m_planeTracts[plane] );
+    for( size_t i = 0; i < theseTracts.size(); ++i )
+    {
+        const size_t tractID( theseTracts[i] );
+        while( m_states[tractID] == TS_READING && m_error.empty() )
+        {
+            m_changed.wait( lock );
+        }
+        if( !m_error.empty() )
+        {
+            return false;
+        }
+        if( m_states[tractID] != TS_READY )
+        {
+            lock.unlock();
+            setError( "ERROR @ leafTractStream::acquirePlane(): tract requested after its last scheduled use" );
+            return false;
+        }
+        window.insert( window.end(), std::make_pair( tractID, m_tracts[tractID] ) );
+    }
+    return true;
+} // end "acquirePlane()" -----------------------------------------------------------------
+
+
+bool leafTractStream::failed()
+{
+    boost::unique_lock< boost::mutex > lock( m_mutex );
+    return !m_error.empty();
+} // end "failed()" -----------------------------------------------------------------
+
+
+void leafTractStream::releasePlane( const size_t worker )
+{
+    boost::unique_lock< boost::mutex > lock( m_mutex );
+    if( m_released.at( worker ) >= m_acquired[worker] )
+    {
+        throw std::runtime_error( "ERROR @ leafTractStream::releasePlane(): worker has no acquired plane to release" );
+    }
+    const std::vector< size_t >& theseTracts( m_planeTracts[m_schedules[worker][m_released[worker]++]] );
+    for( size_t i = 0; i < theseTracts.size(); ++i )
+    {
+        const size_t tractID( theseTracts[i] );
+        if( --m_uses[tractID] == 0 )
+        {
+            delete m_tracts[tractID];
+            m_tracts[tractID] = 0;
+            m_states[tractID] = TS_FREED;
+            --m_windowTracts;
+        }
+    }
+} // end "releasePlane()" -----------------------------------------------------------------
+
+
+void leafTractStream::ioLoop()
+{
+    while( true )
+    {
+        size_t plane( 0 );
+        {
+            boost::unique_lock< boost::mutex > lock( m_mutex );
+            while( true )
+            {
+                if( m_stop )
+                {
+                    return;
+                }
+                // take the next plane of the least advanced worker that still has planes left within its prefetch window
+                size_t nextWorker( m_schedules.size() ), nextAhead( 0 );
+                bool pending( false );
+                for( size_t i = 0; i < m_schedules.size(); ++i )
+                {
+                    m_prefetched[i] = std::max( m_prefetched[i], m_acquired[i] );
+                    pending = pending || ( m_prefetched[i] < m_schedules[i].size() );
+                    if( m_prefetched[i] < std::min( m_acquired[i] + m_depth, m_schedules[i].size() )
+                        && ( nextWorker == m_schedules.size() || m_prefetched[i] - m_acquired[i] < nextAhead ) )
+                    {
+                        nextWorker = i;
+                        nextAhead = m_prefetched[i] - m_acquired[i];
+                    }
+                }
+                if( nextWorker != m_schedules.size() )
+                {
+                    plane = m_schedules[nextWorker][m_prefetched[nextWorker]++];
+                    break;
+                }
+                if( !pending )
+                {
+                    return;
+                }
+                m_changed.wait( lock );
+            }
+        }
+
+        try
+        {
+            readPlane( plane );
+        }
+        catch( const std::exception& except )
+        {
+            setError( except.what() );
+        }
+    }
+} // end "ioLoop()" -----------------------------------------------------------------
+
+
+void leafTractStream::readPlane( const size_t plane )
+{
+    const std::vector< size_t >& theseTracts( m_planeTracts[plane] );
+    for( size_t i = 0; i < theseTracts.size(); ++i )
+    {
+        const size_t tractID( theseTracts[i] );
+        {
+            // claim the tract, so that it is never read twice
+            boost::unique_lock< boost::mutex > lock( m_mutex );
+            if( m_states[tractID] != TS_UNREAD )
+            {
+                continue;
+            }
+            m_states[tractID] = TS_READING;
+        }
+
+        sparseTract* tract( new sparseTract );
+        try
+        {
+            m_builder.readSparseLeaf( tractID, tract );
+        }
+        catch( ... )
+        {
+            delete tract;
+            {
+                boost::unique_lock< boost::mutex > lock( m_mutex );
+                m_states[tractID] = TS_UNREAD;
+            }
+            m_changed.notify_all();
+            throw;
+        }
+
+        {
+            boost::unique_lock< boost::mutex > lock( m_mutex );
+            m_tracts[tractID] = tract;
+            m_states[tractID] = TS_READY;
+            ++m_readTracts;
+            m_peakTracts = std::max( m_peakTracts, ++m_windowTracts );
+        }
+        m_changed.notify_all();
+    }
+} // end "readPlane()" -----------------------------------------------------------------
+
+
+void leafTractStream::setError( const std::string& message )
+{
+    {
+        boost::unique_lock< boost::mutex > lock( m_mutex );
+        if( m_error.empty() )
+        {
+            m_error = message;
+        }
+    }
+    m_changed.notify_all();
+} // end "setError()" -----------------------------------------------------------------
@@ -0,0 +1,174 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#ifndef LEAFTRACTSTREAM_H
+#define LEAFTRACTSTREAM_H
+
+// std library
+#include <vector>
+#include <map>
+#include <string>
+#include <stdexcept>
+
+// boost library
+#include <boost/thread.hpp>
+
+#include "sparseTract.h"
+
+class CnbTreeBuilder;
+
+/**
+ * This class streams the seed voxel tractograms needed by the neighbour distance scan of the tree initialization.
+ * The scan is split among workers, each going through its own sequence of roi planes. The tracts needed by each plane
+ * (its seeds and the neighbours they own the distance to) are known in advance from the roi and the neighbourhood stencil,
+ * so the window of tracts in memory follows the scan exactly: a tract enters it when it is first needed, either by a worker
+ * or by an I/O thread prefetching the planes ahead of a worker, and it leaves it as soon as the last plane using it is released,
+ * whichever the workers using it are. Each tract is read exactly once.
+ */
+class leafTractStream
+{
+public:
+    /**
+     * Constructor, I/O threads are started right away
+     * \param builder the tree builder object that does the actual tractogram reading
+     * \param numTracts the number of seed voxel tracts
+     * \param planeTracts the IDs of the tracts needed by each plane
+     * \param schedules the ordered sequence of planes of each worker
+     * \param depth number of planes ahead of each worker the I/O threads may prefetch, 0 disables prefetching and tracts are read on demand by the workers
+     * \param ioThreads number of I/O threads (if depth is greater than 0)
+     */
+    leafTractStream( const CnbTreeBuilder& builder, const size_t numTracts, const std::vector< std::vector< size_t > >& planeTracts,
+                     const std::vector< std::vector< size_t > >& schedules, const size_t depth, const size_t ioThreads );
+
+    //! Destructor, stops and joins the I/O threads
+    ~leafTractStream();
+
+    // === IN-LINE MEMBER FUNCTIONS ===
+
+    /**
+     * returns the number of tractograms read from disk so far
+     * \return number of tractograms read
+     */
+    inline size_t readTracts() const { return m_readTracts; }
+
+    /**
+     * returns the maximum number of tractograms held in memory at the same time
+     * \return peak number of tractograms in the window
+     */
+    inline size_t peakTracts() const { return m_peakTracts; }
+
+    /**
+     * returns the error message of the first failed tract reading or plane acquisition
+     * \return error message, empty if there was no error (only read it once the workers have stopped)
+     */
+    inline const std::string& getError() const { return m_error; }
+
+    // === PUBLIC MEMBER FUNCTIONS ===
+
+    /**
+     * gets the tracts of the next plane in the schedule of a worker, waiting for them to be read if necessary.
+     * Called from the worker threads, so errors are not thrown: the message is kept (see getError()) and all the workers get a false return
+     * \param worker the worker index
+     * \param windowPointer a pointer to a map where the tracts of the plane will be returned (by seed ID), they are valid until the plane is released
+     * \param planePointer a pointer to where the index of the plane will be returned
+     * \return true if the plane tracts are ready, false if a tract reading failed
+     */
+    bool acquirePlane( const size_t worker, std::map< size_t, const sparseTract* >* windowPointer, size_t* planePointer );
+
+    /**
+     * tells whether a tract reading or plane acquisition has failed, so that the workers can stop
+     * \return true if there was an error
+     */
+    bool failed();
+
+    /**
+     * releases the tracts of the current plane of a worker, tracts with no uses left are freed
+     * \param worker the worker index
+     */
+    void releasePlane( const size_t worker );
+
+private:
+    /**
+     * Reading state of a tractogram
+     */
+    enum tractState
+    {
+        TS_UNREAD,
+        TS_READING,
+        TS_READY,
+        TS_FREED
+    };
+
+    // === PRIVATE DATA MEMBERS ===
+
+    const CnbTreeBuilder& m_builder;                        //!< The object that does the actual reading
+    std::vector< std::vector< size_t > > m_planeTracts;     //!< The IDs of the tracts needed by each plane
+    std::vector< std::vector< size_t > > m_schedules;       //!< The plane sequence of each worker
+    std::vector< size_t > m_acquired;                       //!< For each worker, number of planes of its schedule already acquired
+    std::vector< size_t > m_prefetched;                     //!< For each worker, number of planes of its schedule already handed to the I/O threads
+    std::vector< size_t > m_released;                       //!< For each worker, number of planes of its schedule already released
+    std::vector< sparseTract* > m_tracts;                   //!< The tracts in the window (null if not read or freed)
+    std::vector< size_t > m_uses;                           //!< Number of plane uses left for each tract
+    std::vector< tractState > m_states;                     //!< Reading state of each tract
+    size_t m_depth;                                         //!< Prefetch depth in planes
+    size_t m_readTracts;                                    //!< Number of tracts read
+    size_t m_windowTracts;                                  //!< Number of tracts currently in memory
+    size_t m_peakTracts;                                    //!< Maximum number of tracts in memory
+    bool m_stop;                                            //!< Stop flag for the I/O threads
+    std::string m_error;                                    //!< Error message of a failed read (returned to the workers as a failed acquisition)
+
+    boost::mutex m_mutex;                                   //!< Protects the shared state
+    boost::condition_variable m_changed;                    //!< Signals tract readings, plane acquisitions and stops
+    boost::thread_group m_ioThreads;                        //!< The I/O threads
+
+    // === PRIVATE MEMBER FUNCTIONS ===
+
+    /**
+     * I/O thread main loop: takes the next plane within the prefetch window of the least advanced worker and reads its tracts
+     */
+    void ioLoop();
+
+    /**
+     * reads the tracts of a plane that have not been read (nor are being read) yet
+     * \param plane the plane index
+     */
+    void readPlane( const size_t plane );
+
+    /**
+     * keeps the message of the first error and wakes up the threads waiting for tracts, must be called with the mutex unlocked
+     * \param message the error message
+     */
+    void setError( const std::string& message );
+};
+
+#endif  // LEAFTRACTSTREAM_H
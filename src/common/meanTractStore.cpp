@@ -0,0 +1,300 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+// std library
+#include <vector>
+#include <deque>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+
+// posix
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// boost library
+#include <boost/lexical_cast.hpp>
+
+#include "meanTractStore.h"
+
+meanTractStore::meanTractStore( const std::string& slabFolder, const size_t memoryBytes ): m_slabFolder( slabFolder ),
+                                                                                           m_memoryBytes( memoryBytes ),
+                                                                                           m_tractSize( 0 ),
+                                                                                           m_memoryTracts( 0 ),
+                                                                                           m_slabDescriptor( -1 ),
+                                                                                           m_slotBytes( 0 ),
+                                                                                           m_slotsPerChunk( 0 ),
+                                                                                           m_slabSlots( 0 ),
+                                                                                           m_peakMemoryTracts( 0 ),
+                                                                                           m_spilledTracts( 0 ),
+                                                                                           m_slabReads( 0 )
+{
+}
+
+meanTractStore::~meanTractStore()
+{
+    for( size_t i = 0; i < m_chunks.size(); ++i )
+    {
+        munmap( m_chunks[i], m_slotsPerChunk * m_slotBytes );
+    }
+    if( m_slabDescriptor >= 0 )
+    {
+        close( m_slabDescriptor );
+    }
+}
+
+void meanTractStore::put( const size_t nodeID, const compactTract& tract )
+{
+    if( tract.m_inLogUnits || tract.m_thresholded )
+    {
+        throw std::runtime_error( "ERROR @ meanTractStore::put(): tract must be in natural units and unthresholded" );
+    }
+
+    boost::mutex::scoped_lock lock( m_mutex );
+    if( m_tractSize == 0 )
+    {
+        m_tractSize = tract.m_tract.size();
+        m_slotBytes = ( ( m_tractSize * sizeof( float ) + MEANSTORE_PAGE_BYTES - 1 ) / MEANSTORE_PAGE_BYTES ) * MEANSTORE_PAGE_BYTES;
+        m_slotsPerChunk = std::max( ( size_t )1, ( size_t )MEANSTORE_CHUNK_BYTES / m_slotBytes );
+    }
+    else if( tract.m_tract.size() != m_tractSize )
+    {
+        throw std::runtime_error( "ERROR @ meanTractStore::put(): tract size does not match the size of the stored tracts" );
+    }
+    if( nodeID >= m_entries.size() )
+    {
+        storeEntry emptyEntry;
+        emptyEntry.place = storeEntry::EMPTY;
+        emptyEntry.index = 0;
+        m_entries.resize( nodeID + 1, emptyEntry );
+    }
+    release( nodeID );
+
+    storeEntry& entry( m_entries[nodeID] );
+    if( makeRoom( m_tractSize * sizeof( float ) ) )
+    {
+        if( m_freeBuffers.empty() )
+        {
+            m_freeBuffers.push_back( m_buffers.size() );
+            m_buffers.push_back( std::vector< float >() );
+        }
+        entry.place = storeEntry::MEMORY;
+        entry.index = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+        m_buffers[entry.index] = tract.m_tract;
+        m_memoryOrder.push_back( nodeID );
+        m_peakMemoryTracts = std::max( m_peakMemoryTracts, ++m_memoryTracts );
+    }
+    else
+    {
+        entry.place = storeEntry::SLAB;
+        entry.index = allocateSlot();
+        std::memcpy( slotData( entry.index ), &tract.m_tract[0], m_tractSize * sizeof( float ) );
+        ++m_spilledTracts;
+    }
+    return;
+}// end "put()" -----------------------------------------------------------------
+
+void meanTractStore::get( const size_t nodeID, compactTract* tract ) const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    if( nodeID >= m_entries.size() || m_entries[nodeID].place == storeEntry::EMPTY )
+    {
+        throw std::runtime_error( "ERROR @ meanTractStore::get(): tract of node " + boost::lexical_cast< std::string >( nodeID ) + " is not in the store" );
+    }
+    const storeEntry& entry( m_entries[nodeID] );
+    if( entry.place == storeEntry::MEMORY )
+    {
+        tract->m_tract = m_buffers[entry.index];
+    }
+    else
+    {
+        const float* data( slotData( entry.index ) );
+        tract->m_tract.assign( data, data + m_tractSize );
+        ++m_slabReads;
+    }
+    tract->m_inLogUnits = false;
+    tract->m_thresholded = false;
+    tract->m_normReady = false;
+    tract->m_norm = 0;
+    return;
+}// end "get()" -----------------------------------------------------------------
+
+void meanTractStore::take( const size_t nodeID, compactTract* tract )
+{
+    {
+        boost::mutex::scoped_lock lock( m_mutex );
+        if( nodeID < m_entries.size() && m_entries[nodeID].place == storeEntry::MEMORY )
+        {
+            storeEntry& entry( m_entries[nodeID] );
+            tract->m_tract.clear();
+            tract->m_tract.swap( m_buffers[entry.index] );
+            m_freeBuffers.push_back( entry.index );
+            entry.place = storeEntry::EMPTY;
+            --m_memoryTracts;
+            tract->m_inLogUnits = false;
+            tract->m_thresholded = false;
+            tract->m_normReady = false;
+            tract->m_norm = 0;
+            return;
+        }
+    }
+    get( nodeID, tract );
+    erase( nodeID );
+    return;
+}// end "take()" -----------------------------------------------------------------
+
+void meanTractStore::erase( const size_t nodeID )
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    release( nodeID );
+    return;
+}// end "erase()" -----------------------------------------------------------------
+
+bool meanTractStore::contains( const size_t nodeID ) const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    return ( nodeID < m_entries.size() && m_entries[nodeID].place != storeEntry::EMPTY );
+}// end "contains()" -----------------------------------------------------------------
+
+std::string meanTractStore::getReport() const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    std::stringstream report;
+    report << "Mean tract store. Peak tracts in memory: " << m_peakMemoryTracts << ". Spilled to slab: " << m_spilledTracts;
+    report << " (slab size: " << ( m_slabSlots * m_slotBytes ) / ( 1024 * 1024 ) << " MB, reads: " << m_slabReads << ")";
+    return report.str();
+}// end "getReport()" -----------------------------------------------------------------
+
+size_t meanTractStore::memoryBytes() const
+{
+    boost::mutex::scoped_lock lock( m_mutex );
+    return m_memoryTracts * m_tractSize * sizeof( float );
+}// end "memoryBytes()" -----------------------------------------------------------------
+
+void meanTractStore::release( const size_t nodeID )
+{
+    if( nodeID >= m_entries.size() )
+    {
+        return;
+    }
+    storeEntry& entry( m_entries[nodeID] );
+    if( entry.place == storeEntry::MEMORY )
+    {
+        std::vector< float >().swap( m_buffers[entry.index] );
+        m_freeBuffers.push_back( entry.index );
+        --m_memoryTracts;
+    }
+    else if( entry.place == storeEntry::SLAB )
+    {
+        m_freeSlots.push_back( entry.index );
+    }
+    entry.place = storeEntry::EMPTY;
+    return;
+}// end "release()" -----------------------------------------------------------------
+
+bool meanTractStore::makeRoom( const size_t bytesNeeded )
+{
+    const size_t tractBytes( m_tractSize * sizeof( float ) );
+    if( bytesNeeded > m_memoryBytes )
+    {
+        return false;
+    }
+    while( ( m_memoryTracts * tractBytes ) + bytesNeeded > m_memoryBytes && !m_memoryOrder.empty() )
+    {
+        const size_t oldestID( m_memoryOrder.front() );
+        m_memoryOrder.pop_front();
+        storeEntry& entry( m_entries[oldestID] );
+        if( entry.place != storeEntry::MEMORY )
+        {
+            continue; // tract was already taken or erased
+        }
+        const size_t slot( allocateSlot() );
+        std::memcpy( slotData( slot ), &m_buffers[entry.index][0], tractBytes );
+        std::vector< float >().swap( m_buffers[entry.index] );
+        m_freeBuffers.push_back( entry.index );
+        --m_memoryTracts;
+        entry.place = storeEntry::SLAB;
+        entry.index = slot;
+        ++m_spilledTracts;
+    }
+    return true;
+}// end "makeRoom()" -----------------------------------------------------------------
+
+size_t meanTractStore::allocateSlot()
+{
+    if( !m_freeSlots.empty() )
+    {
+        const size_t slot( m_freeSlots.back() );
+        m_freeSlots.pop_back();
+        return slot;
+    }
+
+    if( m_slabDescriptor < 0 )
+    {
+        // create the slab and unlink it right away, the space is released when the descriptor is closed
+        std::string slabFilename( m_slabFolder + "/meanTracts_" + boost::lexical_cast< std::string >( getpid() ) + "_"
+                                  + boost::lexical_cast< std::string >( reinterpret_cast< size_t >( this ) ) + ".slab" );
+        m_slabDescriptor = open( slabFilename.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600 );
+        if( m_slabDescriptor < 0 )
+        {
+            throw std::runtime_error( "ERROR @ meanTractStore::allocateSlot(): unable to create slab file \"" + slabFilename + "\"" );
+        }
+        unlink( slabFilename.c_str() );
+    }
+
+    // append a new chunk to the slab
+    const size_t chunkBytes( m_slotsPerChunk * m_slotBytes );
+    const size_t chunkOffset( m_chunks.size() * chunkBytes );
+    if( ftruncate( m_slabDescriptor, chunkOffset + chunkBytes ) != 0 )
+    {
+        throw std::runtime_error( "ERROR @ meanTractStore::allocateSlot(): unable to grow the slab file (disk full?)" );
+    }
+    void* mapping( mmap( NULL, chunkBytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_slabDescriptor, chunkOffset ) );
+    if( mapping == MAP_FAILED )
+    {
+        throw std::runtime_error( "ERROR @ meanTractStore::allocateSlot(): unable to map the slab file" );
+    }
+    m_chunks.push_back( static_cast< char* >( mapping ) );
+
+    // the first slot of the new chunk is returned, the rest are made available in ascending order
+    const size_t firstSlot( m_slabSlots );
+    m_slabSlots += m_slotsPerChunk;
+    for( size_t slot = m_slabSlots - 1; slot > firstSlot; --slot )
+    {
+        m_freeSlots.push_back( slot );
+    }
+    return firstSlot;
+}// end "allocateSlot()" -----------------------------------------------------------------
@@ -0,0 +1,184 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+
+#ifndef MEANTRACTSTORE_H
+#define MEANTRACTSTORE_H
+
+// std library
+#include <vector>
+#include <deque>
+#include <string>
+#include <stdexcept>
+
+// boost library
+#include <boost/thread/mutex.hpp>
+
+// hClustering
+#include "compactTract.h"
+
+#define MEANSTORE_PAGE_BYTES 4096            // slab slots are aligned to the memory page size
+#define MEANSTORE_CHUNK_BYTES 268435456      // the slab file is grown and mapped in steps of at least this size (256 MB)
+
+/**
+ * This class keeps the natural-unit, unthresholded mean tractograms of the nodes built by the centroid algorithm until they are merged.
+ * Tracts are held in RAM up to a memory budget, when the budget is exceeded the oldest tracts are spilled to a single memory-mapped slab file
+ * in the temporary folder. The slab is made of fixed-size slots, it only grows by appending chunks and the slots of erased tracts are reused in place.
+ * The slab file is unlinked as soon as it is created, so its disk space is returned to the system when the store is destroyed (or the program ends).
+ * All member functions are thread-safe.
+ */
+class meanTractStore
+{
+public:
+    /**
+     * Constructor
+     * \param slabFolder folder where the slab file will be created if tracts need to be spilled from memory
+     * \param memoryBytes the maximum number of bytes of tract data to keep in RAM
+     */
+    meanTractStore( const std::string& slabFolder, const size_t memoryBytes );
+
+    //! Destructor
+    ~meanTractStore();
+
+    // === PUBLIC MEMBER FUNCTIONS ===
+
+    /**
+     * stores the mean tractogram of a node
+     * \param nodeID ID of the node
+     * \param tract the tractogram, must be in natural units and unthresholded. All the tracts in the store must have the same size
+     */
+    void put( const size_t nodeID, const compactTract& tract );
+
+    /**
+     * reads a mean tractogram from the store, the tract is kept in the store
+     * \param nodeID ID of the node
+     * \param tract a pointer to the tractogram object where the data will be copied
+     */
+    void get( const size_t nodeID, compactTract* tract ) const;
+
+    /**
+     * reads a mean tractogram from the store and removes it (memory tracts are handed over without copying)
+     * \param nodeID ID of the node
+     * \param tract a pointer to the tractogram object where the data will be placed
+     */
+    void take( const size_t nodeID, compactTract* tract );
+
+    /**
+     * removes a mean tractogram from the store, freeing its memory or slab slot
+     * \param nodeID ID of the node
+     */
+    void erase( const size_t nodeID );
+
+    /**
+     * returns true if the tractogram of a node is in the store
+     * \param nodeID ID of the node
+     * \return stored flag
+     */
+    bool contains( const size_t nodeID ) const;
+
+    /**
+     * returns a string with the usage statistics of the store
+     * \return report string
+     */
+    std::string getReport() const;
+
+    /**
+     * returns the memory currently held by the in-memory tract buffers
+     * \return size in bytes of the tracts held in memory
+     */
+    size_t memoryBytes() const;
+
+private:
+    // === PRIVATE DATA MEMBERS ===
+
+    /**
+     * location of a stored tractogram
+     */
+    struct storeEntry
+    {
+        enum { EMPTY, MEMORY, SLAB } place;  //!< where the tract is stored
+        size_t index;                        //!< position in the memory buffer pool or slab slot number
+    };
+
+    std::string m_slabFolder;                        //!< folder where the slab file is created
+    size_t m_memoryBytes;                            //!< memory budget for tract data in bytes
+    size_t m_tractSize;                              //!< number of values of a tractogram (set by the first stored tract)
+    std::vector< storeEntry > m_entries;             //!< location of the tract of each node, indexed by node ID
+    std::deque< std::vector< float > > m_buffers;    //!< pool of in-memory tract buffers
+    std::vector< size_t > m_freeBuffers;             //!< indices of unused positions in the buffer pool
+    std::deque< size_t > m_memoryOrder;              //!< node IDs in the order their tracts were stored in memory (may contain IDs no longer in memory)
+    size_t m_memoryTracts;                           //!< number of tracts currently held in memory
+    int m_slabDescriptor;                            //!< descriptor of the slab file, -1 if not yet created
+    size_t m_slotBytes;                              //!< size of a slab slot in bytes (page aligned)
+    size_t m_slotsPerChunk;                          //!< number of slots in each mapped chunk of the slab
+    std::vector< char* > m_chunks;                   //!< memory mappings of the slab chunks
+    std::vector< size_t > m_freeSlots;               //!< slab slots available for reuse
+    size_t m_slabSlots;                              //!< total number of slots in the slab
+    size_t m_peakMemoryTracts;                       //!< maximum number of tracts held in memory at the same time
+    size_t m_spilledTracts;                          //!< number of tracts written to the slab
+    mutable size_t m_slabReads;                      //!< number of tracts read back from the slab
+    mutable boost::mutex m_mutex;                    //!< protects all the data members
+
+    // === PRIVATE MEMBER FUNCTIONS ===
+
+    /**
+     * frees the memory or slab slot of a stored tract (the mutex must be held by the caller)
+     * \param nodeID ID of the node
+     */
+    void release( const size_t nodeID );
+
+    /**
+     * moves the oldest tracts in memory to the slab until the given number of additional bytes fits in the budget (the mutex must be held)
+     * \param bytesNeeded number of bytes to be made available
+     * \return true if the bytes fit in memory, false if the budget is too small even with no tracts in memory
+     */
+    bool makeRoom( const size_t bytesNeeded );
+
+    /**
+     * gets a free slab slot, creating the slab file or appending a new chunk if needed (the mutex must be held)
+     * \return slot number
+     */
+    size_t allocateSlot();
+
+    /**
+     * returns the address of a slab slot in the mapping
+     * \param slot slot number
+     * \return pointer to the tract data of the slot
+     */
+    inline float* slotData( const size_t slot ) const
+    {
+        return reinterpret_cast< float* >( m_chunks[slot / m_slotsPerChunk] + ( slot % m_slotsPerChunk ) * m_slotBytes );
+    }
+};
+
+#endif  // MEANTRACTSTORE_H
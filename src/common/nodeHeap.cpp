@@ -0,0 +1,233 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+// std library
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "nodeHeap.h"
+
+
+nodeHeap::nodeHeap( size_t numLeaves ): m_positions( 2 * numLeaves, NOT_IN_HEAP ),
+                                        m_numLeaves( numLeaves ),
+                                        m_insertCount( 0 )
+{
+    m_heap.reserve( numLeaves );
+}
+
+void nodeHeap::push( const nodeID_t& elementID, const dist_t distance )
+{
+    const size_t slot( idSlot( elementID ) );
+    if( slot >= m_positions.size() )
+    {
+        m_positions.resize( slot + 1, NOT_IN_HEAP );
+    }
+
+    heapEntry newEntry;
+    newEntry.dist = distance;
+    newEntry.order = m_insertCount++;
+    newEntry.slot = slot;
+
+    size_t position( m_positions[slot] );
+    if( position == NOT_IN_HEAP )
+    {
+        position = m_heap.size();
+        m_heap.push_back( newEntry );
+        m_positions[slot] = position;
+        siftUp( position );
+    }
+    else
+    {
+        // update in place: the entry can only move up (decrease) or down (increase)
+        const bool goesUp( before( newEntry, m_heap[position] ) );
+        m_heap[position] = newEntry;
+        if( goesUp )
+        {
+            siftUp( position );
+        }
+        else
+        {
+            siftDown( position );
+        }
+    }
+    return;
+} // end "push()" -----------------------------------------------------------------
+
+void nodeHeap::erase( const nodeID_t& elementID )
+{
+    const size_t slot( idSlot( elementID ) );
+    if( slot < m_positions.size() && m_positions[slot] != NOT_IN_HEAP )
+    {
+        removeAt( m_positions[slot] );
+    }
+    return;
+} // end "erase()" -----------------------------------------------------------------
+
+void nodeHeap::pop()
+{
+    if( !m_heap.empty() )
+    {
+        removeAt( 0 );
+    }
+    return;
+} // end "pop()" -----------------------------------------------------------------
+
+void nodeHeap::sortedIDs( std::vector< nodeID_t >* elementIDsPointer ) const
+{
+    std::vector< nodeID_t >& elementIDs( *elementIDsPointer );
+    std::vector< heapEntry > entries( m_heap );
+    std::sort( entries.begin(), entries.end(), before );
+    elementIDs.clear();
+    elementIDs.reserve( entries.size() );
+    for( size_t i = 0; i < entries.size(); ++i )
+    {
+        elementIDs.push_back( slotID( entries[i].slot ) );
+    }
+    return;
+} // end "sortedIDs()" -----------------------------------------------------------------
+
+void nodeHeap::topElements( const size_t count, std::vector< std::pair< nodeID_t, dist_t > >* elementsPointer ) const
+{
+    std::vector< std::pair< nodeID_t, dist_t > >& elements( *elementsPointer );
+    elements.clear();
+    if( m_heap.empty() )
+    {
+        return;
+    }
+    // best-first walk down the heap: the next element in priority order is always a child of an element already taken
+    std::vector< size_t > frontier( 1, 0 );
+    while( !frontier.empty() && elements.size() < count )
+    {
+        size_t best( 0 );
+        for( size_t i = 1; i < frontier.size(); ++i )
+        {
+            if( before( m_heap[frontier[i]], m_heap[frontier[best]] ) )
+            {
+                best = i;
+            }
+        }
+        const size_t position( frontier[best] );
+        frontier[best] = frontier.back();
+        frontier.pop_back();
+        elements.push_back( std::make_pair( slotID( m_heap[position].slot ), m_heap[position].dist ) );
+
+        const size_t firstChild( position * NODEHEAP_ARITY + 1 );
+        for( size_t child = firstChild; child < firstChild + NODEHEAP_ARITY && child < m_heap.size(); ++child )
+        {
+            frontier.push_back( child );
+        }
+    }
+    return;
+} // end "topElements()" -----------------------------------------------------------------
+
+
+// PRIVATE FUNCTIONS
+
+void nodeHeap::siftUp( size_t position )
+{
+    const heapEntry movingEntry( m_heap[position] );
+    while( position > 0 )
+    {
+        const size_t parent( ( position - 1 ) / NODEHEAP_ARITY );
+        if( !before( movingEntry, m_heap[parent] ) )
+        {
+            break;
+        }
+        m_heap[position] = m_heap[parent];
+        m_positions[m_heap[position].slot] = position;
+        position = parent;
+    }
+    m_heap[position] = movingEntry;
+    m_positions[movingEntry.slot] = position;
+    return;
+} // end "siftUp()" -----------------------------------------------------------------
+
+void nodeHeap::siftDown( size_t position )
+{
+    const heapEntry movingEntry( m_heap[position] );
+    const size_t heapSize( m_heap.size() );
+    while( true )
+    {
+        const size_t firstChild( position * NODEHEAP_ARITY + 1 );
+        if( firstChild >= heapSize )
+        {
+            break;
+        }
+        const size_t postLastChild( std::min( firstChild + NODEHEAP_ARITY, heapSize ) );
+        size_t bestChild( firstChild );
+        for( size_t child = firstChild + 1; child < postLastChild; ++child )
+        {
+            if( before( m_heap[child], m_heap[bestChild] ) )
+            {
+                bestChild = child;
+            }
+        }
+        if( !before( m_heap[bestChild], movingEntry ) )
+        {
+            break;
+        }
+        m_heap[position] = m_heap[bestChild];
+        m_positions[m_heap[position].slot] = position;
+        position = bestChild;
+    }
+    m_heap[position] = movingEntry;
+    m_positions[movingEntry.slot] = position;
+    return;
+} // end "siftDown()" -----------------------------------------------------------------
+
+void nodeHeap::removeAt( size_t position )
+{
+    m_positions[m_heap[position].slot] = NOT_IN_HEAP;
+    const size_t lastPosition( m_heap.size() - 1 );
+    if( position != lastPosition )
+    {
+        // move the last entry into the gap and restore the order in whichever direction is needed
+        const bool goesUp( before( m_heap[lastPosition], m_heap[position] ) );
+        m_heap[position] = m_heap[lastPosition];
+        m_heap.pop_back();
+        if( goesUp )
+        {
+            siftUp( position );
+        }
+        else
+        {
+            siftDown( position );
+        }
+    }
+    else
+    {
+        m_heap.pop_back();
+    }
+    return;
+} // end "removeAt()" -----------------------------------------------------------------
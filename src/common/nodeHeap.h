@@ -0,0 +1,204 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#ifndef NODEHEAP_H
+#define NODEHEAP_H
+
+// std library
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "WHnode.h"
+
+#define NODEHEAP_ARITY  4                   // children per heap node (4-ary heap: shallower and more cache friendly than binary)
+#define NOT_IN_HEAP     ( ( size_t ) -1 )   // heap position of an element not contained in the heap
+
+
+/**
+ * This class implements an indexed (addressable) priority queue of tree elements (leaves and nodes) ordered by their nearest neighbour distance.
+ * It is stored in flat arrays: a 4-ary min-heap of entries plus a table with the heap position of each element, indexed by element ID,
+ * so that the distance of any element can be decreased or increased in place without searching or allocating.
+ * Elements with equal distance are returned in insertion order (an element whose distance is updated counts as re-inserted),
+ * which reproduces the ordering of a std::multimap< dist_t, nodeID_t > where updates are done by erasing and inserting
+ */
+class nodeHeap
+{
+public:
+    /**
+     * Constructor
+     * \param numLeaves number of leaves of the tree (node IDs will be expected in the same range)
+     */
+    explicit nodeHeap( size_t numLeaves );
+
+    //! Destructor
+    ~nodeHeap() {}
+
+    // === IN-LINE MEMBER FUNCTIONS ===
+
+    /**
+     * returns true if the heap contains no elements
+     * \return empty flag
+     */
+    inline bool empty() const { return m_heap.empty(); }
+
+    /**
+     * returns the number of elements in the heap
+     * \return heap size
+     */
+    inline size_t size() const { return m_heap.size(); }
+
+    /**
+     * returns the ID of the element with the smallest distance
+     * \return top element ID
+     */
+    inline nodeID_t topID() const { return slotID( m_heap.front().slot ); }
+
+    /**
+     * returns the smallest distance in the heap
+     * \return top element distance
+     */
+    inline dist_t topDist() const { return m_heap.front().dist; }
+
+    /**
+     * returns true if the element is contained in the heap
+     * \param elementID ID of the element
+     * \return contained flag
+     */
+    inline bool contains( const nodeID_t& elementID ) const
+    {
+        size_t slot( idSlot( elementID ) );
+        return ( slot < m_positions.size() && m_positions[slot] != NOT_IN_HEAP );
+    }
+
+    // === PUBLIC MEMBER FUNCTIONS ===
+
+    /**
+     * inserts an element in the heap, if the element is already contained its distance is updated (and it counts as re-inserted)
+     * \param elementID ID of the element
+     * \param distance priority distance of the element
+     */
+    void push( const nodeID_t& elementID, const dist_t distance );
+
+    /**
+     * removes an element from the heap, does nothing if the element is not contained
+     * \param elementID ID of the element
+     */
+    void erase( const nodeID_t& elementID );
+
+    /**
+     * removes the element with the smallest distance
+     */
+    void pop();
+
+    /**
+     * returns the IDs of all elements in priority order (the heap is not modified)
+     * \param elementIDsPointer vector where the element IDs will be stored
+     */
+    void sortedIDs( std::vector< nodeID_t >* elementIDsPointer ) const;
+
+    /**
+     * returns the first elements in priority order with their distances, without sorting the whole heap (the heap is not modified)
+     * \param count maximum number of elements to return
+     * \param elementsPointer vector where the element IDs and distances will be stored
+     */
+    void topElements( const size_t count, std::vector< std::pair< nodeID_t, dist_t > >* elementsPointer ) const;
+
+private:
+    /**
+     * A heap entry, the distance and insertion order are stored inline so that sifting does not access other arrays
+     */
+    struct heapEntry
+    {
+        dist_t dist;    //!< priority distance
+        size_t order;   //!< insertion order, breaks ties between equal distances
+        size_t slot;    //!< slot of the element in the position table
+    };
+
+    // === PRIVATE DATA MEMBERS ===
+
+    std::vector< heapEntry > m_heap;    //!< the heap entries (4-ary heap in array form)
+    std::vector< size_t > m_positions;  //!< heap position of each element slot (NOT_IN_HEAP if not contained), leaves first and then nodes
+    size_t m_numLeaves;                 //!< number of leaves, first node slot
+    size_t m_insertCount;               //!< insertion counter
+
+    // === PRIVATE MEMBER FUNCTIONS ===
+
+    /**
+     * returns the position table slot of an element
+     * \param elementID ID of the element
+     * \return slot
+     */
+    inline size_t idSlot( const nodeID_t& elementID ) const { return ( elementID.first ? m_numLeaves + elementID.second : elementID.second ); }
+
+    /**
+     * returns the element ID of a position table slot
+     * \param slot the slot
+     * \return element ID
+     */
+    inline nodeID_t slotID( const size_t slot ) const
+    {
+        return ( slot < m_numLeaves ? std::make_pair( false, slot ) : std::make_pair( true, slot - m_numLeaves ) );
+    }
+
+    /**
+     * heap order of two entries
+     * \param lhs first entry
+     * \param rhs second entry
+     * \return true if the first entry goes before the second
+     */
+    inline static bool before( const heapEntry& lhs, const heapEntry& rhs )
+    {
+        return ( lhs.dist < rhs.dist || ( lhs.dist == rhs.dist && lhs.order < rhs.order ) );
+    }
+
+    /**
+     * moves the entry at a position towards the top of the heap until the heap order is restored
+     * \param position heap position of the entry
+     */
+    void siftUp( size_t position );
+
+    /**
+     * moves the entry at a position towards the bottom of the heap until the heap order is restored
+     * \param position heap position of the entry
+     */
+    void siftDown( size_t position );
+
+    /**
+     * removes the entry at a heap position
+     * \param position heap position of the entry
+     */
+    void removeAt( size_t position );
+};
+
+#endif  // NODEHEAP_H
@@ -0,0 +1,491 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+// std library
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <fstream>
+
+// posix memory mapping
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// boost library
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "packedDistMatrix.h"
+#include "WFileParser.h"
+#include "fileManagerFactory.h"
+
+
+packedDistMatrix::packedDistMatrix(): m_fileDescriptor( -1 ),
+                                      m_mapping( NULL ),
+                                      m_mappingBytes( 0 ),
+                                      m_writable( false ),
+                                      m_data( NULL ),
+                                      m_seeds( 0 ),
+                                      m_blockSize( 0 ),
+                                      m_storage( PSFloat32 ),
+                                      m_valueOffset( 0 ),
+                                      m_valueScale( 1 )
+{
+}
+
+packedDistMatrix::packedDistMatrix( const std::string& filename ): m_fileDescriptor( -1 ),
+                                                                   m_mapping( NULL ),
+                                                                   m_mappingBytes( 0 ),
+                                                                   m_writable( false ),
+                                                                   m_data( NULL ),
+                                                                   m_seeds( 0 ),
+                                                                   m_blockSize( 0 ),
+                                                                   m_storage( PSFloat32 ),
+                                                                   m_valueOffset( 0 ),
+                                                                   m_valueScale( 1 )
+{
+    open( filename );
+}
+
+packedDistMatrix::~packedDistMatrix()
+{
+    close();
+}
+
+void packedDistMatrix::open( const std::string& filename )
+{
+    close();
+
+    m_fileDescriptor = ::open( filename.c_str(), O_RDONLY );
+    if( m_fileDescriptor < 0 )
+    {
+        throw std::runtime_error( "ERROR @ packedDistMatrix::open(): unable to open packed matrix file \"" + filename + "\"" );
+    }
+    struct stat fileStatus;
+    if( fstat( m_fileDescriptor, &fileStatus ) != 0 || ( size_t )fileStatus.st_size < sizeof( packedMatrixHeader ) )
+    {
+        close();
+        throw std::runtime_error( "ERROR @ packedDistMatrix::open(): file \"" + filename + "\" is too small to be a packed matrix" );
+    }
+    m_mappingBytes = fileStatus.st_size;
+    void* mapping( mmap( NULL, m_mappingBytes, PROT_READ, MAP_SHARED, m_fileDescriptor, 0 ) );
+    if( mapping == MAP_FAILED )
+    {
+        m_mappingBytes = 0;
+        close();
+        throw std::runtime_error( "ERROR @ packedDistMatrix::open(): unable to map file \"" + filename + "\"" );
+    }
+    m_mapping = static_cast< unsigned char* >( mapping );
+
+    packedMatrixHeader header;
+    std::memcpy( &header, m_mapping, sizeof( header ) );
+    if( std::memcmp( header.magic, PACKED_MATRIX_MAGIC, sizeof( header.magic ) ) != 0 || header.version != PACKED_MATRIX_VERSION
+        || header.storage > PSUInt8 )
+    {
+        close();
+        throw std::runtime_error( "ERROR @ packedDistMatrix::open(): file \"" + filename + "\" is not a packed matrix file of a supported version" );
+    }
+    const PackedStorage storage( static_cast< PackedStorage >( header.storage ) );
+    const size_t valueCount( header.seeds * ( header.seeds - ( header.seeds > 0 ? 1 : 0 ) ) / 2 );
+    if( header.fileBytes != m_mappingBytes || header.coordOffset + 3 * sizeof( float ) * header.seeds > header.dataOffset
+        || header.dataOffset + valueCount * valueBytes( storage ) > m_mappingBytes )
+    {
+        close();
+        throw std::runtime_error( "ERROR @ packedDistMatrix::open(): file \"" + filename + "\" is truncated or corrupt" );
+    }
+
+    m_seeds = header.seeds;
+    m_blockSize = header.blockSize;
+    m_storage = storage;
+    m_valueOffset = header.valueOffset;
+    m_valueScale = header.valueScale;
+    m_coordinates.clear();
+    m_coordinates.reserve( m_seeds );
+    const float* coords( reinterpret_cast< const float* >( m_mapping + header.coordOffset ) );
+    for( size_t i = 0; i < m_seeds; ++i )
+    {
+        m_coordinates.push_back( WHcoord( coords[3*i], coords[3*i+1], coords[3*i+2] ) );
+    }
+    m_data = m_mapping + header.dataOffset;
+    m_writable = false;
+
+    // distance queries access the values at random
+    madvise( m_mapping, m_mappingBytes, MADV_RANDOM );
+    return;
+}// end "open()" -----------------------------------------------------------------
+
+void packedDistMatrix::create( const std::string& filename, const PackedStorage storage, const std::vector< WHcoord >& coordinates, const size_t blockSize )
+{
+    close();
+
+    m_seeds = coordinates.size();
+    m_blockSize = blockSize;
+    m_storage = storage;
+    m_coordinates = coordinates;
+    m_valueOffset = 0;
+    if( storage == PSUInt16 )
+    {
+        m_valueScale = 1. / 0xffff;
+    }
+    else if( storage == PSUInt8 )
+    {
+        m_valueScale = 1. / 0xff;
+    }
+    else
+    {
+        m_valueScale = 1;
+    }
+
+    packedMatrixHeader header;
+    std::memset( &header, 0, sizeof( header ) );
+    std::memcpy( header.magic, PACKED_MATRIX_MAGIC, sizeof( header.magic ) );
+    header.version = PACKED_MATRIX_VERSION;
+    header.storage = storage;
+    header.seeds = m_seeds;
+    header.blockSize = m_blockSize;
+    header.valueOffset = m_valueOffset;
+    header.valueScale = m_valueScale;
+    header.coordOffset = sizeof( header );
+    header.dataOffset = ( ( header.coordOffset + 3 * sizeof( float ) * m_seeds + PACKED_MATRIX_ALIGN - 1 ) / PACKED_MATRIX_ALIGN ) * PACKED_MATRIX_ALIGN;
+    header.fileBytes = header.dataOffset + ( m_seeds * ( m_seeds - ( m_seeds > 0 ? 1 : 0 ) ) / 2 ) * valueBytes( storage );
+
+    m_fileDescriptor = ::open( filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if( m_fileDescriptor < 0 )
+    {
+        throw std::runtime_error( "ERROR @ packedDistMatrix::create(): unable to create packed matrix file \"" + filename + "\"" );
+    }
+    if( ftruncate( m_fileDescriptor, header.fileBytes ) != 0 )
+    {
+        close();
+        throw std::runtime_error( "ERROR @ packedDistMatrix::create(): unable to allocate packed matrix file \"" + filename + "\"" );
+    }
+    m_mappingBytes = header.fileBytes;
+    void* mapping( mmap( NULL, m_mappingBytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fileDescriptor, 0 ) );
+    if( mapping == MAP_FAILED )
+    {
+        m_mappingBytes = 0;
+        close();
+        throw std::runtime_error( "ERROR @ packedDistMatrix::create(): unable to map file \"" + filename + "\"" );
+    }
+    m_mapping = static_cast< unsigned char* >( mapping );
+    m_writable = true;
+
+    std::memcpy( m_mapping, &header, sizeof( header ) );
+    float* coords( reinterpret_cast< float* >( m_mapping + header.coordOffset ) );
+    for( size_t i = 0; i < m_seeds; ++i )
+    {
+        coords[3*i] = m_coordinates[i].m_x;
+        coords[3*i+1] = m_coordinates[i].m_y;
+        coords[3*i+2] = m_coordinates[i].m_z;
+    }
+    m_data = m_mapping + header.dataOffset;
+    return;
+}// end "create()" -----------------------------------------------------------------
+
+void packedDistMatrix::close()
+{
+    if( m_mapping != NULL )
+    {
+        if( m_writable )
+        {
+            msync( m_mapping, m_mappingBytes, MS_SYNC );
+        }
+        munmap( m_mapping, m_mappingBytes );
+    }
+    if( m_fileDescriptor >= 0 )
+    {
+        ::close( m_fileDescriptor );
+    }
+    m_fileDescriptor = -1;
+    m_mapping = NULL;
+    m_mappingBytes = 0;
+    m_writable = false;
+    m_data = NULL;
+    m_seeds = 0;
+    m_coordinates.clear();
+    return;
+}// end "close()" -----------------------------------------------------------------
+
+void packedDistMatrix::setDistance( size_t seed1, size_t seed2, const dist_t distance )
+{
+    if( !m_writable )
+    {
+        throw std::runtime_error( "ERROR @ packedDistMatrix::setDistance(): matrix was not opened for writing" );
+    }
+    if( seed1 >= m_seeds || seed2 >= m_seeds )
+    {
+        throw std::runtime_error( "ERROR @ packedDistMatrix::setDistance(): seed index is out of bounds" );
+    }
+    if( seed1 == seed2 )
+    {
+        return;
+    }
+    const size_t position( packedPosition( seed1, seed2 ) );
+    unsigned char* data( m_mapping + ( m_data - m_mapping ) );
+    switch( m_storage )
+    {
+        case PSFloat32:
+            reinterpret_cast< float* >( data )[position] = distance;
+            break;
+        case PSFloat16:
+            reinterpret_cast< uint16_t* >( data )[position] = floatToHalf( distance );
+            break;
+        case PSUInt16:
+            reinterpret_cast< uint16_t* >( data )[position] = ( uint16_t )( std::min( std::max( ( distance - m_valueOffset ) / m_valueScale, 0.f ), ( float )0xffff ) + 0.5f );
+            break;
+        default:
+            data[position] = ( unsigned char )( std::min( std::max( ( distance - m_valueOffset ) / m_valueScale, 0.f ), ( float )0xff ) + 0.5f );
+            break;
+    }
+    return;
+}// end "setDistance()" -----------------------------------------------------------------
+
+void packedDistMatrix::importBlocks( const std::string& blockFolder, const std::string& filename, const PackedStorage storage, const bool verbose )
+{
+    std::vector< WHcoord > coordinates;
+    const size_t blockSize( readBlockIndex( blockFolder, &coordinates ) );
+    const size_t blocksPerRow( ( coordinates.size() + blockSize - 1 ) / blockSize );
+    create( filename, storage, coordinates, blockSize );
+
+    fileManagerFactory blockFMF( blockFolder );
+    fileManager& blockFM( blockFMF.getFM() );
+    size_t blockCount( 0 );
+    for( size_t row = 0; row < blocksPerRow; ++row )
+    {
+        for( size_t column = row; column < blocksPerRow; ++column )
+        {
+            if( verbose )
+            {
+                std::cout << "\rImporting block " << row << "-" << column << " (" << ++blockCount << " of " << blocksPerRow * ( blocksPerRow + 1 ) / 2 << ")..." << std::flush;
+            }
+            std::vector< std::vector< float > > blockValues;
+            blockFM.readDistBlock( row, column, &blockValues );
+            const size_t rowSeeds( std::min( blockSize, m_seeds - row * blockSize ) ), columnSeeds( std::min( blockSize, m_seeds - column * blockSize ) );
+            if( blockValues.size() != rowSeeds || ( rowSeeds > 0 && blockValues[0].size() != columnSeeds ) )
+            {
+                throw std::runtime_error( "ERROR @ packedDistMatrix::importBlocks(): block size does not match the index file" );
+            }
+            for( size_t i = 0; i < rowSeeds; ++i )
+            {
+                // only the upper triangle of diagonal blocks holds valid values
+                for( size_t j = ( row == column ) ? i + 1 : 0; j < columnSeeds; ++j )
+                {
+                    setDistance( row * blockSize + i, column * blockSize + j, blockValues[i][j] );
+                }
+            }
+        }
+    }
+    msync( m_mapping, m_mappingBytes, MS_SYNC );
+    if( verbose )
+    {
+        std::cout << "\rImported " << blockCount << " blocks, " << m_seeds << " seeds. File size: " << m_mappingBytes / ( 1024 * 1024 ) << " MBytes" << std::endl;
+    }
+    return;
+}// end "importBlocks()" -----------------------------------------------------------------
+
+void packedDistMatrix::exportBlocks( const std::string& blockFolder, size_t blockSize, const bool zipFlag, const bool verbose ) const
+{
+    if( !ready() )
+    {
+        throw std::runtime_error( "ERROR @ packedDistMatrix::exportBlocks(): no matrix is open" );
+    }
+    if( blockSize == 0 )
+    {
+        blockSize = m_blockSize;
+    }
+    if( blockSize == 0 || blockSize > m_seeds )
+    {
+        blockSize = m_seeds;
+    }
+    const size_t blocksPerRow( ( m_seeds + blockSize - 1 ) / blockSize );
+
+    // write index file
+    std::string indexFilename = blockFolder + "/" + MATRIX_INDEX_FILENAME;
+    std::ofstream outFileStream( indexFilename.c_str() );
+    if( !outFileStream )
+    {
+        std::cerr << "ERROR: unable to open output index file: \"" << indexFilename << "\"" << std::endl;
+        throw std::runtime_error("ERROR: unable to open output index file");
+    }
+    outFileStream << "#distindex" << std::endl;
+    for( size_t i = 0; i < m_seeds; ++i )
+    {
+        outFileStream << m_coordinates[i];
+        outFileStream << boost::format( " b %03d i %04d" ) % ( i / blockSize ) % ( i % blockSize );
+        outFileStream << std::endl;
+    }
+    outFileStream << "#enddistindex" << std::endl;
+    outFileStream.close();
+
+    // write blocks
+    fileManagerFactory blockFMF( blockFolder );
+    fileManager& blockFM( blockFMF.getFM() );
+    blockFM.writeInFloat();
+    if( zipFlag )
+    {
+        blockFM.storeZipped();
+    }
+    else
+    {
+        blockFM.storeUnzipped();
+    }
+    size_t blockCount( 0 );
+    for( size_t row = 0; row < blocksPerRow; ++row )
+    {
+        for( size_t column = row; column < blocksPerRow; ++column )
+        {
+            if( verbose )
+            {
+                std::cout << "\rExporting block " << row << "-" << column << " (" << ++blockCount << " of " << blocksPerRow * ( blocksPerRow + 1 ) / 2 << ")..." << std::flush;
+            }
+            const size_t rowSeeds( std::min( blockSize, m_seeds - row * blockSize ) ), columnSeeds( std::min( blockSize, m_seeds - column * blockSize ) );
+            std::vector< std::vector< float > > blockValues( rowSeeds, std::vector< float >( columnSeeds, 0 ) );
+            for( size_t i = 0; i < rowSeeds; ++i )
+            {
+                for( size_t j = 0; j < columnSeeds; ++j )
+                {
+                    blockValues[i][j] = getDistance( row * blockSize + i, column * blockSize + j );
+                }
+            }
+            blockFM.writeDistBlock( row, column, blockValues );
+        }
+    }
+    if( verbose )
+    {
+        std::cout << "\rExported " << blockCount << " blocks of size " << blockSize << "                  " << std::endl;
+    }
+    return;
+}// end "exportBlocks()" -----------------------------------------------------------------
+
+
+// PRIVATE FUNCTIONS
+
+size_t packedDistMatrix::valueBytes( const PackedStorage storage ) const
+{
+    switch( storage )
+    {
+        case PSFloat32:
+            return sizeof( float );
+        case PSFloat16:
+        case PSUInt16:
+            return sizeof( uint16_t );
+        default:
+            return sizeof( unsigned char );
+    }
+}// end "valueBytes()" -----------------------------------------------------------------
+
+uint16_t packedDistMatrix::floatToHalf( const float value )
+{
+    uint32_t bits;
+    std::memcpy( &bits, &value, sizeof( bits ) );
+    const uint16_t sign( ( bits >> 16 ) & 0x8000 );
+    const int exponent( ( int )( ( bits >> 23 ) & 0xff ) - 127 + 15 );
+    uint32_t mantissa( bits & 0x7fffff );
+
+    if( ( ( bits >> 23 ) & 0xff ) == 0xff )
+    {
+        // infinity or NaN
+        return sign | 0x7c00 | ( mantissa ? 0x200 : 0 );
+    }
+    if( exponent >= 0x1f )
+    {
+        // overflow
+        return sign | 0x7c00;
+    }
+    if( exponent <= 0 )
+    {
+        // subnormal half (or underflow to zero)
+        if( exponent < -10 )
+        {
+            return sign;
+        }
+        mantissa |= 0x800000;
+        const uint32_t shift( 14 - exponent ), halfway( 1u << ( shift - 1 ) ), remainder( mantissa & ( ( 1u << shift ) - 1 ) );
+        uint32_t half( mantissa >> shift );
+        if( remainder > halfway || ( remainder == halfway && ( half & 1 ) ) )
+        {
+            ++half;
+        }
+        return sign | half;
+    }
+    // normal half, a rounding carry into the exponent gives the right result
+    uint32_t half( ( exponent << 10 ) | ( mantissa >> 13 ) );
+    const uint32_t remainder( mantissa & 0x1fff );
+    if( remainder > 0x1000 || ( remainder == 0x1000 && ( half & 1 ) ) )
+    {
+        ++half;
+    }
+    return sign | half;
+}// end "floatToHalf()" -----------------------------------------------------------------
+
+size_t packedDistMatrix::readBlockIndex( const std::string& blockFolder, std::vector< WHcoord >* coordinatesPointer ) const
+{
+    std::vector< WHcoord >& coordinates( *coordinatesPointer );
+    coordinates.clear();
+
+    std::string indexFilename = blockFolder + "/" + MATRIX_INDEX_FILENAME;
+    WFileParser parser( indexFilename );
+    if( !parser.readFile() )
+    {
+        throw std::runtime_error( "ERROR @ packedDistMatrix::readBlockIndex(): unable to read index file \"" + indexFilename + "\"" );
+    }
+    std::vector< std::vector< std::string > > indexStrings = parser.getLinesForTagSeparated( "distindex" );
+    if( indexStrings.empty() )
+    {
+        throw std::runtime_error( "ERROR @ packedDistMatrix::readBlockIndex(): index file is empty" );
+    }
+    size_t blockSize( 0 );
+    coordinates.reserve( indexStrings.size() );
+    for( size_t i = 0; i < indexStrings.size(); ++i )
+    {
+        if( indexStrings[i].size() != 7 || indexStrings[i][3] != "b" || indexStrings[i][5] != "i" )
+        {
+            throw std::runtime_error( "ERROR @ packedDistMatrix::readBlockIndex(): format of index file is not correct" );
+        }
+        coordinates.push_back( WHcoord( boost::lexical_cast< coord_t >( indexStrings[i][0] ), boost::lexical_cast< coord_t >( indexStrings[i][1] ),
+                                        boost::lexical_cast< coord_t >( indexStrings[i][2] ) ) );
+        const size_t block( boost::lexical_cast< size_t >( indexStrings[i][4] ) ), position( boost::lexical_cast< size_t >( indexStrings[i][6] ) );
+        if( block == 0 )
+        {
+            blockSize = position + 1;
+        }
+        // seeds are stored in the block layout in matrix order, block after block
+        if( blockSize == 0 || block * blockSize + position != i )
+        {
+            throw std::runtime_error( "ERROR @ packedDistMatrix::readBlockIndex(): index file positions are not consecutive" );
+        }
+    }
+    return blockSize;
+}// end "readBlockIndex()" -----------------------------------------------------------------
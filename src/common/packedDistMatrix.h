@@ -0,0 +1,308 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#ifndef PACKEDDISTMATRIX_H
+#define PACKEDDISTMATRIX_H
+
+// std library
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+
+#include "WHcoord.h"
+#include "WHnode.h"
+
+#define PACKED_MATRIX_MAGIC "HCDISTPK"  // file signature (8 characters)
+#define PACKED_MATRIX_VERSION 1
+#define PACKED_MATRIX_ALIGN 4096        // byte alignment of the value array within the file (page size)
+
+/**
+ * defines the data type used to store the distance values in a packed matrix file
+ */
+typedef enum {
+    PSFloat32,  //!< 32 bit float, exact
+    PSFloat16,  //!< 16 bit float (IEEE half precision), relative error < 0.05%
+    PSUInt16,   //!< 16 bit integer quantization of the [0,1] range, absolute error < 8e-6
+    PSUInt8     //!< 8 bit integer quantization of the [0,1] range, absolute error < 2e-3
+} PackedStorage;
+
+/**
+ * header of a packed matrix file, written at the beginning of the file
+ */
+struct packedMatrixHeader
+{
+    char magic[8];          //!< file signature (PACKED_MATRIX_MAGIC)
+    uint32_t version;       //!< file format version
+    uint32_t storage;       //!< data type of the values (PackedStorage)
+    uint64_t seeds;         //!< number of seed voxels (rows/columns of the matrix)
+    uint64_t blockSize;     //!< block size of the block layout the matrix was imported from (default block size when exporting)
+    float valueOffset;      //!< quantized values are decoded as offset + scale * stored value
+    float valueScale;       //!< quantized values are decoded as offset + scale * stored value
+    uint64_t coordOffset;   //!< byte position of the seed coordinate table (3 floats per seed)
+    uint64_t dataOffset;    //!< byte position of the value array
+    uint64_t fileBytes;     //!< total size of the file in bytes
+};
+
+/**
+ * This class implements a distance matrix stored as a single binary file with the packed upper triangle (without the zero diagonal) in row order,
+ * preceded by a small header and the seed voxel coordinates. The file is accessed through a memory mapping, values are read directly from the
+ * mapped pages without decoding whole blocks, and any distance value is obtained in constant time.
+ * Values can be stored in float32, float16 or quantized to 16 or 8 bits. Matrices in the distance block layout (as written by distMatComputer)
+ * can be imported into a packed file and exported back to blocks.
+ */
+class packedDistMatrix
+{
+public:
+    /**
+     * Constructor
+     */
+    packedDistMatrix();
+
+    /**
+     * \overload
+     * \param filename packed matrix file to be opened (read only)
+     */
+    explicit packedDistMatrix( const std::string& filename );
+
+    //! Destructor
+    ~packedDistMatrix();
+
+    // === IN-LINE MEMBER FUNCTIONS ===
+
+    /**
+     * returns the number of seeds (rows/columns) of the matrix
+     * \return matrix size
+     */
+    inline size_t size() const { return m_seeds; }
+
+    /**
+     * returns the storage data type of the matrix values
+     * \return storage type
+     */
+    inline PackedStorage storage() const { return m_storage; }
+
+    /**
+     * returns the block size of the block layout the matrix was imported from
+     * \return block size
+     */
+    inline size_t blockSize() const { return m_blockSize; }
+
+    /**
+     * returns the seed voxel coordinates, in matrix order
+     * \return the coordinate vector
+     */
+    inline const std::vector< WHcoord >& coordinates() const { return m_coordinates; }
+
+    /**
+     * returns true if a matrix file is open
+     * \return ready flag
+     */
+    inline bool ready() const { return m_data != NULL; }
+
+    /**
+     * fetches the distance value between two seed voxel tracts. Called per element from parallel loops, so indices are only range-checked
+     * in DEBUG builds: callers must pass indices below size() (positions in coordinates())
+     * \param seed1 matrix index of the first seed
+     * \param seed2 matrix index of the second seed
+     * \return distance value
+     */
+    inline dist_t getDistance( size_t seed1, size_t seed2 ) const
+    {
+#if DEBUG
+        if( seed1 >= m_seeds || seed2 >= m_seeds )
+        {
+            throw std::runtime_error( "ERROR @ packedDistMatrix::getDistance(): seed index is out of bounds" );
+        }
+#endif
+        if( seed1 == seed2 )
+        {
+            return 0;
+        }
+        const size_t position( packedPosition( seed1, seed2 ) );
+        switch( m_storage )
+        {
+            case PSFloat32:
+                return reinterpret_cast< const float* >( m_data )[position];
+            case PSFloat16:
+                return halfToFloat( reinterpret_cast< const uint16_t* >( m_data )[position] );
+            case PSUInt16:
+                return m_valueOffset + m_valueScale * reinterpret_cast< const uint16_t* >( m_data )[position];
+            default:
+                return m_valueOffset + m_valueScale * m_data[position];
+        }
+    }
+
+    /**
+     * converts a half precision float to single precision
+     * \param half the half precision bit pattern
+     * \return the single precision value
+     */
+    static inline float halfToFloat( const uint16_t half )
+    {
+        uint32_t sign( ( uint32_t )( half & 0x8000 ) << 16 ), exponent( ( half >> 10 ) & 0x1f ), mantissa( half & 0x3ff ), bits( 0 );
+        if( exponent == 0x1f )
+        {
+            bits = sign | 0x7f800000 | ( mantissa << 13 );
+        }
+        else if( exponent != 0 )
+        {
+            bits = sign | ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 );
+        }
+        else if( mantissa != 0 )
+        {
+            // subnormal half, normalize it
+            exponent = 113;
+            while( !( mantissa & 0x400 ) )
+            {
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits = sign | ( exponent << 23 ) | ( ( mantissa & 0x3ff ) << 13 );
+        }
+        else
+        {
+            bits = sign;
+        }
+        float value;
+        std::memcpy( &value, &bits, sizeof( value ) );
+        return value;
+    }
+
+    /**
+     * converts a single precision float to half precision (rounding to nearest even)
+     * \param value the single precision value
+     * \return the half precision bit pattern
+     */
+    static uint16_t floatToHalf( const float value );
+
+    // === PUBLIC MEMBER FUNCTIONS ===
+
+    /**
+     * opens a packed matrix file for reading, the file is memory mapped
+     * \param filename packed matrix file path
+     */
+    void open( const std::string& filename );
+
+    /**
+     * creates a new packed matrix file (all distances set to 0) and maps it for writing
+     * \param filename path of the file to be created
+     * \param storage storage data type of the values
+     * \param coordinates the seed voxel coordinates, in matrix order
+     * \param blockSize block size to be used by default when exporting to the block layout
+     */
+    void create( const std::string& filename, const PackedStorage storage, const std::vector< WHcoord >& coordinates, const size_t blockSize );
+
+    /**
+     * closes the matrix file (changes to a matrix created with create() are flushed to disk)
+     */
+    void close();
+
+    /**
+     * sets the distance value between two seed voxel tracts (only for a matrix created with create())
+     * \param seed1 matrix index of the first seed
+     * \param seed2 matrix index of the second seed
+     * \param distance the distance value
+     */
+    void setDistance( size_t seed1, size_t seed2, const dist_t distance );
+
+    /**
+     * creates a packed matrix file from a distance matrix stored in the block layout (index file and distance blocks)
+     * \param blockFolder folder containing the distance matrix index and blocks
+     * \param filename path of the packed matrix file to be created
+     * \param storage storage data type of the values
+     * \param verbose if true progress information is written to the standard output
+     */
+    void importBlocks( const std::string& blockFolder, const std::string& filename, const PackedStorage storage, const bool verbose );
+
+    /**
+     * writes the open matrix in the block layout (index file and distance blocks), as written by distMatComputer
+     * \param blockFolder folder where the distance matrix index and blocks will be written
+     * \param blockSize size of the blocks, if 0 the block size stored in the packed file is used
+     * \param zipFlag if true block files will be zipped
+     * \param verbose if true progress information is written to the standard output
+     */
+    void exportBlocks( const std::string& blockFolder, size_t blockSize, const bool zipFlag, const bool verbose ) const;
+
+private:
+    // === PRIVATE DATA MEMBERS ===
+
+    int m_fileDescriptor;                   //!< descriptor of the open matrix file
+    unsigned char* m_mapping;               //!< start of the memory mapped file
+    size_t m_mappingBytes;                  //!< size of the memory mapping
+    bool m_writable;                        //!< true if the file was mapped for writing
+    const unsigned char* m_data;            //!< start of the value array within the mapping
+    size_t m_seeds;                         //!< number of seed voxels (rows/columns of the matrix)
+    size_t m_blockSize;                     //!< block size of the block layout the matrix was imported from
+    PackedStorage m_storage;                //!< storage data type of the values
+    float m_valueOffset;                    //!< offset of the quantized values
+    float m_valueScale;                     //!< scale of the quantized values
+    std::vector< WHcoord > m_coordinates;   //!< seed voxel coordinates
+
+    // === PRIVATE MEMBER FUNCTIONS ===
+
+    /**
+     * returns the position of a distance value within the packed value array
+     * \param seed1 matrix index of the first seed (must differ from the second one)
+     * \param seed2 matrix index of the second seed
+     * \return the array position
+     */
+    inline size_t packedPosition( size_t seed1, size_t seed2 ) const
+    {
+        if( seed1 > seed2 )
+        {
+            std::swap( seed1, seed2 );
+        }
+        return seed1 * m_seeds - ( seed1 * ( seed1 + 1 ) ) / 2 + ( seed2 - seed1 - 1 );
+    }
+
+    /**
+     * returns the number of bytes used to store each value
+     * \param storage the storage data type
+     * \return bytes per value
+     */
+    size_t valueBytes( const PackedStorage storage ) const;
+
+    /**
+     * reads a distance matrix index file (as written by distMatComputer)
+     * \param blockFolder folder containing the index file
+     * \param coordinatesPointer a pointer to the vector where the seed coordinates will be returned, in matrix order
+     * \return the block size of the matrix
+     */
+    size_t readBlockIndex( const std::string& blockFolder, std::vector< WHcoord >* coordinatesPointer ) const;
+};
+
+#endif  // PACKEDDISTMATRIX_H
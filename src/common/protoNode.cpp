@@ -31,10 +31,86 @@
 //---------------------------------------------------------------------------
 
 
-#include <map>
+#include <vector>
+#include <algorithm>
 
 #include "protoNode.h"
 
+
+// nbTable
+
+bool nbTable::insert( const value_type& entry )
+{
+    // new entries (merged nodes have the highest IDs) usually go at the end
+    if( m_table.empty() || m_table.back().first < entry.first )
+    {
+        m_table.push_back( entry );
+        return true;
+    }
+    iterator iter( std::lower_bound( m_table.begin(), m_table.end(), entry.first, idLess ) );
+    if( iter != m_table.end() && iter->first == entry.first )
+    {
+        return false;
+    }
+    m_table.insert( iter, entry );
+    return true;
+} // end "nbTable::insert()" -----------------------------------------------------------------
+
+void nbTable::set( const nodeID_t& id, const dist_t dist )
+{
+    iterator iter( std::lower_bound( m_table.begin(), m_table.end(), id, idLess ) );
+    if( iter != m_table.end() && iter->first == id )
+    {
+        iter->second = dist;
+    }
+    else
+    {
+        m_table.insert( iter, std::make_pair( id, dist ) );
+    }
+} // end "nbTable::set()" -----------------------------------------------------------------
+
+size_t nbTable::erase( const nodeID_t& id )
+{
+    iterator iter( find( id ) );
+    if( iter == m_table.end() )
+    {
+        return 0;
+    }
+    m_table.erase( iter );
+    return 1;
+} // end "nbTable::erase()" -----------------------------------------------------------------
+
+void nbTable::merge( const nbTable& table1, const nbTable& table2, const nodeID_t& excluded1, const nodeID_t& excluded2 )
+{
+    m_table.clear();
+    m_table.reserve( table1.size() + table2.size() );
+    const_iterator iter1( table1.begin() ), iter2( table2.begin() );
+    while( iter1 != table1.end() || iter2 != table2.end() )
+    {
+        const value_type* next;
+        if( iter2 == table2.end() || ( iter1 != table1.end() && !( iter2->first < iter1->first ) ) )
+        {
+            // on equal IDs take the entry from the first table and skip the one from the second
+            if( iter2 != table2.end() && iter2->first == iter1->first )
+            {
+                ++iter2;
+            }
+            next = &( *iter1++ );
+        }
+        else
+        {
+            next = &( *iter2++ );
+        }
+        if( next->first != excluded1 && next->first != excluded2 )
+        {
+            m_table.push_back( *next );
+        }
+    }
+} // end "nbTable::merge()" -----------------------------------------------------------------
+
+
+// protoNode
+
 bool protoNode::updateNbhood( const nodeID_t& oldNode1, const nodeID_t& oldNode2, const nodeID_t& newNode, const dist_t newDist )
 {
     // update nbhood table
@@ -45,7 +121,7 @@ bool protoNode::updateNbhood( const nodeID_t& oldNode1, const nodeID_t& oldNode2
     if( ( m_nearNb.first == oldNode1 ) || ( m_nearNb.first == oldNode2 ) )
     { //if one of the deleted nb was the nearest, check all of them again
         m_nearNb = *( m_nbNodes.begin() );
-        for( std::map< nodeID_t, dist_t >::const_iterator iter = m_nbNodes.begin(); iter != m_nbNodes.end(); ++iter )
+        for( nbTable::const_iterator iter = m_nbNodes.begin(); iter != m_nbNodes.end(); ++iter )
             if( iter->second < m_nearNb.second )
                 m_nearNb = *iter;
         return true;
@@ -95,7 +171,7 @@ bool protoNode::updateActivhood( const nodeID_t& oldNode1, const nodeID_t& oldNo
 
 void protoNode::updateDist( const nodeID_t& updatedNode, const dist_t updatedDist )
 {
-    m_nbNodes[updatedNode]=updatedDist;
+    m_nbNodes.set( updatedNode, updatedDist );
 } // end "updateDist()" -----------------------------------------------------------------
 
 bool protoNode::updateActive( const std::vector< protoNode > &protoNodes )
@@ -109,7 +185,7 @@ bool protoNode::updateActive( const std::vector< protoNode > &protoNodes )
             changed = true;
         }
     }
-    for( std::map< nodeID_t, dist_t >::const_iterator iter = m_nbNodes.begin(); iter != m_nbNodes.end(); ++iter )
+    for( nbTable::const_iterator iter = m_nbNodes.begin(); iter != m_nbNodes.end(); ++iter )
     {
         bool isNode( iter->first.first );
         size_t thisNodeID( iter->first.second );
@@ -143,7 +219,7 @@ std::ostream& operator <<( std::ostream& os, const protoNode& object )
     os << "Near Nb: " << object.m_nearNb.first.first << "-" << object.m_nearNb.first.second << "|" << object.m_nearNb.second
                     << std::flush;
     os << ". Nbs: " << std::flush;
-    for( std::map< nodeID_t, dist_t >::const_iterator iter( object.m_nbNodes.begin() ); iter != object.m_nbNodes.end(); ++iter )
+    for( nbTable::const_iterator iter( object.m_nbNodes.begin() ); iter != object.m_nbNodes.end(); ++iter )
     {
         os << "(" << iter->first.first << "-" << iter->first.second << "|" << iter->second << ") " << std::flush;
     }
@@ -36,7 +36,8 @@
 
 // std library
 #include <utility>
-#include <map>
+#include <vector>
+#include <algorithm>
 
 
 // hClustering
@@ -45,6 +46,99 @@
 const dist_t noNbDist( 999 );
 const nodeID_t noNbID( std::make_pair( false, 0 ) );
 
+/**
+ * This class implements the neighbourhood table of a protonode as a flat vector of (neighbour ID, distance) pairs kept sorted by ID.
+ * It offers the map-like lookup operations the tree builders need plus random access by position and a linear merge of two tables
+ */
+class nbTable
+{
+public:
+    typedef std::pair< nodeID_t, dist_t > value_type;
+    typedef std::vector< value_type >::iterator iterator;
+    typedef std::vector< value_type >::const_iterator const_iterator;
+
+    // === IN-LINE MEMBER FUNCTIONS ===
+
+    inline iterator begin() { return m_table.begin(); }
+    inline iterator end() { return m_table.end(); }
+    inline const_iterator begin() const { return m_table.begin(); }
+    inline const_iterator end() const { return m_table.end(); }
+    inline value_type& operator []( size_t index ) { return m_table[index]; }
+    inline const value_type& operator []( size_t index ) const { return m_table[index]; }
+    inline size_t size() const { return m_table.size(); }
+    inline bool empty() const { return m_table.empty(); }
+    inline size_t capacity() const { return m_table.capacity(); }
+    inline void reserve( size_t count ) { m_table.reserve( count ); }
+    inline void clear() { m_table.clear(); }
+    inline void swap( nbTable& other ) { m_table.swap( other.m_table ); }
+
+    /**
+     * releases the memory allocated by the table
+     */
+    inline void release() { std::vector< value_type >().swap( m_table ); }
+
+    /**
+     * looks for a neighbour in the table (binary search)
+     * \param id ID of the neighbour to look for
+     * \return iterator to the neighbour entry, end() if not found
+     */
+    inline iterator find( const nodeID_t& id )
+    {
+        iterator iter( std::lower_bound( m_table.begin(), m_table.end(), id, idLess ) );
+        return ( iter != m_table.end() && iter->first == id ) ? iter : m_table.end();
+    }
+    /**
+     * \overload
+     */
+    inline const_iterator find( const nodeID_t& id ) const
+    {
+        const_iterator iter( std::lower_bound( m_table.begin(), m_table.end(), id, idLess ) );
+        return ( iter != m_table.end() && iter->first == id ) ? iter : m_table.end();
+    }
+
+    // === PUBLIC MEMBER FUNCTIONS ===
+
+    /**
+     * inserts a neighbour entry keeping the table sorted, existing entries are not overwritten (as in std::map::insert())
+     * \param entry neighbour ID and distance to insert
+     * \return true if the entry was inserted, false if the neighbour was already in the table
+     */
+    bool insert( const value_type& entry );
+
+    /**
+     * sets the distance value of a neighbour, inserting it if it was not yet in the table
+     * \param id ID of the neighbour
+     * \param dist distance value
+     */
+    void set( const nodeID_t& id, const dist_t dist );
+
+    /**
+     * removes a neighbour from the table
+     * \param id ID of the neighbour to remove
+     * \return number of entries removed (0 or 1)
+     */
+    size_t erase( const nodeID_t& id );
+
+    /**
+     * fills the table with the union of two neighbourhood tables in one linear pass, leaving out the two given IDs
+     * (used to obtain the neighbourhood of a newly merged node, if a neighbour is in both tables the entry from the first one is kept)
+     * \param table1 neighbourhood table of the first merged node
+     * \param table2 neighbourhood table of the second merged node
+     * \param excluded1 first ID to leave out (ID of the first merged node)
+     * \param excluded2 second ID to leave out (ID of the second merged node)
+     */
+    void merge( const nbTable& table1, const nbTable& table2, const nodeID_t& excluded1, const nodeID_t& excluded2 );
+
+private:
+    // === PRIVATE MEMBER FUNCTIONS ===
+
+    static inline bool idLess( const value_type& entry, const nodeID_t& id ) { return entry.first < id; }
+
+    // === PRIVATE DATA MEMBERS ===
+
+    std::vector< value_type > m_table; //!< neighbour entries sorted by ID
+};
+
 /**
  * This class implements a tree node information container without hierarchical relationships to use while tree building
  */
@@ -54,10 +148,10 @@ public:
     /**
      * Constructor
      * \param nearNb information on the nearest neighbor of this protonode
-     * \param nbNodes a map wit  the information on all the neighbor of this protonode
+     * \param nbNodes a table with the information on all the neighbor of this protonode
      * \param isactive a boolean flag indicating whther this protonode is currently active (if its allowed to be merged with another protonode)
      */
-    protoNode( std::pair< nodeID_t, dist_t > nearNb, std::map< nodeID_t, dist_t > nbNodes, bool isactive = true ) :
+    protoNode( std::pair< nodeID_t, dist_t > nearNb, const nbTable& nbNodes, bool isactive = true ) :
                m_nearNb( nearNb ), m_nbNodes( nbNodes ), m_discarded( false ),  m_active( isactive ) {}
 
     //! Destructor
@@ -92,12 +186,27 @@ public:
     /**
      * erases the stored neighbor information
      */
-    inline void clearNbhood() { m_nbNodes.clear(); }
+    inline void clearNbhood() { m_nbNodes.release(); }
+
+    /**
+     * erases the stored neighbor information handing its allocated memory over to a spare table so that it can be reused
+     * \param spare table to receive the (emptied) memory of the neighbourhood table, if it is larger than the spare one
+     */
+    inline void clearNbhood( nbTable* spare )
+    {
+        m_nbNodes.clear();
+        if( m_nbNodes.capacity() > spare->capacity() )
+        {
+            spare->clear();
+            spare->swap( m_nbNodes );
+        }
+        m_nbNodes.release();
+    }
 
     /**
      * discards the protonode as outlier
      */
-    inline void discard() { m_nbNodes.clear(); m_discarded = true; }
+    inline void discard() { m_nbNodes.release(); m_discarded = true; }
 
     /**
      * inactivates the protonode so that it may not be merged until reactivated
@@ -156,7 +265,7 @@ public:
     // === PUBLIC DATA MEMBERS ===
 
     std::pair< nodeID_t, dist_t > m_nearNb; //!< current nearest neighbour data
-    std::map< nodeID_t, dist_t > m_nbNodes; //!< list of current neighbours data
+    nbTable m_nbNodes; //!< list of current neighbours data (sorted by ID)
 
 private:
     // === PRIVATE DATA MEMBERS ===
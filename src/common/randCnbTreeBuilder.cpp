@@ -141,7 +141,7 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
 
     { // ------- Tree build up ----------
         // supernode, keeps track of the current top nodes in the hierarchy
-        std::multimap< dist_t, nodeID_t > priorityNodes;
+        nodeHeap priorityNodes( protoLeaves.size() );
         std::set< size_t > currentNodes;
 
         size_t activeSize( 1 ), prioritySize( 1 );
@@ -156,15 +156,14 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
 
         leaves.reserve( protoLeaves.size() );
         nodes.reserve( protoLeaves.size() );
+        protoNodes.reserve( protoLeaves.size() );
 
         WHnode rootNode( std::make_pair( false, 0 ) ); // node where to keep all isolated clusters
         rootNode.setSize( 0 );
 
-        std::vector< std::multimap< dist_t, nodeID_t >::iterator > priorityLeafIndex( protoLeaves.size(), priorityNodes.end() );
-        std::vector< std::multimap< dist_t, nodeID_t >::iterator > priorityNodeIndex( protoLeaves.size(), priorityNodes.end() );
         for( size_t i = 0; i < protoLeaves.size(); ++i )
         {
-            priorityLeafIndex[i] = priorityNodes.insert( std::make_pair( protoLeaves[i].nearDist(), std::make_pair( false, i ) ) );
+            priorityNodes.push( std::make_pair( false, i ), protoLeaves[i].nearDist() );
             WHnode newLeaf( std::make_pair( false, i ) );
             leaves.push_back( newLeaf );
         }
@@ -172,6 +171,7 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
 
         time_t lastTime( time( NULL ) ), loopStart( time( NULL ) ); // time object
         size_t maxNbs( 0 ); // to keep track of maximum number of neighbours in an iteration during the program
+        nbTable newNbNodes, spareNbNodes; // neighbourhood table of the node being built, and memory recycled from merged nodes to build the next one
         std::stringstream eventStream;
 
         while( !priorityNodes.empty() || currentNodes.size() > 1 )
@@ -182,11 +182,11 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
 
 
                 // get nodes to join
-                WHnode* node2join1( fetchNode( priorityNodes.begin()->second, &leaves, &nodes ) );
+                WHnode* node2join1( fetchNode( priorityNodes.topID(), &leaves, &nodes ) );
                 protoNode* protoNode2join1( fetchProtoNode( node2join1->getFullID(), &protoLeaves, &protoNodes ) );
                 WHnode* node2join2( fetchNode( protoNode2join1->nearNb(), &leaves, &nodes ) );
                 protoNode* protoNode2join2( fetchProtoNode( node2join2->getFullID(), &protoLeaves, &protoNodes ) );
-                dist_t newDist( priorityNodes.begin()->first );
+                dist_t newDist( priorityNodes.topDist() );
                 size_t newID( nodes.size() );
                 size_t newSize( node2join1->getSize() + node2join2->getSize() );
                 size_t newHLevel( std::max( node2join1->getHLevel(), node2join2->getHLevel() ) + 1 );
@@ -286,7 +286,6 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
 
                 // initialize data members of new node object
                 std::pair< nodeID_t, dist_t > newNearNb( std::make_pair( false, 0 ), 999 );
-                std::map< nodeID_t, dist_t > newNbNodes;
                 bool newIsActive( newSize <= activeSize );
 
     // #pragma omp parallel sections
@@ -294,7 +293,7 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
     // #pragma omp parallel sections
                     {
                         // eliminate children entries from current and priority vectors
-                        priorityNodes.erase( priorityNodes.begin() );
+                        priorityNodes.pop();
                         if( node2join2->isNode() )
                         {
                             if (node2join2->getSize() > prioritySize )
@@ -303,13 +302,13 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
                             }
                             else
                             {
-                                priorityNodes.erase( priorityNodeIndex[node2join2->getID()] );
+                                priorityNodes.erase( node2join2->getFullID() );
                             }
 
                         }
                         else
                         {
-                            priorityNodes.erase( priorityLeafIndex[node2join2->getID()] );
+                            priorityNodes.erase( node2join2->getFullID() );
                         }
 
                         // update parent of joining nodes
@@ -317,13 +316,10 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
                         node2join2->setParent( std::make_pair( true, newID ) );
 
                         // start new protonode (merging nbhood tables)
-                        newNbNodes.insert( protoNode2join1->m_nbNodes.begin(), protoNode2join1->m_nbNodes.end() );
-                        newNbNodes.insert( protoNode2join2->m_nbNodes.begin(), protoNode2join2->m_nbNodes.end() );
-                        newNbNodes.erase( node2join1->getFullID() );
-                        newNbNodes.erase( node2join2->getFullID() );
-                        protoNode2join1->clearNbhood();
+                        newNbNodes.merge( protoNode2join1->m_nbNodes, protoNode2join2->m_nbNodes, node2join1->getFullID(), node2join2->getFullID() );
+                        protoNode2join1->clearNbhood( &spareNbNodes );
                         protoNode2join1->inactivate();
-                        protoNode2join2->clearNbhood();
+                        protoNode2join2->clearNbhood( &spareNbNodes );
                         protoNode2join2->inactivate();
                         maxNbs = std::max( maxNbs, newNbNodes.size() );
                     }
@@ -347,9 +343,7 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
                 #pragma omp parallel for schedule( static )
                 for( size_t i = 0; i < newNbNodes.size(); ++i )
                 {
-                    std::map< nodeID_t, dist_t >::iterator nbIter( newNbNodes.begin() );
-                    for( int j = 0; j < i; ++j )
-                        ++nbIter;
+                    nbTable::iterator nbIter( newNbNodes.begin() + i );
 
                     bool nbIsNode( nbIter->first.first );
                     size_t nbId( nbIter->first.second );
@@ -396,13 +390,11 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
                         {
                             if ( !nbIsNode )
                             {
-                                priorityNodes.erase( priorityLeafIndex[nbId] );
-                                priorityLeafIndex[nbId] = priorityNodes.insert( std::make_pair( newProtoNb->nearDist(), nbIter->first ) );
+                                priorityNodes.push( nbIter->first, newProtoNb->nearDist() );
                             }
                             else if( nodes[nbId].getSize() <= prioritySize )
                             {
-                                priorityNodes.erase( priorityNodeIndex[nbId] );
-                                priorityNodeIndex[nbId] = priorityNodes.insert( std::make_pair( newProtoNb->nearDist(), nbIter->first ) );
+                                priorityNodes.push( nbIter->first, newProtoNb->nearDist() );
                             }
 
                         }
@@ -417,11 +409,12 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
                 nodes.push_back( newNode );
 
                 // insert new protoNode object
-                protoNode newProtoNode( newNearNb, newNbNodes );
-                protoNodes.push_back( newProtoNode );
+                protoNodes.push_back( protoNode( newNearNb, nbTable() ) );
+                protoNodes.back().m_nbNodes.swap( newNbNodes );
+                newNbNodes.swap( spareNbNodes );
 
                 // if new node is isolated
-                if( ( newNbNodes.empty() ) )
+                if( ( protoNodes.back().m_nbNodes.empty() ) )
                 {
                     if( m_verbose && ( newSize != m_roi.size() ) )
                         std::cout << std::endl << "Node (1-" << newID << ") with " << newSize
@@ -481,7 +474,7 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
                     }
                     else
                     {
-                        priorityNodeIndex[newID] = priorityNodes.insert( std::make_pair( newNearNb.second, std::make_pair( true, newID ) ) );
+                        priorityNodes.push( std::make_pair( true, newID ), newNearNb.second );
                     }
                 }
 
@@ -522,11 +515,13 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
                     activeSize = protoLeaves.size();
                     prioritySize = protoLeaves.size();
                     baseNodes.clear();
-                    for( std::multimap< dist_t, nodeID_t >::iterator priorityIter( priorityNodes.begin() ); priorityIter != priorityNodes.end(); ++priorityIter )
+                    std::vector< nodeID_t > priorityIDs;
+                    priorityNodes.sortedIDs( &priorityIDs );
+                    for( size_t i = 0; i < priorityIDs.size(); ++i )
                     {
-                        if(priorityIter->second.first)
+                        if( priorityIDs[i].first )
                         {
-                            baseNodes.push_back(priorityIter->second.second);
+                            baseNodes.push_back( priorityIDs[i].second );
                         }
                     }
                     baseNodes.insert( baseNodes.end(), currentNodes.begin(), currentNodes.end() );
@@ -549,11 +544,13 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
                         growingStage = false;
                         prioritySize = protoLeaves.size();
                         activeSize = protoLeaves.size();
-                        for( std::multimap< dist_t, nodeID_t >::iterator priorityIter( priorityNodes.begin() ); priorityIter != priorityNodes.end(); )
+                        std::vector< nodeID_t > priorityIDs;
+                        priorityNodes.sortedIDs( &priorityIDs );
+                        for( size_t i = 0; i < priorityIDs.size(); ++i )
                         {
-                            if(priorityIter->second.first)
+                            if( priorityIDs[i].first )
                             {
-                                baseNodes.push_back(priorityIter->second.second);
+                                baseNodes.push_back( priorityIDs[i].second );
                             }
                         }
                         baseNodes.insert( baseNodes.end(), currentNodes.begin(), currentNodes.end() );
@@ -591,18 +588,20 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
                     }
                 }
                 //update nearest neighbors for nodes already in the priority list, save changed entries in a temporal list
-                std::list< std::pair< dist_t, nodeID_t > > tempPnodes;
-                for( std::multimap< dist_t, nodeID_t >::iterator priorityIter( priorityNodes.begin() ); priorityIter != priorityNodes.end(); )
+                std::vector< nodeID_t > priorityIDs;
+                priorityNodes.sortedIDs( &priorityIDs );
+                std::vector< std::pair< dist_t, nodeID_t > > tempPnodes;
+                for( size_t i = 0; i < priorityIDs.size(); ++i )
                 {
                     bool elementChanged( false );
-                    bool isNode( priorityIter->second.first );
-                    size_t thisNodeID(priorityIter->second.second );
+                    bool isNode( priorityIDs[i].first );
+                    size_t thisNodeID( priorityIDs[i].second );
                     if( isNode )
                     {
                         elementChanged = protoNodes[thisNodeID].updateActive( protoNodes );
                         if( elementChanged )
                         {
-                            tempPnodes.push_back( std::make_pair( protoNodes[thisNodeID].nearDist(), priorityIter->second ) );
+                            tempPnodes.push_back( std::make_pair( protoNodes[thisNodeID].nearDist(), priorityIDs[i] ) );
                         }
                     }
                     else
@@ -610,34 +609,15 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
                         elementChanged = protoLeaves[thisNodeID].updateActive( protoNodes );
                         if( elementChanged )
                         {
-                            tempPnodes.push_back( std::make_pair( protoLeaves[thisNodeID].nearDist(), priorityIter->second ) );
+                            tempPnodes.push_back( std::make_pair( protoLeaves[thisNodeID].nearDist(), priorityIDs[i] ) );
                         }
                     }
-                    // if the entry changed delete it
-                    if( elementChanged )
-                    {
-                        priorityNodes.erase( priorityIter++ );
-                    }
-                    else
-                    {
-                        ++priorityIter;
-                    }
                 }
-                //insert updated elements on the priority map
-                for( std::list< std::pair< dist_t, nodeID_t > >::const_iterator tempIter( tempPnodes.begin() ); tempIter != tempPnodes.end(); ++tempIter )
+                //update changed elements on the priority heap (as re-insertions, in their previous priority order)
+                for( size_t i = 0; i < tempPnodes.size(); ++i )
                 {
-                    bool isNode( tempIter->second.first );
-                    size_t thisNodeID(tempIter->second.second );
-                    if( isNode )
-                    {
-                        priorityNodeIndex[thisNodeID] = priorityNodes.insert( *tempIter );
-                    }
-                    else
-                    {
-                        priorityLeafIndex[thisNodeID] = priorityNodes.insert( *tempIter );
-                    }
+                    priorityNodes.push( tempPnodes[i].second, tempPnodes[i].first );
                 }
-                tempPnodes.clear();
                 //update nearest neighbors for nodes in the current list and move into the priority list if necessary
                 for( std::set< size_t >::const_iterator currentIter( currentNodes.begin() ); currentIter != currentNodes.end(); )
                 {
@@ -646,7 +626,7 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
                     protoNodes[*currentIter].updateActive( protoNodes );
                     if( thisSize <= prioritySize )
                     {
-                        priorityNodeIndex[*currentIter] = priorityNodes.insert( std::make_pair( protoNodes[*currentIter].nearDist(), std::make_pair( true, *currentIter) ) );
+                        priorityNodes.push( std::make_pair( true, *currentIter ), protoNodes[*currentIter].nearDist() );
                         currentNodes.erase( currentIter++ );
                     }
                     else
@@ -670,7 +650,7 @@ void randCnbTreeBuilder::buildRandCentroid( const unsigned int nbLevel, const fl
         if( !priorityNodes.empty() )
         {
             std::cerr << "WARNING @ treeBuildRand::buildCentroiRand(): after finish, supernode is not empty" << std::endl;
-            WHnode* leftNode( fetchNode( priorityNodes.begin()->second, &leaves, &nodes ) );
+            WHnode* leftNode( fetchNode( priorityNodes.topID(), &leaves, &nodes ) );
             std::cerr << "Node info: " << leftNode << std::endl;
             protoNode* leftProtoNode( fetchProtoNode( leftNode->getFullID(), &protoLeaves, &protoNodes ) );
             std::cerr << "Protonode info: " << leftProtoNode << std::endl;
@@ -1098,7 +1078,7 @@ std::list< WHcoord > randCnbTreeBuilder::initialize( const unsigned int nbLevel,
 
             //create a valid proto leaf
             std::pair< nodeID_t, dist_t > nearNb( std::make_pair( std::make_pair( false, 0 ), 999 ) );
-            std::map< nodeID_t, dist_t > nbNodes;
+            nbTable nbNodes;
             for( std::map< size_t, dist_t >::const_iterator fillIter = nbLeaves.begin(); fillIter != nbLeaves.end(); ++fillIter )
             {
                 nbNodes.insert( std::make_pair( std::make_pair( false, fillIter->first ), fillIter->second ) );
@@ -1113,7 +1093,7 @@ std::list< WHcoord > randCnbTreeBuilder::initialize( const unsigned int nbLevel,
         {
             //create discarded proto leaf
             std::pair< nodeID_t, dist_t > nearNbEmpty( std::make_pair( std::make_pair( false, 0 ), 1 ) );
-            std::map< nodeID_t, dist_t > nbNodesEmpty;
+            nbTable nbNodesEmpty;
             protoNode thisProtoLeaf( nearNbEmpty, nbNodesEmpty );
             thisProtoLeaf.discard();
             protoLeaves.push_back( thisProtoLeaf );
@@ -1172,13 +1152,14 @@ std::list< WHcoord > randCnbTreeBuilder::initialize( const unsigned int nbLevel,
         if( !protoLeaves[i].isDiscarded() )
         {
             protoLeaves[i].m_nearNb.first.second = lookuptable[protoLeaves[i].m_nearNb.first.second]; // near nb id
-            std::map< nodeID_t, dist_t > newNbs;
-            for( std::map< nodeID_t, dist_t >::iterator nbIter( protoLeaves[i].m_nbNodes.begin() ); nbIter
+            nbTable newNbs;
+            newNbs.reserve( protoLeaves[i].m_nbNodes.size() );
+            for( nbTable::iterator nbIter( protoLeaves[i].m_nbNodes.begin() ); nbIter
                             != protoLeaves[i].m_nbNodes.end(); ++nbIter )
             {
                 size_t nbNewID = ( lookuptable[nbIter->first.second] );
                 if( nbNewID != INVALID_PROTONODE )
-                    newNbs[std::make_pair( 0, nbNewID )] = nbIter->second;
+                    newNbs.set( std::make_pair( false, nbNewID ), nbIter->second );
             }
             protoLeaves[i].m_nbNodes.swap( newNbs );
         }
@@ -1269,7 +1250,7 @@ bool randCnbTreeBuilder::scanNbs( const size_t currentSeedID,
                 continue;
             }
 
-            std::map< nodeID_t, dist_t >::const_iterator searchIter( protoLeaves[thisNbID].m_nbNodes.find( std::make_pair( false,
+            nbTable::const_iterator searchIter( protoLeaves[thisNbID].m_nbNodes.find( std::make_pair( false,
                             currentSeedID ) ) );
             if( searchIter == protoLeaves[thisNbID].m_nbNodes.end() )
             {
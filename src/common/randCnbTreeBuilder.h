@@ -61,6 +61,7 @@
 #include "roiLoader.h"
 #include "WHtree.h"
 #include "protoNode.h"
+#include "nodeHeap.h"
 #include "fileManager.h"
 #include "cnbTreeBuilder.h"
 
@@ -0,0 +1,311 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#include <vector>
+
+#include "sparseTract.h"
+
+namespace
+{
+    // largest index gap that can be stored in a single entry
+    const size_t MAX_GAP( 65535 );
+}
+
+sparseTract::sparseTract( const compactTractChar &charTract ) :
+    m_size( charTract.m_tract.size() ), m_norm( charTract.m_norm ), m_thresholded( charTract.m_thresholded ),
+    m_normReady( charTract.m_normReady )
+{
+    const std::vector< unsigned char >& dense( charTract.m_tract );
+
+    size_t nonZeros( 0 );
+    for( size_t i = 0; i < dense.size(); ++i )
+    {
+        if( dense[i] != 0 )
+        {
+            ++nonZeros;
+        }
+    }
+    m_gaps.reserve( nonZeros );
+    m_values.reserve( nonZeros );
+
+    size_t lastPos( 0 );
+    for( size_t i = 0; i < dense.size(); ++i )
+    {
+        if( dense[i] == 0 )
+        {
+            continue;
+        }
+        size_t gap( i - lastPos );
+        // bridge long gaps with zero-valued entries, they do not contribute to any product
+        while( gap > MAX_GAP )
+        {
+            m_gaps.push_back( MAX_GAP );
+            m_values.push_back( 0 );
+            gap -= MAX_GAP;
+        }
+        m_gaps.push_back( gap );
+        m_values.push_back( dense[i] );
+        lastPos = i;
+    }
+} // end "sparseTract()" -----------------------------------------------------------------
+
+
+double sparseTract::tractDistance( const sparseTract &tractogram ) const
+{
+    return 1 - normDotProduct( tractogram );
+}
+double sparseTract::tractDistance( const compactTractChar &tractogram ) const
+{
+    return 1 - normDotProduct( tractogram );
+}
+double sparseTract::tractDistance( const compactTract &tractogram ) const
+{
+    return 1 - normDotProduct( tractogram );
+} // end "tractDistance()" -----------------------------------------------------------------
+
+
+double sparseTract::computeNorm()
+{
+    if( !this->m_thresholded )
+    {
+        std::cerr << "ERROR @ sparseTract::computeNorm(): tract has not been thresholded" << std::endl;
+        return 0;
+    }
+    uint64_t squareSum( 0 );
+    for( size_t i = 0; i < m_values.size(); ++i )
+    {
+        squareSum += m_values[i] * m_values[i];
+    }
+    m_norm = sqrt( static_cast< double >( squareSum ) );
+    m_normReady = true;
+    return m_norm;
+} // end "computeNorm()" -----------------------------------------------------------------
+
+
+size_t sparseTract::bytes() const
+{
+    return ( sizeof( *this ) + m_gaps.size() * sizeof( uint16_t ) + m_values.size() * sizeof( unsigned char ) ) * CHAR_BIT / 8.;
+}
+
+float sparseTract::mBytes() const
+{
+    return bytes() / ( 1024. * 1024. );
+}
+
+
+void sparseTract::steal( sparseTract* const stolen )
+{
+    m_gaps.swap( stolen->m_gaps );
+    m_values.swap( stolen->m_values );
+    m_size = stolen->m_size;
+    m_norm = stolen->m_norm;
+    m_thresholded = stolen->m_thresholded;
+    m_normReady = stolen->m_normReady;
+    return;
+} // end "steal()" -----------------------------------------------------------------
+
+
+void sparseTract::densify( compactTractChar* const charTractPointer ) const
+{
+    compactTractChar& charTract( *charTractPointer );
+    charTract.m_tract.assign( m_size, 0 );
+    size_t pos( 0 );
+    for( size_t i = 0; i < m_values.size(); ++i )
+    {
+        pos += m_gaps[i];
+        charTract.m_tract[pos] = m_values[i];
+    }
+    charTract.m_norm = m_norm;
+    charTract.m_thresholded = m_thresholded;
+    charTract.m_normReady = m_normReady;
+    return;
+} // end "densify()" -----------------------------------------------------------------
+
+
+// PRIVATE MEMBERS
+
+double sparseTract::checkOperand( const size_t size, const bool normReady, const bool thresholded, const double norm ) const
+{
+    if( m_size != size )
+    {
+        throw std::runtime_error( "ERROR @ sparseTract::normDotProduct(): Tractograms are not of the same size" );
+    }
+    else if( ( !m_normReady ) || ( !normReady ) )
+    {
+        throw std::runtime_error( "ERROR @ sparseTract::normDotProduct(): one (or both) of the tracts has no available precomputed norm" );
+    }
+    else if( ( !m_thresholded ) || ( !thresholded ) )
+    {
+        throw std::runtime_error( "ERROR @ sparseTract::normDotProduct(): one (or both) of the tracts has not been thresholded" );
+    }
+    else if( ( m_norm == 0. ) || ( norm == 0. ) )
+    {
+        std::cerr << "WARNING @ sparseTract::normDotProduct(): At least one of the tractograms is a zero vector, inner product will be set to 0"
+                  << std::endl;
+        return 0.;
+    }
+    return m_norm * norm;
+} // end "checkOperand()" -----------------------------------------------------------------
+
+
+// sparse x sparse: both entry lists are walked simultaneously, only coinciding positions contribute
+double sparseTract::normDotProduct( const sparseTract &tractogram ) const
+{
+    double normProduct( checkOperand( tractogram.m_size, tractogram.m_normReady, tractogram.m_thresholded, tractogram.m_norm ) );
+    if( normProduct == 0. )
+    {
+        return 0.;
+    }
+
+    uint64_t dotprod_sum( 0 );
+    const size_t size1( m_values.size() ), size2( tractogram.m_values.size() );
+    size_t i1( 0 ), i2( 0 );
+    size_t pos1( 0 ), pos2( 0 );
+    if( size1 != 0 && size2 != 0 )
+    {
+        pos1 = m_gaps[0];
+        pos2 = tractogram.m_gaps[0];
+        while( true )
+        {
+            if( pos1 < pos2 )
+            {
+                if( ++i1 == size1 )
+                {
+                    break;
+                }
+                pos1 += m_gaps[i1];
+            }
+            else if( pos2 < pos1 )
+            {
+                if( ++i2 == size2 )
+                {
+                    break;
+                }
+                pos2 += tractogram.m_gaps[i2];
+            }
+            else
+            {
+                dotprod_sum += m_values[i1] * tractogram.m_values[i2];
+                if( ++i1 == size1 || ++i2 == size2 )
+                {
+                    break;
+                }
+                pos1 += m_gaps[i1];
+                pos2 += tractogram.m_gaps[i2];
+            }
+        }
+    }
+    return clampProduct( dotprod_sum / normProduct );
+}
+// sparse x dense: only the stored positions are read from the dense vector
+double sparseTract::normDotProduct( const compactTractChar &tractogram ) const
+{
+    double normProduct( checkOperand( tractogram.m_tract.size(), tractogram.m_normReady, tractogram.m_thresholded, tractogram.m_norm ) );
+    if( normProduct == 0. )
+    {
+        return 0.;
+    }
+
+    uint64_t dotprod_sum( 0 );
+    const unsigned char* dense( &tractogram.m_tract.front() );
+    size_t pos( 0 );
+    for( size_t i = 0; i < m_values.size(); ++i )
+    {
+        pos += m_gaps[i];
+        dotprod_sum += m_values[i] * dense[pos];
+    }
+    return clampProduct( dotprod_sum / normProduct );
+}
+double sparseTract::normDotProduct( const compactTract &tractogram ) const
+{
+    if( !tractogram.m_inLogUnits )
+    {
+        throw std::runtime_error( "ERROR @ sparseTract::normDotProduct(): float tract is not in logaritmic units" );
+    }
+    double normProduct( checkOperand( tractogram.m_tract.size(), tractogram.m_normReady, tractogram.m_thresholded, tractogram.m_norm ) );
+    if( normProduct == 0. )
+    {
+        return 0.;
+    }
+
+    double dotprod_sum( 0 );
+    const float* dense( &tractogram.m_tract.front() );
+    size_t pos( 0 );
+    for( size_t i = 0; i < m_values.size(); ++i )
+    {
+        pos += m_gaps[i];
+        dotprod_sum += m_values[i] * dense[pos];
+    }
+    return clampProduct( dotprod_sum / normProduct );
+} // end "normDotProduct()" -----------------------------------------------------------------
+
+
+double sparseTract::clampProduct( double inProd ) const
+{
+    if( inProd < 0 )
+    {
+        if( inProd < -0.0001 )
+        {
+            std::cerr << std::endl << "WARNING @ sparseTract::normDotProduct(): Negative inner product (" << inProd << ")" << std::endl;
+        }
+        inProd = 0;
+    }
+    else if( inProd > 1 )
+    {
+        if( inProd > 1.0001 )
+        {
+            std::cerr << std::endl << "WARNING @ sparseTract::normDotProduct(): Bad inner product (" << inProd << ")" << std::endl;
+        }
+        inProd = 1;
+    }
+    return inProd;
+} // end "clampProduct()" -----------------------------------------------------------------
+
+
+// === NON-MEMBER OPERATORS ===
+
+std::ostream& operator <<( std::ostream& os, const sparseTract& object )
+{
+    const std::vector< unsigned char >& values( object.values() );
+    size_t counter0 ( 0 );
+    for( size_t i = 0; i < values.size() && counter0 < 15; ++i )
+    {
+        size_t datapoint( values[i] );
+        if( datapoint )
+        {
+            os << datapoint << " ";
+            ++counter0;
+        }
+    }
+    return os;
+} // end "operator << " -----------------------------------------------------------------
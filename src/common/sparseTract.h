@@ -0,0 +1,224 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#ifndef SPARSETRACT_H
+#define SPARSETRACT_H
+
+// std library
+#include <vector>
+#include <cmath>
+#include <stdexcept>
+#include <iostream>
+#include <climits>
+#include <stdint.h>
+
+#include "compactTract.h"
+#include "compactTractChar.h"
+
+/**
+ * This class stores a thresholded vector-compacted probabilistic tractogram in sparse 8-bit form.
+ * Only non-zero datapoints are kept, as pairs of (index gap to the previous stored datapoint, value).
+ * Gaps are stored as 16-bit integers, longer gaps are bridged with zero-valued padding entries.
+ * Thresholded tractograms are mostly empty, so both memory usage and dot product cost are reduced by the tractogram sparsity factor
+ * while the dissimilarity values obtained are identical to those from the equivalent compactTractChar object.
+ */
+class sparseTract
+{
+public:
+    /**
+     * Constructor
+     */
+    sparseTract() :
+        m_size( 0 ), m_norm( 0 ), m_thresholded( false ), m_normReady( false ) {}
+    /**
+     * \overload
+     * \param charTract the dense tractogram to take the data from (should have been thresholded)
+     */
+    explicit sparseTract( const compactTractChar &charTract );
+
+    //! Destructor
+    ~sparseTract() {}
+
+    // === IN-LINE MEMBER FUNCTIONS ===
+
+    /**
+     * returns the size of the equivalent dense compact tract vector
+     * \return tractogram size (number of voxels in the white matter)
+     */
+    inline size_t size() const { return m_size; }
+
+    /**
+     * returns the number of stored entries (non-zero datapoints plus padding entries)
+     * \return number of stored entries
+     */
+    inline size_t entries() const { return m_values.size(); }
+
+    /**
+     * returns the fraction of the dense tractogram size that is stored
+     * \return stored entries / dense size
+     */
+    inline float density() const { return ( m_size == 0 ) ? 0 : m_values.size() / static_cast< float >( m_size ); }
+
+    /**
+     * returns true if the tractogram vector norm has been precomputed and saved in the tract object
+     * \return norm ready boolean flag
+     */
+    inline bool normReady() const { return m_normReady; }
+
+    /**
+     * returns true if the tractogram vector data has been thresholded
+     * \return thresholded boolean flag
+     */
+    inline bool thresholded() const { return m_thresholded; }
+
+    /**
+     * saves a precomputed vector norm value in the tractogram object
+     * \param norm the norm data in double precision
+     */
+    inline void setNorm( double norm ) { m_norm = norm; m_normReady = true; }
+
+    /**
+     * returns the index gaps between consecutive stored entries (the first gap is the index of the first entry)
+     * \return a reference to the gap vector
+     */
+    inline const std::vector< uint16_t >& indexGaps() const { return m_gaps; }
+
+    /**
+     * returns the values of the stored entries
+     * \return a reference to the value vector
+     */
+    inline const std::vector< unsigned char >& values() const { return m_values; }
+
+    // === PUBLIC MEMBER FUNCTIONS ===
+
+    /**
+     * returns the total size of the sparseTract object in bytes (including the data vectors)
+     * \return size in bytes of a sparseTract object
+     */
+    size_t bytes() const;
+
+    /**
+     * returns the total size of the sparseTract object in megaBytes (including the data vectors)
+     * \return size in megaBytes of a sparseTract object
+     */
+    float mBytes() const;
+
+    /**
+     * swaps the tractogram memory from another tractogram object into this one and copies its data members
+     * \param stolen pointer to the tractogram object with the data to be "stolen"
+     */
+    void steal( sparseTract* const stolen );
+
+    /**
+     * expands the data into a dense 8-bit tractogram
+     * \param charTractPointer pointer to the compactTractChar object where to write the dense data
+     */
+    void densify( compactTractChar* const charTractPointer ) const;
+
+    /**
+     * computes the distance (dissimilarity) between this tract and a tract defined by the parameter, as 1 - normDotProduct()
+     * \param tractogram tractogram object to compute the distance to
+     * \return the distance value between the two tracts in double precision
+     */
+    double tractDistance( const sparseTract &tractogram ) const;
+    /**
+     * \overload
+     */
+    double tractDistance( const compactTractChar &tractogram ) const;
+    /**
+     * \overload
+     */
+    double tractDistance( const compactTract &tractogram ) const;
+
+    /**
+     * computes and returns the norm (rooted square-sum) of the tractogram and saves it in the tract object data member
+     * \return the tractogram norm value
+     */
+    double computeNorm();
+
+private:
+    // === PRIVATE DATA MEMBERS ===
+
+    std::vector< uint16_t > m_gaps;        //!< index gap of each stored entry to the previous one
+    std::vector< unsigned char > m_values; //!< value of each stored entry
+    size_t  m_size;         //!< size of the equivalent dense data vector
+    double  m_norm;         //!< norm of the data vector
+    bool    m_thresholded;  //!< thresholded flag (if true, data vector has been thresholded)
+    bool    m_normReady;    //!< norm ready flag (if true, norm has been precomputed and saved)
+
+    // === PRIVATE MEMBER FUNCTIONS ===
+
+    /**
+     * checks that the tractograms can be compared and returns the product of the norms
+     * \param size size of the other tractogram
+     * \param normReady norm ready flag of the other tractogram
+     * \param thresholded thresholded flag of the other tractogram
+     * \param norm norm of the other tractogram
+     * \return the product of both norms, 0 if one of the tractograms is a zero vector
+     */
+    double checkOperand( const size_t size, const bool normReady, const bool thresholded, const double norm ) const;
+
+    /**
+     * computes the normalized dot product between this tract and a tract defined by the parameter (tractograms must be thresholded).
+     * \param tractogram tractogram object to compute the norm. dot product with
+     * \return the norm. dot product value between the two tracts in double precision
+     */
+    double normDotProduct( const sparseTract &tractogram ) const;
+    /**
+     * \overload
+     */
+    double normDotProduct( const compactTractChar &tractogram ) const;
+    /**
+     * \overload
+     */
+    double normDotProduct( const compactTract &tractogram ) const;
+
+    /**
+     * clamps a normalized dot product value to the [0,1] range, warning if it is far off
+     * \param inProd the normalized dot product value
+     * \return the clamped value
+     */
+    double clampProduct( double inProd ) const;
+};
+
+// === NON-MEMBER OPERATORS ===
+
+/**
+ * << operator for the sparse tract class
+ * \param os output stream
+ * \param object tract to print out
+ * \return ostream with the tract information
+ */
+std::ostream& operator <<( std::ostream& os, const sparseTract& object );
+
+#endif  // SPARSETRACT_H
@@ -0,0 +1,785 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include "tractKernels.h"
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define TRACTKERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // number of elements accumulated in single precision vector lanes before flushing them to the double precision total
+    const size_t FLOAT_BLOCK( 4096 );
+
+    // number of elements accumulated in 32-bit integer lanes before flushing them to the 64-bit total.
+    // each lane receives at most 2*255*255 per step, with at least 16 elements per step the lanes stay far below 2^31
+    const size_t CHAR_BLOCK( 65536 );
+
+    typedef double ( *floatDot_t )( const float*, const float*, size_t );
+    typedef uint64_t ( *charDot_t )( const unsigned char*, const unsigned char*, size_t );
+    typedef double ( *mixedDot_t )( const float*, const unsigned char*, size_t );
+    typedef void ( *multAcc_t )( const unsigned char* const*, const uint32_t*, uint32_t*, size_t );
+    typedef double ( *mergeMeans_t )( const float*, bool, const float*, bool, float, float, float, float, float*, float*, size_t );
+
+    // constants of the log10 and 10^x approximations
+    const float SQRT2( 1.41421356f );
+    const float LN2( 0.693147181f );
+    const float LN10( 2.30258509f );
+    const float LOG10_E( 0.434294482f );
+    const float LOG2_10( 3.32192809f );
+    const float LOG10_2_HI( 0.301025390625f );      // log10(2) split in two parts so that n*LOG10_2_HI is exact for the exponents used
+    const float LOG10_2_LO( 4.60503898e-06f );
+    const float EXP10_MIN( -37.9f );                // 10^x stays within the normal float range
+    const float EXP10_MAX( 38.2f );
+    // odd series of ln(m) = 2*atanh(t), t = (m-1)/(m+1), |t| <= 0.172 for m in [sqrt(2)/2, sqrt(2)]
+    const float LOG_C3( 1.f / 3 );
+    const float LOG_C5( 1.f / 5 );
+    const float LOG_C7( 1.f / 7 );
+    const float LOG_C9( 1.f / 9 );
+    // taylor series of e^g for |g| <= ln(10)*log10(2)/2 (truncation error below 6e-9)
+    const float EXP_C2( 1.f / 2 );
+    const float EXP_C3( 1.f / 6 );
+    const float EXP_C4( 1.f / 24 );
+    const float EXP_C5( 1.f / 120 );
+    const float EXP_C6( 1.f / 720 );
+    const float EXP_C7( 1.f / 5040 );
+
+    // "mergeValue()": merge kernel step for a single value (scalar path and remainder of the vector paths), returns the log-unit value
+    inline float mergeValue( float value1, const bool exp1, float value2, const bool exp2, const float weight1, const float weight2,
+                             const float logFactor, const float invLogFactor, const float threshold, float* natValue )
+    {
+        if( exp1 && value1 != 0 )
+        {
+            value1 = tract_kernels::fastExp10( value1 * logFactor );
+        }
+        if( exp2 && value2 != 0 )
+        {
+            value2 = tract_kernels::fastExp10( value2 * logFactor );
+        }
+        const float mean( weight1 * value1 + weight2 * value2 );
+        *natValue = mean;
+        float logValue( mean );
+        if( logFactor != 0 && mean != 0 )
+        {
+            logValue = tract_kernels::fastLog10( mean ) * invLogFactor;
+        }
+        if( threshold != 0 && logValue < threshold )
+        {
+            logValue = 0;
+        }
+        return logValue;
+    }
+
+    /**
+     * set of kernel function pointers for one instruction set extension
+     */
+    struct kernelSet
+    {
+        floatDot_t floatDot;
+        charDot_t charDot;
+        mixedDot_t mixedDot;
+        multAcc_t multAcc;
+        mergeMeans_t merge;
+        const char* name;
+    };
+
+#ifdef TRACTKERNELS_X86
+
+    // === SSE4.1 ===
+
+    __attribute__(( target( "sse4.1" ) ))
+    double floatDotSse( const float* data1, const float* data2, size_t size )
+    {
+        double total( 0 );
+        const size_t vecEnd( size - ( size % 16 ) );
+        float lanes[4];
+        for( size_t blockStart = 0; blockStart < vecEnd; blockStart += FLOAT_BLOCK )
+        {
+            const size_t blockEnd( std::min( blockStart + FLOAT_BLOCK, vecEnd ) );
+            __m128 acc0( _mm_setzero_ps() ), acc1( _mm_setzero_ps() ), acc2( _mm_setzero_ps() ), acc3( _mm_setzero_ps() );
+            for( size_t i = blockStart; i < blockEnd; i += 16 )
+            {
+                acc0 = _mm_add_ps( acc0, _mm_mul_ps( _mm_loadu_ps( data1 + i ), _mm_loadu_ps( data2 + i ) ) );
+                acc1 = _mm_add_ps( acc1, _mm_mul_ps( _mm_loadu_ps( data1 + i + 4 ), _mm_loadu_ps( data2 + i + 4 ) ) );
+                acc2 = _mm_add_ps( acc2, _mm_mul_ps( _mm_loadu_ps( data1 + i + 8 ), _mm_loadu_ps( data2 + i + 8 ) ) );
+                acc3 = _mm_add_ps( acc3, _mm_mul_ps( _mm_loadu_ps( data1 + i + 12 ), _mm_loadu_ps( data2 + i + 12 ) ) );
+            }
+            _mm_storeu_ps( lanes, _mm_add_ps( _mm_add_ps( acc0, acc1 ), _mm_add_ps( acc2, acc3 ) ) );
+            total += ( double )lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+        for( size_t i = vecEnd; i < size; ++i )
+        {
+            total += data1[i] * data2[i];
+        }
+        return total;
+    }
+
+    __attribute__(( target( "sse4.1" ) ))
+    uint64_t charDotSse( const unsigned char* data1, const unsigned char* data2, size_t size )
+    {
+        uint64_t total( 0 );
+        const size_t vecEnd( size - ( size % 16 ) );
+        uint32_t lanes[4];
+        for( size_t blockStart = 0; blockStart < vecEnd; blockStart += CHAR_BLOCK )
+        {
+            const size_t blockEnd( std::min( blockStart + CHAR_BLOCK, vecEnd ) );
+            __m128i acc0( _mm_setzero_si128() ), acc1( _mm_setzero_si128() );
+            for( size_t i = blockStart; i < blockEnd; i += 16 )
+            {
+                __m128i a0( _mm_cvtepu8_epi16( _mm_loadl_epi64( ( const __m128i* )( data1 + i ) ) ) );
+                __m128i b0( _mm_cvtepu8_epi16( _mm_loadl_epi64( ( const __m128i* )( data2 + i ) ) ) );
+                __m128i a1( _mm_cvtepu8_epi16( _mm_loadl_epi64( ( const __m128i* )( data1 + i + 8 ) ) ) );
+                __m128i b1( _mm_cvtepu8_epi16( _mm_loadl_epi64( ( const __m128i* )( data2 + i + 8 ) ) ) );
+                acc0 = _mm_add_epi32( acc0, _mm_madd_epi16( a0, b0 ) );
+                acc1 = _mm_add_epi32( acc1, _mm_madd_epi16( a1, b1 ) );
+            }
+            _mm_storeu_si128( ( __m128i* )lanes, _mm_add_epi32( acc0, acc1 ) );
+            total += ( uint64_t )lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+        for( size_t i = vecEnd; i < size; ++i )
+        {
+            total += data1[i] * data2[i];
+        }
+        return total;
+    }
+
+    __attribute__(( target( "sse4.1" ) ))
+    double mixedDotSse( const float* data1, const unsigned char* data2, size_t size )
+    {
+        double total( 0 );
+        const size_t vecEnd( size - ( size % 8 ) );
+        float lanes[4];
+        int32_t packed[2];
+        for( size_t blockStart = 0; blockStart < vecEnd; blockStart += FLOAT_BLOCK )
+        {
+            const size_t blockEnd( std::min( blockStart + FLOAT_BLOCK, vecEnd ) );
+            __m128 acc0( _mm_setzero_ps() ), acc1( _mm_setzero_ps() );
+            for( size_t i = blockStart; i < blockEnd; i += 8 )
+            {
+                std::memcpy( packed, data2 + i, 8 );
+                __m128 c0( _mm_cvtepi32_ps( _mm_cvtepu8_epi32( _mm_cvtsi32_si128( packed[0] ) ) ) );
+                __m128 c1( _mm_cvtepi32_ps( _mm_cvtepu8_epi32( _mm_cvtsi32_si128( packed[1] ) ) ) );
+                acc0 = _mm_add_ps( acc0, _mm_mul_ps( _mm_loadu_ps( data1 + i ), c0 ) );
+                acc1 = _mm_add_ps( acc1, _mm_mul_ps( _mm_loadu_ps( data1 + i + 4 ), c1 ) );
+            }
+            _mm_storeu_ps( lanes, _mm_add_ps( acc0, acc1 ) );
+            total += ( double )lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+        for( size_t i = vecEnd; i < size; ++i )
+        {
+            total += data1[i] * ( double )data2[i];
+        }
+        return total;
+    }
+
+    __attribute__(( target( "sse4.1" ) ))
+    void multAccSse( const unsigned char* const* columns, const uint32_t* weights, uint32_t* accumulator, size_t size )
+    {
+        // 16-bit value pairs ( columns[0][j], columns[1][j] ) and ( columns[2][j], columns[3][j] ) are multiplied by the weight pairs with madd
+        const __m128i weights01( _mm_set1_epi32( ( int )( weights[0] | ( weights[1] << 16 ) ) ) );
+        const __m128i weights23( _mm_set1_epi32( ( int )( weights[2] | ( weights[3] << 16 ) ) ) );
+        const size_t vecEnd( size - ( size % 8 ) );
+        for( size_t j = 0; j < vecEnd; j += 8 )
+        {
+            __m128i c0( _mm_cvtepu8_epi16( _mm_loadl_epi64( ( const __m128i* )( columns[0] + j ) ) ) );
+            __m128i c1( _mm_cvtepu8_epi16( _mm_loadl_epi64( ( const __m128i* )( columns[1] + j ) ) ) );
+            __m128i c2( _mm_cvtepu8_epi16( _mm_loadl_epi64( ( const __m128i* )( columns[2] + j ) ) ) );
+            __m128i c3( _mm_cvtepu8_epi16( _mm_loadl_epi64( ( const __m128i* )( columns[3] + j ) ) ) );
+            __m128i low( _mm_add_epi32( _mm_madd_epi16( _mm_unpacklo_epi16( c0, c1 ), weights01 ),
+                                        _mm_madd_epi16( _mm_unpacklo_epi16( c2, c3 ), weights23 ) ) );
+            __m128i high( _mm_add_epi32( _mm_madd_epi16( _mm_unpackhi_epi16( c0, c1 ), weights01 ),
+                                         _mm_madd_epi16( _mm_unpackhi_epi16( c2, c3 ), weights23 ) ) );
+            __m128i* acc( ( __m128i* )( accumulator + j ) );
+            _mm_storeu_si128( acc, _mm_add_epi32( _mm_loadu_si128( acc ), low ) );
+            _mm_storeu_si128( acc + 1, _mm_add_epi32( _mm_loadu_si128( acc + 1 ), high ) );
+        }
+        for( size_t j = vecEnd; j < size; ++j )
+        {
+            accumulator[j] += weights[0] * columns[0][j] + weights[1] * columns[1][j] + weights[2] * columns[2][j] + weights[3] * columns[3][j];
+        }
+    }
+
+    // === AVX2 ===
+
+    __attribute__(( target( "avx2,fma" ) ))
+    double floatDotAvx2( const float* data1, const float* data2, size_t size )
+    {
+        double total( 0 );
+        const size_t vecEnd( size - ( size % 32 ) );
+        float lanes[8];
+        for( size_t blockStart = 0; blockStart < vecEnd; blockStart += FLOAT_BLOCK )
+        {
+            const size_t blockEnd( std::min( blockStart + FLOAT_BLOCK, vecEnd ) );
+            __m256 acc0( _mm256_setzero_ps() ), acc1( _mm256_setzero_ps() ), acc2( _mm256_setzero_ps() ), acc3( _mm256_setzero_ps() );
+            for( size_t i = blockStart; i < blockEnd; i += 32 )
+            {
+                acc0 = _mm256_fmadd_ps( _mm256_loadu_ps( data1 + i ), _mm256_loadu_ps( data2 + i ), acc0 );
+                acc1 = _mm256_fmadd_ps( _mm256_loadu_ps( data1 + i + 8 ), _mm256_loadu_ps( data2 + i + 8 ), acc1 );
+                acc2 = _mm256_fmadd_ps( _mm256_loadu_ps( data1 + i + 16 ), _mm256_loadu_ps( data2 + i + 16 ), acc2 );
+                acc3 = _mm256_fmadd_ps( _mm256_loadu_ps( data1 + i + 24 ), _mm256_loadu_ps( data2 + i + 24 ), acc3 );
+            }
+            _mm256_storeu_ps( lanes, _mm256_add_ps( _mm256_add_ps( acc0, acc1 ), _mm256_add_ps( acc2, acc3 ) ) );
+            for( size_t k = 0; k < 8; ++k )
+            {
+                total += lanes[k];
+            }
+        }
+        for( size_t i = vecEnd; i < size; ++i )
+        {
+            total += data1[i] * data2[i];
+        }
+        return total;
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    uint64_t charDotAvx2( const unsigned char* data1, const unsigned char* data2, size_t size )
+    {
+        uint64_t total( 0 );
+        const size_t vecEnd( size - ( size % 32 ) );
+        uint32_t lanes[8];
+        for( size_t blockStart = 0; blockStart < vecEnd; blockStart += CHAR_BLOCK )
+        {
+            const size_t blockEnd( std::min( blockStart + CHAR_BLOCK, vecEnd ) );
+            __m256i acc0( _mm256_setzero_si256() ), acc1( _mm256_setzero_si256() );
+            for( size_t i = blockStart; i < blockEnd; i += 32 )
+            {
+                __m256i a0( _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i* )( data1 + i ) ) ) );
+                __m256i b0( _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i* )( data2 + i ) ) ) );
+                __m256i a1( _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i* )( data1 + i + 16 ) ) ) );
+                __m256i b1( _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i* )( data2 + i + 16 ) ) ) );
+                acc0 = _mm256_add_epi32( acc0, _mm256_madd_epi16( a0, b0 ) );
+                acc1 = _mm256_add_epi32( acc1, _mm256_madd_epi16( a1, b1 ) );
+            }
+            _mm256_storeu_si256( ( __m256i* )lanes, _mm256_add_epi32( acc0, acc1 ) );
+            for( size_t k = 0; k < 8; ++k )
+            {
+                total += lanes[k];
+            }
+        }
+        for( size_t i = vecEnd; i < size; ++i )
+        {
+            total += data1[i] * data2[i];
+        }
+        return total;
+    }
+
+    __attribute__(( target( "avx2,fma" ) ))
+    double mixedDotAvx2( const float* data1, const unsigned char* data2, size_t size )
+    {
+        double total( 0 );
+        const size_t vecEnd( size - ( size % 16 ) );
+        float lanes[8];
+        for( size_t blockStart = 0; blockStart < vecEnd; blockStart += FLOAT_BLOCK )
+        {
+            const size_t blockEnd( std::min( blockStart + FLOAT_BLOCK, vecEnd ) );
+            __m256 acc0( _mm256_setzero_ps() ), acc1( _mm256_setzero_ps() );
+            for( size_t i = blockStart; i < blockEnd; i += 16 )
+            {
+                __m128i packed( _mm_loadu_si128( ( const __m128i* )( data2 + i ) ) );
+                __m256 c0( _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( packed ) ) );
+                __m256 c1( _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( _mm_srli_si128( packed, 8 ) ) ) );
+                acc0 = _mm256_fmadd_ps( _mm256_loadu_ps( data1 + i ), c0, acc0 );
+                acc1 = _mm256_fmadd_ps( _mm256_loadu_ps( data1 + i + 8 ), c1, acc1 );
+            }
+            _mm256_storeu_ps( lanes, _mm256_add_ps( acc0, acc1 ) );
+            for( size_t k = 0; k < 8; ++k )
+            {
+                total += lanes[k];
+            }
+        }
+        for( size_t i = vecEnd; i < size; ++i )
+        {
+            total += data1[i] * ( double )data2[i];
+        }
+        return total;
+    }
+
+    __attribute__(( target( "avx2" ) ))
+    void multAccAvx2( const unsigned char* const* columns, const uint32_t* weights, uint32_t* accumulator, size_t size )
+    {
+        // the 64-bit quarters of the widened values are reordered (0,2,1,3) so that the in-lane unpacks yield elements 0-7 and 8-15 in order
+        const __m256i weights01( _mm256_set1_epi32( ( int )( weights[0] | ( weights[1] << 16 ) ) ) );
+        const __m256i weights23( _mm256_set1_epi32( ( int )( weights[2] | ( weights[3] << 16 ) ) ) );
+        const size_t vecEnd( size - ( size % 16 ) );
+        for( size_t j = 0; j < vecEnd; j += 16 )
+        {
+            __m256i c0( _mm256_permute4x64_epi64( _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i* )( columns[0] + j ) ) ), 0xD8 ) );
+            __m256i c1( _mm256_permute4x64_epi64( _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i* )( columns[1] + j ) ) ), 0xD8 ) );
+            __m256i c2( _mm256_permute4x64_epi64( _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i* )( columns[2] + j ) ) ), 0xD8 ) );
+            __m256i c3( _mm256_permute4x64_epi64( _mm256_cvtepu8_epi16( _mm_loadu_si128( ( const __m128i* )( columns[3] + j ) ) ), 0xD8 ) );
+            __m256i low( _mm256_add_epi32( _mm256_madd_epi16( _mm256_unpacklo_epi16( c0, c1 ), weights01 ),
+                                           _mm256_madd_epi16( _mm256_unpacklo_epi16( c2, c3 ), weights23 ) ) );
+            __m256i high( _mm256_add_epi32( _mm256_madd_epi16( _mm256_unpackhi_epi16( c0, c1 ), weights01 ),
+                                            _mm256_madd_epi16( _mm256_unpackhi_epi16( c2, c3 ), weights23 ) ) );
+            __m256i* acc( ( __m256i* )( accumulator + j ) );
+            _mm256_storeu_si256( acc, _mm256_add_epi32( _mm256_loadu_si256( acc ), low ) );
+            _mm256_storeu_si256( acc + 1, _mm256_add_epi32( _mm256_loadu_si256( acc + 1 ), high ) );
+        }
+        for( size_t j = vecEnd; j < size; ++j )
+        {
+            accumulator[j] += weights[0] * columns[0][j] + weights[1] * columns[1][j] + weights[2] * columns[2][j] + weights[3] * columns[3][j];
+        }
+    }
+
+
+    __attribute__(( target( "avx2,fma" ) ))
+    inline __m256 fastExp10Avx2( __m256 value )
+    {
+        value = _mm256_min_ps( _mm256_max_ps( value, _mm256_set1_ps( EXP10_MIN ) ), _mm256_set1_ps( EXP10_MAX ) );
+        const __m256 n( _mm256_round_ps( _mm256_mul_ps( value, _mm256_set1_ps( LOG2_10 ) ), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ) );
+        const __m256 r( _mm256_fnmadd_ps( n, _mm256_set1_ps( LOG10_2_LO ), _mm256_fnmadd_ps( n, _mm256_set1_ps( LOG10_2_HI ), value ) ) );
+        const __m256 g( _mm256_mul_ps( r, _mm256_set1_ps( LN10 ) ) );
+        __m256 series( _mm256_fmadd_ps( _mm256_set1_ps( EXP_C7 ), g, _mm256_set1_ps( EXP_C6 ) ) );
+        series = _mm256_fmadd_ps( series, g, _mm256_set1_ps( EXP_C5 ) );
+        series = _mm256_fmadd_ps( series, g, _mm256_set1_ps( EXP_C4 ) );
+        series = _mm256_fmadd_ps( series, g, _mm256_set1_ps( EXP_C3 ) );
+        series = _mm256_fmadd_ps( series, g, _mm256_set1_ps( EXP_C2 ) );
+        series = _mm256_fmadd_ps( series, g, _mm256_set1_ps( 1.f ) );
+        series = _mm256_fmadd_ps( series, g, _mm256_set1_ps( 1.f ) );
+        const __m256i scale( _mm256_slli_epi32( _mm256_add_epi32( _mm256_cvtps_epi32( n ), _mm256_set1_epi32( 127 ) ), 23 ) );
+        return _mm256_mul_ps( series, _mm256_castsi256_ps( scale ) );
+    }
+
+    __attribute__(( target( "avx2,fma" ) ))
+    inline __m256 fastLog10Avx2( const __m256 value )
+    {
+        const __m256 one( _mm256_set1_ps( 1.f ) );
+        const __m256i bits( _mm256_castps_si256( value ) );
+        __m256 exponent( _mm256_cvtepi32_ps( _mm256_sub_epi32( _mm256_srli_epi32( bits, 23 ), _mm256_set1_epi32( 127 ) ) ) );
+        __m256 mantissa( _mm256_castsi256_ps( _mm256_or_si256( _mm256_and_si256( bits, _mm256_set1_epi32( 0x007fffff ) ), _mm256_set1_epi32( 0x3f800000 ) ) ) );
+        const __m256 large( _mm256_cmp_ps( mantissa, _mm256_set1_ps( SQRT2 ), _CMP_GT_OQ ) );
+        mantissa = _mm256_blendv_ps( mantissa, _mm256_mul_ps( mantissa, _mm256_set1_ps( 0.5f ) ), large );
+        exponent = _mm256_add_ps( exponent, _mm256_and_ps( large, one ) );
+        const __m256 t( _mm256_div_ps( _mm256_sub_ps( mantissa, one ), _mm256_add_ps( mantissa, one ) ) );
+        const __m256 t2( _mm256_mul_ps( t, t ) );
+        __m256 series( _mm256_fmadd_ps( _mm256_set1_ps( LOG_C9 ), t2, _mm256_set1_ps( LOG_C7 ) ) );
+        series = _mm256_fmadd_ps( series, t2, _mm256_set1_ps( LOG_C5 ) );
+        series = _mm256_fmadd_ps( series, t2, _mm256_set1_ps( LOG_C3 ) );
+        series = _mm256_fmadd_ps( series, t2, one );
+        const __m256 logE( _mm256_fmadd_ps( exponent, _mm256_set1_ps( LN2 ), _mm256_mul_ps( _mm256_add_ps( t, t ), series ) ) );
+        return _mm256_mul_ps( logE, _mm256_set1_ps( LOG10_E ) );
+    }
+
+    __attribute__(( target( "avx2,fma" ) ))
+    double mergeMeansAvx2( const float* data1, bool log1, const float* data2, bool log2, float weight1, float weight2,
+                           float logFactor, float threshold, float* natMean, float* logMean, size_t size )
+    {
+        const bool doLog( logFactor != 0 );
+        const bool exp1( log1 && doLog ), exp2( log2 && doLog ), doThreshold( threshold != 0 );
+        const float invLogFactor( doLog ? 1.f / logFactor : 1.f );
+        const __m256 zero( _mm256_setzero_ps() ), factor( _mm256_set1_ps( logFactor ) ), invFactor( _mm256_set1_ps( invLogFactor ) );
+        const __m256 w1( _mm256_set1_ps( weight1 ) ), w2( _mm256_set1_ps( weight2 ) ), thresholdValue( _mm256_set1_ps( threshold ) );
+        double total( 0 );
+        const size_t vecEnd( size - ( size % 8 ) );
+        float lanes[8];
+        for( size_t blockStart = 0; blockStart < vecEnd; blockStart += FLOAT_BLOCK )
+        {
+            const size_t blockEnd( std::min( blockStart + FLOAT_BLOCK, vecEnd ) );
+            __m256 acc( zero );
+            for( size_t i = blockStart; i < blockEnd; i += 8 )
+            {
+                __m256 value1( _mm256_loadu_ps( data1 + i ) ), value2( _mm256_loadu_ps( data2 + i ) );
+                if( exp1 )
+                {
+                    value1 = _mm256_blendv_ps( fastExp10Avx2( _mm256_mul_ps( value1, factor ) ), zero, _mm256_cmp_ps( value1, zero, _CMP_EQ_OQ ) );
+                }
+                if( exp2 )
+                {
+                    value2 = _mm256_blendv_ps( fastExp10Avx2( _mm256_mul_ps( value2, factor ) ), zero, _mm256_cmp_ps( value2, zero, _CMP_EQ_OQ ) );
+                }
+                const __m256 mean( _mm256_fmadd_ps( value1, w1, _mm256_mul_ps( value2, w2 ) ) );
+                _mm256_storeu_ps( natMean + i, mean );
+                __m256 logValue( mean );
+                if( doLog )
+                {
+                    logValue = _mm256_blendv_ps( _mm256_mul_ps( fastLog10Avx2( mean ), invFactor ), zero, _mm256_cmp_ps( mean, zero, _CMP_EQ_OQ ) );
+                }
+                if( doThreshold )
+                {
+                    logValue = _mm256_andnot_ps( _mm256_cmp_ps( logValue, thresholdValue, _CMP_LT_OQ ), logValue );
+                }
+                _mm256_storeu_ps( logMean + i, logValue );
+                acc = _mm256_fmadd_ps( logValue, logValue, acc );
+            }
+            _mm256_storeu_ps( lanes, acc );
+            for( size_t k = 0; k < 8; ++k )
+            {
+                total += lanes[k];
+            }
+        }
+        for( size_t i = vecEnd; i < size; ++i )
+        {
+            logMean[i] = mergeValue( data1[i], exp1, data2[i], exp2, weight1, weight2, logFactor, invLogFactor, threshold, natMean + i );
+            total += logMean[i] * logMean[i];
+        }
+        return total;
+    }
+
+    // === AVX-512 ===
+
+    __attribute__(( target( "avx512f" ) ))
+    double floatDotAvx512( const float* data1, const float* data2, size_t size )
+    {
+        double total( 0 );
+        const size_t vecEnd( size - ( size % 64 ) );
+        float lanes[16];
+        for( size_t blockStart = 0; blockStart < vecEnd; blockStart += FLOAT_BLOCK )
+        {
+            const size_t blockEnd( std::min( blockStart + FLOAT_BLOCK, vecEnd ) );
+            __m512 acc0( _mm512_setzero_ps() ), acc1( _mm512_setzero_ps() ), acc2( _mm512_setzero_ps() ), acc3( _mm512_setzero_ps() );
+            for( size_t i = blockStart; i < blockEnd; i += 64 )
+            {
+                acc0 = _mm512_fmadd_ps( _mm512_loadu_ps( data1 + i ), _mm512_loadu_ps( data2 + i ), acc0 );
+                acc1 = _mm512_fmadd_ps( _mm512_loadu_ps( data1 + i + 16 ), _mm512_loadu_ps( data2 + i + 16 ), acc1 );
+                acc2 = _mm512_fmadd_ps( _mm512_loadu_ps( data1 + i + 32 ), _mm512_loadu_ps( data2 + i + 32 ), acc2 );
+                acc3 = _mm512_fmadd_ps( _mm512_loadu_ps( data1 + i + 48 ), _mm512_loadu_ps( data2 + i + 48 ), acc3 );
+            }
+            _mm512_storeu_ps( lanes, _mm512_add_ps( _mm512_add_ps( acc0, acc1 ), _mm512_add_ps( acc2, acc3 ) ) );
+            for( size_t k = 0; k < 16; ++k )
+            {
+                total += lanes[k];
+            }
+        }
+        for( size_t i = vecEnd; i < size; ++i )
+        {
+            total += data1[i] * data2[i];
+        }
+        return total;
+    }
+
+    __attribute__(( target( "avx512f,avx512bw" ) ))
+    uint64_t charDotAvx512( const unsigned char* data1, const unsigned char* data2, size_t size )
+    {
+        uint64_t total( 0 );
+        const size_t vecEnd( size - ( size % 64 ) );
+        uint32_t lanes[16];
+        for( size_t blockStart = 0; blockStart < vecEnd; blockStart += CHAR_BLOCK )
+        {
+            const size_t blockEnd( std::min( blockStart + CHAR_BLOCK, vecEnd ) );
+            __m512i acc0( _mm512_setzero_si512() ), acc1( _mm512_setzero_si512() );
+            for( size_t i = blockStart; i < blockEnd; i += 64 )
+            {
+                __m512i a0( _mm512_cvtepu8_epi16( _mm256_loadu_si256( ( const __m256i* )( data1 + i ) ) ) );
+                __m512i b0( _mm512_cvtepu8_epi16( _mm256_loadu_si256( ( const __m256i* )( data2 + i ) ) ) );
+                __m512i a1( _mm512_cvtepu8_epi16( _mm256_loadu_si256( ( const __m256i* )( data1 + i + 32 ) ) ) );
+                __m512i b1( _mm512_cvtepu8_epi16( _mm256_loadu_si256( ( const __m256i* )( data2 + i + 32 ) ) ) );
+                acc0 = _mm512_add_epi32( acc0, _mm512_madd_epi16( a0, b0 ) );
+                acc1 = _mm512_add_epi32( acc1, _mm512_madd_epi16( a1, b1 ) );
+            }
+            _mm512_storeu_si512( lanes, _mm512_add_epi32( acc0, acc1 ) );
+            for( size_t k = 0; k < 16; ++k )
+            {
+                total += lanes[k];
+            }
+        }
+        for( size_t i = vecEnd; i < size; ++i )
+        {
+            total += data1[i] * data2[i];
+        }
+        return total;
+    }
+
+    __attribute__(( target( "avx512f" ) ))
+    double mixedDotAvx512( const float* data1, const unsigned char* data2, size_t size )
+    {
+        double total( 0 );
+        const size_t vecEnd( size - ( size % 32 ) );
+        float lanes[16];
+        for( size_t blockStart = 0; blockStart < vecEnd; blockStart += FLOAT_BLOCK )
+        {
+            const size_t blockEnd( std::min( blockStart + FLOAT_BLOCK, vecEnd ) );
+            __m512 acc0( _mm512_setzero_ps() ), acc1( _mm512_setzero_ps() );
+            for( size_t i = blockStart; i < blockEnd; i += 32 )
+            {
+                __m512 c0( _mm512_cvtepi32_ps( _mm512_cvtepu8_epi32( _mm_loadu_si128( ( const __m128i* )( data2 + i ) ) ) ) );
+                __m512 c1( _mm512_cvtepi32_ps( _mm512_cvtepu8_epi32( _mm_loadu_si128( ( const __m128i* )( data2 + i + 16 ) ) ) ) );
+                acc0 = _mm512_fmadd_ps( _mm512_loadu_ps( data1 + i ), c0, acc0 );
+                acc1 = _mm512_fmadd_ps( _mm512_loadu_ps( data1 + i + 16 ), c1, acc1 );
+            }
+            _mm512_storeu_ps( lanes, _mm512_add_ps( acc0, acc1 ) );
+            for( size_t k = 0; k < 16; ++k )
+            {
+                total += lanes[k];
+            }
+        }
+        for( size_t i = vecEnd; i < size; ++i )
+        {
+            total += data1[i] * ( double )data2[i];
+        }
+        return total;
+    }
+
+    __attribute__(( target( "avx512f,avx512bw" ) ))
+    void multAccAvx512( const unsigned char* const* columns, const uint32_t* weights, uint32_t* accumulator, size_t size )
+    {
+        // the 64-bit quarters of the widened values are reordered so that the in-lane unpacks yield elements 0-15 and 16-31 in order
+        const __m512i order( _mm512_set_epi64( 7, 3, 6, 2, 5, 1, 4, 0 ) );
+        const __m512i weights01( _mm512_set1_epi32( ( int )( weights[0] | ( weights[1] << 16 ) ) ) );
+        const __m512i weights23( _mm512_set1_epi32( ( int )( weights[2] | ( weights[3] << 16 ) ) ) );
+        const size_t vecEnd( size - ( size % 32 ) );
+        for( size_t j = 0; j < vecEnd; j += 32 )
+        {
+            __m512i c0( _mm512_permutexvar_epi64( order, _mm512_cvtepu8_epi16( _mm256_loadu_si256( ( const __m256i* )( columns[0] + j ) ) ) ) );
+            __m512i c1( _mm512_permutexvar_epi64( order, _mm512_cvtepu8_epi16( _mm256_loadu_si256( ( const __m256i* )( columns[1] + j ) ) ) ) );
+            __m512i c2( _mm512_permutexvar_epi64( order, _mm512_cvtepu8_epi16( _mm256_loadu_si256( ( const __m256i* )( columns[2] + j ) ) ) ) );
+            __m512i c3( _mm512_permutexvar_epi64( order, _mm512_cvtepu8_epi16( _mm256_loadu_si256( ( const __m256i* )( columns[3] + j ) ) ) ) );
+            __m512i low( _mm512_add_epi32( _mm512_madd_epi16( _mm512_unpacklo_epi16( c0, c1 ), weights01 ),
+                                           _mm512_madd_epi16( _mm512_unpacklo_epi16( c2, c3 ), weights23 ) ) );
+            __m512i high( _mm512_add_epi32( _mm512_madd_epi16( _mm512_unpackhi_epi16( c0, c1 ), weights01 ),
+                                            _mm512_madd_epi16( _mm512_unpackhi_epi16( c2, c3 ), weights23 ) ) );
+            _mm512_storeu_si512( accumulator + j, _mm512_add_epi32( _mm512_loadu_si512( accumulator + j ), low ) );
+            _mm512_storeu_si512( accumulator + j + 16, _mm512_add_epi32( _mm512_loadu_si512( accumulator + j + 16 ), high ) );
+        }
+        for( size_t j = vecEnd; j < size; ++j )
+        {
+            accumulator[j] += weights[0] * columns[0][j] + weights[1] * columns[1][j] + weights[2] * columns[2][j] + weights[3] * columns[3][j];
+        }
+    }
+
+    __attribute__(( target( "avx512f,avx512bw,avx512vnni" ) ))
+    void multAccAvx512Vnni( const unsigned char* const* columns, const uint32_t* weights, uint32_t* accumulator, size_t size )
+    {
+        // same as multAccAvx512() but with the fused 16-bit pair multiply-accumulate (vpdpwssd)
+        const __m512i order( _mm512_set_epi64( 7, 3, 6, 2, 5, 1, 4, 0 ) );
+        const __m512i weights01( _mm512_set1_epi32( ( int )( weights[0] | ( weights[1] << 16 ) ) ) );
+        const __m512i weights23( _mm512_set1_epi32( ( int )( weights[2] | ( weights[3] << 16 ) ) ) );
+        const size_t vecEnd( size - ( size % 32 ) );
+        for( size_t j = 0; j < vecEnd; j += 32 )
+        {
+            __m512i c0( _mm512_permutexvar_epi64( order, _mm512_cvtepu8_epi16( _mm256_loadu_si256( ( const __m256i* )( columns[0] + j ) ) ) ) );
+            __m512i c1( _mm512_permutexvar_epi64( order, _mm512_cvtepu8_epi16( _mm256_loadu_si256( ( const __m256i* )( columns[1] + j ) ) ) ) );
+            __m512i c2( _mm512_permutexvar_epi64( order, _mm512_cvtepu8_epi16( _mm256_loadu_si256( ( const __m256i* )( columns[2] + j ) ) ) ) );
+            __m512i c3( _mm512_permutexvar_epi64( order, _mm512_cvtepu8_epi16( _mm256_loadu_si256( ( const __m256i* )( columns[3] + j ) ) ) ) );
+            __m512i low( _mm512_loadu_si512( accumulator + j ) );
+            __m512i high( _mm512_loadu_si512( accumulator + j + 16 ) );
+            low = _mm512_dpwssd_epi32( _mm512_dpwssd_epi32( low, _mm512_unpacklo_epi16( c0, c1 ), weights01 ), _mm512_unpacklo_epi16( c2, c3 ), weights23 );
+            high = _mm512_dpwssd_epi32( _mm512_dpwssd_epi32( high, _mm512_unpackhi_epi16( c0, c1 ), weights01 ), _mm512_unpackhi_epi16( c2, c3 ), weights23 );
+            _mm512_storeu_si512( accumulator + j, low );
+            _mm512_storeu_si512( accumulator + j + 16, high );
+        }
+        for( size_t j = vecEnd; j < size; ++j )
+        {
+            accumulator[j] += weights[0] * columns[0][j] + weights[1] * columns[1][j] + weights[2] * columns[2][j] + weights[3] * columns[3][j];
+        }
+    }
+
+#endif // TRACTKERNELS_X86
+
+    // "selectKernels()": picks the fastest kernel set supported by the running CPU
+    kernelSet selectKernels()
+    {
+        kernelSet kernels;
+        kernels.floatDot = &tract_kernels::dotProductScalar;
+        kernels.charDot = &tract_kernels::dotProductScalar;
+        kernels.mixedDot = &tract_kernels::dotProductScalar;
+        kernels.multAcc = &tract_kernels::multiplyAccumulateScalar;
+        kernels.merge = &tract_kernels::mergeMeansScalar;
+        kernels.name = "scalar";
+
+#ifdef TRACTKERNELS_X86
+        __builtin_cpu_init();
+        if( __builtin_cpu_supports( "avx512f" ) && __builtin_cpu_supports( "avx512bw" ) )
+        {
+            kernels.floatDot = &floatDotAvx512;
+            kernels.charDot = &charDotAvx512;
+            kernels.mixedDot = &mixedDotAvx512;
+            kernels.multAcc = &multAccAvx512;
+            kernels.merge = &mergeMeansAvx2; // the merge kernel is bound by the transcendental approximations, 256-bit lanes are used
+            kernels.name = "avx512";
+            if( __builtin_cpu_supports( "avx512vnni" ) )
+            {
+                kernels.multAcc = &multAccAvx512Vnni;
+                kernels.name = "avx512vnni";
+            }
+        }
+        else if( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) )
+        {
+            kernels.floatDot = &floatDotAvx2;
+            kernels.charDot = &charDotAvx2;
+            kernels.mixedDot = &mixedDotAvx2;
+            kernels.multAcc = &multAccAvx2;
+            kernels.merge = &mergeMeansAvx2;
+            kernels.name = "avx2";
+        }
+        else if( __builtin_cpu_supports( "sse4.1" ) )
+        {
+            kernels.floatDot = &floatDotSse;
+            kernels.charDot = &charDotSse;
+            kernels.mixedDot = &mixedDotSse;
+            kernels.multAcc = &multAccSse;
+            kernels.name = "sse4.1";
+        }
+#endif
+        return kernels;
+    }
+
+    // "activeKernels()": returns the kernel set selected for this CPU (selection is done only once, on first call)
+    const kernelSet& activeKernels()
+    {
+        static const kernelSet kernels( selectKernels() );
+        return kernels;
+    }
+}
+
+
+double tract_kernels::dotProduct( const float* data1, const float* data2, size_t size )
+{
+    return activeKernels().floatDot( data1, data2, size );
+}
+uint64_t tract_kernels::dotProduct( const unsigned char* data1, const unsigned char* data2, size_t size )
+{
+    return activeKernels().charDot( data1, data2, size );
+}
+double tract_kernels::dotProduct( const float* data1, const unsigned char* data2, size_t size )
+{
+    return activeKernels().mixedDot( data1, data2, size );
+} // end "dotProduct()" -----------------------------------------------------------------
+
+
+void tract_kernels::multiplyAccumulate( const unsigned char* const columns[4], const uint32_t weights[4], uint32_t* accumulator, size_t size )
+{
+    activeKernels().multAcc( columns, weights, accumulator, size );
+} // end "multiplyAccumulate()" -----------------------------------------------------------------
+
+
+double tract_kernels::mergeMeans( const float* data1, bool log1, const float* data2, bool log2, float weight1, float weight2,
+                                  float logFactor, float threshold, float* natMean, float* logMean, size_t size )
+{
+    return activeKernels().merge( data1, log1, data2, log2, weight1, weight2, logFactor, threshold, natMean, logMean, size );
+} // end "mergeMeans()" -----------------------------------------------------------------
+
+
+double tract_kernels::logThreshold( float* data, float logFactor, float threshold, float* logData, size_t size )
+{
+    // a unit-weight mean of the tract with itself (weight1 * x + 0 * x) is exactly x, so the log step runs on the same values as in the merge
+    return activeKernels().merge( data, false, data, false, 1.f, 0.f, logFactor, threshold, data, logData, size );
+} // end "logThreshold()" -----------------------------------------------------------------
+
+
+double tract_kernels::dotProductScalar( const float* data1, const float* data2, size_t size )
+{
+    double total( 0 );
+    for( size_t i = 0; i < size; ++i )
+    {
+        total += data1[i] * data2[i];
+    }
+    return total;
+}
+uint64_t tract_kernels::dotProductScalar( const unsigned char* data1, const unsigned char* data2, size_t size )
+{
+    uint64_t total( 0 );
+    for( size_t i = 0; i < size; ++i )
+    {
+        total += data1[i] * data2[i];
+    }
+    return total;
+}
+double tract_kernels::dotProductScalar( const float* data1, const unsigned char* data2, size_t size )
+{
+    double total( 0 );
+    for( size_t i = 0; i < size; ++i )
+    {
+        total += data1[i] * ( double )data2[i];
+    }
+    return total;
+} // end "dotProductScalar()" -----------------------------------------------------------------
+
+
+void tract_kernels::multiplyAccumulateScalar( const unsigned char* const columns[4], const uint32_t weights[4], uint32_t* accumulator, size_t size )
+{
+    for( size_t j = 0; j < size; ++j )
+    {
+        accumulator[j] += weights[0] * columns[0][j] + weights[1] * columns[1][j] + weights[2] * columns[2][j] + weights[3] * columns[3][j];
+    }
+} // end "multiplyAccumulateScalar()" -----------------------------------------------------------------
+
+
+double tract_kernels::mergeMeansScalar( const float* data1, bool log1, const float* data2, bool log2, float weight1, float weight2,
+                                        float logFactor, float threshold, float* natMean, float* logMean, size_t size )
+{
+    const bool exp1( log1 && logFactor != 0 ), exp2( log2 && logFactor != 0 );
+    const float invLogFactor( logFactor != 0 ? 1.f / logFactor : 1.f );
+    double total( 0 );
+    for( size_t i = 0; i < size; ++i )
+    {
+        logMean[i] = mergeValue( data1[i], exp1, data2[i], exp2, weight1, weight2, logFactor, invLogFactor, threshold, natMean + i );
+        total += logMean[i] * logMean[i];
+    }
+    return total;
+} // end "mergeMeansScalar()" -----------------------------------------------------------------
+
+
+float tract_kernels::fastLog10( float value )
+{
+    uint32_t bits;
+    std::memcpy( &bits, &value, sizeof( bits ) );
+    float exponent( static_cast< int >( bits >> 23 ) - 127 );
+    bits = ( bits & 0x007fffff ) | 0x3f800000;
+    float mantissa;
+    std::memcpy( &mantissa, &bits, sizeof( mantissa ) );
+    if( mantissa > SQRT2 )
+    {
+        mantissa *= 0.5f;
+        exponent += 1;
+    }
+    const float t( ( mantissa - 1.f ) / ( mantissa + 1.f ) );
+    const float t2( t * t );
+    const float series( 1.f + t2 * ( LOG_C3 + t2 * ( LOG_C5 + t2 * ( LOG_C7 + t2 * LOG_C9 ) ) ) );
+    return ( exponent * LN2 + 2.f * t * series ) * LOG10_E;
+} // end "fastLog10()" -----------------------------------------------------------------
+
+
+float tract_kernels::fastExp10( float value )
+{
+    value = std::min( std::max( value, EXP10_MIN ), EXP10_MAX );
+    const float n( std::floor( value * LOG2_10 + 0.5f ) );
+    const float r( ( value - n * LOG10_2_HI ) - n * LOG10_2_LO );
+    const float g( r * LN10 );
+    const float series( 1.f + g * ( 1.f + g * ( EXP_C2 + g * ( EXP_C3 + g * ( EXP_C4 + g * ( EXP_C5 + g * ( EXP_C6 + g * EXP_C7 ) ) ) ) ) ) );
+    const uint32_t bits( static_cast< uint32_t >( static_cast< int >( n ) + 127 ) << 23 );
+    float scale;
+    std::memcpy( &scale, &bits, sizeof( scale ) );
+    return series * scale;
+} // end "fastExp10()" -----------------------------------------------------------------
+
+
+std::string tract_kernels::activeInstructionSet()
+{
+    return activeKernels().name;
+} // end "activeInstructionSet()" -----------------------------------------------------------------
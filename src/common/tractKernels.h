@@ -0,0 +1,173 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#ifndef TRACTKERNELS_H
+#define TRACTKERNELS_H
+
+// std library
+#include <cstddef>
+#include <string>
+#include <stdint.h>
+
+/**
+ * Low-level arithmetic kernels on raw tractogram data (float and 8-bit representations).
+ * The dot products are the innermost loop of every tractogram distance computation, so explicit SIMD versions (SSE4.1, AVX2 and AVX-512)
+ * are implemented alongside the plain scalar loops. The fastest path supported by the running CPU is selected once at program start.
+ * Float products are accumulated in single precision inside short blocks and flushed to a double precision total after each block,
+ * 8-bit products are accumulated exactly in integer arithmetic.
+ * The 8-bit multiply-accumulate kernel is the building block of the tiled set x set product used for distance matrix blocks.
+ * The merge kernel fuses all the per-value steps of joining two cluster tractograms into a single pass, using polynomial approximations
+ * of log10 and 10^x (relative error below 4e-7, i.e. a few float ulps) instead of the libm functions.
+ */
+namespace tract_kernels
+{
+    /**
+     * computes the dot product of two float vectors
+     * \param data1 pointer to the first element of the first vector
+     * \param data2 pointer to the first element of the second vector
+     * \param size number of elements in each vector
+     * \return the dot product in double precision
+     */
+    double dotProduct( const float* data1, const float* data2, size_t size );
+
+    /**
+     * computes the dot product of two 8-bit vectors (exact integer result)
+     * \param data1 pointer to the first element of the first vector
+     * \param data2 pointer to the first element of the second vector
+     * \param size number of elements in each vector
+     * \return the dot product as an unsigned 64-bit integer
+     */
+    uint64_t dotProduct( const unsigned char* data1, const unsigned char* data2, size_t size );
+
+    /**
+     * computes the dot product of a float vector with a raw (not rescaled) 8-bit vector
+     * \param data1 pointer to the first element of the float vector
+     * \param data2 pointer to the first element of the 8-bit vector
+     * \param size number of elements in each vector
+     * \return the dot product in double precision
+     */
+    double dotProduct( const float* data1, const unsigned char* data2, size_t size );
+
+    /**
+     * multiply-accumulate of four 8-bit vectors into a 32-bit integer accumulator: accumulator[j] += sum_q( weights[q] * columns[q][j] ).
+     * this is the micro-kernel of the blocked row-set x column-set product, where each column vector is a row of a transposed tractogram set
+     * and each weight is a value of a row tractogram. Weights must not exceed 255, so every call adds at most 4*255*255 to each accumulator element;
+     * the caller is responsible for flushing the accumulator before it can overflow (see MAC_FLUSH_CALLS).
+     * \param columns pointers to the first element of each of the four 8-bit vectors
+     * \param weights the four multiplying weights (0-255), a zero weight is allowed for unused slots
+     * \param accumulator pointer to the first element of the accumulator vector
+     * \param size number of elements in each vector
+     */
+    void multiplyAccumulate( const unsigned char* const columns[4], const uint32_t weights[4], uint32_t* accumulator, size_t size );
+
+    //! maximum number of consecutive multiplyAccumulate() calls on the same accumulator before its values must be flushed (stays below 2^31)
+    const size_t MAC_FLUSH_CALLS( 8192 );
+
+    /**
+     * computes in one pass the weighted mean of two tractograms in natural units and its log-transformed and thresholded form:
+     * natMean[i] = weight1 * nat(data1[i]) + weight2 * nat(data2[i]), where nat(x) is x for natural-unit input and 10^(x*logFactor) for log-unit input (zeros are kept),
+     * logMean[i] = log10(natMean[i]) / logFactor (zeros are kept, no transform if logFactor is 0), set to 0 if below threshold (unless threshold is 0)
+     * \param data1 pointer to the first element of the first tractogram (unthresholded)
+     * \param log1 true if the first tractogram is in logarithmic units
+     * \param data2 pointer to the first element of the second tractogram (unthresholded)
+     * \param log2 true if the second tractogram is in logarithmic units
+     * \param weight1 weight of the first tractogram in the mean
+     * \param weight2 weight of the second tractogram in the mean
+     * \param logFactor normalization-related factor between natural and logarithmic units, 0 if no logarithmic normalization is used
+     * \param threshold threshold for the log-unit values
+     * \param natMean pointer to the first element of the output natural-unit mean (may be one of the input arrays if that input is in natural units)
+     * \param logMean pointer to the first element of the output log-unit thresholded mean
+     * \param size number of elements in each vector
+     * \return the squared norm of the log-unit thresholded mean, in double precision
+     */
+    double mergeMeans( const float* data1, bool log1, const float* data2, bool log2, float weight1, float weight2,
+                       float logFactor, float threshold, float* natMean, float* logMean, size_t size );
+
+    /**
+     * log-transforms and thresholds a tractogram in natural units with the merge kernel:
+     * logData[i] = log10(data[i]) / logFactor (zeros are kept, no transform if logFactor is 0), set to 0 if below threshold (unless threshold is 0).
+     * The values and the squared norm are bit-identical to the log-unit output of mergeMeans() for the natural-unit mean it returned
+     * \param data pointer to the first element of the tractogram in natural units (passed through the kernel, values are rewritten unchanged)
+     * \param logFactor normalization-related factor between natural and logarithmic units, 0 if no logarithmic normalization is used
+     * \param threshold threshold for the log-unit values
+     * \param logData pointer to the first element of the output log-unit thresholded tractogram
+     * \param size number of elements in each vector
+     * \return the squared norm of the log-unit thresholded tractogram, in double precision
+     */
+    double logThreshold( float* data, float logFactor, float threshold, float* logData, size_t size );
+
+    /**
+     * scalar reference implementations of the dot product kernels, used as fallback when no SIMD extension is available
+     */
+    double dotProductScalar( const float* data1, const float* data2, size_t size );
+    /**
+     * \overload
+     */
+    uint64_t dotProductScalar( const unsigned char* data1, const unsigned char* data2, size_t size );
+    /**
+     * \overload
+     */
+    double dotProductScalar( const float* data1, const unsigned char* data2, size_t size );
+    /**
+     * scalar reference implementation of the multiply-accumulate kernel
+     */
+    void multiplyAccumulateScalar( const unsigned char* const columns[4], const uint32_t weights[4], uint32_t* accumulator, size_t size );
+    /**
+     * scalar implementation of the merge kernel
+     */
+    double mergeMeansScalar( const float* data1, bool log1, const float* data2, bool log2, float weight1, float weight2,
+                             float logFactor, float threshold, float* natMean, float* logMean, size_t size );
+
+    /**
+     * fast approximation of log10(x) for positive normal floats, relative error below 4e-7 (absolute error below 1e-7 close to x=1)
+     * \param value the argument
+     * \return the base-10 logarithm
+     */
+    float fastLog10( float value );
+
+    /**
+     * fast approximation of 10^x for x within [-37,38], relative error below 4e-7
+     * \param value the exponent
+     * \return 10 raised to the exponent
+     */
+    float fastExp10( float value );
+
+    /**
+     * returns the name of the instruction set extension selected at runtime for the kernels
+     * \return "avx512vnni", "avx512", "avx2", "sse4.1" or "scalar"
+     */
+    std::string activeInstructionSet();
+
+} // end of namespace
+
+#endif  // TRACTKERNELS_H
@@ -0,0 +1,298 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+// parallel execution
+#include <omp.h>
+
+#include "tractSetPipeline.h"
+#include "distMatComputer.h"
+
+
+tractSetPipeline::tractSetPipeline( const distMatComputer& computer, const std::vector< tractSetJob >& jobs, const size_t depth, const size_t cacheBytes ):
+    m_computer( computer ), m_jobs( jobs ), m_cacheBytes( cacheBytes ), m_cacheUsedBytes( 0 ), m_depth( depth ), m_started( 0 ), m_taken( 0 ),
+    m_requestedTracts( 0 ), m_readTracts( 0 ), m_stop( false ), m_waitSeconds( 0 )
+{
+    if( m_depth < 1 )
+    {
+        m_depth = 1;
+    }
+    m_results.resize( m_jobs.size() );
+    m_done.assign( m_jobs.size(), false );
+
+    // find for each job the next one requesting the same seed range
+    m_nextUse.assign( m_jobs.size(), NO_NEXT_USE );
+    std::map< rangeKey_t, size_t > lastSeen;
+    for( size_t i = m_jobs.size(); i > 0; --i )
+    {
+        const rangeKey_t key( m_jobs[i-1].firstID, m_jobs[i-1].postLastID );
+        std::map< rangeKey_t, size_t >::iterator lastIter( lastSeen.find( key ) );
+        if( lastIter != lastSeen.end() )
+        {
+            m_nextUse[i-1] = lastIter->second;
+            lastIter->second = i-1;
+        }
+        else
+        {
+            lastSeen.insert( std::make_pair( key, i-1 ) );
+        }
+        m_requestedTracts += m_jobs[i-1].postLastID - m_jobs[i-1].firstID;
+    }
+
+    for( size_t i = 1; i < m_depth; ++i )
+    {
+        m_ioThreads.create_thread( boost::bind( &tractSetPipeline::ioLoop, this ) );
+    }
+} // end "tractSetPipeline()" -----------------------------------------------------------------
+
+
+tractSetPipeline::~tractSetPipeline()
+{
+    {
+        boost::unique_lock< boost::mutex > lock( m_mutex );
+        m_stop = true;
+    }
+    m_changed.notify_all();
+    m_ioThreads.join_all();
+} // end "~tractSetPipeline()" -----------------------------------------------------------------
+
+
+boost::shared_ptr< const tractSet > tractSetPipeline::next( const tractSetJob& expectedJob )
+{
+    if( m_taken >= m_jobs.size() )
+    {
+        throw std::runtime_error( "ERROR @ tractSetPipeline::next(): all scheduled sets have already been taken" );
+    }
+    const tractSetJob& job( m_jobs[m_taken] );
+    if( job.firstID != expectedJob.firstID || job.postLastID != expectedJob.postLastID || job.transposed != expectedJob.transposed )
+    {
+        throw std::runtime_error( "ERROR @ tractSetPipeline::next(): requested set does not match the load schedule" );
+    }
+
+    double waitStart( omp_get_wtime() );
+    boost::shared_ptr< tractSet > result;
+
+    if( m_depth == 1 )
+    {
+        // no prefetching, prepare on demand
+        result = execute( m_taken );
+        ++m_taken;
+    }
+    else
+    {
+        {
+            boost::unique_lock< boost::mutex > lock( m_mutex );
+            while( !m_done[m_taken] && m_error.empty() )
+            {
+                m_changed.wait( lock );
+            }
+            if( !m_error.empty() )
+            {
+                throw std::runtime_error( m_error );
+            }
+            result.swap( m_results[m_taken] );
+            ++m_taken;
+        }
+        m_changed.notify_all();
+    }
+
+    m_waitSeconds += omp_get_wtime() - waitStart;
+    return result;
+} // end "next()" -----------------------------------------------------------------
+
+
+void tractSetPipeline::ioLoop()
+{
+    while( true )
+    {
+        size_t jobID( 0 );
+        {
+            boost::unique_lock< boost::mutex > lock( m_mutex );
+            // wait until there is a free buffer slot
+            while( !m_stop && m_started < m_jobs.size() && m_started >= m_taken + m_depth - 1 )
+            {
+                m_changed.wait( lock );
+            }
+            if( m_stop || m_started >= m_jobs.size() )
+            {
+                return;
+            }
+            jobID = m_started++;
+        }
+
+        boost::shared_ptr< tractSet > result;
+        std::string error;
+        try
+        {
+            result = execute( jobID );
+        }
+        catch( const std::exception& except )
+        {
+            error = except.what();
+        }
+
+        {
+            boost::unique_lock< boost::mutex > lock( m_mutex );
+            m_results[jobID] = result;
+            m_done[jobID] = true;
+            if( !error.empty() && m_error.empty() )
+            {
+                m_error = error;
+            }
+        }
+        m_changed.notify_all();
+    }
+} // end "ioLoop()" -----------------------------------------------------------------
+
+
+boost::shared_ptr< tractSet > tractSetPipeline::execute( const size_t jobID )
+{
+    const tractSetJob& job( m_jobs[jobID] );
+    const rangeKey_t key( job.firstID, job.postLastID );
+    boost::shared_ptr< tractSet > sparse;
+
+    {
+        boost::unique_lock< boost::mutex > lock( m_mutex );
+        while( true )
+        {
+            std::map< rangeKey_t, cacheEntry >::iterator cacheIter( m_cache.find( key ) );
+            if( cacheIter == m_cache.end() )
+            {
+                // not cached: insert an empty entry (so that later jobs wait for this one instead of reading the set again) and read it
+                cacheEntry entry;
+                entry.bytes = 0;
+                entry.nextUse = jobID;
+                m_cache.insert( std::make_pair( key, entry ) );
+                break;
+            }
+            if( cacheIter->second.sparse )
+            {
+                sparse = cacheIter->second.sparse;
+                break;
+            }
+            if( m_stop || !m_error.empty() )
+            {
+                throw std::runtime_error( "ERROR @ tractSetPipeline::execute(): pipeline stopped while waiting for a set being read" );
+            }
+            m_changed.wait( lock );
+        }
+    }
+
+    if( !sparse )
+    {
+        boost::shared_ptr< tractSet > loaded( new tractSet );
+        loaded->firstID = job.firstID;
+        loaded->postLastID = job.postLastID;
+        loaded->transposed = false;
+        try
+        {
+            m_computer.loadTractSet( job.firstID, job.postLastID, &loaded->sparseSet );
+        }
+        catch( ... )
+        {
+            {
+                boost::unique_lock< boost::mutex > lock( m_mutex );
+                m_cache.erase( key );
+            }
+            m_changed.notify_all();
+            throw;
+        }
+        size_t setBytes( sizeof( tractSet ) );
+        for( size_t i = 0; i < loaded->sparseSet.size(); ++i )
+        {
+            setBytes += loaded->sparseSet[i].bytes();
+        }
+        {
+            boost::unique_lock< boost::mutex > lock( m_mutex );
+            cacheEntry& entry( m_cache[key] );
+            entry.sparse = loaded;
+            entry.bytes = setBytes;
+            m_cacheUsedBytes += setBytes;
+            m_readTracts += job.postLastID - job.firstID;
+        }
+        m_changed.notify_all();
+        sparse = loaded;
+    }
+
+    boost::shared_ptr< tractSet > result( sparse );
+    if( job.transposed )
+    {
+        result.reset( new tractSet );
+        result->firstID = job.firstID;
+        result->postLastID = job.postLastID;
+        result->transposed = true;
+        m_computer.transposeSet( sparse->sparseSet, &result->denseSet );
+    }
+
+    {
+        boost::unique_lock< boost::mutex > lock( m_mutex );
+        updateCache( jobID );
+    }
+    return result;
+} // end "execute()" -----------------------------------------------------------------
+
+
+void tractSetPipeline::updateCache( const size_t jobID )
+{
+    const rangeKey_t key( m_jobs[jobID].firstID, m_jobs[jobID].postLastID );
+    std::map< rangeKey_t, cacheEntry >::iterator cacheIter( m_cache.find( key ) );
+    if( cacheIter != m_cache.end() && cacheIter->second.sparse )
+    {
+        // jobs may finish out of order, the next use only moves forward
+        cacheIter->second.nextUse = std::max( cacheIter->second.nextUse, m_nextUse[jobID] );
+        if( cacheIter->second.nextUse == NO_NEXT_USE )
+        {
+            m_cacheUsedBytes -= cacheIter->second.bytes;
+            m_cache.erase( cacheIter );
+        }
+    }
+
+    // evict the sets needed farthest in the future, sets needed within the prefetch window are kept
+    while( m_cacheUsedBytes > m_cacheBytes )
+    {
+        std::map< rangeKey_t, cacheEntry >::iterator evictIter( m_cache.end() );
+        for( cacheIter = m_cache.begin(); cacheIter != m_cache.end(); ++cacheIter )
+        {
+            if( cacheIter->second.sparse && cacheIter->second.nextUse > jobID + m_depth
+                && ( evictIter == m_cache.end() || cacheIter->second.nextUse > evictIter->second.nextUse ) )
+            {
+                evictIter = cacheIter;
+            }
+        }
+        if( evictIter == m_cache.end() )
+        {
+            break;
+        }
+        m_cacheUsedBytes -= evictIter->second.bytes;
+        m_cache.erase( evictIter );
+    }
+} // end "updateCache()" -----------------------------------------------------------------
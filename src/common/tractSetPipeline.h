@@ -0,0 +1,194 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#ifndef TRACTSETPIPELINE_H
+#define TRACTSETPIPELINE_H
+
+// std library
+#include <vector>
+#include <map>
+#include <string>
+#include <stdexcept>
+#include <utility>
+
+// boost library
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "sparseTract.h"
+
+class distMatComputer;
+
+/**
+ * A set of seed tractograms loaded to compute a sub-block of the distance matrix.
+ * Row sets are kept in sparse form, column sets as a dense 8-bit array in transposed orientation
+ */
+struct tractSet
+{
+    size_t firstID;                          //!< ID of the first seed of the set
+    size_t postLastID;                       //!< ID following the last seed of the set
+    bool transposed;                         //!< if true the set is a transposed dense column set, if false a sparse row set
+    std::vector< sparseTract > sparseSet;    //!< row set tractograms (only if not transposed)
+    std::vector< unsigned char > denseSet;   //!< column set data in transposed orientation (only if transposed)
+};
+
+/**
+ * Description of a tractogram set request in the sub-block computation schedule
+ */
+struct tractSetJob
+{
+    size_t firstID;     //!< ID of the first seed of the set
+    size_t postLastID;  //!< ID following the last seed of the set
+    bool transposed;    //!< if true a transposed dense column set is produced, if false a sparse row set
+};
+
+#define NO_NEXT_USE ( ( size_t ) -1 )
+
+/**
+ * This class implements a producer-consumer prefetch pipeline for the tractogram sets of the distance matrix computation,
+ * with a schedule-aware cache of decoded sets.
+ * The whole sequence of set requests is known in advance; I/O threads prepare the upcoming sets while the
+ * consumer computes distances on the current ones. The buffer depth limits how far ahead the I/O threads may run:
+ * at most depth-1 sets are ready or in preparation on top of the row and column sets in use by the consumer (depth 2: double buffering,
+ * depth 3: triple buffering). A depth of 1 disables prefetching and sets are prepared on demand by the consumer thread.
+ * Every set read from disk is kept in sparse (thresholded) form in a byte-budgeted cache, so requests for the same seed range
+ * (either as row set or as column set) are served from memory without I/O. As the schedule is known, the cache evicts the set whose
+ * next request is farthest in the future (optimal replacement); sets requested within the prefetch window are never evicted.
+ */
+class tractSetPipeline
+{
+public:
+    /**
+     * Constructor, I/O threads are started right away
+     * \param computer the distance matrix computer object that does the actual tractogram reading
+     * \param jobs the ordered list of set requests, sets will be returned by next() in this order
+     * \param depth the buffer depth, depth-1 I/O threads will be used
+     * \param cacheBytes the memory budget of the sparse set cache in bytes
+     */
+    tractSetPipeline( const distMatComputer& computer, const std::vector< tractSetJob >& jobs, const size_t depth, const size_t cacheBytes );
+
+    //! Destructor, stops and joins the I/O threads
+    ~tractSetPipeline();
+
+    // === IN-LINE MEMBER FUNCTIONS ===
+
+    /**
+     * returns the number of sets already handed to the consumer
+     * \return number of sets taken
+     */
+    inline size_t taken() const { return m_taken; }
+
+    /**
+     * returns the total time the consumer thread spent waiting for (or preparing) sets
+     * \return waiting time in seconds
+     */
+    inline double waitSeconds() const { return m_waitSeconds; }
+
+    /**
+     * returns the number of tractograms requested in the whole schedule (the number that would be read without set reuse)
+     * \return number of tractograms requested
+     */
+    inline size_t requestedTracts() const { return m_requestedTracts; }
+
+    /**
+     * returns the number of tractograms read from disk so far
+     * \return number of tractograms read
+     */
+    inline size_t readTracts() const { return m_readTracts; }
+
+    // === PUBLIC MEMBER FUNCTIONS ===
+
+    /**
+     * returns the next set in the schedule, waiting for it to be prepared if necessary
+     * \param expectedJob the job description of the set the consumer expects (checked against the schedule)
+     * \return a shared pointer to the set
+     */
+    boost::shared_ptr< const tractSet > next( const tractSetJob& expectedJob );
+
+private:
+    /**
+     * An entry of the sparse set cache
+     */
+    struct cacheEntry
+    {
+        boost::shared_ptr< tractSet > sparse;   //!< the set in sparse (row) form, null while being read
+        size_t bytes;                           //!< memory used by the set
+        size_t nextUse;                         //!< index of the next job requesting this seed range (NO_NEXT_USE if none)
+    };
+    typedef std::pair< size_t, size_t > rangeKey_t;
+
+    // === PRIVATE DATA MEMBERS ===
+
+    const distMatComputer& m_computer;                          //!< The object that does the actual loading
+    std::vector< tractSetJob > m_jobs;                          //!< The ordered set request schedule
+    std::vector< size_t > m_nextUse;                            //!< For each job, index of the next job requesting the same seed range
+    std::vector< boost::shared_ptr< tractSet > > m_results;     //!< Prepared sets not yet handed to the consumer
+    std::vector< bool > m_done;                                 //!< Flags indicating which jobs are finished
+    std::map< rangeKey_t, cacheEntry > m_cache;                 //!< The sparse set cache
+    size_t m_cacheBytes;                                        //!< Memory budget of the cache
+    size_t m_cacheUsedBytes;                                    //!< Memory currently used by the cache
+    size_t m_depth;                                             //!< The buffer depth
+    size_t m_started;                                           //!< Number of jobs handed to I/O threads
+    size_t m_taken;                                             //!< Number of sets handed to the consumer
+    size_t m_requestedTracts;                                   //!< Number of tractograms requested in the schedule
+    size_t m_readTracts;                                        //!< Number of tractograms read from disk
+    bool m_stop;                                                //!< Stop flag for the I/O threads
+    std::string m_error;                                        //!< Error message of a failed job (rethrown in the consumer)
+    double m_waitSeconds;                                       //!< Time the consumer spent waiting for sets
+
+    boost::mutex m_mutex;                                       //!< Protects the shared state
+    boost::condition_variable m_changed;                        //!< Signals job completions, consumptions, cache insertions and stops
+    boost::thread_group m_ioThreads;                            //!< The I/O threads
+
+    // === PRIVATE MEMBER FUNCTIONS ===
+
+    /**
+     * I/O thread main loop: takes the next job within the buffer window, executes it and stores the result
+     */
+    void ioLoop();
+
+    /**
+     * executes a job: gets the sparse set from the cache or reads it from disk, and transposes it if a column set is requested
+     * \param jobID index of the job in the schedule
+     * \return the prepared set
+     */
+    boost::shared_ptr< tractSet > execute( const size_t jobID );
+
+    /**
+     * updates the next use of a cached set after a job and evicts sets (farthest next use first) until the cache fits its budget (mutex must be held)
+     * \param jobID index of the job that just used the set
+     */
+    void updateCache( const size_t jobID );
+};
+
+#endif  // TRACTSETPIPELINE_H
@@ -60,7 +60,6 @@
 #include "compactTract.h"
 #include "WHcoord.h"
 #include "WHtree.h"
-#include "listedCache.hpp"
 #include "fileManagerFactory.h"
 #include "treeManager.h"
 #include "WHtreeProcesser.h"
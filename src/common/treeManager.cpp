@@ -105,6 +105,17 @@ float treeManager::doCpcc()
         std::cout << "OK. Whole matrix roi is " << dBlock.matrixSize() << " elements. " << topBlock + 1 << "x" << topBlock + 1
                         << " blocks (real blocks: " << numBlocks << "). " << std::flush;
 
+    // matrix position of each tree leaf, so that distances are fetched without coordinate lookups
+    std::vector< size_t > leafMatrixIDs( m_tree.m_coordinates.size() );
+    for( size_t i = 0; i < leafMatrixIDs.size(); ++i )
+    {
+        leafMatrixIDs[i] = dBlock.getMatrixID( m_tree.m_coordinates[i] );
+    }
+
+    // blocks are traversed along the rows: keep the current block and read the next one in the background
+    dBlock.setCacheSize( 2 * dBlock.blockBytes() );
+    dBlock.setPrefetch( true );
+
     time_t loopStartTime( time( NULL ) );
 
     // obtain sums for all elements
@@ -182,8 +193,7 @@ float treeManager::doCpcc()
             {
                 for( size_t j = i + 1; j < endPosCol; ++j )
                 {
-                    matrixDistM[i - beginPosRow][j - beginPosCol] = ( dBlock.getDistance( m_tree.getCoordinate4leaf( i ),
-                                    m_tree.getCoordinate4leaf( j ) ) );
+                    matrixDistM[i - beginPosRow][j - beginPosCol] = ( dBlock.getDistance( leafMatrixIDs[i], leafMatrixIDs[j] ) );
                     treeDistM[i - beginPosRow][j - beginPosCol] = ( m_tree.getLeafDistance( i, j ) );
                 }
             }
@@ -196,8 +206,7 @@ float treeManager::doCpcc()
             {
                 for( size_t j = beginPosCol; j < endPosCol; ++j )
                 {
-                    matrixDistM[i - beginPosRow][j - beginPosCol] = ( dBlock.getDistance( m_tree.getCoordinate4leaf( i ),
-                                    m_tree.getCoordinate4leaf( j ) ) );
+                    matrixDistM[i - beginPosRow][j - beginPosCol] = ( dBlock.getDistance( leafMatrixIDs[i], leafMatrixIDs[j] ) );
                     treeDistM[i - beginPosRow][j - beginPosCol] = ( m_tree.getLeafDistance( i, j ) );
                 }
             }
@@ -270,8 +279,8 @@ float treeManager::doCpcc()
     }
 
     if( m_verbose )
-        std::cout << "\rAll " << topBlock + 1 << "x" << topBlock + 1 << " blocks processed, doing final caculations..."
-                        << std::flush;
+        std::cout << "\rAll " << topBlock + 1 << "x" << topBlock + 1 << " blocks processed. " << dBlock.getCacheReport() << std::endl
+                        << "Doing final caculations..." << std::flush;
 
     // do the final computations
     double meanM( sumM / K );
@@ -877,7 +886,7 @@ void treeManager::writeAllNodeTracts( const float memory ) const
     if( m_logfile != 0 )
         ( *m_logfile ) << "Cache size:\t" << cacheSize << " tracts" << std::endl;
 
-    listedCache< compactTract > cache( m_tree.getNumNodes() );
+    concurrentCache< compactTract > cache( m_tree.getNumNodes() );
     cache.setLimit( cacheSize );
     size_t maxLeaves( 2 * cacheSize ); // we can hold cacheSize nodes in cache, which means process 2*cacheSize leaves at a time
 
@@ -1143,7 +1152,7 @@ void treeManager::writeTree() const
 } // end treeManager::writeTree() -------------------------------------------------------------------------------------
 
 
-void treeManager::writeNodeTracts( std::vector< size_t >* const nodeVector, listedCache< compactTract >* const cache, size_t* const tractProg,
+void treeManager::writeNodeTracts( std::vector< size_t >* const nodeVector, concurrentCache< compactTract >* const cache, size_t* const tractProg,
                 time_t* const lastTime, const time_t &startTime ) const
 {
     std::vector< size_t >& nodeVectorRef( *nodeVector );
@@ -1169,18 +1178,10 @@ void treeManager::writeNodeTracts( std::vector< size_t >* const nodeVector, list
         compactTract meanTract;
         if( kids[0].first )
         {
-            compactTract* tractPointer;
-            tractPointer = ( cache->getNoUpdate( kids[0].second ) );
-            if( tractPointer == 0 )
+            if( !cache->take( kids[0].second, &meanTract ) )
             {
                 throw std::runtime_error( "ERROR @ hTree::writeNodeTracts(): tractogram not found in memory" );
             }
-            else
-            {
-                meanTract.steal( tractPointer );
-#pragma omp critical( cache )
-                cache->erase( kids[0].second );
-            }
         }
         else
         {
@@ -1195,18 +1196,10 @@ void treeManager::writeNodeTracts( std::vector< size_t >* const nodeVector, list
             compactTract addedTract;
             if( kids[j].first )
             {
-                compactTract* tractPointer;
-                tractPointer = ( cache->getNoUpdate( kids[j].second ) );
-                if( tractPointer == 0 )
+                if( !cache->take( kids[j].second, &addedTract ) )
                 {
                     throw std::runtime_error( "ERROR @ hTree::writeNodeTracts(): tractogram not found in memory" );
                 }
-                else
-                {
-                    addedTract.steal( tractPointer );
-#pragma omp critical( cache )
-                    cache->erase( kids[j].second );
-                }
             }
             else
             {
@@ -1219,7 +1212,6 @@ void treeManager::writeNodeTracts( std::vector< size_t >* const nodeVector, list
             meanSize += addedSize;
         }
 
-#pragma omp critical( cache )
         cache->insert( m_tree.getNode( nodeVectorRef[i] ).getID(), meanTract );
 
 #pragma omp atomic
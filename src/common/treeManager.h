@@ -55,7 +55,7 @@
 #include "WHcoord.h"
 #include "distBlock.h"
 #include "WHtree.h"
-#include "listedCache.hpp"
+#include "concurrentCache.hpp"
 #include "fileManagerFactory.h"
 #include "WHtreePartition.h"
 
@@ -266,7 +266,7 @@ private:
      * \param lastTime a pointer to a time object indicating the last time the output info was updated
      * \param startTime a time object indicating the time where the routine started
      */
-    void writeNodeTracts( std::vector< size_t >* const nodeVector, listedCache< compactTract >* const cache, size_t* const tractProg,
+    void writeNodeTracts( std::vector< size_t >* const nodeVector, concurrentCache< compactTract >* const cache, size_t* const tractProg,
                     time_t* lastTime, const time_t& startTime ) const;
 
     /**
@@ -0,0 +1,117 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#include "triangleDistMatrix.h"
+
+
+void triangleDistMatrix::resize( const size_t size, const PackedStorage storage )
+{
+    if( storage != PSFloat32 && storage != PSFloat16 )
+    {
+        throw std::runtime_error( "ERROR @ triangleDistMatrix::resize(): only float32 and float16 storage are supported" );
+    }
+    clear();
+    m_size = size;
+    m_storage = storage;
+    const size_t numValues( ( size * ( size - 1 ) ) / 2 );
+    if( m_storage == PSFloat32 )
+    {
+        m_floats.assign( numValues, 0 );
+    }
+    else
+    {
+        m_halves.assign( numValues, 0 );
+    }
+    return;
+} // end triangleDistMatrix::resize() -------------------------------------------------------------------------------------
+
+void triangleDistMatrix::clear()
+{
+    std::vector< float >().swap( m_floats );
+    std::vector< uint16_t >().swap( m_halves );
+    m_size = 0;
+    return;
+} // end triangleDistMatrix::clear() -------------------------------------------------------------------------------------
+
+void triangleDistMatrix::fillPosition( const size_t position, const float distance )
+{
+    if( position >= m_size )
+    {
+        throw std::runtime_error( "ERROR @ triangleDistMatrix::fillPosition(): position is out of bounds" );
+    }
+    const size_t start( rowStart( position ) );
+    if( m_storage == PSFloat32 )
+    {
+        std::fill( m_floats.begin() + start, m_floats.begin() + start + position, distance );
+    }
+    else
+    {
+        std::fill( m_halves.begin() + start, m_halves.begin() + start + position, packedDistMatrix::floatToHalf( distance ) );
+    }
+    for( size_t k = position + 1; k < m_size; ++k )
+    {
+        setDistance( k, position, distance );
+    }
+    return;
+} // end triangleDistMatrix::fillPosition() -------------------------------------------------------------------------------------
+
+void triangleDistMatrix::rowMinimum( const size_t row, float* const minDist, size_t* const minPosition ) const
+{
+    const size_t start( rowStart( row ) );
+    if( m_storage == PSFloat32 )
+    {
+        const float* rowValues( &m_floats[0] + start );
+        for( size_t k = 0; k < row; ++k )
+        {
+            if( rowValues[k] < *minDist )
+            {
+                *minDist = rowValues[k];
+                *minPosition = k;
+            }
+        }
+    }
+    else
+    {
+        const uint16_t* rowValues( &m_halves[0] + start );
+        for( size_t k = 0; k < row; ++k )
+        {
+            const float value( packedDistMatrix::halfToFloat( rowValues[k] ) );
+            if( value < *minDist )
+            {
+                *minDist = value;
+                *minPosition = k;
+            }
+        }
+    }
+    return;
+} // end triangleDistMatrix::rowMinimum() -------------------------------------------------------------------------------------
@@ -0,0 +1,282 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+
+#ifndef TRIANGLEDISTMATRIX_H
+#define TRIANGLEDISTMATRIX_H
+
+// parallel execution
+#include <omp.h>
+
+// std library
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include <stdint.h>
+
+#include "packedDistMatrix.h"
+
+#define TRIANGLE_HALF_CHUNK 512 // number of float16 values decoded at once in a row merging pass
+
+/**
+ * This class implements an in-memory distance matrix stored as a single contiguous buffer with the packed lower triangle (without the diagonal)
+ * in row order, so that row i holds the distances to positions 0..i-1. Values can be stored in float32 or float16 (halving the memory footprint).
+ * It is meant to be overwritten in place by graph linkage algorithms: when two positions are merged, their distances to every other position are
+ * combined by a Lance-Williams update in a single pass (the contiguous row segments are processed in vectorizable loops).
+ */
+class triangleDistMatrix
+{
+public:
+    /**
+     * Constructor
+     */
+    triangleDistMatrix(): m_size( 0 ), m_storage( PSFloat32 ) {}
+
+    //! Destructor
+    ~triangleDistMatrix() {}
+
+    // === IN-LINE MEMBER FUNCTIONS ===
+
+    /**
+     * returns the number of positions (rows/columns) of the matrix
+     * \return matrix size
+     */
+    inline size_t size() const { return m_size; }
+
+    /**
+     * returns the storage data type of the matrix values
+     * \return storage type
+     */
+    inline PackedStorage storage() const { return m_storage; }
+
+    /**
+     * returns the memory used by the matrix values
+     * \return size in bytes
+     */
+    inline size_t bytes() const { return m_floats.size() * sizeof( float ) + m_halves.size() * sizeof( uint16_t ); }
+
+    /**
+     * fetches the distance value between two different positions
+     * \param pos1 first matrix position
+     * \param pos2 second matrix position (must differ from the first one)
+     * \return distance value
+     */
+    inline float getDistance( const size_t pos1, const size_t pos2 ) const
+    {
+        if( m_storage == PSFloat32 )
+        {
+            return m_floats[valueIndex( pos1, pos2 )];
+        }
+        return packedDistMatrix::halfToFloat( m_halves[valueIndex( pos1, pos2 )] );
+    }
+
+    /**
+     * sets the distance value between two different positions
+     * \param pos1 first matrix position
+     * \param pos2 second matrix position (must differ from the first one)
+     * \param distance distance value
+     */
+    inline void setDistance( const size_t pos1, const size_t pos2, const float distance )
+    {
+        if( m_storage == PSFloat32 )
+        {
+            m_floats[valueIndex( pos1, pos2 )] = distance;
+        }
+        else
+        {
+            m_halves[valueIndex( pos1, pos2 )] = packedDistMatrix::floatToHalf( distance );
+        }
+    }
+
+    // === PUBLIC MEMBER FUNCTIONS ===
+
+    /**
+     * allocates the matrix (all distances set to 0), previous contents are discarded
+     * \param size number of positions of the matrix
+     * \param storage storage data type of the values (only PSFloat32 and PSFloat16 are valid)
+     */
+    void resize( const size_t size, const PackedStorage storage );
+
+    /**
+     * frees the matrix memory
+     */
+    void clear();
+
+    /**
+     * sets all the distances from a position to any other position to the same value
+     * \param position matrix position
+     * \param distance distance value
+     */
+    void fillPosition( const size_t position, const float distance );
+
+    /**
+     * merges two positions: the distances from the first position to every other one are replaced by update( d(first,k), d(second,k) ).
+     * The distances from the second position are left unchanged
+     * \param first first matrix position (the lower one)
+     * \param second second matrix position (the higher one)
+     * \param update functor with a float operator()( float distance1, float distance2 ) const returning the distance to the merged position
+     */
+    template< class Update > void mergePositions( const size_t first, const size_t second, const Update& update );
+
+    /**
+     * \overload
+     * \param positions sorted list of the positions whose distances to the first position have to be kept up to date above the first position
+     * (positions below the first one are always all updated, as they lie in a contiguous row segment)
+     */
+    template< class Update > void mergePositions( const size_t first, const size_t second, const Update& update, const std::vector< size_t >& positions );
+
+    /**
+     * finds the lowest distance from a position to the positions below it (first strict minimum, in position order, below the given initial value)
+     * \param row matrix position
+     * \param minDist pointer to the initial value, returns the lowest distance found
+     * \param minPosition pointer to the position with the lowest distance, left unchanged if none is below the initial value
+     */
+    void rowMinimum( const size_t row, float* const minDist, size_t* const minPosition ) const;
+
+private:
+    // === PRIVATE DATA MEMBERS ===
+
+    size_t m_size;                      //!< number of positions of the matrix
+    PackedStorage m_storage;            //!< storage data type of the values
+    std::vector< float > m_floats;      //!< packed values in float32 storage
+    std::vector< uint16_t > m_halves;   //!< packed values in float16 storage
+
+    // === PRIVATE MEMBER FUNCTIONS ===
+
+    /**
+     * merges the contiguous row segments of two positions, for all positions below the first one
+     * \param first first matrix position (the lower one)
+     * \param second second matrix position (the higher one)
+     * \param update Lance-Williams update functor
+     */
+    template< class Update > void mergeRowSegments( const size_t first, const size_t second, const Update& update );
+
+    /**
+     * returns the index of the first value of a row within the packed buffer
+     * \param row matrix position
+     * \return buffer index
+     */
+    inline size_t rowStart( const size_t row ) const { return ( row * ( row - 1 ) ) / 2; }
+
+    /**
+     * returns the index of a distance value within the packed buffer
+     * \param pos1 first matrix position
+     * \param pos2 second matrix position (must differ from the first one)
+     * \return buffer index
+     */
+    inline size_t valueIndex( const size_t pos1, const size_t pos2 ) const
+    {
+        return ( pos1 > pos2 ) ? rowStart( pos1 ) + pos2 : rowStart( pos2 ) + pos1;
+    }
+};
+
+template< class Update > void triangleDistMatrix::mergePositions( const size_t first, const size_t second, const Update& update )
+{
+    if( first >= second || second >= m_size )
+    {
+        throw std::runtime_error( "ERROR @ triangleDistMatrix::mergePositions(): invalid positions" );
+    }
+    mergeRowSegments( first, second, update );
+
+    // positions above the first one: the distances to the first position are spread along its column
+#pragma omp parallel for schedule( static )
+    for( size_t k = first + 1; k < m_size; ++k )
+    {
+        if( k != second )
+        {
+            setDistance( k, first, update( getDistance( k, first ), getDistance( second, k ) ) );
+        }
+    }
+    return;
+} // end triangleDistMatrix::mergePositions() -------------------------------------------------------------------------------------
+
+template< class Update > void triangleDistMatrix::mergePositions( const size_t first, const size_t second, const Update& update,
+                                                                  const std::vector< size_t >& positions )
+{
+    if( first >= second || second >= m_size )
+    {
+        throw std::runtime_error( "ERROR @ triangleDistMatrix::mergePositions(): invalid positions" );
+    }
+    mergeRowSegments( first, second, update );
+
+    // listed positions above the first one
+    const size_t listStart( std::upper_bound( positions.begin(), positions.end(), first ) - positions.begin() );
+#pragma omp parallel for schedule( static )
+    for( size_t i = listStart; i < positions.size(); ++i )
+    {
+        const size_t k( positions[i] );
+        if( k != second )
+        {
+            setDistance( k, first, update( getDistance( k, first ), getDistance( second, k ) ) );
+        }
+    }
+    return;
+} // end triangleDistMatrix::mergePositions() -------------------------------------------------------------------------------------
+
+template< class Update > void triangleDistMatrix::mergeRowSegments( const size_t first, const size_t second, const Update& update )
+{
+    if( m_storage == PSFloat32 )
+    {
+        float* firstRow( &m_floats[0] + rowStart( first ) );
+        const float* secondRow( &m_floats[0] + rowStart( second ) );
+        for( size_t k = 0; k < first; ++k )
+        {
+            firstRow[k] = update( firstRow[k], secondRow[k] );
+        }
+    }
+    else
+    {
+        uint16_t* firstRow( &m_halves[0] + rowStart( first ) );
+        const uint16_t* secondRow( &m_halves[0] + rowStart( second ) );
+        float firstValues[TRIANGLE_HALF_CHUNK], secondValues[TRIANGLE_HALF_CHUNK];
+        for( size_t chunkStart = 0; chunkStart < first; chunkStart += TRIANGLE_HALF_CHUNK )
+        {
+            const size_t chunkSize( std::min( ( size_t ) TRIANGLE_HALF_CHUNK, first - chunkStart ) );
+            for( size_t k = 0; k < chunkSize; ++k )
+            {
+                firstValues[k] = packedDistMatrix::halfToFloat( firstRow[chunkStart + k] );
+                secondValues[k] = packedDistMatrix::halfToFloat( secondRow[chunkStart + k] );
+            }
+            for( size_t k = 0; k < chunkSize; ++k )
+            {
+                firstValues[k] = update( firstValues[k], secondValues[k] );
+            }
+            for( size_t k = 0; k < chunkSize; ++k )
+            {
+                firstRow[chunkStart + k] = packedDistMatrix::floatToHalf( firstValues[k] );
+            }
+        }
+    }
+    return;
+} // end triangleDistMatrix::mergeRowSegments() -------------------------------------------------------------------------------------
+
+#endif  // TRIANGLEDISTMATRIX_H
@@ -67,7 +67,14 @@
 //
 //  [--vista]:        Read/write vista (.v) files [default is nifti (.nii) and compact (.cmpct) files].
 //
-//  [-m --cache-mem]: Maximum amount of RAM memory (in GBytes) to use for temporal tractogram cache storing. Valid values [0.1,50]. Default: 0.5.
+//  [-m --cache-mem]: Maximum amount of RAM memory (in GBytes) to use for temporal tractogram cache storing and neighbourhood tables. Valid values [0.1,50]. Default: 0.5.
+//                    The cache budget is what remains after the measured program footprint, and is split between leaf and node caches according to their hit rates.
+//
+//  [-M --mean-mem]:  Amount of RAM memory (in GBytes) to hold the mean tractograms of the nodes waiting to be merged, tractograms exceeding it are spilled
+//                     to a single slab file in the temporal folder. Valid values [0,50]. Default: 0.5.
+//
+//  [-B --merge-batch]: Maximum number of independent merges taken from the top of the priority heap and computed in parallel at once.
+//                     A value of 0 uses twice the number of processing threads. Result is identical to serial merging. Default: 1 (serial merging).
 //
 //  [-k --keep-disc]: Keep discarded voxel information in a specialiced section of the tree.
 //
@@ -147,11 +154,11 @@ int main( int argc, char *argv[] )
 
         // program parameters
         std::string roiFilename, inputFolder, outputFolder, tempFolder;
-        float memory( 0.5 ), maxNbDist( 1 ), relativeThreshold( 0 );
+        float memory( 0.5 ), meanMemory( 0.5 ), maxNbDist( 1 ), relativeThreshold( 0 );
         unsigned int nbLevel( 26 ), threads( 0 );
         bool keepDiscarded( false ), niftiMode( true ), debug( false ), noLog( false );
         TC_GROWTYPE growType( TC_GROWOFF );
-        size_t baseSize( 0 );
+        size_t baseSize( 0 ), mergeBatch( 1 );
 
         // Declare a group of options that will be allowed only on command line
         boost::program_options::options_description genericOptions( "Generic options" );
@@ -176,6 +183,8 @@ int main( int argc, char *argv[] )
                 ( "verbose,v", "[opt] verbose output." )
                 ( "vista", "[opt] use vista file format (default is nifti)." )
                 ( "cache-mem,m",  boost::program_options::value< float >(&memory)->implicit_value(0.5), "[opt] maximum of memory (in GBytes) to use for tractogram cache memory. Default: 0.5." )
+                ( "mean-mem,M",  boost::program_options::value< float >(&meanMemory)->implicit_value(0.5), "[opt] memory (in GBytes) to hold mean tractograms before spilling them to the temporal folder. Default: 0.5." )
+                ( "merge-batch,B",  boost::program_options::value< size_t >(&mergeBatch)->implicit_value(0), "[opt] number of independent merges to compute in parallel (0: twice the number of threads). Default: 1." )
                 ( "keep-disc,k", "[opt] keep discarded voxels data in a section of the tree file." )
                 ( "debugout", "[opt] write additional detailed outputs meant for debug." )
                 ( "pthreads,p",  boost::program_options::value< unsigned int >(&threads), "[opt] number of processing cores to run the program in. Default: all available." )
@@ -256,7 +265,12 @@ int main( int argc, char *argv[] )
             std::cout << "[--nolog]:        Use linear normalization. Use if input tracts are only linearly normalized instead of logarithmically normalized (assumed by default)." << std::endl << std::endl;
             std::cout << "[-v --verbose]:   verbose output (recommended)." << std::endl << std::endl;
             std::cout << "[--vista]: 	     read/write vista (.v) files [default is nifti (.nii) and compact (.cmpct) files]." << std::endl << std::endl;
-            std::cout << "[-m --cache-mem]: maximum amount of RAM memory (in GBytes) to use for temporal tractogram cache storing. Valid values [0.1,50]. Default: 0.5." << std::endl << std::endl;
+            std::cout << "[-m --cache-mem]: maximum amount of RAM memory (in GBytes) to use for temporal tractogram cache storing and neighbourhood tables. Valid values [0.1,50]. Default: 0.5." << std::endl;
+            std::cout << "                  The cache budget is what remains after the measured program footprint, and is split between leaf and node caches according to their hit rates." << std::endl << std::endl;
+            std::cout << "[-M --mean-mem]:  amount of RAM memory (in GBytes) to hold the mean tractograms of the nodes waiting to be merged, tractograms exceeding it are spilled" << std::endl;
+            std::cout << "                   to a single slab file in the temporal folder. Valid values [0,50]. Default: 0.5." << std::endl << std::endl;
+            std::cout << "[-B --merge-batch]: maximum number of independent merges taken from the top of the priority heap and computed in parallel at once." << std::endl;
+            std::cout << "                   A value of 0 uses twice the number of processing threads. Result is identical to serial merging. Default: 1 (serial merging)." << std::endl << std::endl;
             std::cout << "[-k --keep-disc]: keep discarded voxel information in a specialiced section of the tree." << std::endl << std::endl;
             std::cout << "[--debugout]:     write additional detailed outputs meant to be used for debugging." << std::endl << std::endl;
             std::cout << "[-p --pthreads]:  number of processing threads to run the program in parallel. Default: use all available processors." << std::endl << std::endl;
@@ -566,6 +580,26 @@ int main( int argc, char *argv[] )
             std::cout << "Tractogram cache memory: " << memory << " GBytes" << std::endl;
         }
 
+        if ( meanMemory < 0 || meanMemory > 50)
+        {
+            std::cerr << "ERROR: mean tractogram memory must be a float between 0 and 50 (GB)" << std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+        else if( verbose )
+        {
+            std::cout << "Mean tractogram memory: " << meanMemory << " GBytes" << std::endl;
+        }
+
+        if ( mergeBatch == 0 )
+        {
+            mergeBatch = 2 * threads;
+        }
+        if( verbose )
+        {
+            std::cout << "Merge batch size: " << mergeBatch << std::endl;
+        }
+
 
         std::string logFilename(outputFolder+"/"+progName+"_log.txt" );
         std::ofstream logFile(logFilename.c_str() );
@@ -612,6 +646,8 @@ int main( int argc, char *argv[] )
         logFile << "Output folder:\t" << outputFolder << std::endl;
         logFile << "Temp folder:\t" << tempFolder << std::endl;
         logFile << "Memory cache size:\t" << memory << " GB" << std::endl;
+        logFile << "Mean tract memory:\t" << meanMemory << " GB" << std::endl;
+        logFile << "Merge batch size:\t" << mergeBatch << std::endl;
         logFile << "Debug outputr:\t" << debug << std::endl;
         logFile << "-------------" << std::endl;
 
@@ -626,6 +662,8 @@ int main( int argc, char *argv[] )
         builder.setInputFolder( inputFolder );
         builder.setOutputFolder( outputFolder );
         builder.setTempFolder( tempFolder );
+        builder.setMeanTractMemory( meanMemory );
+        builder.setMergeBatch( mergeBatch );
         builder.setDebugOutput( debug );
         builder.buildCentroid( nbLevel, memory, growType, baseSize, keepDiscarded );
 
@@ -32,7 +32,7 @@
 //
 //  buildgraphtree
 //
-//  Build a graph linkage hierarchical tree from a distance matrix built with distmatrix.
+//  Build a graph linkage hierarchical tree from a distance matrix built with distmatrix, or from the neighbourhood graph of the seed tractograms.
 //
 //  * Arguments:
 //
@@ -44,7 +44,8 @@
 //
 //   -g --graph:      The graph linkage method to recalculate distances, use: 0=single, 1=complete, 2=average, 3=weighted, 4=ward(not verified).
 //
-//   -I --inputf:     Input data folder (containing the distance blocks).
+//   -I --inputf:     Input data folder (containing the distance blocks), or packed distance matrix file (as written by packmatrix).
+//                     With option -c, input data folder containing the compact tractograms.
 //
 //   -O --outputf:    Output folder where tree files will be written.
 //
@@ -56,10 +57,35 @@
 //
 //  [-p --pthreads]:  Number of processing threads to run the program in parallel. Default: use all available processors.
 //
+//  [--chain]:        Build reducible linkages (single, complete, average, weighted) by following nearest-neighbour chains instead of
+//                     scanning for the global minimum distance on every merge. O(N^2) instead of up to O(N^2) per merge, but tied distances
+//                     (common with --half) may be merged in a different order and give a different, equally valid tree.
+//
+//  [--half]:         Keep the distance matrix in memory in half precision (float16, relative error < 0.05%), halving its memory footprint.
+//
+//  [-T --tempf]:     Build the tree out-of-core: the working distance matrix is kept in a temporary file in this folder (needs 4*N^2 bytes of disk space
+//                     for N seeds) instead of in memory, and only the rows in use are cached in RAM. Produces the same tree as the in-memory matrix.
+//
+//  [-m --matrix-mem]: Maximum amount of RAM memory (in GBytes) for the row cache of the out-of-core matrix (used with -T). Default: 0.5.
+//
+//  [--mst]:          Build single linkage from the minimum spanning tree of the distance matrix, streaming the matrix without loading it into memory,
+//                     instead of with the same engines as the other linkages. Tied distances may be merged in a different order than by the global
+//                     minimum scan and give a different, equally valid tree. Cannot be used with --half or -T.
+//
+//  [-c --cnbhood]:   Build the tree from the sparse graph of spatially neighbouring seeds with C neighborhood level instead of from a distance matrix.
+//                     Only the distances between neighbours are computed, from the tractograms, and only clusters joined by a graph edge are merged.
+//                     Valid values: 6, 18, 26, 32, 92, 124. Cannot be used with the distance matrix options --chain, --half, -T or --mst.
+//
+//  [-t --threshold]: Number of streamlines relative to the total generated that must pass through a tract voxel to be considered for tract similarity
+//                     (used with -c). Valid values: [0,1) Use a value of 0 (default) if no thresholding is desired.
+//
+//  [--nolog]:        Use if input tracts are only linearly normalized instead of logarithmically normalized (used with -c).
+//
 //
 //  * Usage example:
 //
 //   buildgraphtree -r roi_lh.txt -g 2 -I distblocks/ -O results/ -v
+//   buildgraphtree -r roi_lh.txt -g 2 -c 26 -t 0.001 -I tracts/ -O results/ -v
 //
 //
 //  * Outputs (in output folder defined at option -O):
@@ -115,9 +141,10 @@ int main( int argc, char *argv[] )
         std::string configFilename("/home/raid2/moreno/Code/hClustering/config/"+progName+".cfg");
 
         // program parameters
-        std::string roiFilename, inputFolder, outputFolder;
-        unsigned int selector(0), threads(0);
-        bool niftiMode( true ), debug( false );
+        std::string roiFilename, inputFolder, outputFolder, tempFolder;
+        float matrixMemory( 0.5 ), relativeThreshold( 0 );
+        unsigned int selector(0), threads(0), nbLevel(0);
+        bool niftiMode( true ), debug( false ), nnChain( false ), halfMatrix( false ), mstSingle( false ), noLog( false );
         TG_GRAPHTYPE graphMethod;
 
         // Declare a group of options that will be allowed only on command line
@@ -127,7 +154,7 @@ int main( int argc, char *argv[] )
                 ( "help,h", "Produce extended program help message" )
                 ( "roi,r", boost::program_options::value< std::string >(&roiFilename), "file with the seed voxels coordinates." )
                 ( "graph,g",  boost::program_options::value< unsigned int >(&selector), "use N graph method (0=single, 1=complete, 2=average, 3=weighted, 4=ward)")
-                ( "inputf,I",  boost::program_options::value< std::string >(&inputFolder), "input data folder (distance blocks)." )
+                ( "inputf,I",  boost::program_options::value< std::string >(&inputFolder), "input data folder (distance blocks, or tractograms with -c) or packed matrix file." )
                 ( "outputf,O",  boost::program_options::value< std::string >(&outputFolder), "output folder" )
                 ;
 
@@ -138,6 +165,14 @@ int main( int argc, char *argv[] )
                 ( "vista", "[opt] use vista file format (default is nifti)." )
                 ( "debugout", "[opt] write additional detailed outputs meant for debug." )
                 ( "pthreads,p",  boost::program_options::value< unsigned int >(&threads), "[opt] number of processing cores to run the program in. Default: all available." )
+                ( "chain", "[opt] build reducible linkages with nearest-neighbour chains instead of a global minimum scan on every merge." )
+                ( "half", "[opt] keep the distance matrix in memory in half precision (float16)." )
+                ( "tempf,T",  boost::program_options::value< std::string >(&tempFolder), "[opt] build out-of-core, keeping the working distance matrix in this temporal folder." )
+                ( "matrix-mem,m",  boost::program_options::value< float >(&matrixMemory)->implicit_value(0.5), "[opt] memory (in GBytes) for the out-of-core matrix row cache. Default: 0.5." )
+                ( "mst", "[opt] build single linkage from the minimum spanning tree of the distance matrix, without loading it into memory." )
+                ( "cnbhood,c",  boost::program_options::value< unsigned int >(&nbLevel), "[opt] build from the neighbourhood graph with this level instead of a distance matrix. Valid values: 6, 18, 26, 32, 92, 124." )
+                ( "threshold,t", boost::program_options::value< float >(&relativeThreshold)->implicit_value(0), "[opt] noise threshold for the tractograms relative to number of streamlines per tract (with -c). [0,1)." )
+                ( "nolog", "[opt] treat input tracts as linearly normalized (with -c)." )
                 ;
 
         // Hidden options, will be allowed both on command line and in config file, but will not be shown to the user.
@@ -196,21 +231,39 @@ int main( int argc, char *argv[] )
             std::cout << std::endl;
             std::cout << "---------------------------------------------------------------------------" << std::endl << std::endl;
             std::cout << "buildgraphtree" << std::endl << std::endl;
-            std::cout << "Build a graph linkage hierarchical tree from a distance matrix built with distmatrix." << std::endl << std::endl;
+            std::cout << "Build a graph linkage hierarchical tree from a distance matrix built with distmatrix, or from the neighbourhood graph of the seed tractograms." << std::endl << std::endl;
             std::cout << "* Arguments:" << std::endl << std::endl;
             std::cout << " --version:       Program version." << std::endl << std::endl;
             std::cout << " -h --help:       Produce extended program help message." << std::endl << std::endl;
             std::cout << " -r --roi:        A text file with the seed voxel coordinates and the corresponding tractogram index (if tractogram naming is based on index rather than coordinates)." << std::endl << std::endl;
             std::cout << " -g --graph:      The graph linkage method to recalculate distances, use: 0=single, 1=complete, 2=average, 3=weighted, 4=ward(not verified)." << std::endl;
-            std::cout << " -I --inputf:     Input data folder (containing the distance blocks)." << std::endl << std::endl;
+            std::cout << " -I --inputf:     Input data folder (containing the distance blocks), or packed distance matrix file (as written by packmatrix)." << std::endl;
+            std::cout << "                   With option -c, input data folder containing the compact tractograms." << std::endl << std::endl;
             std::cout << " -O --outputf:    Output folder where tree files will be written." << std::endl << std::endl;
             std::cout << "[-v --verbose]:   Verbose output (recommended)." << std::endl << std::endl;
             std::cout << "[--vista]: 	    Read/write vista (.v) files [default is nifti (.nii) and compact (.cmpct) files]." << std::endl << std::endl;
             std::cout << "[--debugout]:     Write additional detailed outputs meant to be used for debugging." << std::endl << std::endl;
             std::cout << "[-p --pthreads]:  Number of processing threads to run the program in parallel. Default: use all available processors." << std::endl << std::endl;
+            std::cout << "[--chain]:        Build reducible linkages (single, complete, average, weighted) by following nearest-neighbour chains instead of" << std::endl;
+            std::cout << "                   scanning for the global minimum distance on every merge. O(N^2) instead of up to O(N^2) per merge, but tied distances" << std::endl;
+            std::cout << "                   (common with --half) may be merged in a different order and give a different, equally valid tree." << std::endl << std::endl;
+            std::cout << "[--half]:         Keep the distance matrix in memory in half precision (float16, relative error < 0.05%), halving its memory footprint." << std::endl << std::endl;
+            std::cout << "[-T --tempf]:     Build the tree out-of-core: the working distance matrix is kept in a temporary file in this folder (needs 4*N^2 bytes of disk space" << std::endl;
+            std::cout << "                   for N seeds) instead of in memory, and only the rows in use are cached in RAM. Produces the same tree as the in-memory matrix." << std::endl << std::endl;
+            std::cout << "[-m --matrix-mem]: Maximum amount of RAM memory (in GBytes) for the row cache of the out-of-core matrix (used with -T). Default: 0.5." << std::endl << std::endl;
+            std::cout << "[--mst]:          Build single linkage from the minimum spanning tree of the distance matrix, streaming the matrix without loading it into memory," << std::endl;
+            std::cout << "                   instead of with the same engines as the other linkages. Tied distances may be merged in a different order than by the global" << std::endl;
+            std::cout << "                   minimum scan and give a different, equally valid tree. Cannot be used with --half or -T." << std::endl << std::endl;
+            std::cout << "[-c --cnbhood]:   Build the tree from the sparse graph of spatially neighbouring seeds with C neighborhood level instead of from a distance matrix." << std::endl;
+            std::cout << "                   Only the distances between neighbours are computed, from the tractograms, and only clusters joined by a graph edge are merged." << std::endl;
+            std::cout << "                   Valid values: 6, 18, 26, 32, 92, 124. Cannot be used with the distance matrix options --chain, --half, -T or --mst." << std::endl << std::endl;
+            std::cout << "[-t --threshold]: Number of streamlines relative to the total generated that must pass through a tract voxel to be considered for tract similarity" << std::endl;
+            std::cout << "                   (used with -c). Valid values: [0,1) Use a value of 0 (default) if no thresholding is desired." << std::endl << std::endl;
+            std::cout << "[--nolog]:        Use if input tracts are only linearly normalized instead of logarithmically normalized (used with -c)." << std::endl << std::endl;
             std::cout << std::endl;
             std::cout << "* Usage example:" << std::endl << std::endl;
-            std::cout << " buildgraphtree -r roi_lh.txt -g 2 -I distblocks/ -O results/ -v" << std::endl << std::endl;
+            std::cout << " buildgraphtree -r roi_lh.txt -g 2 -I distblocks/ -O results/ -v" << std::endl;
+            std::cout << " buildgraphtree -r roi_lh.txt -g 2 -c 26 -t 0.001 -I tracts/ -O results/ -v" << std::endl << std::endl;
             std::cout << std::endl;
             std::cout << "* Outputs (in output folder defined at option -O):" << std::endl << std::endl;
             std::cout << " - 'LINKAGE.txt' - (where LINKAGE is a string defining the method chosen in option -g: single/complete/average/weighgted/ward) Contains the output hierarchical tree." << std::endl;
@@ -280,6 +333,101 @@ int main( int argc, char *argv[] )
             debug = true;
         }
 
+        if ( variableMap.count( "chain" ) )
+        {
+            if( verbose )
+            {
+                std::cout << "Using nearest-neighbour chains instead of global minimum scan" << std::endl;
+            }
+            nnChain = true;
+        }
+
+        if ( variableMap.count( "half" ) )
+        {
+            if( verbose )
+            {
+                std::cout << "Distance matrix kept in half precision" << std::endl;
+            }
+            halfMatrix = true;
+        }
+
+        if ( variableMap.count( "mst" ) )
+        {
+            if( verbose )
+            {
+                std::cout << "Single linkage built from the minimum spanning tree" << std::endl;
+            }
+            mstSingle = true;
+        }
+
+        if ( variableMap.count( "cnbhood" ) )
+        {
+            if ( ( nbLevel != 6 ) && ( nbLevel != 18 ) && ( nbLevel != 26 ) && ( nbLevel != 32 ) && ( nbLevel != 92 ) && ( nbLevel != 124 ) )
+            {
+                std::cerr << "ERROR: invalid nbhood level, only (6,18,26,32,92,124) are accepted" << std::endl;
+                std::cerr << visibleOptions << std::endl;
+                exit(-1);
+            }
+            if ( variableMap.count( "tempf" ) || variableMap.count( "half" ) || variableMap.count( "chain" ) || variableMap.count( "mst" ) )
+            {
+                std::cerr << "ERROR: the neighbourhood graph mode does not use a distance matrix,"
+                          << " options --chain, --half, --tempf (-T) and --mst cannot be used with it" << std::endl;
+                std::cerr << visibleOptions << std::endl;
+                exit(-1);
+            }
+            if ( relativeThreshold < 0 || relativeThreshold >= 1 )
+            {
+                std::cerr << "ERROR: Threshold value used is out of bounds please use a value within [0,1)" << std::endl;
+                std::cerr << visibleOptions << std::endl;
+                exit(-1);
+            }
+            if ( variableMap.count( "nolog" ) )
+            {
+                noLog = true;
+            }
+            if( verbose )
+            {
+                std::cout << "Tree built from the neighbourhood graph, neighborhood level: " << nbLevel << std::endl;
+                std::cout << "Tractogram relative threshold value: " << relativeThreshold << std::endl;
+                if( noLog )
+                {
+                    std::cout << "Using linear normalization for input tracts" << std::endl;
+                }
+            }
+        }
+        else if ( variableMap.count( "threshold" ) || variableMap.count( "nolog" ) )
+        {
+            std::cerr << "ERROR: options --threshold (-t) and --nolog are only used with the neighbourhood graph mode (-c)" << std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+
+        if ( variableMap.count( "tempf" ) )
+        {
+            if( !boost::filesystem::is_directory( boost::filesystem::path( tempFolder ) ) )
+            {
+                std::cerr << "ERROR: temp folder \"" << tempFolder << "\" is not a directory" << std::endl;
+                std::cerr << visibleOptions << std::endl;
+                exit(-1);
+            }
+            if( halfMatrix )
+            {
+                std::cerr << "ERROR: half precision is not available for the out-of-core matrix" << std::endl;
+                std::cerr << visibleOptions << std::endl;
+                exit(-1);
+            }
+            if ( matrixMemory <= 0 || matrixMemory > 50 )
+            {
+                std::cerr << "ERROR: matrix row cache memory must be a float between 0 and 50 (GB)" << std::endl;
+                std::cerr << visibleOptions << std::endl;
+                exit(-1);
+            }
+            if( verbose )
+            {
+                std::cout << "Out-of-core matrix in temp folder: " << tempFolder << ", row cache memory: " << matrixMemory << " GBytes" << std::endl;
+            }
+        }
+
         if ( variableMap.count( "version" ) )
         {
             std::cout << progName << ", version 2.0" << std::endl;
@@ -308,8 +456,8 @@ int main( int argc, char *argv[] )
 
 
         if (variableMap.count("inputf")) {
-            if(!boost::filesystem::is_directory(boost::filesystem::path(inputFolder))) {
-                std::cerr << "ERROR: input folder \""<<inputFolder<<"\" is not a directory"<<std::endl;
+            if(!boost::filesystem::is_directory(boost::filesystem::path(inputFolder)) && !boost::filesystem::is_regular_file(boost::filesystem::path(inputFolder))) {
+                std::cerr << "ERROR: input \""<<inputFolder<<"\" is neither a directory nor a packed matrix file"<<std::endl;
                 std::cerr << visibleOptions << std::endl;
                 exit(-1);
 
@@ -380,6 +528,14 @@ int main( int argc, char *argv[] )
             exit(-1);
         }
 
+        if( graphMethod == TG_SINGLE && mstSingle && nbLevel == 0 && ( halfMatrix || !tempFolder.empty() ) )
+        {
+            std::cerr << "ERROR: with --mst single linkage is built from the minimum spanning tree without loading the distance matrix,"
+                      << " options --half and --tempf (-T) cannot be used with it" << std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+
 
         std::string logFilename(outputFolder+"/"+progName+"_log.txt");
         std::ofstream logFile(logFilename.c_str());
@@ -419,6 +575,23 @@ int main( int argc, char *argv[] )
             exit(-1);
         }
         logFile << "Debug outputr:\t" << debug << std::endl;
+        if( nbLevel != 0 )
+        {
+            logFile << "Neighbourhood graph level:\t" << nbLevel << std::endl;
+            logFile << "Relative threshold:\t" << relativeThreshold << std::endl;
+            logFile << "Linear tract normalization:\t" << noLog << std::endl;
+        }
+        else
+        {
+            logFile << "Nearest-neighbour chains:\t" << nnChain << std::endl;
+            logFile << "Half precision matrix:\t" << halfMatrix << std::endl;
+            logFile << "Single linkage from minimum spanning tree:\t" << mstSingle << std::endl;
+        }
+        if( !tempFolder.empty() )
+        {
+            logFile << "Out-of-core temp folder:\t" << tempFolder << std::endl;
+            logFile << "Matrix row cache memory:\t" << matrixMemory << " GB" << std::endl;
+        }
         logFile <<"-------------"<<std::endl;
 
         /////////////////////////////////////////////////////////////////
@@ -430,6 +603,17 @@ int main( int argc, char *argv[] )
         builder.setInputFolder(inputFolder);
         builder.setOutputFolder(outputFolder);
         builder.setDebugOutput( debug );
+        builder.setNnChain( nnChain );
+        builder.setHalfMatrix( halfMatrix );
+        builder.setMstSingle( mstSingle );
+        if( nbLevel != 0 )
+        {
+            builder.setNeighbourhood( nbLevel, relativeThreshold, noLog );
+        }
+        if( !tempFolder.empty() )
+        {
+            builder.setOutOfCore( tempFolder, matrixMemory * 1024 * 1024 * 1024 );
+        }
         builder.buildGraph(graphMethod);
 
         /////////////////////////////////////////////////////////////////
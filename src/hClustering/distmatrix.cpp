@@ -38,6 +38,8 @@
 //         - As matrix will be simmetrical only upper triangle is computed.
 //         - Distance metric used is normalized dot product.
 //         - Memory and CPU heavy.
+//         - Interrupted runs are resumed automatically: completed blocks are recorded (with a checksum) in a journal file and are not computed again
+//           if their files are valid. Blocks that were being written when the run stopped are computed again.
 //
 //  * Arguments:
 //
@@ -61,6 +63,12 @@
 //
 //  [--finish]:       A pair of row-column integers indicating the last block where to finish the process. Posterior blocks will not be computed.
 //
+//  [--shard]:        Compute only one shard of the matrix, given as i/N (shard i of N, starting at 0), to distribute the computation among several processes or cluster nodes
+//                     writing to the same output folder. Blocks are divided in N contiguous ranges of similar computation cost. Starting and finishing blocks are ignored.
+//
+//  [--verify]:       Do not compute, check instead that the distance matrix in the output folder is complete and consistent with the index file
+//                     and the shard manifests (missing blocks are listed with the shard computing them). Input folder is not needed.
+//
 //  [-v --verbose]:   verbose output (recommended).
 //
 //  [-V --vverbose]:  Very verbose output. Writes additional progress information in the standard output.
@@ -69,6 +77,9 @@
 //
 //  [-m --memory]:    Approximate RAM memory amount to be made available and used by the program (in GBytes). Valid values [0.1,50]. Default: 0.5.
 //
+//  [--prefetch]:     Buffer depth of the tractogram prefetch pipeline: number of tractogram sub-blocks loaded in advance by I/O threads, plus one.
+//                     Use 1 to disable prefetching, 2 for double buffering, 3 for triple buffering. Every buffer counts against the memory limit. Default: 2.
+//
 //  [-z --zip]:       zip output files.
 //
 //  [--nolog]:        Treat input tractograms as being normalized in natural units rather than logarithmic.
@@ -85,7 +96,10 @@
 //
 //   - "roi_index.txt" - A file containing an index matching each seed coordinate to a block number and position within the block.
 //   - "dist_block_X_Y.nii(.v)" - Files containing the distance values for the submatrix in pasition XY within the full distance matrix.
-//   - "distmatrix_log.txt" - A text log file containing the parameter details and in-run and completion information of the program.
+//   - "dist_journal_X.txt" - Journal with the blocks completed by the run (X is the shard index, 0 if not sharded), used to resume interrupted runs.
+//   - "dist_shard_X.txt" - (only with --shard) A manifest file for shard X containing the matrix dimensions and the blocks computed by that shard.
+//   - "distmatrix_log.txt" - A text log file containing the parameter details and in-run and completion information of the program
+//                            ("distmatrix_shard_X_log.txt" with --shard, "distmatrix_verify_log.txt" with --verify).
 //
 //---------------------------------------------------------------------------
 
@@ -102,6 +116,7 @@
 // boost library
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
 
 // classes
 #include "distMatComputer.h"
@@ -124,13 +139,15 @@ int main( int argc, char *argv[] )
 
         // program parameters
         std::string roiFilename;
-        std::string tractFolder, outputFolder;
+        std::string tractFolder, outputFolder, shardString;
         std::vector<size_t> startBlock, finishBlock;
         std::pair<size_t, size_t> startPair, finishPair;
         size_t blocksize( 5000 );
+        size_t prefetchDepth( DEFAULT_PREFETCH_DEPTH );
+        size_t shardIndex( 0 ), shardCount( 1 );
         unsigned int threads(0);
         bool verbose( false ), veryVerbose( false ), niftiMode( true );
-        bool doZip( false ), noLog( false );
+        bool doZip( false ), noLog( false ), verifyOnly( false );
         float memory(0.5), relativeThreshold( 0 );
 
         // Declare a group of options that will be allowed only on command line
@@ -145,6 +162,8 @@ int main( int argc, char *argv[] )
                 ( "blocksize,b", boost::program_options::value< size_t >(&blocksize)->implicit_value(5000), "[opt] size of the blocks in which the matrix will be divided. If 0 maximum size for the available memmory will be used. Default: 5000." )
                 ( "start", boost::program_options::value< std::vector<size_t> >(&startBlock)->multitoken(), "[opt] A pair of row-column integers indicating the first block where to start the process. Previous blocks will not be computed." )
                 ( "finish", boost::program_options::value< std::vector<size_t> >(&finishBlock)->multitoken(), "[opt] A pair of row-column integers indicating the last block where to finish the process. Posterior blocks will not be computed." )
+                ( "shard", boost::program_options::value< std::string >(&shardString), "[opt] compute only shard i of N of the matrix, given as i/N (starting at 0). Blocks are assigned by computation cost." )
+                ( "verify", "[opt] check that the distance matrix in the output folder is complete and consistent with the index file and shard manifests." )
                 ;
 
         // Declare a group of options that will be allowed both on command line and in config file
@@ -154,6 +173,7 @@ int main( int argc, char *argv[] )
                 ( "vverbose,V", "[opt] very verbose output." )
                 ( "vista", "[opt] use vista file format (default is nifti)." )
                 ( "memory,m",  boost::program_options::value< float >(&memory)->implicit_value(0.5), "[opt] maximum of memory (in GBytes) to use for tractogram cache memory. Default: 0.5." )
+                ( "prefetch", boost::program_options::value< size_t >(&prefetchDepth), "[opt] buffer depth of the tractogram prefetch pipeline (1: no prefetching, 2: double buffering, 3: triple buffering). Default: 2." )
                 ( "zip,z", "[opt] zip output files.")
                 ( "nolog", "[opt] treat input tractograms as being in natural units rather than logarithmic" )
                 ( "pthreads,p",  boost::program_options::value< unsigned int >(&threads), "[opt] number of processing cores to run the program in. Default: all available." )
@@ -216,7 +236,9 @@ int main( int argc, char *argv[] )
             std::cout << "* Notes:" << std::endl;
             std::cout << "       - As matrix will be simmetrical only upper triangle is computed." << std::endl;
             std::cout << "       - Distance metric used is normalized dot product." << std::endl;
-            std::cout << "       - Memory and CPU heavy." << std::endl << std::endl;
+            std::cout << "       - Memory and CPU heavy." << std::endl;
+            std::cout << "       - Interrupted runs are resumed automatically: completed blocks are recorded (with a checksum) in a journal file and are not computed again" << std::endl;
+            std::cout << "         if their files are valid. Blocks that were being written when the run stopped are computed again." << std::endl << std::endl;
             std::cout << "* Arguments:" << std::endl << std::endl;
             std::cout << " --version:       Program version." << std::endl << std::endl;
             std::cout << " -h --help:       Produce extended program help message." << std::endl << std::endl;
@@ -229,10 +251,16 @@ int main( int argc, char *argv[] )
             std::cout << "[-b --blocksize]: Desired size (in number of elements per row/column) of the blocks the distance matrix will be subdivided in. Choose 0 for maximum size according to available memory. Default: 5000." << std::endl << std::endl;
             std::cout << "[--start]:        A pair of row-column integers indicating the first block where to start the process. Previous blocks will not be computed." << std::endl << std::endl;
             std::cout << "[--finish]:       A pair of row-column integers indicating the last block where to finish the process. Posterior blocks will not be computed." << std::endl << std::endl;
+            std::cout << "[--shard]:        Compute only one shard of the matrix, given as i/N (shard i of N, starting at 0), to distribute the computation among several processes or cluster nodes" << std::endl;
+            std::cout << "                    writing to the same output folder. Blocks are divided in N contiguous ranges of similar computation cost. Starting and finishing blocks are ignored." << std::endl << std::endl;
+            std::cout << "[--verify]:       Do not compute, check instead that the distance matrix in the output folder is complete and consistent with the index file" << std::endl;
+            std::cout << "                    and the shard manifests (missing blocks are listed with the shard computing them). Input folder is not needed." << std::endl << std::endl;
             std::cout << "[-v --verbose]:   verbose output (recommended)." << std::endl << std::endl;
             std::cout << "[-V --vverbose]:  Very verbose output. Writes additional progress information in the standard output." << std::endl << std::endl;
             std::cout << "[--vista]:        Read/write vista (.v) files [default is nifti (.nii) and compact (.cmpct) files]." << std::endl << std::endl;
             std::cout << "[-m --memory]:    Approximate RAM memory amount to be made available and used by the program (in GBytes). Valid values [0.1,50]. Default: 0.5." << std::endl << std::endl;
+            std::cout << "[--prefetch]:     Buffer depth of the tractogram prefetch pipeline: number of tractogram sub-blocks loaded in advance by I/O threads, plus one." << std::endl;
+            std::cout << "                   Use 1 to disable prefetching, 2 for double buffering, 3 for triple buffering. Every buffer counts against the memory limit. Default: 2." << std::endl << std::endl;
             std::cout << "[-z --zip]:       Zip output files." << std::endl << std::endl;
             std::cout << "[--nolog]:        Treat input tractograms as being normalized in natural units rather than logarithmic." << std::endl << std::endl;
             std::cout << "[-p --pthreads]:  Number of processing threads to run the program in parallel. Default: use all available processors." << std::endl << std::endl;
@@ -242,7 +270,10 @@ int main( int argc, char *argv[] )
             std::cout << "* Outputs (in output folder defined at option -O):" << std::endl << std::endl;
             std::cout << " - 'roi_index.txt'' - A file containing an index matching each seed coordinate to a block number and position within the block." << std::endl;
             std::cout << " - 'dist_block_X_Y.nii(.v)'' - Files containing the distance values for the submatrix in pasition XY within the full distance matrix." << std::endl;
-            std::cout << " - 'distmatrix_log.txt'' - A text log file containing the parameter details and in-run and completion information of the program." << std::endl;
+            std::cout << " - 'dist_journal_X.txt'' - Journal with the blocks completed by the run (X is the shard index, 0 if not sharded), used to resume interrupted runs." << std::endl;
+            std::cout << " - 'dist_shard_X.txt'' - (only with --shard) A manifest file for shard X containing the matrix dimensions and the blocks computed by that shard." << std::endl;
+            std::cout << " - 'distmatrix_log.txt'' - A text log file containing the parameter details and in-run and completion information of the program" << std::endl;
+            std::cout << "                           ('distmatrix_shard_X_log.txt' with --shard, 'distmatrix_verify_log.txt' with --verify)." << std::endl;
             std::cout << std::endl;
             exit(0);
         }
@@ -345,6 +376,15 @@ int main( int argc, char *argv[] )
             std::cerr << visibleOptions << std::endl;
             exit(-1);
         }
+        if ( variableMap.count( "verify" ) )
+        {
+            if( verbose )
+            {
+                std::cout << "Verifying distance matrix, no blocks will be computed" << std::endl;
+            }
+            verifyOnly = true;
+        }
+
         if (variableMap.count("inputf"))
         {
             if(!boost::filesystem::is_directory(boost::filesystem::path(tractFolder)))
@@ -358,7 +398,7 @@ int main( int argc, char *argv[] )
                 std::cout << "Single (leaf) tracts folder: "<< tractFolder << std::endl;
             }
         }
-        else
+        else if( !verifyOnly )
         {
             std::cerr << "ERROR: no single tract folder stated"<<std::endl;
             std::cerr << visibleOptions << std::endl;
@@ -414,6 +454,17 @@ int main( int argc, char *argv[] )
             std::cout <<"Maximum memory available to the program: "<< memory <<" GBytes"<< std::endl;
         }
 
+        if( prefetchDepth < 1 || prefetchDepth > 16 )
+        {
+            std::cerr << "ERROR: prefetch depth must be an integer between 1 and 16"<<std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+        if( verbose )
+        {
+            std::cout <<"Tractogram prefetch buffer depth: "<< prefetchDepth << std::endl;
+        }
+
         if( verbose )
         {
             std::cout <<"Desired distance matrix block size: ";
@@ -481,6 +532,42 @@ int main( int argc, char *argv[] )
             finishPair = std::make_pair< size_t, size_t >( 0, 0 );
         }
 
+        if ( variableMap.count( "shard" ) )
+        {
+            size_t slashPos( shardString.find( '/' ) );
+            try
+            {
+                if( slashPos == std::string::npos )
+                {
+                    throw boost::bad_lexical_cast();
+                }
+                shardIndex = boost::lexical_cast< size_t >( shardString.substr( 0, slashPos ) );
+                shardCount = boost::lexical_cast< size_t >( shardString.substr( slashPos + 1 ) );
+            }
+            catch( boost::bad_lexical_cast& )
+            {
+                std::cerr << "ERROR: shard must be given as i/N (i.e.: 0/4). Introduced: \"" << shardString << "\"" << std::endl;
+                std::cerr << visibleOptions << std::endl;
+                exit(-1);
+            }
+            if( shardCount == 0 || shardIndex >= shardCount )
+            {
+                std::cerr << "ERROR: shard index must be lower than the number of shards (shards are numbered from 0 to N-1)" << std::endl;
+                std::cerr << visibleOptions << std::endl;
+                exit(-1);
+            }
+            if( variableMap.count( "start" ) || variableMap.count( "finish" ) )
+            {
+                std::cerr << "WARNING: starting and finishing blocks are ignored when computing a shard." << std::endl;
+                startPair = std::make_pair< size_t, size_t >( 0, 0 );
+                finishPair = std::make_pair< size_t, size_t >( 0, 0 );
+            }
+            if( verbose )
+            {
+                std::cout << "Computing shard " << shardIndex << " of " << shardCount << std::endl;
+            }
+        }
+
 
         if ( variableMap.count( "nolog" ) )
         {
@@ -495,6 +582,14 @@ int main( int argc, char *argv[] )
         ///////////////////////
 
         std::string logFilename(outputFolder+"/"+progName+"_log.txt" );
+        if( verifyOnly )
+        {
+            logFilename = outputFolder+"/"+progName+"_verify_log.txt";
+        }
+        else if( shardCount > 1 )
+        {
+            logFilename = outputFolder+"/"+progName+"_shard_"+boost::lexical_cast< std::string >( shardIndex )+"_log.txt";
+        }
         std::ofstream logFile(logFilename.c_str() );
         if(!logFile)
         {
@@ -542,6 +637,8 @@ int main( int argc, char *argv[] )
         }
         logFile <<"Zip flag:\t"<< doZip <<std::endl;
         logFile <<"Available memory:\t"<< memory <<" GB"<<std::endl;
+        logFile <<"Prefetch depth:\t"<< prefetchDepth <<std::endl;
+        logFile <<"Shard:\t"<< shardIndex << "/" << shardCount <<std::endl;
         logFile <<"-------------"<<std::endl;
 
 
@@ -549,8 +646,22 @@ int main( int argc, char *argv[] )
 
 
         distMatComputer distMat( roiFilename, relativeThreshold, verbose, noLog);
+
+        if( verifyOnly )
+        {
+            distMat.setOutputFolder( outputFolder );
+            bool matrixComplete( distMat.verifyMatrix() );
+            logFile << "Verification:\t" << ( matrixComplete ? "complete" : "INCOMPLETE" ) << std::endl;
+            return ( matrixComplete ? 0 : 1 );
+        }
+
         distMat.setInputFolder( tractFolder );
         distMat.setOutputFolder( outputFolder );
+        distMat.setPrefetchDepth( prefetchDepth );
+        if( shardCount > 1 )
+        {
+            distMat.setShard( shardIndex, shardCount );
+        }
         distMat.setBlockSize( memory, blocksize );
         if( startPair.first != 0 && startPair.second != 0 )
         {
@@ -0,0 +1,496 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+//
+//  graphenginebench
+//
+//  Regression check and timing driver of the graph linkage engines: generates a random distance matrix
+//   for each seed count, builds the tree of each linkage with the global minimum scan engine (the buildgraphtree default)
+//   and with the nearest-neighbour chain engine (as buildgraphtree --chain), checks that both trees are identical and reports the build times.
+//   Single linkage is also built with the minimum spanning tree engine (as buildgraphtree --mst) and checked to have the same clusters
+//   at every level as the scan tree (the merge order of tied pairs is not checked).
+//   Exits with a non-zero status if any full precision chain tree differs in merge order or topology, or any spanning tree in its clusters.
+//
+//  * Arguments:
+//
+//   --version:       Program version.
+//
+//   -h --help:       Produce extended program help message.
+//
+//   -O --outputf:    Working folder where the generated roi files, packed matrices and trees will be written.
+//
+//  [-n --seeds]:     Numbers of seed voxels of the generated matrices. Default: 20000 40000 60000.
+//
+//  [-g --graph]:     Graph linkages to build (0=single, 1=complete, 2=average, 3=weighted). Default: 0 1 2 3.
+//                     Ward linkage always uses the scan engine and is not accepted.
+//
+//  [-d --dims]:      Dimension of the random points the distances are computed from. Default: 8.
+//
+//  [--half]:         Store the generated matrices and the working matrix in 16 bit floats (half the memory).
+//                     Many distances tie at this precision and the engines may merge tied pairs in a different order, so differences
+//                     are reported but not counted as failures.
+//
+//  [-T --tempf]:     Build the trees out-of-core, keeping the working matrix in this folder.
+//
+//  [-m --cache-mem]: Memory (in GBytes) for the out-of-core row cache (only with -T). Default: 1.
+//
+//  [-k --keep]:      Keep the generated matrices (by default they are deleted after each seed count).
+//
+//  [-v --verbose]:   verbose output.
+//
+//
+//  * Usage example:
+//
+//   graphenginebench -O bench/ -n 20000 40000 60000 -g 1 2 --half
+//
+//
+//  * Outputs (in output folder defined at option -O):
+//
+//   - 'roi_N.txt', 'matrix_N.pk' - (where N is the number of seeds) generated roi and packed distance matrix.
+//   - 'scan_N/', 'chain_N/' - trees built by each engine.
+//   - On standard output, one line per seed count and linkage with the build time of each engine (including the matrix loading),
+//      the speedup, the number of tree nodes whose children differ between both engines (must be 0),
+//      and the largest difference between their node distance levels (float rounding only).
+//
+//---------------------------------------------------------------------------
+
+// std librabry
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <cmath>
+
+// parallel execution
+#include <omp.h>
+
+// boost library
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+// classes
+#include "graphTreeBuilder.h"
+#include "packedDistMatrix.h"
+#include "WHtree.h"
+
+
+
+// A helper function to simplify the main part.
+template<class T>
+std::ostream& operator<<(std::ostream& os, const std::vector<T>& v)
+{
+    copy(v.begin(), v.end(), std::ostream_iterator<T>(os, " "));
+    return os;
+}
+
+// writes a roi file with the seeds placed on a cubic grid, tractograms named by index
+void writeRoi( const std::string& roiFilename, const size_t numSeeds, std::vector< WHcoord >* const coordsPointer )
+{
+    std::vector< WHcoord >& coords( *coordsPointer );
+    const size_t side( std::ceil( std::pow( ( double ) numSeeds, 1.0 / 3.0 ) ) + 1 );
+    coords.clear();
+    coords.reserve( numSeeds );
+    for( size_t i = 0; i < numSeeds; ++i )
+    {
+        coords.push_back( WHcoord( i % side, ( i / side ) % side, i / ( side * side ) ) );
+    }
+
+    std::ofstream roiFile( roiFilename.c_str() );
+    if( !roiFile )
+    {
+        throw std::runtime_error( "ERROR @ writeRoi(): unable to open roi file: " + roiFilename );
+    }
+    roiFile << "#imagesize" << std::endl << side << " " << side << " " << side << " nifti" << std::endl << "#endimagesize" << std::endl << std::endl;
+    roiFile << "#streams" << std::endl << 5000 << std::endl << "#endstreams" << std::endl << std::endl;
+    roiFile << "#roi" << std::endl;
+    for( size_t i = 0; i < numSeeds; ++i )
+    {
+        roiFile << coords[i].m_x << " " << coords[i].m_y << " " << coords[i].m_z << std::endl;
+    }
+    roiFile << "#endroi" << std::endl << std::endl << "#trackindex" << std::endl;
+    for( size_t i = 0; i < numSeeds; ++i )
+    {
+        roiFile << i << std::endl;
+    }
+    roiFile << "#endtrackindex" << std::endl;
+}
+
+// writes a packed matrix with the normalized euclidean distances between random points (values in [0,1])
+void writeMatrix( const std::string& matrixFilename, const std::vector< WHcoord >& coords, const size_t dims, const bool halfMatrix )
+{
+    const size_t numSeeds( coords.size() );
+    std::vector< float > points( numSeeds * dims );
+    srand( 1 );
+    for( size_t i = 0; i < points.size(); ++i )
+    {
+        points[i] = rand() / ( float ) RAND_MAX;
+    }
+
+    packedDistMatrix matrix;
+    matrix.create( matrixFilename, halfMatrix ? PSFloat16 : PSFloat32, coords, 1000 );
+    for( size_t i = 0; i < numSeeds; ++i )
+    {
+        const float* point1( &points[i * dims] );
+        for( size_t j = i + 1; j < numSeeds; ++j )
+        {
+            const float* point2( &points[j * dims] );
+            float sum( 0 );
+            for( size_t d = 0; d < dims; ++d )
+            {
+                const float diff( point1[d] - point2[d] );
+                sum += diff * diff;
+            }
+            matrix.setDistance( i, j, std::sqrt( sum / dims ) );
+        }
+    }
+    matrix.close();
+}
+
+// returns the number of nodes with different children between two trees (nodes are numbered in merge order, so this covers both the merge order
+// and the topology), and the largest difference between their distance levels (average and weighted levels are accumulated in a different
+// merge order by each engine, so they may differ in the last digits)
+size_t compareTrees( const std::string& treeFilename1, const std::string& treeFilename2, dist_t* const maxLevelDiff )
+{
+    WHtree tree1( treeFilename1 ), tree2( treeFilename2 );
+    *maxLevelDiff = 0;
+    if( tree1.getNumNodes() != tree2.getNumNodes() )
+    {
+        return std::max( tree1.getNumNodes(), tree2.getNumNodes() );
+    }
+    size_t mismatches( 0 );
+    for( size_t i = 0; i < tree1.getNumNodes(); ++i )
+    {
+        const WHnode& node1( tree1.getNode( i ) );
+        const WHnode& node2( tree2.getNode( i ) );
+        if( node1.getChildren() != node2.getChildren() )
+        {
+            ++mismatches;
+        }
+        *maxLevelDiff = std::max( *maxLevelDiff, std::fabs( node1.getDistLevel() - node2.getDistLevel() ) );
+    }
+    return mismatches;
+}
+
+// returns the number of single linkage clusters of the first tree that are not in the second one. Nodes at the level of their parent are merged into it,
+// so that the clusters do not depend on the order in which tied pairs were merged: every cluster is then identified by its level and its lowest leaf,
+// and is compared together with the cluster it belongs to
+size_t compareSingleClusters( const std::string& treeFilename1, const std::string& treeFilename2 )
+{
+    typedef std::pair< dist_t, size_t > clusterKey_t;
+    std::vector< std::pair< clusterKey_t, clusterKey_t > > memberships[2];
+    for( size_t t = 0; t < 2; ++t )
+    {
+        WHtree tree( t == 0 ? treeFilename1 : treeFilename2 );
+        const size_t numNodes( tree.getNumNodes() );
+        std::vector< size_t > lowestLeaves( numNodes );
+        for( size_t i = 0; i < numNodes; ++i )
+        {
+            const std::vector< nodeID_t > children( tree.getNode( i ).getChildren() );
+            lowestLeaves[i] = tree.getNumLeaves();
+            for( size_t c = 0; c < children.size(); ++c )
+            {
+                lowestLeaves[i] = std::min( lowestLeaves[i], children[c].first ? lowestLeaves[children[c].second] : children[c].second );
+            }
+        }
+
+        // nodes are numbered in merge order, so parents are visited before their children
+        std::vector< size_t > clusters( numNodes, numNodes - 1 ); // node of the cluster each node is merged into
+        for( size_t i = numNodes; i-- > 0; )
+        {
+            const dist_t level( tree.getNode( i ).getDistLevel() );
+            const bool ownCluster( i + 1 == numNodes || tree.getNode( tree.getNode( i ).getParent() ).getDistLevel() != level );
+            const size_t cluster( ownCluster ? i : clusters[i] );
+            const clusterKey_t clusterKey( level, lowestLeaves[i] );
+            if( ownCluster && i + 1 != numNodes )
+            {
+                memberships[t].push_back( std::make_pair( clusterKey, clusterKey_t( tree.getNode( clusters[i] ).getDistLevel(), lowestLeaves[clusters[i]] ) ) );
+            }
+            const std::vector< nodeID_t > children( tree.getNode( i ).getChildren() );
+            for( size_t c = 0; c < children.size(); ++c )
+            {
+                if( children[c].first )
+                {
+                    clusters[children[c].second] = cluster;
+                }
+                else
+                {
+                    memberships[t].push_back( std::make_pair( clusterKey_t( -1, children[c].second ), clusterKey_t( tree.getNode( cluster ).getDistLevel(), lowestLeaves[cluster] ) ) );
+                }
+            }
+        }
+        std::sort( memberships[t].begin(), memberships[t].end() );
+    }
+
+    std::vector< std::pair< clusterKey_t, clusterKey_t > > missing;
+    std::set_difference( memberships[0].begin(), memberships[0].end(), memberships[1].begin(), memberships[1].end(), std::back_inserter( missing ) );
+    return missing.size();
+}
+
+int main( int argc, char *argv[] )
+{
+        // ========== PROGRAM PARAMETERS ==========
+
+        std::string progName("graphenginebench");
+
+        // program parameters
+        std::string outputFolder, tempFolder;
+        std::vector< size_t > seedCounts;
+        std::vector< unsigned int > selectors;
+        size_t dims( 8 );
+        float memory( 1 );
+        bool verbose( false ), halfMatrix( false ), keepMatrix( false );
+
+        // Declare a group of options that will be allowed only on command line
+        boost::program_options::options_description genericOptions("Generic options");
+        genericOptions.add_options()
+                ( "version", "Program version" )
+                ( "help,h", "Produce extended program help message" )
+                ( "outputf,O",  boost::program_options::value< std::string >(&outputFolder), "working folder where matrices and trees will be written")
+                ;
+
+        // Declare a group of options that will be allowed both on command line and in config file
+        boost::program_options::options_description configOptions("Configuration");
+        configOptions.add_options()
+                ( "seeds,n", boost::program_options::value< std::vector< size_t > >(&seedCounts)->multitoken(), "[opt] numbers of seeds of the generated matrices (default: 20000 40000 60000)")
+                ( "graph,g", boost::program_options::value< std::vector< unsigned int > >(&selectors)->multitoken(), "[opt] graph linkages to build (0=single, 1=complete, 2=average, 3=weighted). Default: all")
+                ( "dims,d", boost::program_options::value< size_t >(&dims), "[opt] dimension of the random points (default: 8)")
+                ( "half", "[opt] store the matrices in 16 bit floats")
+                ( "tempf,T",  boost::program_options::value< std::string >(&tempFolder), "[opt] build out-of-core, keeping the working matrix in this folder")
+                ( "cache-mem,m",  boost::program_options::value< float >(&memory), "[opt] memory (GB) of the out-of-core row cache (default: 1)")
+                ( "keep,k", "[opt] keep the generated matrices")
+                ( "verbose,v", "[opt] verbose output." )
+                ;
+
+        boost::program_options::options_description cmdlineOptions;
+        cmdlineOptions.add(genericOptions).add(configOptions);
+        boost::program_options::options_description visibleOptions("Allowed options");
+        visibleOptions.add(genericOptions).add(configOptions);
+
+        boost::program_options::variables_map variableMap;
+        store(boost::program_options::command_line_parser(argc, argv).options(cmdlineOptions).run(), variableMap);
+        notify(variableMap);
+
+        if (variableMap.count("help"))
+        {
+            std::cout << "graphenginebench" << std::endl << std::endl;
+            std::cout << "Regression check and timing driver of the graph linkage engines: generates a random distance matrix" << std::endl;
+            std::cout << " for each seed count, builds the tree of each linkage with the global minimum scan engine (the buildgraphtree default)" << std::endl;
+            std::cout << " and with the nearest-neighbour chain engine (as buildgraphtree --chain), checks that both trees are identical and reports the build times." << std::endl;
+            std::cout << " Exits with a non-zero status if any tree differs in merge order or topology." << std::endl << std::endl;
+            std::cout << "* Arguments:" << std::endl << std::endl;
+            std::cout << " --version:       Program version." << std::endl << std::endl;
+            std::cout << " -h --help:       produce extended program help message." << std::endl << std::endl;
+            std::cout << " -O --outputf:    Working folder where the generated roi files, packed matrices and trees will be written." << std::endl << std::endl;
+            std::cout << "[-n --seeds]:     Numbers of seed voxels of the generated matrices. Default: 20000 40000 60000." << std::endl << std::endl;
+            std::cout << "[-g --graph]:     Graph linkages to build (0=single, 1=complete, 2=average, 3=weighted). Default: 0 1 2 3." << std::endl;
+            std::cout << "                   Ward linkage always uses the scan engine and is not accepted." << std::endl << std::endl;
+            std::cout << "[-d --dims]:      Dimension of the random points the distances are computed from. Default: 8." << std::endl << std::endl;
+            std::cout << "[--half]:         Store the generated matrices and the working matrix in 16 bit floats (half the memory)." << std::endl;
+            std::cout << "                   Many distances tie at this precision and the engines may merge tied pairs in a different order, so differences" << std::endl;
+            std::cout << "                   are reported but not counted as failures." << std::endl << std::endl;
+            std::cout << "[-T --tempf]:     Build the trees out-of-core, keeping the working matrix in this folder." << std::endl << std::endl;
+            std::cout << "[-m --cache-mem]: Memory (in GBytes) for the out-of-core row cache (only with -T). Default: 1." << std::endl << std::endl;
+            std::cout << "[-k --keep]:      Keep the generated matrices (by default they are deleted after each seed count)." << std::endl << std::endl;
+            std::cout << "[-v --verbose]:   verbose output." << std::endl << std::endl;
+            std::cout << std::endl;
+            std::cout << "* Usage example:" << std::endl << std::endl;
+            std::cout << " graphenginebench -O bench/ -n 20000 40000 60000 -g 1 2 --half" << std::endl << std::endl;
+            std::cout << std::endl;
+            std::cout << "* Outputs (in output folder defined at option -O):" << std::endl << std::endl;
+            std::cout << " - 'roi_N.txt', 'matrix_N.pk' - (where N is the number of seeds) generated roi and packed distance matrix." << std::endl;
+            std::cout << " - 'scan_N/', 'chain_N/' - trees built by each engine." << std::endl;
+            std::cout << " - On standard output, one line per seed count and linkage with the build time of each engine (including the matrix loading)," << std::endl;
+            std::cout << "    the speedup, the number of tree nodes whose children differ between both engines (must be 0)," << std::endl;
+            std::cout << "    and the largest difference between their node distance levels (float rounding only)." << std::endl;
+            std::cout << std::endl;
+            exit(0);
+        }
+        if (variableMap.count("version")) {
+            std::cout << progName <<", version 2.0"<<std::endl;
+            exit(0);
+        }
+        if (variableMap.count("verbose")) {
+            std::cout << "verbose output"<<std::endl;
+            verbose=true;
+        }
+        halfMatrix = variableMap.count( "half" );
+        keepMatrix = variableMap.count( "keep" );
+
+        if (variableMap.count("outputf")) {
+            if(!boost::filesystem::is_directory(boost::filesystem::path(outputFolder))) {
+                std::cerr << "ERROR: output folder \""<<outputFolder<<"\" is not a directory"<<std::endl;
+                std::cerr << visibleOptions << std::endl;
+                exit(-1);
+            }
+            std::cout << "Output folder: "<< outputFolder << std::endl;
+        } else {
+            std::cerr << "ERROR: no output folder stated"<<std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+
+        if( !tempFolder.empty() && !boost::filesystem::is_directory( boost::filesystem::path( tempFolder ) ) )
+        {
+            std::cerr << "ERROR: temp folder \"" << tempFolder << "\" is not a directory" << std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+
+        if( seedCounts.empty() )
+        {
+            seedCounts.push_back( 20000 );
+            seedCounts.push_back( 40000 );
+            seedCounts.push_back( 60000 );
+        }
+        if( selectors.empty() )
+        {
+            for( unsigned int i = 0; i < 4; ++i )
+            {
+                selectors.push_back( i );
+            }
+        }
+        for( size_t i = 0; i < selectors.size(); ++i )
+        {
+            if( selectors[i] > 3 )
+            {
+                std::cerr << "ERROR: graph linkage must be one of 0=single, 1=complete, 2=average, 3=weighted" << std::endl;
+                std::cerr << visibleOptions << std::endl;
+                exit(-1);
+            }
+        }
+        if( dims == 0 )
+        {
+            std::cerr << "ERROR: point dimension must be positive" << std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+
+        size_t failedBuilds( 0 );
+        const std::string graphNames[4] = { "single", "complete", "average", "weighted" };
+        const std::string engineNames[3] = { "scan", "chain", "mst" };
+
+        /////////////////////////////////////////////////////////////////
+
+        for( size_t s = 0; s < seedCounts.size(); ++s )
+        {
+            const size_t numSeeds( seedCounts[s] );
+            if( numSeeds < 2 )
+            {
+                continue;
+            }
+            std::stringstream seedString;
+            seedString << numSeeds;
+            const std::string roiFilename( outputFolder + "/roi_" + seedString.str() + ".txt" );
+            const std::string matrixFilename( outputFolder + "/matrix_" + seedString.str() + ".pk" );
+
+            double startTime( omp_get_wtime() );
+            std::vector< WHcoord > coords;
+            writeRoi( roiFilename, numSeeds, &coords );
+            writeMatrix( matrixFilename, coords, dims, halfMatrix );
+            std::cout << "n=" << numSeeds << "\tmatrix generated in " << std::fixed << std::setprecision( 1 ) << omp_get_wtime() - startTime << " s" << std::endl;
+            std::cout.unsetf( std::ios::floatfield );
+
+            for( size_t g = 0; g < selectors.size(); ++g )
+            {
+                // single linkage is also built from the minimum spanning tree
+                const size_t engineCount( selectors[g] == TG_SINGLE ? 3 : 2 );
+                double engineTime[3];
+                std::string treeFilename[3];
+                for( size_t e = 0; e < engineCount; ++e )
+                {
+                    const std::string treeFolder( outputFolder + "/" + engineNames[e] + "_" + seedString.str() );
+                    boost::filesystem::create_directory( boost::filesystem::path( treeFolder ) );
+                    treeFilename[e] = treeFolder + "/" + graphNames[selectors[g]] + ".txt";
+
+                    graphTreeBuilder builder( roiFilename, verbose );
+                    builder.setInputFolder( matrixFilename );
+                    builder.setOutputFolder( treeFolder );
+                    builder.setNnChain( e == 1 );
+                    builder.setHalfMatrix( halfMatrix );
+                    builder.setMstSingle( e == 2 );
+                    if( !tempFolder.empty() )
+                    {
+                        builder.setOutOfCore( tempFolder, memory * 1024 * 1024 * 1024 );
+                    }
+                    startTime = omp_get_wtime();
+                    builder.buildGraph( ( TG_GRAPHTYPE ) selectors[g] );
+                    engineTime[e] = omp_get_wtime() - startTime;
+                }
+                for( size_t e = 1; e < engineCount; ++e )
+                {
+                    dist_t maxLevelDiff( 0 );
+                    const size_t mismatches( compareTrees( treeFilename[0], treeFilename[e], &maxLevelDiff ) );
+                    std::cout << "n=" << numSeeds << "\t" << graphNames[selectors[g]] << std::fixed << std::setprecision( 1 )
+                              << "\tscan " << engineTime[0] << " s\t" << engineNames[e] << " " << engineTime[e] << " s\tx" << engineTime[0] / engineTime[e]
+                              << "\tnode mismatches " << mismatches << std::scientific << std::setprecision( 1 )
+                              << "\tmax level diff " << maxLevelDiff;
+                    std::cout.unsetf( std::ios::floatfield );
+
+                    if( e == 2 )
+                    {
+                        // the spanning tree engine only sees the tree edges, so tied pairs can be merged in any order: only the clusters are checked
+                        const size_t clusterMismatches( compareSingleClusters( treeFilename[0], treeFilename[e] ) );
+                        std::cout << "\tcluster mismatches " << clusterMismatches;
+                        if( clusterMismatches != 0 )
+                        {
+                            ++failedBuilds;
+                        }
+                    }
+                    else if( mismatches != 0 && !halfMatrix )
+                    {
+                        // at half precision the engines may take tied pairs in a different order, giving different but equally valid trees
+                        ++failedBuilds;
+                    }
+                    std::cout << std::endl;
+                }
+            }
+
+            if( !keepMatrix )
+            {
+                boost::filesystem::remove( boost::filesystem::path( matrixFilename ) );
+            }
+        }
+
+        /////////////////////////////////////////////////////////////////
+
+        if( failedBuilds != 0 )
+        {
+            std::cerr << "ERROR: " << failedBuilds << " chain or minimum spanning tree engine trees differ from the scan engine trees" << std::endl;
+            return 1;
+        }
+
+    return 0;
+}
@@ -0,0 +1,364 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+//
+//  nodeheapbench
+//
+//  Microbenchmark of the centroid tree builders' priority queue: replays a synthetic agglomeration trace
+//   (top pops, neighbour removals, neighbour distance updates and new node insertions) on the indexed nodeHeap and on the
+//   std::multimap frontier it replaced, reports merges per second and checks that both return the same merge order.
+//
+//  * Arguments:
+//
+//   --version:       Program version.
+//
+//   -h --help:       Produce extended program help message.
+//
+//  [-l --leaves]:    Numbers of leaves of the replayed traces. Default: 100000 1000000.
+//
+//  [-n --nbhood]:    Neighbour distance updates per merge. Default: 26.
+//
+//  [-r --reps]:      Number of replays per trace, the best time is reported. Default: 3.
+//
+//
+//  * Usage example:
+//
+//   nodeheapbench -l 50000 500000 -n 124
+//
+//
+//  * Outputs (on standard output):
+//
+//   - One line per trace with the number of merges and queue operations, the replay time and merges per second
+//      of each queue, the speedup, and the number of merges popped in a different order (should be 0).
+//
+//---------------------------------------------------------------------------
+
+// std librabry
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <map>
+#include <algorithm>
+
+// parallel execution
+#include <omp.h>
+
+// boost library
+#include <boost/program_options.hpp>
+
+// classes
+#include "nodeHeap.h"
+
+
+// A queue operation of the replayed trace
+struct queueOp
+{
+    enum opType { UPDATE, ERASE, POP };
+    opType type;        //!< push or update, erase, or pop the top element
+    nodeID_t id;        //!< element ID
+    dist_t dist;        //!< new distance (UPDATE only)
+};
+
+typedef std::multimap< dist_t, nodeID_t > frontier_t;
+
+// A helper function to simplify the main part.
+template<class T>
+std::ostream& operator<<(std::ostream& os, const std::vector<T>& v)
+{
+    copy(v.begin(), v.end(), std::ostream_iterator<T>(os, " "));
+    return os;
+}
+
+// slot of an element in a table with leaves first and then nodes
+inline size_t idSlot( const nodeID_t& id, size_t numLeaves )
+{
+    return id.first ? numLeaves + id.second : id.second;
+}
+
+inline dist_t randomDist()
+{
+    return ( dist_t ) ( ( rand() % 100000 ) / 100000.0 );
+}
+
+// removes an element from the live element list in constant time
+void removeLive( const nodeID_t& id, size_t numLeaves, std::vector< nodeID_t >* livePointer, std::vector< size_t >* livePosPointer )
+{
+    std::vector< nodeID_t >& live( *livePointer );
+    std::vector< size_t >& livePos( *livePosPointer );
+    const size_t pos( livePos[idSlot( id, numLeaves )] );
+    live[pos] = live.back();
+    livePos[idSlot( live.back(), numLeaves )] = pos;
+    live.pop_back();
+}
+
+// generates an agglomeration trace: each merge pops the top element, removes a random partner,
+// updates the distances of nbUpdates random live elements and inserts the new node.
+// A shadow multimap provides the top element so the trace is valid for both queues.
+size_t makeTrace( size_t numLeaves, size_t nbUpdates, std::vector< queueOp >* tracePointer )
+{
+    std::vector< queueOp >& trace( *tracePointer );
+    trace.clear();
+    srand( 7 );
+
+    frontier_t shadow;
+    std::vector< frontier_t::iterator > shadowPos( 2 * numLeaves, shadow.end() );
+    std::vector< nodeID_t > live;
+    std::vector< size_t > livePos( 2 * numLeaves, 0 );
+    live.reserve( numLeaves );
+
+    for( size_t i = 0; i < numLeaves; ++i )
+    {
+        queueOp op = { queueOp::UPDATE, nodeID_t( false, i ), randomDist() };
+        trace.push_back( op );
+        shadowPos[i] = shadow.insert( std::make_pair( op.dist, op.id ) );
+        livePos[i] = live.size();
+        live.push_back( op.id );
+    }
+
+    size_t numNodes( 0 );
+    while( live.size() > 1 )
+    {
+        nodeID_t topID( shadow.begin()->second );
+        queueOp popOp = { queueOp::POP, topID, 0 };
+        trace.push_back( popOp );
+        shadow.erase( shadow.begin() );
+        removeLive( topID, numLeaves, &live, &livePos );
+
+        nodeID_t partnerID( live[rand() % live.size()] );
+        queueOp eraseOp = { queueOp::ERASE, partnerID, 0 };
+        trace.push_back( eraseOp );
+        shadow.erase( shadowPos[idSlot( partnerID, numLeaves )] );
+        removeLive( partnerID, numLeaves, &live, &livePos );
+
+        for( size_t k = 0; k < nbUpdates && !live.empty(); ++k )
+        {
+            queueOp updateOp = { queueOp::UPDATE, live[rand() % live.size()], randomDist() };
+            trace.push_back( updateOp );
+            const size_t slot( idSlot( updateOp.id, numLeaves ) );
+            shadow.erase( shadowPos[slot] );
+            shadowPos[slot] = shadow.insert( std::make_pair( updateOp.dist, updateOp.id ) );
+        }
+
+        queueOp nodeOp = { queueOp::UPDATE, nodeID_t( true, numNodes++ ), randomDist() };
+        trace.push_back( nodeOp );
+        const size_t slot( idSlot( nodeOp.id, numLeaves ) );
+        shadowPos[slot] = shadow.insert( std::make_pair( nodeOp.dist, nodeOp.id ) );
+        livePos[slot] = live.size();
+        live.push_back( nodeOp.id );
+    }
+    return numNodes;
+}
+
+// replays the trace on a multimap frontier with per-element iterators, as the builders did before nodeHeap
+void replayMultimap( const std::vector< queueOp >& trace, size_t numLeaves, std::vector< nodeID_t >* topsPointer )
+{
+    frontier_t frontier;
+    std::vector< frontier_t::iterator > positions( 2 * numLeaves, frontier.end() );
+    topsPointer->clear();
+    for( size_t i = 0; i < trace.size(); ++i )
+    {
+        const queueOp& op( trace[i] );
+        if( op.type == queueOp::UPDATE )
+        {
+            frontier_t::iterator& pos( positions[idSlot( op.id, numLeaves )] );
+            if( pos != frontier.end() )
+            {
+                frontier.erase( pos );
+            }
+            pos = frontier.insert( std::make_pair( op.dist, op.id ) );
+        }
+        else if( op.type == queueOp::ERASE )
+        {
+            frontier_t::iterator& pos( positions[idSlot( op.id, numLeaves )] );
+            frontier.erase( pos );
+            pos = frontier.end();
+        }
+        else
+        {
+            const nodeID_t topID( frontier.begin()->second );
+            topsPointer->push_back( topID );
+            positions[idSlot( topID, numLeaves )] = frontier.end();
+            frontier.erase( frontier.begin() );
+        }
+    }
+}
+
+// replays the trace on the indexed heap
+void replayHeap( const std::vector< queueOp >& trace, size_t numLeaves, std::vector< nodeID_t >* topsPointer )
+{
+    nodeHeap frontier( numLeaves );
+    topsPointer->clear();
+    for( size_t i = 0; i < trace.size(); ++i )
+    {
+        const queueOp& op( trace[i] );
+        if( op.type == queueOp::UPDATE )
+        {
+            frontier.push( op.id, op.dist );
+        }
+        else if( op.type == queueOp::ERASE )
+        {
+            frontier.erase( op.id );
+        }
+        else
+        {
+            topsPointer->push_back( frontier.topID() );
+            frontier.pop();
+        }
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+        // ========== PROGRAM PARAMETERS ==========
+
+        std::string progName("nodeheapbench");
+
+        // program parameters
+        std::vector< size_t > leafCounts;
+        size_t nbUpdates( 26 ), reps( 3 );
+
+        // Declare a group of options that will be allowed only on command line
+        boost::program_options::options_description genericOptions("Generic options");
+        genericOptions.add_options()
+                ( "version", "Program version" )
+                ( "help,h", "Produce extended program help message" )
+                ;
+
+        // Declare a group of options that will be allowed both on command line and in config file
+        boost::program_options::options_description configOptions("Configuration");
+        configOptions.add_options()
+                ( "leaves,l", boost::program_options::value< std::vector< size_t > >(&leafCounts)->multitoken(), "[opt] numbers of leaves of the replayed traces (default: 100000 1000000)")
+                ( "nbhood,n", boost::program_options::value< size_t >(&nbUpdates), "[opt] neighbour distance updates per merge (default: 26)")
+                ( "reps,r", boost::program_options::value< size_t >(&reps), "[opt] replays per trace, the best time is reported (default: 3)")
+                ;
+
+        boost::program_options::options_description cmdlineOptions;
+        cmdlineOptions.add(genericOptions).add(configOptions);
+        boost::program_options::options_description visibleOptions("Allowed options");
+        visibleOptions.add(genericOptions).add(configOptions);
+
+        boost::program_options::variables_map variableMap;
+        store(boost::program_options::command_line_parser(argc, argv).options(cmdlineOptions).run(), variableMap);
+        notify(variableMap);
+
+        if (variableMap.count("help"))
+        {
+            std::cout << "nodeheapbench" << std::endl << std::endl;
+            std::cout << "Microbenchmark of the centroid tree builders' priority queue: replays a synthetic agglomeration trace" << std::endl;
+            std::cout << " (top pops, neighbour removals, neighbour distance updates and new node insertions) on the indexed nodeHeap and on the" << std::endl;
+            std::cout << " std::multimap frontier it replaced, reports merges per second and checks that both return the same merge order." << std::endl << std::endl;
+            std::cout << "* Arguments:" << std::endl << std::endl;
+            std::cout << " --version:       Program version." << std::endl << std::endl;
+            std::cout << " -h --help:       produce extended program help message." << std::endl << std::endl;
+            std::cout << "[-l --leaves]:    Numbers of leaves of the replayed traces. Default: 100000 1000000." << std::endl << std::endl;
+            std::cout << "[-n --nbhood]:    Neighbour distance updates per merge. Default: 26." << std::endl << std::endl;
+            std::cout << "[-r --reps]:      Number of replays per trace, the best time is reported. Default: 3." << std::endl << std::endl;
+            std::cout << std::endl;
+            std::cout << "* Usage example:" << std::endl << std::endl;
+            std::cout << " nodeheapbench -l 50000 500000 -n 124" << std::endl << std::endl;
+            std::cout << std::endl;
+            std::cout << "* Outputs (on standard output):" << std::endl << std::endl;
+            std::cout << " - One line per trace with the number of merges and queue operations, the replay time and merges per second" << std::endl;
+            std::cout << "    of each queue, the speedup, and the number of merges popped in a different order (should be 0)." << std::endl;
+            std::cout << std::endl;
+            exit(0);
+        }
+        if (variableMap.count("version")) {
+            std::cout << progName <<", version 2.0"<<std::endl;
+            exit(0);
+        }
+        if( leafCounts.empty() )
+        {
+            leafCounts.push_back( 100000 );
+            leafCounts.push_back( 1000000 );
+        }
+        if( reps == 0 )
+        {
+            std::cerr << "ERROR: number of replays must be positive" << std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+
+        /////////////////////////////////////////////////////////////////
+
+        for( size_t l = 0; l < leafCounts.size(); ++l )
+        {
+            const size_t numLeaves( leafCounts[l] );
+            if( numLeaves < 2 )
+            {
+                continue;
+            }
+            std::vector< queueOp > trace;
+            const size_t merges( makeTrace( numLeaves, nbUpdates, &trace ) );
+
+            std::vector< nodeID_t > mapTops, heapTops;
+            mapTops.reserve( merges );
+            heapTops.reserve( merges );
+            double mapTime( 0 ), heapTime( 0 );
+            for( size_t r = 0; r < reps; ++r )
+            {
+                double startTime( omp_get_wtime() );
+                replayMultimap( trace, numLeaves, &mapTops );
+                const double thisMapTime( omp_get_wtime() - startTime );
+
+                startTime = omp_get_wtime();
+                replayHeap( trace, numLeaves, &heapTops );
+                const double thisHeapTime( omp_get_wtime() - startTime );
+
+                mapTime = ( r == 0 ) ? thisMapTime : std::min( mapTime, thisMapTime );
+                heapTime = ( r == 0 ) ? thisHeapTime : std::min( heapTime, thisHeapTime );
+            }
+
+            size_t mismatches( 0 );
+            for( size_t i = 0; i < merges; ++i )
+            {
+                if( mapTops[i] != heapTops[i] )
+                {
+                    ++mismatches;
+                }
+            }
+
+            std::cout << "leaves " << numLeaves << "\tmerges " << merges << "\tops " << trace.size()
+                      << std::fixed << std::setprecision( 3 )
+                      << "\tmultimap " << mapTime << " s (" << std::setprecision( 0 ) << merges / mapTime << " merges/s)"
+                      << std::setprecision( 3 )
+                      << "\tnodeHeap " << heapTime << " s (" << std::setprecision( 0 ) << merges / heapTime << " merges/s)"
+                      << std::setprecision( 2 ) << "\tx" << mapTime / heapTime
+                      << "\torder mismatches " << mismatches << std::endl;
+            std::cout.unsetf( std::ios::floatfield );
+        }
+
+        /////////////////////////////////////////////////////////////////
+
+    return 0;
+}
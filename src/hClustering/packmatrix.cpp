@@ -0,0 +1,336 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+
+//
+//  packmatrix
+//
+//  Convert a distance matrix between the block layout (index file and distance block files, as written by distmatrix)
+//  and a single packed matrix file (memory mapped upper triangle with direct access to any distance value).
+//
+//  * Arguments:
+//
+//   --version:       Program version.
+//
+//   -h --help:       Produce extended program help message.
+//
+//   -b --blocks:     Folder with the distance matrix in the block layout (input when packing, output when unpacking).
+//
+//   -f --file:       Packed distance matrix file (output when packing, input when unpacking).
+//
+//  [--unpack]:       Convert a packed matrix file back to the block layout (default is to pack a block layout matrix into a packed file).
+//
+//  [-s --storage]:   Data type used to store the distances in the packed file: float32 (exact), float16 (relative error < 0.05%),
+//                     uint16 (absolute error < 8e-6) or uint8 (absolute error < 2e-3). Default: float32.
+//
+//  [--blocksize]:    (only with --unpack) Size of the distance blocks to be written. Default: block size of the original matrix.
+//
+//  [-v --verbose]:   verbose output (recommended).
+//
+//  [--vista]:        Read/write vista (.v) files [default is nifti (.nii) files].
+//
+//  [-z --zip]:       (only with --unpack) zip output block files.
+//
+//
+//  * Usage example:
+//
+//   packmatrix -b distmatrix/ -f distmatrix.pdm -s float16 -v
+//   packmatrix -b distblocks/ -f distmatrix.pdm --unpack -z -v
+//
+//  * Outputs:
+//
+//   - When packing: the packed matrix file defined by option -f.
+//
+//   - When unpacking: "roi_index.txt" and "dist_block_X_Y.nii(.v)" files in the folder defined by option -b.
+//
+//---------------------------------------------------------------------------
+
+// std librabry
+#include <vector>
+#include <string>
+#include <iostream>
+#include <ctime>
+#include <cstdlib>
+#include <stdexcept>
+#include <fstream>
+
+// boost library
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+
+// classes
+#include "fileManagerFactory.h"
+#include "packedDistMatrix.h"
+
+
+int main( int argc, char *argv[] )
+{
+//    try {
+
+        time_t programStartTime(time(NULL));
+        boost::filesystem::path workingDir( boost::filesystem::current_path());
+
+
+        // ========== PROGRAM PARAMETERS ==========
+
+        std::string progName("packmatrix");
+        std::string configFilename("../../config/"+progName+".cfg");
+
+        // program parameters
+        std::string blockFolder, packedFilename, storageString( "float32" );
+        size_t blockSize( 0 );
+        bool verbose( false ), doZip( false ), unpack( false );
+        PackedStorage storage( PSFloat32 );
+
+        // Declare a group of options that will be allowed only on command line
+        boost::program_options::options_description genericOptions("Generic options");
+        genericOptions.add_options()
+                ( "version", "Program version" )
+                ( "help,h", "Produce extended program help message" )
+                ( "blocks,b", boost::program_options::value< std::string >(&blockFolder), "folder with the distance matrix in the block layout (input when packing, output when unpacking)")
+                ( "file,f", boost::program_options::value< std::string >(&packedFilename), "packed distance matrix file (output when packing, input when unpacking)")
+                ( "unpack", "[opt] convert a packed matrix file back to the block layout." )
+                ( "storage,s", boost::program_options::value< std::string >(&storageString), "[opt] data type of the packed distances: float32, float16, uint16 or uint8. Default: float32." )
+                ( "blocksize", boost::program_options::value< size_t >(&blockSize), "[opt] (only with --unpack) size of the blocks to be written. Default: original block size." )
+                ;
+
+        // Declare a group of options that will be allowed both on command line and in config file
+        boost::program_options::options_description configOptions("Configuration");
+        configOptions.add_options()
+                ( "verbose,v", "[opt] verbose output." )
+                ( "vista", "[opt] use vista file format (default is nifti)." )
+                ( "zip,z", "[opt] zip output block files.")
+                ;
+
+        // Hidden options, will be allowed both on command line and in config file, but will not be shown to the user.
+        boost::program_options::options_description hiddenOptions("Hidden options");
+        //hiddenOptions.add_options() ;
+
+        boost::program_options::options_description cmdlineOptions;
+        cmdlineOptions.add(genericOptions).add(configOptions).add(hiddenOptions);
+        boost::program_options::options_description configFileOptions;
+        configFileOptions.add(configOptions).add(hiddenOptions);
+        boost::program_options::options_description visibleOptions("Allowed options");
+        visibleOptions.add(genericOptions).add(configOptions);
+        boost::program_options::positional_options_description posOpt; //this arguments do not need to specify the option descriptor when typed in
+
+        boost::program_options::variables_map variableMap;
+        store(boost::program_options::command_line_parser(argc, argv).options(cmdlineOptions).positional(posOpt).run(), variableMap);
+
+        std::ifstream ifs(configFilename.c_str());
+        store(parse_config_file(ifs, configFileOptions), variableMap);
+        notify(variableMap);
+
+        if (variableMap.count("help"))
+        {
+            std::cout << "---------------------------------------------------------------------------" << std::endl;
+            std::cout << std::endl;
+            std::cout << " Project: hClustering" << std::endl;
+            std::cout << std::endl;
+            std::cout << " Whole-Brain Connectivity-Based Hierarchical Parcellation Project" << std::endl;
+            std::cout << " David Moreno-Dominguez" << std::endl;
+            std::cout << " d.mor.dom@gmail.com" << std::endl;
+            std::cout << " moreno@cbs.mpg.de" << std::endl;
+            std::cout << " www.cbs.mpg.de/~moreno" << std::endl;
+            std::cout << std::endl;
+            std::cout << " For more reference on the underlying algorithm and research they have been used for refer to:" << std::endl;
+            std::cout << " - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014)." << std::endl;
+            std::cout << "   A hierarchical method for whole-brain connectivity-based parcellation." << std::endl;
+            std::cout << "   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528" << std::endl;
+            std::cout << " - Moreno-Dominguez, D. (2014)." << std::endl;
+            std::cout << "   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography." << std::endl;
+            std::cout << "   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig." << std::endl;
+            std::cout << "   ISBN 978-3-941504-45-5" << std::endl;
+            std::cout << std::endl;
+            std::cout << " hClustering is free software: you can redistribute it and/or modify" << std::endl;
+            std::cout << " it under the terms of the GNU Lesser General Public License as published by" << std::endl;
+            std::cout << " the Free Software Foundation, either version 3 of the License, or" << std::endl;
+            std::cout << " (at your option) any later version." << std::endl;
+            std::cout << " http://creativecommons.org/licenses/by-nc/3.0" << std::endl;
+            std::cout << std::endl;
+            std::cout << " hClustering is distributed in the hope that it will be useful," << std::endl;
+            std::cout << " but WITHOUT ANY WARRANTY; without even the implied warranty of" << std::endl;
+            std::cout << " MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the" << std::endl;
+            std::cout << " GNU Lesser General Public License for more details." << std::endl;
+            std::cout << std::endl;
+            std::cout << "---------------------------------------------------------------------------" << std::endl << std::endl;
+            std::cout << "packmatrix" << std::endl << std::endl;
+            std::cout << "Convert a distance matrix between the block layout (index file and distance block files, as written by distmatrix)" << std::endl;
+            std::cout << "and a single packed matrix file (memory mapped upper triangle with direct access to any distance value)." << std::endl << std::endl;
+            std::cout << "* Arguments:" << std::endl << std::endl;
+            std::cout << " --version:       Program version." << std::endl << std::endl;
+            std::cout << " -h --help:       Produce extended program help message." << std::endl << std::endl;
+            std::cout << " -b --blocks:     Folder with the distance matrix in the block layout (input when packing, output when unpacking)." << std::endl << std::endl;
+            std::cout << " -f --file:       Packed distance matrix file (output when packing, input when unpacking)." << std::endl << std::endl;
+            std::cout << "[--unpack]:       Convert a packed matrix file back to the block layout (default is to pack a block layout matrix into a packed file)." << std::endl << std::endl;
+            std::cout << "[-s --storage]:   Data type used to store the distances in the packed file: float32 (exact), float16 (relative error < 0.05%)," << std::endl;
+            std::cout << "                    uint16 (absolute error < 8e-6) or uint8 (absolute error < 2e-3). Default: float32." << std::endl << std::endl;
+            std::cout << "[--blocksize]:    (only with --unpack) Size of the distance blocks to be written. Default: block size of the original matrix." << std::endl << std::endl;
+            std::cout << "[-v --verbose]:   verbose output (recommended)." << std::endl << std::endl;
+            std::cout << "[--vista]:        Read/write vista (.v) files [default is nifti (.nii) files]." << std::endl << std::endl;
+            std::cout << "[-z --zip]:       (only with --unpack) zip output block files." << std::endl << std::endl;
+            std::cout << std::endl;
+            std::cout << "* Usage example:" << std::endl << std::endl;
+            std::cout << " packmatrix -b distmatrix/ -f distmatrix.pdm -s float16 -v" << std::endl;
+            std::cout << " packmatrix -b distblocks/ -f distmatrix.pdm --unpack -z -v" << std::endl << std::endl;
+            std::cout << "* Outputs:" << std::endl << std::endl;
+            std::cout << " - When packing: the packed matrix file defined by option -f." << std::endl << std::endl;
+            std::cout << " - When unpacking: 'roi_index.txt' and 'dist_block_X_Y.nii(.v)' files in the folder defined by option -b." << std::endl;
+            std::cout << std::endl;
+            exit(0);
+        }
+
+        if ( variableMap.count( "verbose" ) )
+        {
+            std::cout << "verbose output" << std::endl;
+            verbose=true;
+        }
+
+        if ( variableMap.count( "version" ) )
+        {
+            std::cout << progName << ", version 2.0" << std::endl;
+            exit(0);
+        }
+
+        if ( variableMap.count( "vista" ) )
+        {
+            if( verbose )
+            {
+                std::cout << "Using vista format" << std::endl;
+            }
+            fileManagerFactory fmf;
+            fmf.setVista();
+        }
+        else
+        {
+            if( verbose )
+            {
+                std::cout << "Using nifti format" << std::endl;
+            }
+            fileManagerFactory fmf;
+            fmf.setNifti();
+        }
+
+        if (variableMap.count("zip"))
+        {
+            doZip=true;
+        }
+
+        if ( variableMap.count( "unpack" ) )
+        {
+            unpack = true;
+        }
+
+        if ( !variableMap.count( "blocks" ) || !boost::filesystem::is_directory( boost::filesystem::path( blockFolder ) ) )
+        {
+            std::cerr << "ERROR: block folder \"" << blockFolder << "\" is not a directory" << std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+        if ( !variableMap.count( "file" ) )
+        {
+            std::cerr << "ERROR: no packed matrix file stated" << std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+        if( unpack && !boost::filesystem::is_regular_file( boost::filesystem::path( packedFilename ) ) )
+        {
+            std::cerr << "ERROR: packed matrix file \"" << packedFilename << "\" is not a regular file" << std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+
+        if( storageString == "float32" )
+        {
+            storage = PSFloat32;
+        }
+        else if( storageString == "float16" )
+        {
+            storage = PSFloat16;
+        }
+        else if( storageString == "uint16" )
+        {
+            storage = PSUInt16;
+        }
+        else if( storageString == "uint8" )
+        {
+            storage = PSUInt8;
+        }
+        else
+        {
+            std::cerr << "ERROR: storage type \"" << storageString << "\" not recognized, use float32, float16, uint16 or uint8" << std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+
+        if( verbose )
+        {
+            if( unpack )
+            {
+                std::cout << "Unpacking matrix file \"" << packedFilename << "\" into block folder \"" << blockFolder << "\"" << std::endl;
+            }
+            else
+            {
+                std::cout << "Packing block folder \"" << blockFolder << "\" into matrix file \"" << packedFilename << "\" (" << storageString << " values)" << std::endl;
+            }
+        }
+
+
+        // ==============================================================================
+
+        packedDistMatrix matrix;
+        if( unpack )
+        {
+            matrix.open( packedFilename );
+            matrix.exportBlocks( blockFolder, blockSize, doZip, verbose );
+        }
+        else
+        {
+            matrix.importBlocks( blockFolder, packedFilename, storage, verbose );
+        }
+        matrix.close();
+
+        // ==============================================================================
+
+        // save and print total time
+        time_t programEndTime(time(NULL));
+        int totalTime( difftime(programEndTime,programStartTime) );
+        std::cout << "Program Finished, total time: " << totalTime/3600 <<"h "<<  (totalTime%3600)/60 <<"' "<< ((totalTime%3600)%60) <<"\""<< std::endl;
+
+
+//    }
+//    catch(std::exception& e)
+//    {
+//        std::cout << e.what() << std::endl;
+//        return 1;
+//    }
+    return 0;
+}
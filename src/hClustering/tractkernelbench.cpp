@@ -0,0 +1,280 @@
+//---------------------------------------------------------------------------
+//
+// Project: hClustering
+//
+// Whole-Brain Connectivity-Based Hierarchical Parcellation Project
+// David Moreno-Dominguez
+// d.mor.dom@gmail.com
+// moreno@cbs.mpg.de
+// www.cbs.mpg.de/~moreno//
+//
+// For more reference on the underlying algorithm and research they have been used for refer to:
+// - Moreno-Dominguez, D., Anwander, A., & Knösche, T. R. (2014).
+//   A hierarchical method for whole-brain connectivity-based parcellation.
+//   Human Brain Mapping, 35(10), 5000-5025. doi: http://dx.doi.org/10.1002/hbm.22528
+// - Moreno-Dominguez, D. (2014).
+//   Whole-brain cortical parcellation: A hierarchical method based on dMRI tractography.
+//   PhD Thesis, Max Planck Institute for Human Cognitive and Brain Sciences, Leipzig.
+//   ISBN 978-3-941504-45-5
+//
+// hClustering is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// http://creativecommons.org/licenses/by-nc/3.0
+//
+// hClustering is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+//---------------------------------------------------------------------------
+//
+//  tractkernelbench
+//
+//  Microbenchmark of the tractogram dot product kernels: times the scalar reference loops against the dispatched
+//   vectorized versions on synthetic float and compact char tractograms and checks that both give the same result.
+//   Also checks that a node mean tract evicted to the mean tract store and rebuilt (as on a node cache miss of buildctree)
+//   is bit-identical to the log-unit tract produced when the node was merged.
+//
+//  * Arguments:
+//
+//   --version:       Program version.
+//
+//   -h --help:       Produce extended program help message.
+//
+//  [-s --sizes]:     Tractogram lengths (number of elements) to benchmark. Default: 200003 500000 1000001.
+//
+//  [-r --reps]:      Number of repetitions averaged for each timing. Default: 200.
+//
+//
+//  * Usage example:
+//
+//   tractkernelbench -s 200003 1000001 -r 500
+//
+//
+//  * Outputs (on standard output):
+//
+//   - One line per size and kernel (float-float, char-char, float-char) with the scalar and vectorized time per call,
+//      the speedup, and the relative error (float) or exact equality (char) of the vectorized result.
+//   - One line per size with the result of the node tract rebuild check (the program returns 1 if it fails).
+//   - The instruction set selected at runtime by the kernel dispatcher.
+//
+//---------------------------------------------------------------------------
+
+// std librabry
+#include <vector>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+
+// parallel execution
+#include <omp.h>
+
+// boost library
+#include <boost/program_options.hpp>
+
+// classes
+#include "tractKernels.h"
+#include "compactTract.h"
+#include "meanTractStore.h"
+
+
+
+// A helper function to simplify the main part.
+template<class T>
+std::ostream& operator<<(std::ostream& os, const std::vector<T>& v)
+{
+    copy(v.begin(), v.end(), std::ostream_iterator<T>(os, " "));
+    return os;
+}
+
+// times reps calls of both kernels and prints one result line
+template< class T1, class T2, class R >
+void timeKernel( const std::string& name, const std::vector< T1 >& data1, const std::vector< T2 >& data2, size_t reps,
+                 R ( *scalarKernel )( const T1*, const T2*, size_t ), R ( *simdKernel )( const T1*, const T2*, size_t ), bool exact )
+{
+    const size_t size( data1.size() );
+    R scalarResult( 0 ), simdResult( 0 );
+
+    double startTime( omp_get_wtime() );
+    for( size_t i = 0; i < reps; ++i )
+    {
+        scalarResult += scalarKernel( &data1[0], &data2[0], size );
+    }
+    const double scalarTime( ( omp_get_wtime() - startTime ) / reps );
+
+    startTime = omp_get_wtime();
+    for( size_t i = 0; i < reps; ++i )
+    {
+        simdResult += simdKernel( &data1[0], &data2[0], size );
+    }
+    const double simdTime( ( omp_get_wtime() - startTime ) / reps );
+
+    std::cout << "n=" << size << "\t" << name << "\tscalar " << std::fixed << std::setprecision( 3 ) << scalarTime * 1000 << " ms"
+              << "\tsimd " << simdTime * 1000 << " ms\tx" << std::setprecision( 1 ) << scalarTime / simdTime;
+    if( exact )
+    {
+        std::cout << "\tequal " << ( scalarResult == simdResult ? "yes" : "NO" ) << std::endl;
+    }
+    else
+    {
+        const double relErr( scalarResult == 0 ? 0 : ( ( double ) simdResult - ( double ) scalarResult ) / ( double ) scalarResult );
+        std::cout << "\trelerr " << std::scientific << std::setprecision( 2 ) << relErr << std::endl;
+    }
+    std::cout.unsetf( std::ios::floatfield );
+} // end timeKernel() -------------------------------------------------------------------------------------
+
+// evicts a merged node mean to a mean tract store without memory budget, rebuilds its log-unit tract as a node cache miss does,
+// and returns true if it is bit-identical (values and norm) to the log-unit tract obtained at the merge
+bool rebuildMatches( const compactTract& meanTract, const compactTract& logTract, const double mergedNorm, const float logFactor, const float threshold )
+{
+    meanTractStore store( ".", 0 );
+    store.put( 0, meanTract );
+    compactTract rebuiltTract;
+    store.get( 0, &rebuiltTract );
+    const double rebuiltNorm( rebuiltTract.logThreshold( logFactor, threshold ) );
+
+    const std::vector< float > merged( logTract.tract() ), rebuilt( rebuiltTract.tract() );
+    return ( rebuiltNorm == mergedNorm && merged.size() == rebuilt.size()
+             && std::memcmp( &merged[0], &rebuilt[0], merged.size() * sizeof( float ) ) == 0 );
+} // end rebuildMatches() -------------------------------------------------------------------------------------
+
+// merges two leaf tracts (log units) into a node and that node with the first leaf again, and checks the rebuild of both node tracts
+bool checkNodeRebuild( const std::vector< float >& leafData1, const std::vector< float >& leafData2 )
+{
+    const float logFactor( log10( 5000.f ) );
+    const float threshold( log10( 5000.f * 0.001f ) / logFactor );
+
+    compactTract leafTract1( leafData1 ), leafTract2( leafData2 );
+    compactTract nodeTract, nodeLogTract, rootTract, rootLogTract;
+    const double nodeNorm( nodeTract.joinTracts( leafTract1, leafTract2, 1, 1, logFactor, threshold, &nodeLogTract ) );
+    const double rootNorm( rootTract.joinTracts( leafTract1, nodeTract, 1, 2, logFactor, threshold, &rootLogTract ) );
+
+    return ( rebuildMatches( nodeTract, nodeLogTract, nodeNorm, logFactor, threshold )
+             && rebuildMatches( rootTract, rootLogTract, rootNorm, logFactor, threshold ) );
+} // end checkNodeRebuild() -------------------------------------------------------------------------------------
+
+int main( int argc, char *argv[] )
+{
+        // ========== PROGRAM PARAMETERS ==========
+
+        std::string progName("tractkernelbench");
+
+        // program parameters
+        std::vector< size_t > sizes;
+        size_t reps( 200 );
+        bool rebuildFailed( false );
+
+        // Declare a group of options that will be allowed only on command line
+        boost::program_options::options_description genericOptions("Generic options");
+        genericOptions.add_options()
+                ( "version", "Program version" )
+                ( "help,h", "Produce extended program help message" )
+                ;
+
+        // Declare a group of options that will be allowed both on command line and in config file
+        boost::program_options::options_description configOptions("Configuration");
+        configOptions.add_options()
+                ( "sizes,s", boost::program_options::value< std::vector< size_t > >(&sizes)->multitoken(), "[opt] tractogram lengths to benchmark (default: 200003 500000 1000001)")
+                ( "reps,r", boost::program_options::value< size_t >(&reps), "[opt] repetitions averaged for each timing (default: 200)")
+                ;
+
+        boost::program_options::options_description cmdlineOptions;
+        cmdlineOptions.add(genericOptions).add(configOptions);
+        boost::program_options::options_description visibleOptions("Allowed options");
+        visibleOptions.add(genericOptions).add(configOptions);
+
+        boost::program_options::variables_map variableMap;
+        store(boost::program_options::command_line_parser(argc, argv).options(cmdlineOptions).run(), variableMap);
+        notify(variableMap);
+
+        if (variableMap.count("help"))
+        {
+            std::cout << "tractkernelbench" << std::endl << std::endl;
+            std::cout << "Microbenchmark of the tractogram dot product kernels: times the scalar reference loops against the dispatched" << std::endl;
+            std::cout << " vectorized versions on synthetic float and compact char tractograms and checks that both give the same result." << std::endl;
+            std::cout << " Also checks that a node mean tract evicted to the mean tract store and rebuilt (as on a node cache miss of buildctree)" << std::endl;
+            std::cout << " is bit-identical to the log-unit tract produced when the node was merged." << std::endl << std::endl;
+            std::cout << "* Arguments:" << std::endl << std::endl;
+            std::cout << " --version:       Program version." << std::endl << std::endl;
+            std::cout << " -h --help:       produce extended program help message." << std::endl << std::endl;
+            std::cout << "[-s --sizes]:     Tractogram lengths (number of elements) to benchmark. Default: 200003 500000 1000001." << std::endl << std::endl;
+            std::cout << "[-r --reps]:      Number of repetitions averaged for each timing. Default: 200." << std::endl << std::endl;
+            std::cout << std::endl;
+            std::cout << "* Usage example:" << std::endl << std::endl;
+            std::cout << " tractkernelbench -s 200003 1000001 -r 500" << std::endl << std::endl;
+            std::cout << std::endl;
+            std::cout << "* Outputs (on standard output):" << std::endl << std::endl;
+            std::cout << " - One line per size and kernel (float-float, char-char, float-char) with the scalar and vectorized time per call," << std::endl;
+            std::cout << "    the speedup, and the relative error (float) or exact equality (char) of the vectorized result." << std::endl;
+            std::cout << " - One line per size with the result of the node tract rebuild check (the program returns 1 if it fails)." << std::endl;
+            std::cout << " - The instruction set selected at runtime by the kernel dispatcher." << std::endl;
+            std::cout << std::endl;
+            exit(0);
+        }
+        if (variableMap.count("version")) {
+            std::cout << progName <<", version 2.0"<<std::endl;
+            exit(0);
+        }
+        if( sizes.empty() )
+        {
+            sizes.push_back( 200003 );
+            sizes.push_back( 500000 );
+            sizes.push_back( 1000001 );
+        }
+        if( reps == 0 )
+        {
+            std::cerr << "ERROR: number of repetitions must be positive" << std::endl;
+            std::cerr << visibleOptions << std::endl;
+            exit(-1);
+        }
+
+        std::cout << "Kernel instruction set: " << tract_kernels::activeInstructionSet() << std::endl;
+        std::cout << "Repetitions: " << reps << std::endl;
+
+        /////////////////////////////////////////////////////////////////
+
+        for( size_t s = 0; s < sizes.size(); ++s )
+        {
+            const size_t size( sizes[s] );
+            if( size == 0 )
+            {
+                continue;
+            }
+
+            // synthetic tractograms: about one third of the float values are zero, as in thresholded tracts
+            std::vector< float > floatData1( size ), floatData2( size );
+            std::vector< unsigned char > charData1( size ), charData2( size );
+            srand( 1 );
+            for( size_t i = 0; i < size; ++i )
+            {
+                floatData1[i] = ( rand() % 3 == 0 ) ? 0 : rand() / ( float ) RAND_MAX;
+                floatData2[i] = ( rand() % 3 == 0 ) ? 0 : rand() / ( float ) RAND_MAX;
+                charData1[i] = rand() % 256;
+                charData2[i] = rand() % 256;
+            }
+
+            timeKernel< float, float, double >( "float-float", floatData1, floatData2, reps,
+                                                tract_kernels::dotProductScalar, tract_kernels::dotProduct, false );
+            timeKernel< unsigned char, unsigned char, uint64_t >( "char-char", charData1, charData2, reps,
+                                                                  tract_kernels::dotProductScalar, tract_kernels::dotProduct, true );
+            timeKernel< float, unsigned char, double >( "float-char", floatData1, charData1, reps,
+                                                        tract_kernels::dotProductScalar, tract_kernels::dotProduct, false );
+
+            const bool rebuildOk( checkNodeRebuild( floatData1, floatData2 ) );
+            std::cout << "n=" << size << "\tnode tract rebuilt after eviction identical to merged: " << ( rebuildOk ? "yes" : "NO" ) << std::endl;
+            if( !rebuildOk )
+            {
+                rebuildFailed = true;
+            }
+        }
+
+        /////////////////////////////////////////////////////////////////
+
+    return rebuildFailed ? 1 : 0;
+}